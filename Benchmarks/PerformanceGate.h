@@ -0,0 +1,238 @@
+//
+//  PerformanceGate.h
+//  ug3-electrode-viewer
+//
+//  Compares benchmark timings against a committed baseline file and fails when a
+//  benchmark is slower than its baseline by more than its tolerance band, or when the
+//  ratio of two benchmarks run together exceeds its bound.
+//
+//  Baseline format:
+//  {
+//      "default_tolerance_percent": 25,
+//      "benchmarks": {
+//          "BM_Process/channels:4096/map:1": { "real_time_ns": 123456.0, "tolerance_percent": 30 },
+//          ...
+//      },
+//      "ratios": {
+//          "channel map overhead": { "numerator": "BM_Process/channels:4096/map:1", "denominator": "BM_Process/channels:4096/map:0", "max_ratio": 1.5 },
+//          ...
+//      }
+//  }
+//  Entries whose real_time_ns is null have not been recorded yet and are only reported.
+//  Ratios compare benchmarks timed on the same machine in the same run, so they need no
+//  recording and always gate; a ratio whose benchmarks weren't run fails. Ratios against
+//  BM_ProcessFloor, a fixed amount of work per sample, bound the absolute cost of process()
+//  on any machine; catchesInjectedWork() checks that they would catch added per-channel work.
+//
+
+#ifndef PerformanceGate_h
+#define PerformanceGate_h
+
+#include <benchmark/benchmark.h>
+
+#include <ProcessorHeaders.h>
+
+#include <iostream>
+#include <map>
+#include <memory>
+
+/**
+    Wraps the display reporter --benchmark_format asks for and keeps the fastest real time
+    of every benchmark, in nanoseconds, so the gate works whatever the output format
+*/
+class TimingCollector : public benchmark::BenchmarkReporter {
+public:
+    /** format is the value of --benchmark_format: "console", "json" or "csv" */
+    explicit TimingCollector(const std::string& format) {
+        if (format == "json") {
+            display = std::make_unique<benchmark::JSONReporter>();
+        }
+        else if (format == "csv") {
+            display = std::make_unique<benchmark::CSVReporter>();
+        }
+        else {
+            display = std::make_unique<benchmark::ConsoleReporter>();
+        }
+    }
+
+    bool ReportContext(const Context& context) override {
+        return display->ReportContext(context);
+    }
+
+    void Finalize() override {
+        display->Finalize();
+    }
+
+    void ReportRuns(const std::vector<Run>& reports) override {
+        for (const auto& run : reports) {
+            if (run.run_type != Run::RT_Iteration || run.iterations == 0) {
+                continue;
+            }
+            const double nanos = run.GetAdjustedRealTime() / benchmark::GetTimeUnitMultiplier(run.time_unit) * 1.0e9;
+            const std::string name = run.benchmark_name();
+            //The minimum over repetitions is the least noisy estimate on a shared machine
+            auto existing = timings.find(name);
+            if (existing == timings.end() || nanos < existing->second) {
+                timings[name] = nanos;
+            }
+        }
+        display->ReportRuns(reports);
+    }
+
+    const std::map<std::string, double>& getTimings() const { return timings; }
+
+private:
+    std::unique_ptr<benchmark::BenchmarkReporter> display;
+    std::map<std::string, double> timings;
+};
+
+namespace PerformanceGate {
+
+    inline int compareRatios(const var& baseline, const std::map<std::string, double>& timings);
+
+    /** Returns the number of regressions, or -1 if the baseline can't be read */
+    inline int compare(const File& baselineFile, const std::map<std::string, double>& timings, double toleranceOverride) {
+        var baseline = JSON::parse(baselineFile);
+        if (!baseline.isObject() || !baseline.getProperty("benchmarks", var()).isObject()) {
+            std::cerr << "could not read performance baseline " << baselineFile.getFullPathName() << std::endl;
+            return -1;
+        }
+
+        const double defaultTolerance = toleranceOverride > 0.0 ? toleranceOverride : double(baseline.getProperty("default_tolerance_percent", 25.0));
+        DynamicObject* entries = baseline.getProperty("benchmarks", var()).getDynamicObject();
+
+        int regressions = 0;
+        for (const auto& timing : timings) {
+            const var entry = entries->getProperty(Identifier(String(timing.first)));
+            const var recorded = entry.getProperty("real_time_ns", var());
+
+            if (!entry.isObject() || recorded.isVoid() || !(recorded.isDouble() || recorded.isInt() || recorded.isInt64())) {
+                std::cout << "[ NO BASELINE ] " << timing.first << ": " << timing.second << " ns" << std::endl;
+                continue;
+            }
+
+            const double baselineNanos = double(recorded);
+            const double tolerance = toleranceOverride > 0.0 ? toleranceOverride : double(entry.getProperty("tolerance_percent", defaultTolerance));
+            const double change = (timing.second - baselineNanos) / baselineNanos * 100.0;
+
+            if (change > tolerance) {
+                std::cout << "[ REGRESSION  ] ";
+                regressions++;
+            }
+            else if (change < -tolerance) {
+                std::cout << "[ FASTER      ] ";
+            }
+            else {
+                std::cout << "[ OK          ] ";
+            }
+            std::cout << timing.first << ": " << timing.second << " ns vs baseline " << baselineNanos << " ns ("
+                      << (change >= 0.0 ? "+" : "") << change << "%, tolerance " << tolerance << "%)" << std::endl;
+        }
+
+        for (const auto& entry : entries->getProperties()) {
+            if (timings.find(entry.name.toString().toStdString()) == timings.end()) {
+                std::cout << "[ NOT RUN     ] " << entry.name.toString() << std::endl;
+            }
+        }
+
+        return regressions + compareRatios(baseline, timings);
+    }
+
+    /** Returns the number of ratios in baseline that are over their bound or couldn't be measured */
+    inline int compareRatios(const var& baseline, const std::map<std::string, double>& timings) {
+        DynamicObject* ratios = baseline.getProperty("ratios", var()).getDynamicObject();
+        if (ratios == nullptr) {
+            return 0;
+        }
+
+        int failures = 0;
+        for (const auto& ratio : ratios->getProperties()) {
+            const std::string numerator = ratio.value.getProperty("numerator", "").toString().toStdString();
+            const std::string denominator = ratio.value.getProperty("denominator", "").toString().toStdString();
+            const double maxRatio = double(ratio.value.getProperty("max_ratio", 0.0));
+            const auto numeratorTiming = timings.find(numerator);
+            const auto denominatorTiming = timings.find(denominator);
+            if (numeratorTiming == timings.end() || denominatorTiming == timings.end() || !(denominatorTiming->second > 0.0) || !(maxRatio > 0.0)) {
+                std::cout << "[ RATIO NOT RUN ] " << ratio.name.toString() << ": needs " << numerator << " and " << denominator << std::endl;
+                failures++;
+                continue;
+            }
+
+            const double measured = numeratorTiming->second / denominatorTiming->second;
+            std::cout << (measured > maxRatio ? "[ RATIO FAILED  ] " : "[ RATIO OK      ] ") << ratio.name.toString() << ": "
+                      << numerator << " / " << denominator << " = " << measured << " (max " << maxRatio << ")" << std::endl;
+            failures += measured > maxRatio ? 1 : 0;
+        }
+        return failures;
+    }
+
+    /**
+        Stands each BM_ProcessInjected timing in for the mapped BM_Process it mirrors and returns true
+        if every ratio against BM_ProcessFloor passes as measured but fails with the injected work
+    */
+    inline bool catchesInjectedWork(const File& baselineFile, const std::map<std::string, double>& timings) {
+        var baseline = JSON::parse(baselineFile);
+        DynamicObject* ratios = baseline.getProperty("ratios", var()).getDynamicObject();
+        if (ratios == nullptr) {
+            std::cerr << "could not read performance baseline " << baselineFile.getFullPathName() << std::endl;
+            return false;
+        }
+
+        DynamicObject::Ptr floorRatios = new DynamicObject();
+        for (const auto& ratio : ratios->getProperties()) {
+            if (ratio.value.getProperty("denominator", "").toString().startsWith("BM_ProcessFloor/")) {
+                floorRatios->setProperty(ratio.name, ratio.value);
+            }
+        }
+        const int numFloorRatios = floorRatios->getProperties().size();
+        if (numFloorRatios == 0) {
+            std::cerr << "no ratios against BM_ProcessFloor in " << baselineFile.getFullPathName() << std::endl;
+            return false;
+        }
+        DynamicObject::Ptr floorBaseline = new DynamicObject();
+        floorBaseline->setProperty("ratios", var(floorRatios));
+
+        std::map<std::string, double> injected = timings;
+        for (const auto& timing : timings) {
+            const String name(timing.first);
+            if (name.startsWith("BM_ProcessInjected/")) {
+                injected["BM_Process/" + name.fromFirstOccurrenceOf("/", false, false).toStdString() + "/map:1"] = timing.second;
+            }
+        }
+
+        std::cout << "as measured:" << std::endl;
+        const int measuredFailures = compareRatios(var(floorBaseline), timings);
+        std::cout << "with per-channel work injected into process():" << std::endl;
+        const int injectedFailures = compareRatios(var(floorBaseline), injected);
+        return measuredFailures == 0 && injectedFailures == numFloorRatios;
+    }
+
+    /** Writes the collected timings as a new baseline, keeping tolerances from an existing file */
+    inline bool writeBaseline(const File& baselineFile, const std::map<std::string, double>& timings) {
+        var previous = JSON::parse(baselineFile);
+        const double defaultTolerance = previous.isObject() ? double(previous.getProperty("default_tolerance_percent", 25.0)) : 25.0;
+
+        DynamicObject::Ptr entries = new DynamicObject();
+        for (const auto& timing : timings) {
+            DynamicObject::Ptr entry = new DynamicObject();
+            entry->setProperty("real_time_ns", timing.second);
+            const var previousEntry = previous.getProperty("benchmarks", var()).getProperty(Identifier(String(timing.first)), var());
+            entry->setProperty("tolerance_percent", previousEntry.getProperty("tolerance_percent", defaultTolerance));
+            entries->setProperty(Identifier(String(timing.first)), var(entry));
+        }
+
+        DynamicObject::Ptr root = new DynamicObject();
+        root->setProperty("recorded_on", SystemStats::getComputerName() + " (" + SystemStats::getCpuModel() + ")");
+        root->setProperty("recorded_at", Time::getCurrentTime().toISO8601(true));
+        root->setProperty("default_tolerance_percent", defaultTolerance);
+        root->setProperty("benchmarks", var(entries));
+        //Ratios are machine independent, so they carry over unchanged
+        if (previous.getProperty("ratios", var()).isObject()) {
+            root->setProperty("ratios", previous.getProperty("ratios", var()));
+        }
+
+        return baselineFile.replaceWithText(JSON::toString(var(root), false));
+    }
+}
+
+#endif /* PerformanceGate_h */
@@ -0,0 +1,180 @@
+//
+//  SyntheticUG3Source.h
+//  ug3-electrode-viewer
+//
+//  Generates UG3-like multichannel data on a cols x rows electrode grid:
+//  per-channel gaussian noise, Poisson spikes, a plane travelling wave whose
+//  direction slowly rotates, and a fraction of dead (flat) and railed channels.
+//  Channel c sits at grid site (c % cols, c / cols).
+//
+
+#ifndef SyntheticUG3Source_h
+#define SyntheticUG3Source_h
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+struct SyntheticSignalConfig {
+    int cols = 256;
+    int rows = 256;
+    float sampleRate = 1000.0f;
+
+    //all amplitudes are in microvolts
+    float noiseAmplitude = 10.0f;
+    float spikeRateHz = 5.0f;
+    float spikeAmplitude = 120.0f;
+    float waveAmplitude = 200.0f;
+    float waveFrequencyHz = 4.0f;
+    float waveSpeedSitesPerSecond = 40.0f;
+    //seconds for the wave direction to turn a full circle
+    float waveRotationPeriod = 20.0f;
+    float railLevel = 6000.0f;
+
+    float saturatedFraction = 0.01f;
+    float deadFraction = 0.005f;
+
+    uint64_t seed = 0x5eed;
+};
+
+class SyntheticUG3Source {
+public:
+    enum class ChannelState : uint8_t { NORMAL, DEAD, SATURATED };
+
+    explicit SyntheticUG3Source(const SyntheticSignalConfig& config_) : config(config_), rngState(config_.seed | 1) {
+        const int numChannels = getNumChannels();
+        noiseGain.resize(numChannels);
+        state.resize(numChannels, ChannelState::NORMAL);
+        samplesUntilSpike.resize(numChannels);
+        spikeSample.resize(numChannels, -1);
+
+        spikeLength = std::max(2, int(config.sampleRate / 1000.0f));
+        spikeTemplate.resize(spikeLength);
+        for (int i = 0; i < spikeLength; i++) {
+            //biphasic: sharp trough followed by a smaller, wider peak
+            const float t = float(i) / float(spikeLength);
+            spikeTemplate[i] = t < 0.4f ? -std::sin(float(pi) * t / 0.4f) : 0.4f * std::sin(float(pi) * (t - 0.4f) / 0.6f);
+        }
+
+        for (int c = 0; c < numChannels; c++) {
+            //Sites differ in gain and noise by up to 4x
+            noiseGain[c] = config.noiseAmplitude * (0.5f + 1.5f * uniform());
+            const float draw = uniform();
+            if (draw < config.deadFraction) {
+                state[c] = ChannelState::DEAD;
+            }
+            else if (draw < config.deadFraction + config.saturatedFraction) {
+                state[c] = ChannelState::SATURATED;
+            }
+            samplesUntilSpike[c] = nextSpikeInterval();
+        }
+    }
+
+    int getNumChannels() const { return config.cols * config.rows; }
+
+    const SyntheticSignalConfig& getConfig() const { return config; }
+
+    ChannelState getChannelState(int channel) const { return state[channel]; }
+
+    /** Fills numSamples for every channel and advances time. channelData[c] must hold numSamples floats */
+    void fillBlock(float* const* channelData, int numSamples) {
+        const int numChannels = getNumChannels();
+        const double t0 = double(sampleIndex) / config.sampleRate;
+
+        //The spatial phase only depends on direction, which changes slowly, so it is evaluated once per block
+        const double direction = 2.0 * pi * t0 / config.waveRotationPeriod;
+        const double wavelengthSites = config.waveSpeedSitesPerSecond / config.waveFrequencyHz;
+        const double kx = 2.0 * pi * std::cos(direction) / wavelengthSites;
+        const double ky = 2.0 * pi * std::sin(direction) / wavelengthSites;
+        const double temporalPhase = 2.0 * pi * config.waveFrequencyHz * t0;
+        const double step = 2.0 * pi * config.waveFrequencyHz / config.sampleRate;
+        const float stepRe = float(std::cos(step));
+        const float stepIm = float(std::sin(step));
+
+        for (int c = 0; c < numChannels; c++) {
+            float* out = channelData[c];
+
+            if (state[c] == ChannelState::DEAD) {
+                std::fill(out, out + numSamples, 0.0f);
+                continue;
+            }
+
+            const double phase = temporalPhase - kx * (c % config.cols) - ky * (c / config.cols);
+            float re = float(std::cos(phase));
+            float im = float(std::sin(phase));
+
+            for (int s = 0; s < numSamples; s++) {
+                float value = config.waveAmplitude * im + noiseGain[c] * gaussian();
+
+                if (spikeSample[c] >= 0) {
+                    value += config.spikeAmplitude * spikeTemplate[spikeSample[c]];
+                    if (++spikeSample[c] >= spikeLength) {
+                        spikeSample[c] = -1;
+                    }
+                }
+                else if (--samplesUntilSpike[c] <= 0) {
+                    spikeSample[c] = 0;
+                    samplesUntilSpike[c] = nextSpikeInterval();
+                }
+
+                if (state[c] == ChannelState::SATURATED) {
+                    value = value >= 0.0f ? config.railLevel : -config.railLevel;
+                }
+
+                out[s] = std::min(config.railLevel, std::max(-config.railLevel, value));
+
+                //rotate the wave phasor by one sample
+                const float nextRe = re * stepRe - im * stepIm;
+                im = re * stepIm + im * stepRe;
+                re = nextRe;
+            }
+        }
+
+        sampleIndex += numSamples;
+    }
+
+private:
+    static constexpr double pi = 3.14159265358979323846;
+
+    //xorshift64*; quality is plenty for synthetic signals and it is a few cycles per draw
+    uint64_t nextRandom() {
+        rngState ^= rngState >> 12;
+        rngState ^= rngState << 25;
+        rngState ^= rngState >> 27;
+        return rngState * 0x2545F4914F6CDD1DULL;
+    }
+
+    float uniform() {
+        return float(nextRandom() >> 40) / float(1 << 24);
+    }
+
+    //Irwin-Hall approximation of a unit gaussian from four uniforms
+    float gaussian() {
+        const uint64_t r = nextRandom();
+        const float sum = float(r & 0xffff) + float((r >> 16) & 0xffff) + float((r >> 32) & 0xffff) + float(r >> 48);
+        return (sum / 65536.0f - 2.0f) * 1.7320508f;
+    }
+
+    int nextSpikeInterval() {
+        if (config.spikeRateHz <= 0.0f) {
+            return INT32_MAX;
+        }
+        const float u = std::max(uniform(), 1.0e-6f);
+        return std::max(1, int(-std::log(u) * config.sampleRate / config.spikeRateHz));
+    }
+
+    SyntheticSignalConfig config;
+    uint64_t rngState;
+    int64_t sampleIndex = 0;
+
+    int spikeLength;
+    std::vector<float> spikeTemplate;
+
+    std::vector<float> noiseGain;
+    std::vector<ChannelState> state;
+    std::vector<int> samplesUntilSpike;
+    std::vector<int> spikeSample;
+};
+
+#endif /* SyntheticUG3Source_h */
@@ -0,0 +1,357 @@
+//
+//  UG3ElectrodeViewerBenchmarks.cpp
+//  ug3-electrode-viewer
+//
+//  Google Benchmark suite for the processor, colour mapping and display hot paths.
+//  Run headless with e.g.
+//      UG3ElectrodeViewer_benchmarks --benchmark_format=json --benchmark_out=bench.json
+//
+//  Extra flags for the performance regression gate:
+//      --ug3_baseline=<file>        fail if a benchmark is slower than its baseline tolerance or a ratio is over its bound
+//      --ug3_tolerance=<percent>    override every tolerance in the baseline
+//      --ug3_write_baseline=<file>  record the current timings as the new baseline
+//      --ug3_gate_self_test         with --ug3_baseline, succeed only if the process() floor ratios catch BM_ProcessInjected
+//
+
+#include <benchmark/benchmark.h>
+
+#include "ViewerHarness.h"
+#include "PerformanceGate.h"
+#include "../Source/ElectrodeGeometry.h"
+#include "../Source/FrameRasterizer.h"
+
+namespace {
+
+    const std::vector<int64_t> channelCounts = { 16, 256, 1024, 4096, 16384 };
+
+    void processArguments(benchmark::internal::Benchmark* bench) {
+        for (int64_t channels : channelCounts) {
+            for (int64_t withMap : { 0, 1 }) {
+                bench->Args({ channels, withMap });
+            }
+        }
+        bench->ArgNames({ "channels", "map" });
+    }
+
+    void displayArguments(benchmark::internal::Benchmark* bench) {
+        for (int64_t channels : channelCounts) {
+            bench->Arg(channels);
+        }
+        bench->ArgName("channels");
+    }
+}
+
+static void BM_Process(benchmark::State& state) {
+    const int numChannels = int(state.range(0));
+    const bool withMap = state.range(1) != 0;
+    const int blockSize = 64;
+
+    ViewerHarness harness(numChannels);
+    harness.loadLayout(withMap);
+    harness.startAcquisition();
+
+    AudioBuffer<float> buffer = harness.createBuffer(0.0f, 0.5f, blockSize);
+
+    for (auto _ : state) {
+        harness.writeBlock(buffer);
+    }
+
+    harness.stopAcquisition();
+    state.SetItemsProcessed(state.iterations() * numChannels);
+    state.counters["channels"] = numChannels;
+}
+BENCHMARK(BM_Process)->Apply(processArguments)->Unit(benchmark::kMicrosecond);
+
+//The least a process() that reads the block can do: every sample once, keeping each channel's
+//latest value and running sum. The gate bounds process() against it instead of a recorded time
+static void BM_ProcessFloor(benchmark::State& state) {
+    const int numChannels = int(state.range(0));
+    const int blockSize = 64;
+
+    ViewerHarness harness(numChannels);
+    AudioBuffer<float> buffer = harness.createBuffer(0.0f, 0.5f, blockSize);
+    std::vector<float> latest(numChannels);
+    std::vector<float> sums(numChannels);
+
+    for (auto _ : state) {
+        for (int channel = 0; channel < numChannels; channel++) {
+            const float* samples = buffer.getReadPointer(channel);
+            float sum = sums[channel];
+            for (int sampleIdx = 0; sampleIdx < blockSize; sampleIdx++) {
+                sum += samples[sampleIdx];
+            }
+            sums[channel] = sum;
+            latest[channel] = samples[blockSize - 1];
+        }
+        benchmark::DoNotOptimize(sums.data());
+        benchmark::DoNotOptimize(latest.data());
+        benchmark::ClobberMemory();
+    }
+
+    state.SetItemsProcessed(state.iterations() * numChannels);
+    state.counters["channels"] = numChannels;
+}
+BENCHMARK(BM_ProcessFloor)->Apply(displayArguments)->Unit(benchmark::kMicrosecond);
+
+//Mapped process() plus a dependent chain of square roots per channel per block, standing in for
+//per-channel work creeping into the hot path; --ug3_gate_self_test checks the gate catches it
+static void BM_ProcessInjected(benchmark::State& state) {
+    const int numChannels = int(state.range(0));
+    const int blockSize = 64;
+    const int injectedStepsPerChannel = 256;
+
+    ViewerHarness harness(numChannels);
+    harness.loadLayout(true);
+    harness.startAcquisition();
+
+    AudioBuffer<float> buffer = harness.createBuffer(0.0f, 0.5f, blockSize);
+    std::vector<float> injected(numChannels);
+
+    for (auto _ : state) {
+        harness.writeBlock(buffer);
+        for (int channel = 0; channel < numChannels; channel++) {
+            float value = buffer.getSample(channel, blockSize - 1);
+            for (int step = 0; step < injectedStepsPerChannel; step++) {
+                value = std::sqrt(value * value + 1.0f);
+            }
+            injected[channel] = value;
+        }
+        benchmark::DoNotOptimize(injected.data());
+    }
+
+    harness.stopAcquisition();
+    state.SetItemsProcessed(state.iterations() * numChannels);
+    state.counters["channels"] = numChannels;
+}
+BENCHMARK(BM_ProcessInjected)->Apply(displayArguments)->Unit(benchmark::kMicrosecond);
+
+
+static void BM_ColourMapping(benchmark::State& state) {
+    const ColourSchemeId scheme = static_cast<ColourSchemeId>(state.range(0));
+    const int numValues = 65536;
+
+    //Sweep slightly past both ends so clipping is exercised
+    std::vector<float> values(numValues);
+    for (int i = 0; i < numValues; i++) {
+        values[i] = -0.05f + 1.1f * float(i) / float(numValues);
+    }
+
+    for (auto _ : state) {
+        for (float value : values) {
+            benchmark::DoNotOptimize(ColourScheme::getColourForNormalizedValueInScheme(value, scheme));
+        }
+    }
+
+    state.SetItemsProcessed(state.iterations() * numValues);
+}
+BENCHMARK(BM_ColourMapping)
+    ->Arg(int(ColourSchemeId::INFERNO))
+    ->Arg(int(ColourSchemeId::VIRIDIS))
+    ->Arg(int(ColourSchemeId::PLASMA))
+    ->Arg(int(ColourSchemeId::MAGMA))
+    ->Arg(int(ColourSchemeId::JET))
+    ->ArgName("scheme");
+
+
+static void BM_DisplayRefresh(benchmark::State& state) {
+    const int numChannels = int(state.range(0));
+
+    ViewerHarness harness(numChannels);
+    harness.loadLayout(false);
+    auto canvas = harness.createCanvas();
+    canvas->setColorScaleFactor(5000, "5mV");
+
+    harness.startAcquisition();
+    AudioBuffer<float> buffer = harness.createBuffer(-2500.0f, 1.0f, 1);
+    harness.writeBlock(buffer);
+
+    for (auto _ : state) {
+        canvas->refresh();
+    }
+
+    harness.stopAcquisition();
+    state.SetItemsProcessed(state.iterations() * numChannels);
+}
+BENCHMARK(BM_DisplayRefresh)->Apply(displayArguments)->Unit(benchmark::kMicrosecond);
+
+
+static void BM_DisplayPaint(benchmark::State& state) {
+    const int numChannels = int(state.range(0));
+
+    ViewerHarness harness(numChannels);
+    harness.loadLayout(false);
+    auto canvas = harness.createCanvas();
+    canvas->setColorScaleFactor(5000, "5mV");
+
+    harness.startAcquisition();
+    AudioBuffer<float> buffer = harness.createBuffer(-2500.0f, 1.0f, 1);
+    harness.writeBlock(buffer);
+    canvas->refresh();
+
+    Image frame(Image::ARGB, canvas->getWidth(), canvas->getHeight(), true);
+
+    for (auto _ : state) {
+        Graphics g(frame);
+        canvas->paintEntireComponent(g, false);
+    }
+
+    harness.stopAcquisition();
+    state.SetItemsProcessed(state.iterations() * numChannels);
+}
+BENCHMARK(BM_DisplayPaint)->Apply(displayArguments)->Unit(benchmark::kMicrosecond);
+
+
+static void BM_LayoutParse(benchmark::State& state) {
+    const int numChannels = int(state.range(0));
+
+    ViewerHarness harness(numChannels);
+    const String layoutJSON = harness.buildLayoutJSON("Harness", true);
+
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(harness.getProcessor()->loadElectrodeLayoutJSON(layoutJSON));
+    }
+
+    state.SetBytesProcessed(state.iterations() * int64_t(layoutJSON.getNumBytesAsUTF8()));
+    state.counters["sites"] = numChannels;
+}
+BENCHMARK(BM_LayoutParse)->Apply(displayArguments)->Unit(benchmark::kMicrosecond);
+
+
+static void BM_TiledRasterize(benchmark::State& state) {
+    const int side = int(state.range(0));
+    const int numThreads = int(state.range(1));
+
+    const RenderLayout grid = ElectrodeGeometry::placeGrid(side, side, {});
+    std::vector<float> values(grid.sites.size());
+    for (int i = 0; i < int(values.size()); i++) {
+        values[i] = float(i % 5000);
+    }
+    RenderSettings settings;
+    settings.scaleFactor = 5000;
+    const RenderedRange range = FrameRasterizer::getDrawingRange(settings, AutoRange());
+
+    FrameRasterizer rasterizer;
+    rasterizer.setNumThreads(numThreads);
+    Image image;
+
+    for (auto _ : state) {
+        rasterizer.rasterize(image, grid, settings, range, values.data(), int(values.size()), nullptr, 0);
+    }
+
+    state.SetItemsProcessed(state.iterations() * int64_t(values.size()));
+}
+BENCHMARK(BM_TiledRasterize)
+    ->ArgsProduct({ { 64, 128, 256 }, { 1, 2, 4, 8 } })
+    ->ArgNames({ "side", "threads" })
+    ->Unit(benchmark::kMicrosecond)
+    ->UseRealTime();
+
+
+//A hexagonal array with as many sites as the side x side grid above, for comparing irregular layouts with grids
+static void BM_SiteRasterize(benchmark::State& state) {
+    const int side = int(state.range(0));
+    const int numThreads = int(state.range(1));
+
+    std::vector<ElectrodeSite> sites(size_t(side) * side);
+    for (int i = 0; i < int(sites.size()); i++) {
+        const int row = i / side;
+        sites[i].x = 15.0f * float(i % side) + (row % 2 == 0 ? 0.0f : 7.5f);
+        sites[i].y = 13.0f * float(row);
+        sites[i].width = 10.0f;
+        sites[i].height = 11.5f;
+        sites[i].shape = SiteShape::HEXAGON;
+    }
+    const RenderLayout layout = ElectrodeGeometry::placeSites(sites);
+    std::vector<float> values(layout.sites.size());
+    for (int i = 0; i < int(values.size()); i++) {
+        values[i] = float(i % 5000);
+    }
+    RenderSettings settings;
+    settings.scaleFactor = 5000;
+    const RenderedRange range = FrameRasterizer::getDrawingRange(settings, AutoRange());
+
+    FrameRasterizer rasterizer;
+    rasterizer.setNumThreads(numThreads);
+    Image image;
+
+    for (auto _ : state) {
+        rasterizer.rasterize(image, layout, settings, range, values.data(), int(values.size()), nullptr, 0);
+    }
+
+    state.SetItemsProcessed(state.iterations() * int64_t(values.size()));
+}
+BENCHMARK(BM_SiteRasterize)
+    ->ArgsProduct({ { 64, 128, 256 }, { 1, 4 } })
+    ->ArgNames({ "side", "threads" })
+    ->Unit(benchmark::kMicrosecond)
+    ->UseRealTime();
+
+
+int main(int argc, char* argv[]) {
+    String baselinePath;
+    String writeBaselinePath;
+    double tolerance = 0.0;
+    bool isGateSelfTest = false;
+    std::string format = "console";
+
+    //Strip our own flags before handing the rest to Google Benchmark
+    std::vector<char*> benchmarkArgs;
+    for (int i = 0; i < argc; i++) {
+        const String arg(argv[i]);
+        if (arg.startsWith("--ug3_baseline=")) {
+            baselinePath = arg.fromFirstOccurrenceOf("=", false, false);
+        }
+        else if (arg.startsWith("--ug3_write_baseline=")) {
+            writeBaselinePath = arg.fromFirstOccurrenceOf("=", false, false);
+        }
+        else if (arg.startsWith("--ug3_tolerance=")) {
+            tolerance = arg.fromFirstOccurrenceOf("=", false, false).getDoubleValue();
+        }
+        else if (arg == "--ug3_gate_self_test") {
+            isGateSelfTest = true;
+        }
+        else {
+            //Left in for Google Benchmark to validate; the collector creates the reporter it names
+            if (arg.startsWith("--benchmark_format=")) {
+                format = arg.fromFirstOccurrenceOf("=", false, false).toStdString();
+            }
+            benchmarkArgs.push_back(argv[i]);
+        }
+    }
+
+    int benchmarkArgc = int(benchmarkArgs.size());
+    benchmark::Initialize(&benchmarkArgc, benchmarkArgs.data());
+    if (benchmark::ReportUnrecognizedArguments(benchmarkArgc, benchmarkArgs.data())) {
+        return 1;
+    }
+
+    TimingCollector collector(format);
+    benchmark::RunSpecifiedBenchmarks(&collector);
+    benchmark::Shutdown();
+
+    if (writeBaselinePath.isNotEmpty()) {
+        if (!PerformanceGate::writeBaseline(File(writeBaselinePath), collector.getTimings())) {
+            std::cerr << "could not write baseline " << writeBaselinePath << std::endl;
+            return 1;
+        }
+        std::cout << "wrote baseline " << writeBaselinePath << std::endl;
+    }
+
+    if (isGateSelfTest) {
+        if (baselinePath.isEmpty() || !PerformanceGate::catchesInjectedWork(File(baselinePath), collector.getTimings())) {
+            std::cerr << "the performance gate does not catch per-channel work injected into process()" << std::endl;
+            return 1;
+        }
+        return 0;
+    }
+
+    if (baselinePath.isNotEmpty()) {
+        int regressions = PerformanceGate::compare(File(baselinePath), collector.getTimings(), tolerance);
+        if (regressions != 0) {
+            std::cerr << (regressions < 0 ? String("baseline could not be read") : String(regressions) + " benchmark(s) regressed") << std::endl;
+            return 1;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,255 @@
+//
+//  UG3ElectrodeViewerStress.cpp
+//  ug3-electrode-viewer
+//
+//  Headless soak test: streams synthetic UG3-like data through the processor at a
+//  real-time pace while refreshing and painting the canvas at its frame rate, then
+//  reports missed frames, peak latencies and resident memory growth.
+//
+//  Usage: UG3ElectrodeViewer_stress [--channels 65536] [--streams 1] [--rate 1000]
+//             [--block 32] [--fps 30] [--seconds 120] [--probe-cols 0] [--map]
+//             [--json report.json] [--max-memory-growth-mb 0]
+//
+
+#include "ViewerHarness.h"
+#include "SyntheticUG3Source.h"
+
+#include <chrono>
+#include <iostream>
+#include <thread>
+
+#if JUCE_LINUX
+#include <unistd.h>
+#elif JUCE_MAC
+#include <sys/resource.h>
+#endif
+
+namespace {
+
+    struct StressOptions {
+        int channels = 65536;
+        int streams = 1;
+        float sampleRate = 1000.0f;
+        int blockSize = 32;
+        int framesPerSecond = 30;
+        double seconds = 120.0;
+        int probeCols = 0;
+        bool withMap = false;
+        String jsonPath;
+        double maxMemoryGrowthMb = 0.0;
+    };
+
+    StressOptions parseOptions(int argc, char* argv[]) {
+        StressOptions options;
+        for (int i = 1; i < argc; i++) {
+            const String arg(argv[i]);
+            const String value = i + 1 < argc ? String(argv[i + 1]) : String();
+            if (arg == "--channels") { options.channels = value.getIntValue(); i++; }
+            else if (arg == "--streams") { options.streams = value.getIntValue(); i++; }
+            else if (arg == "--rate") { options.sampleRate = value.getFloatValue(); i++; }
+            else if (arg == "--block") { options.blockSize = value.getIntValue(); i++; }
+            else if (arg == "--fps") { options.framesPerSecond = value.getIntValue(); i++; }
+            else if (arg == "--seconds") { options.seconds = value.getDoubleValue(); i++; }
+            else if (arg == "--probe-cols") { options.probeCols = value.getIntValue(); i++; }
+            else if (arg == "--map") { options.withMap = true; }
+            else if (arg == "--json") { options.jsonPath = value; i++; }
+            else if (arg == "--max-memory-growth-mb") { options.maxMemoryGrowthMb = value.getDoubleValue(); i++; }
+            else { std::cerr << "ignoring unknown argument " << arg << std::endl; }
+        }
+        options.streams = std::max(1, options.streams);
+        options.blockSize = std::max(1, options.blockSize);
+        options.framesPerSecond = std::max(1, options.framesPerSecond);
+        return options;
+    }
+
+    //Current resident set size; macOS only exposes the peak, which still shows growth
+    int64 getResidentMemoryBytes() {
+#if JUCE_LINUX
+        long pages = 0;
+        long residentPages = 0;
+        if (FILE* statm = fopen("/proc/self/statm", "r")) {
+            if (fscanf(statm, "%ld %ld", &pages, &residentPages) != 2) {
+                residentPages = 0;
+            }
+            fclose(statm);
+        }
+        return int64(residentPages) * int64(sysconf(_SC_PAGESIZE));
+#elif JUCE_MAC
+        struct rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        return int64(usage.ru_maxrss);
+#else
+        return 0;
+#endif
+    }
+
+    struct LatencyStats {
+        int64 count = 0;
+        double totalMs = 0.0;
+        double peakMs = 0.0;
+
+        void add(double ms) {
+            count++;
+            totalMs += ms;
+            peakMs = std::max(peakMs, ms);
+        }
+
+        double meanMs() const { return count > 0 ? totalMs / double(count) : 0.0; }
+    };
+}
+
+int main(int argc, char* argv[]) {
+    using Clock = std::chrono::steady_clock;
+    const StressOptions options = parseOptions(argc, argv);
+
+    const int channelsPerStream = options.channels / options.streams;
+    ViewerHarness harness(channelsPerStream, options.sampleRate, options.streams);
+    harness.loadLayout(options.withMap, "Synthetic", options.probeCols);
+    auto canvas = harness.createCanvas();
+    canvas->setColorScaleFactor(500, "500uV");
+    canvas->toggleZeroCenter(true);
+
+    //Streams are stacked as bands of rows, the first band is the one on screen
+    SyntheticSignalConfig signalConfig;
+    signalConfig.cols = ViewerHarness::getGridCols(channelsPerStream);
+    signalConfig.rows = (channelsPerStream * options.streams + signalConfig.cols - 1) / signalConfig.cols;
+    signalConfig.sampleRate = options.sampleRate;
+    SyntheticUG3Source source(signalConfig);
+
+    const int totalChannels = channelsPerStream * options.streams;
+    AudioBuffer<float> buffer(totalChannels, options.blockSize);
+    HeapBlock<float> spareChannel(options.blockSize);
+    std::vector<float*> channelPointers(source.getNumChannels());
+    for (int c = 0; c < source.getNumChannels(); c++) {
+        //The generator grid is rounded up to whole rows; the overflow lands in a scratch channel
+        channelPointers[c] = c < totalChannels ? buffer.getWritePointer(c) : spareChannel.get();
+    }
+
+    Image frame(Image::ARGB, canvas->getWidth(), canvas->getHeight(), true);
+
+    const auto blockInterval = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(options.blockSize / options.sampleRate));
+    const auto frameInterval = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / options.framesPerSecond));
+
+    std::cout << "UG3 stress: " << totalChannels << " channels in " << options.streams << " stream(s), "
+              << options.sampleRate << " Hz, " << options.blockSize << " samples/block, "
+              << options.framesPerSecond << " fps, " << options.seconds << " s" << std::endl;
+
+    harness.startAcquisition();
+    canvas->beginAnimation();
+    Instrumentation::reset();
+
+    LatencyStats processLatency;
+    LatencyStats frameLatency;
+    int64 lateBlocks = 0;
+    int64 droppedFrames = 0;
+    int64 framesRendered = 0;
+
+    //Memory is measured after the first second so that one-off allocations don't count as growth
+    int64 baselineMemory = -1;
+    int64 peakMemory = 0;
+
+    const Clock::time_point start = Clock::now();
+    const Clock::time_point end = start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(options.seconds));
+    Clock::time_point nextBlock = start;
+    Clock::time_point nextFrame = start;
+    Clock::time_point nextMemorySample = start + std::chrono::seconds(1);
+
+    while (Clock::now() < end) {
+        Clock::time_point now = Clock::now();
+
+        if (now >= nextBlock) {
+            if (now - nextBlock > blockInterval) {
+                lateBlocks++;
+            }
+            source.fillBlock(channelPointers.data(), options.blockSize);
+            const Clock::time_point blockStart = Clock::now();
+            harness.writeBlock(buffer);
+            processLatency.add(std::chrono::duration<double, std::milli>(Clock::now() - blockStart).count());
+            nextBlock += blockInterval;
+        }
+
+        now = Clock::now();
+        if (now >= nextFrame) {
+            //Every whole frame interval we are late by is a frame that never made it to screen
+            const int64 missed = int64((now - nextFrame) / frameInterval);
+            droppedFrames += missed;
+
+            const Clock::time_point frameStart = Clock::now();
+            canvas->refresh();
+            {
+                Graphics g(frame);
+                canvas->paintEntireComponent(g, false);
+            }
+            frameLatency.add(std::chrono::duration<double, std::milli>(Clock::now() - frameStart).count());
+            framesRendered++;
+            nextFrame += frameInterval * (missed + 1);
+        }
+
+        now = Clock::now();
+        if (now >= nextMemorySample) {
+            const int64 memory = getResidentMemoryBytes();
+            if (baselineMemory < 0) {
+                baselineMemory = memory;
+            }
+            peakMemory = std::max(peakMemory, memory);
+            nextMemorySample += std::chrono::seconds(1);
+        }
+
+        const Clock::time_point wake = std::min(nextBlock, nextFrame);
+        if (wake > Clock::now()) {
+            std::this_thread::sleep_until(wake);
+        }
+    }
+
+    canvas->endAnimation();
+    harness.stopAcquisition();
+
+    const int64 finalMemory = getResidentMemoryBytes();
+    peakMemory = std::max(peakMemory, finalMemory);
+    const double memoryGrowthMb = baselineMemory >= 0 ? double(finalMemory - baselineMemory) / (1024.0 * 1024.0) : 0.0;
+    const ViewerTelemetry telemetry = canvas->getTelemetry();
+
+    std::cout << "blocks processed:   " << processLatency.count << " (" << lateBlocks << " late)" << std::endl;
+    std::cout << "process latency:    mean " << processLatency.meanMs() << " ms, peak " << processLatency.peakMs << " ms" << std::endl;
+    std::cout << "frames rendered:    " << framesRendered << " (" << droppedFrames << " dropped)" << std::endl;
+    std::cout << "frame latency:      mean " << frameLatency.meanMs() << " ms, peak " << frameLatency.peakMs << " ms" << std::endl;
+    std::cout << "measured rate:      " << telemetry.sampleRate << " Hz of " << telemetry.nominalSampleRate << " Hz" << std::endl;
+    std::cout << "resident memory:    " << finalMemory / (1024 * 1024) << " MB (peak " << peakMemory / (1024 * 1024)
+              << " MB, growth " << memoryGrowthMb << " MB)" << std::endl;
+
+    for (const auto& summary : Instrumentation::getSummaries(false)) {
+        if (summary.count > 0) {
+            std::cout << "stage " << Instrumentation::getStageName(summary.stage) << ": p50 " << summary.p50Nanos / 1000
+                      << " us, p99 " << summary.p99Nanos / 1000 << " us, max " << summary.maxNanos / 1000 << " us" << std::endl;
+        }
+    }
+
+    if (options.jsonPath.isNotEmpty()) {
+        DynamicObject::Ptr report = new DynamicObject();
+        report->setProperty("channels", totalChannels);
+        report->setProperty("streams", options.streams);
+        report->setProperty("sample_rate", options.sampleRate);
+        report->setProperty("block_size", options.blockSize);
+        report->setProperty("fps", options.framesPerSecond);
+        report->setProperty("seconds", options.seconds);
+        report->setProperty("blocks", processLatency.count);
+        report->setProperty("late_blocks", lateBlocks);
+        report->setProperty("process_mean_ms", processLatency.meanMs());
+        report->setProperty("process_peak_ms", processLatency.peakMs);
+        report->setProperty("frames", framesRendered);
+        report->setProperty("dropped_frames", droppedFrames);
+        report->setProperty("frame_mean_ms", frameLatency.meanMs());
+        report->setProperty("frame_peak_ms", frameLatency.peakMs);
+        report->setProperty("memory_bytes", finalMemory);
+        report->setProperty("memory_peak_bytes", peakMemory);
+        report->setProperty("memory_growth_mb", memoryGrowthMb);
+        File(options.jsonPath).replaceWithText(JSON::toString(var(report), false));
+    }
+
+    if (options.maxMemoryGrowthMb > 0.0 && memoryGrowthMb > options.maxMemoryGrowthMb) {
+        std::cerr << "memory grew by " << memoryGrowthMb << " MB, limit is " << options.maxMemoryGrowthMb << " MB" << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,181 @@
+//
+//  ViewerHarness.h
+//  ug3-electrode-viewer
+//
+//  Drives a UG3ElectrodeViewer (and optionally its canvas) headlessly from a
+//  FakeSourceNode, the same way Tests/UG3ElectrodeViewerTests.cpp does.
+//
+
+#ifndef ViewerHarness_h
+#define ViewerHarness_h
+
+#include "../Source/UG3ElectrodeViewer.h"
+#include "../Source/UG3ElectrodeViewerCanvas.h"
+#include "../Source/ColourScheme.h"
+
+#include <ModelProcessors.h>
+#include <ModelApplication.h>
+#include <TestFixtures.h>
+
+#include <cmath>
+
+class ViewerHarness {
+public:
+    ViewerHarness(int numChannels_, float sampleRate = 30000.0f, int numStreams = 1) : numChannels(numChannels_) {
+        FakeSourceNodeParams params{
+            numChannels,
+            sampleRate,
+            1.0f
+        };
+        params.streams = numStreams;
+        tester = std::make_unique<ProcessorTester>(params);
+        processor = tester->Create<UG3ElectrodeViewer>(Plugin::Processor::SINK);
+        processor->setCurrentStreamName(processor->getDataStreams()[0]->getName());
+    }
+
+    ~ViewerHarness() {
+        stopAcquisition();
+    }
+
+    UG3ElectrodeViewer* getProcessor() { return processor; }
+
+    int getNumChannels() const { return numChannels; }
+
+    /** Columns of the most square grid that holds every channel */
+    static int getGridCols(int numSites) {
+        return std::max(1, int(std::ceil(std::sqrt(double(numSites)))));
+    }
+
+    static int getGridRows(int numSites) {
+        int cols = getGridCols(numSites);
+        return (numSites + cols - 1) / cols;
+    }
+
+    /**
+        Builds a layout file with a single capability. With a map, every channel of the first
+        stream is routed to the mirrored grid position so that the map is not the identity.
+        With probeCols the columns are rounded up to whole probes.
+    */
+    String buildLayoutJSON(const String& capability, bool withMap, int probeCols = 0) const {
+        int cols = getGridCols(numChannels);
+        if (probeCols > 0) {
+            cols = (cols + probeCols - 1) / probeCols * probeCols;
+        }
+        const int rows = (numChannels + cols - 1) / cols;
+
+        DynamicObject::Ptr entry = new DynamicObject();
+        entry->setProperty("rows", rows);
+        entry->setProperty("cols", cols);
+        if (probeCols > 0) {
+            entry->setProperty("probeCols", probeCols);
+        }
+
+        if (withMap) {
+            const DataStream* stream = processor->getDataStreams()[0];
+            const String streamName = stream->getName().upToFirstOccurrenceOf("-", false, false);
+            Array<var> map;
+            int index = 0;
+            for (auto channel : stream->getContinuousChannels()) {
+                const int site = numChannels - 1 - index++;
+                DynamicObject::Ptr coord = new DynamicObject();
+                coord->setProperty("x", site % cols);
+                coord->setProperty("y", site / cols);
+                coord->setProperty("channel", channel->getName());
+                coord->setProperty("stream", streamName);
+                map.add(var(coord));
+            }
+            entry->setProperty("map", map);
+        }
+
+        DynamicObject::Ptr layout = new DynamicObject();
+        layout->setProperty(capability, var(entry));
+        return JSON::toString(var(layout), true);
+    }
+
+    /** Reports a single capability to the processor and loads a matching layout */
+    bool loadLayout(bool withMap, const String& capability = "Harness", int probeCols = 0) {
+        std::map<String, var> payload;
+        payload["capabilities"] = var(Array<String>{capability});
+        payload["currentCapability"] = var(capability);
+        processor->handleConfigMessage(BroadcastParser::build("", "LOADINPUTINFO", payload));
+
+        return processor->loadElectrodeLayoutJSON(buildLayoutJSON(capability, withMap, probeCols));
+    }
+
+    /** Creates a canvas sized so that the whole grid and info column are visible */
+    std::unique_ptr<UG3ElectrodeViewerCanvas> createCanvas() {
+        auto canvas = std::make_unique<UG3ElectrodeViewerCanvas>(processor);
+        canvas->update();
+        canvas->setSize(getCanvasWidth(), getCanvasHeight());
+        canvas->update();
+        return canvas;
+    }
+
+    int getCanvasWidth() const {
+        return 20 + getGridCols(numChannels) * 12 + 20 + 600;
+    }
+
+    int getCanvasHeight() const {
+        return std::max(400, 20 + getGridRows(numChannels) * 12 + 20 + 200);
+    }
+
+    void startAcquisition() {
+        if (!isAcquiring) {
+            tester->startAcquisition(false);
+            isAcquiring = true;
+        }
+    }
+
+    void stopAcquisition() {
+        if (isAcquiring) {
+            tester->stopAcquisition();
+            isAcquiring = false;
+        }
+    }
+
+    int getNumStreams() const {
+        return int(processor->getDataStreams().size());
+    }
+
+    AudioBuffer<float> createBuffer(float startingValue, float step, int numSamples) const {
+        AudioBuffer<float> buffer(numChannels * getNumStreams(), numSamples);
+        float value = startingValue;
+        for (int chidx = 0; chidx < buffer.getNumChannels(); chidx++) {
+            for (int sampleIdx = 0; sampleIdx < numSamples; sampleIdx++) {
+                buffer.setSample(chidx, sampleIdx, value);
+                value += step;
+            }
+        }
+        return buffer;
+    }
+
+    /** Pushes one block through processBlock(), stamping every stream */
+    void writeBlock(AudioBuffer<float>& buffer) {
+        MidiBuffer eventBuffer;
+        for (auto stream : processor->getDataStreams()) {
+            HeapBlock<char> data;
+            size_t dataSize = SystemEvent::fillTimestampAndSamplesData(
+                data,
+                processor,
+                stream->getStreamId(),
+                currentSampleIndex,
+                0,
+                buffer.getNumSamples(),
+                0);
+            eventBuffer.addEvent(data, int(dataSize), 0);
+        }
+
+        auto audioProcessor = (AudioProcessor*) processor;
+        audioProcessor->processBlock(buffer, eventBuffer);
+        currentSampleIndex += buffer.getNumSamples();
+    }
+
+private:
+    int numChannels;
+    std::unique_ptr<ProcessorTester> tester;
+    UG3ElectrodeViewer* processor;
+    bool isAcquiring = false;
+    int64 currentSampleIndex = 0;
+};
+
+#endif /* ViewerHarness_h */
@@ -0,0 +1,64 @@
+//
+//  CachedLayer.h
+//  ug3-electrode-viewer
+//
+
+#ifndef CachedLayer_h
+#define CachedLayer_h
+
+#include <VisualizerWindowHeaders.h>
+
+/**
+    Part of a paint that only changes when its inputs do, kept as an image between
+    paints. The owner calls invalidate() when an input changes; until then draw()
+    blits the cached image instead of running the paint function again.
+
+    The image is drawn at the target's physical pixel scale so cached text stays as
+    sharp as text drawn directly, and is redrawn if that scale or the bounds change.
+*/
+class CachedLayer {
+public:
+    CachedLayer() : isStale(true), cachedScale(0.0f), numRedraws(0) {}
+
+    void invalidate() {
+        isStale = true;
+    }
+
+    /** Draws the layer over bounds, first calling paintLayer(Graphics&) in the same coordinates as g if it is out of date */
+    template <typename PaintFunction>
+    void draw(Graphics& g, const juce::Rectangle<int>& bounds, PaintFunction&& paintLayer) {
+        if (bounds.isEmpty()) {
+            return;
+        }
+
+        const float scale = g.getInternalContext().getPhysicalPixelScaleFactor();
+        if (isStale || bounds != cachedBounds || scale != cachedScale) {
+            image = Image(Image::ARGB, std::max(1, roundToInt(float(bounds.getWidth()) * scale)),
+                          std::max(1, roundToInt(float(bounds.getHeight()) * scale)), true, SoftwareImageType());
+            Graphics layerGraphics(image);
+            layerGraphics.addTransform(AffineTransform::translation(float(-bounds.getX()), float(-bounds.getY())).scaled(scale));
+            paintLayer(layerGraphics);
+
+            isStale = false;
+            cachedBounds = bounds;
+            cachedScale = scale;
+            numRedraws++;
+        }
+
+        g.drawImageTransformed(image, AffineTransform::scale(1.0f / cachedScale).translated(float(bounds.getX()), float(bounds.getY())));
+    }
+
+    /** How many times the paint function has run */
+    int getNumRedraws() const {
+        return numRedraws;
+    }
+
+private:
+    Image image;
+    bool isStale;
+    juce::Rectangle<int> cachedBounds;
+    float cachedScale;
+    int numRedraws;
+};
+
+#endif /* CachedLayer_h */
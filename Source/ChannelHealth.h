@@ -0,0 +1,338 @@
+//
+//  ChannelHealth.h
+//  ug3-electrode-viewer
+//
+
+#ifndef ChannelHealth_h
+#define ChannelHealth_h
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "ElectrodeSite.h"
+
+/** Reasons an electrode can be flagged; several can be set at once */
+enum ChannelHealthFlag : uint8_t {
+    HEALTHY = 0,
+    FLATLINE = 1 << 0,
+    RAILED = 1 << 1,
+    NOISY = 1 << 2,
+    IMPEDANCE_OUTLIER = 1 << 3
+};
+
+struct ChannelHealthLimits {
+    //standard deviation below which a site counts as flat, in microvolts
+    float flatStdDev = 0.1f;
+    //magnitude at or above which a sample counts as railed, in microvolts
+    float railLevel = 6000.0f;
+    //fraction of recent samples that must be railed to flag the site
+    float railFraction = 0.5f;
+    //standard deviation relative to the median of the grid neighbours that counts as noisy
+    float noiseRatio = 5.0f;
+    //distance from the median impedance, in robust standard deviations, that counts as an outlier
+    float impedanceDeviations = 5.0f;
+    //how quickly the statistics forget, in seconds
+    float timeConstant = 5.0f;
+};
+
+/**
+    Which sites hold a channel, and which sites each one is compared with for noise. Built
+    on the message thread whenever the layout changes and handed to the audio thread with
+    the channel routes, so classifying never looks anything up.
+*/
+struct ChannelNeighbours {
+    //one per site, non-zero where a channel is mapped
+    std::vector<uint8_t> mapped;
+    //the neighbours of site i are indices[start[i] .. start[i + 1]); only mapped sites are listed
+    std::vector<int> start;
+    std::vector<int> indices;
+
+    int getNumSites() const { return int(mapped.size()); }
+
+    /** The up to eight surrounding mapped sites on a grid gridCols wide; 0 treats the sites as a single row */
+    static ChannelNeighbours fromGrid(const std::vector<uint8_t>& mapped, int gridCols) {
+        ChannelNeighbours neighbours;
+        neighbours.mapped = mapped;
+        const int n = int(mapped.size());
+        const int cols = gridCols > 0 ? gridCols : std::max(1, n);
+        neighbours.start.reserve(n + 1);
+        neighbours.start.push_back(0);
+        for (int i = 0; i < n; i++) {
+            const int x = i % cols;
+            const int y = i / cols;
+            for (int dy = -1; dy <= 1 && mapped[i]; dy++) {
+                for (int dx = -1; dx <= 1; dx++) {
+                    const int nx = x + dx;
+                    const int ny = y + dy;
+                    const int j = ny * cols + nx;
+                    if ((dx == 0 && dy == 0) || nx < 0 || nx >= cols || ny < 0 || j >= n || !mapped[j]) {
+                        continue;
+                    }
+                    neighbours.indices.push_back(j);
+                }
+            }
+            neighbours.start.push_back(int(neighbours.indices.size()));
+        }
+        return neighbours;
+    }
+
+    /**
+        For layouts placed by coordinate: the up to eight mapped sites nearest each site's centre,
+        no further than half again the distance to its nearest one. Quadratic, but only run when
+        the layout changes.
+    */
+    static ChannelNeighbours fromSites(const std::vector<uint8_t>& mapped, const std::vector<ElectrodeSite>& sites) {
+        ChannelNeighbours neighbours;
+        neighbours.mapped = mapped;
+        const int n = int(std::min(mapped.size(), sites.size()));
+        neighbours.mapped.resize(n);
+        neighbours.start.reserve(n + 1);
+        neighbours.start.push_back(0);
+        auto centreDistance = [&sites](int i, int j) {
+            const float dx = (sites[i].x + 0.5f * sites[i].width) - (sites[j].x + 0.5f * sites[j].width);
+            const float dy = (sites[i].y + 0.5f * sites[i].height) - (sites[j].y + 0.5f * sites[j].height);
+            return std::sqrt(dx * dx + dy * dy);
+        };
+        for (int i = 0; i < n; i++) {
+            int nearest[8];
+            float distances[8];
+            int count = 0;
+            for (int j = 0; j < n && mapped[i]; j++) {
+                if (j == i || !mapped[j]) {
+                    continue;
+                }
+                const float distance = centreDistance(i, j);
+                if (count == 8 && distance >= distances[7]) {
+                    continue;
+                }
+                //insertion into the eight nearest so far
+                int slot = count < 8 ? count++ : 7;
+                for (; slot > 0 && distances[slot - 1] > distance; slot--) {
+                    nearest[slot] = nearest[slot - 1];
+                    distances[slot] = distances[slot - 1];
+                }
+                nearest[slot] = j;
+                distances[slot] = distance;
+            }
+            for (int k = 0; k < count && distances[k] <= 1.5f * distances[0]; k++) {
+                neighbours.indices.push_back(nearest[k]);
+            }
+            neighbours.start.push_back(int(neighbours.indices.size()));
+        }
+        return neighbours;
+    }
+};
+
+/**
+    Incremental per-electrode health statistics. Every block updates exponentially
+    weighted mean, variance and rail occupancy in place, so nothing is ever rescanned.
+    The statistics are stored as separate arrays, indexed like the visual buffer.
+    Sites without a channel are never flagged and never count as a neighbour.
+*/
+class ChannelHealthMonitor {
+public:
+    void resize(int numElectrodes) {
+        mean.assign(numElectrodes, 0.0f);
+        variance.assign(numElectrodes, 0.0f);
+        stdDev.assign(numElectrodes, 0.0f);
+        railOccupancy.assign(numElectrodes, 0.0f);
+        impedanceFlags.assign(numElectrodes, HEALTHY);
+        flags.assign(numElectrodes, HEALTHY);
+        reset();
+    }
+
+    void reset() {
+        updates = 0;
+        elapsedSeconds = 0.0f;
+        numFlagged = 0;
+        std::fill(flags.begin(), flags.end(), uint8_t(HEALTHY));
+    }
+
+    int size() const { return int(mean.size()); }
+
+    void setLimits(const ChannelHealthLimits& limits_) { limits = limits_; }
+
+    const ChannelHealthLimits& getLimits() const { return limits; }
+
+    /**
+        Takes neighbours and gives back the previous ones, without allocating, so the audio
+        thread can swap them in. Until they match size(), every site is checked but none for noise.
+    */
+    void swapNeighbours(ChannelNeighbours& neighbours_) {
+        std::swap(neighbours, neighbours_);
+    }
+
+    /** Adds one value per electrode covering blockSeconds of data, then reclassifies */
+    void update(const float* values, float blockSeconds) {
+        const int n = size();
+        if (n == 0) {
+            return;
+        }
+
+        if (updates == 0) {
+            std::copy(values, values + n, mean.begin());
+        }
+
+        const float alpha = limits.timeConstant > 0.0f ? 1.0f - std::exp(-blockSeconds / limits.timeConstant) : 1.0f;
+        const float keep = 1.0f - alpha;
+        const float railLevel = limits.railLevel;
+        float* m = mean.data();
+        float* v = variance.data();
+        float* s = stdDev.data();
+        float* r = railOccupancy.data();
+        for (int i = 0; i < n; i++) {
+            const float d = values[i] - m[i];
+            const float increment = alpha * d;
+            m[i] += increment;
+            v[i] = keep * (v[i] + d * increment);
+            s[i] = std::sqrt(v[i]);
+            const float railed = std::abs(values[i]) >= railLevel ? 1.0f : 0.0f;
+            r[i] += alpha * (railed - r[i]);
+        }
+
+        updates++;
+        elapsedSeconds += blockSeconds;
+
+        //The statistics mean little until they have seen a time constant's worth of blocks
+        if (updates >= minimumUpdates && elapsedSeconds >= limits.timeConstant) {
+            classify();
+        }
+        else {
+            std::copy(impedanceFlags.begin(), impedanceFlags.end(), flags.begin());
+            numFlagged = int(std::count_if(flags.begin(), flags.end(), [](uint8_t f) { return f != HEALTHY; }));
+        }
+    }
+
+    /** Flags impedances far from the median of all measured sites; values <= 0 are unmeasured */
+    void setImpedances(const float* magnitudes, int numMagnitudes) {
+        const int n = std::min(numMagnitudes, size());
+        std::fill(impedanceFlags.begin(), impedanceFlags.end(), uint8_t(HEALTHY));
+
+        std::vector<float> measured;
+        measured.reserve(n);
+        for (int i = 0; i < n; i++) {
+            if (magnitudes[i] > 0.0f) {
+                measured.push_back(magnitudes[i]);
+            }
+        }
+        if (measured.size() < 3) {
+            return;
+        }
+
+        const float median = getMedian(measured);
+        for (float& value : measured) {
+            value = std::abs(value - median);
+        }
+        //1.4826 scales the median absolute deviation to a standard deviation for normal data
+        const float robustStdDev = 1.4826f * getMedian(measured);
+        if (robustStdDev <= 0.0f) {
+            return;
+        }
+
+        for (int i = 0; i < n; i++) {
+            if (magnitudes[i] > 0.0f && std::abs(magnitudes[i] - median) > limits.impedanceDeviations * robustStdDev) {
+                impedanceFlags[i] = IMPEDANCE_OUTLIER;
+            }
+        }
+    }
+
+    const uint8_t* getFlags() const { return flags.data(); }
+
+    int getNumFlagged() const { return numFlagged; }
+
+    static std::string describe(uint8_t flag) {
+        if (flag == HEALTHY) {
+            return "OK";
+        }
+        std::string description;
+        auto append = [&description](const char* reason) {
+            description += description.empty() ? reason : std::string(", ") + reason;
+        };
+        if (flag & FLATLINE) append("flat");
+        if (flag & RAILED) append("railed");
+        if (flag & NOISY) append("noisy");
+        if (flag & IMPEDANCE_OUTLIER) append("impedance");
+        return description;
+    }
+
+private:
+    static constexpr int minimumUpdates = 32;
+    static constexpr int maxNeighbours = 8;
+
+    void classify() {
+        const int n = size();
+        const bool hasNeighbours = neighbours.getNumSites() == n;
+        const float flatVariance = limits.flatStdDev * limits.flatStdDev;
+
+        numFlagged = 0;
+        for (int i = 0; i < n; i++) {
+            //An unmapped site holds a constant 0 that says nothing about any electrode
+            if (hasNeighbours && !neighbours.mapped[i]) {
+                flags[i] = HEALTHY;
+                continue;
+            }
+            uint8_t flag = impedanceFlags[i];
+
+            if (variance[i] < flatVariance) {
+                flag |= FLATLINE;
+            }
+            if (railOccupancy[i] > limits.railFraction) {
+                flag |= RAILED;
+            }
+            else if (!(flag & FLATLINE) && hasNeighbours) {
+                const float neighbourStdDev = getNeighbourMedianStdDev(i);
+                if (neighbourStdDev > 0.0f && stdDev[i] > limits.noiseRatio * neighbourStdDev) {
+                    flag |= NOISY;
+                }
+            }
+
+            flags[i] = flag;
+            numFlagged += flag != HEALTHY ? 1 : 0;
+        }
+    }
+
+    /** Median standard deviation of the up to eight mapped neighbours of site i */
+    float getNeighbourMedianStdDev(int i) const {
+        float sorted[maxNeighbours];
+        int count = 0;
+        const int end = std::min(neighbours.start[i + 1], neighbours.start[i] + maxNeighbours);
+        for (int k = neighbours.start[i]; k < end; k++) {
+            const float value = stdDev[neighbours.indices[k]];
+            //insertion sort as we go; there are at most eight
+            int slot = count++;
+            for (; slot > 0 && sorted[slot - 1] > value; slot--) {
+                sorted[slot] = sorted[slot - 1];
+            }
+            sorted[slot] = value;
+        }
+        if (count == 0) {
+            return 0.0f;
+        }
+        return count % 2 == 1 ? sorted[count / 2] : 0.5f * (sorted[count / 2 - 1] + sorted[count / 2]);
+    }
+
+    static float getMedian(std::vector<float>& values) {
+        auto middle = values.begin() + values.size() / 2;
+        std::nth_element(values.begin(), middle, values.end());
+        return *middle;
+    }
+
+    ChannelHealthLimits limits;
+
+    std::vector<float> mean;
+    std::vector<float> variance;
+    std::vector<float> stdDev;
+    std::vector<float> railOccupancy;
+    std::vector<uint8_t> impedanceFlags;
+    std::vector<uint8_t> flags;
+    ChannelNeighbours neighbours;
+
+    int64_t updates = 0;
+    float elapsedSeconds = 0.0f;
+    int numFlagged = 0;
+};
+
+#endif /* ChannelHealth_h */
@@ -37,7 +37,7 @@ namespace ColourScheme
      *  Get the color mapping for a given value, with a specific ColourSchemeId and
      *  ignoring the value otherwise stored globally.
      */
-    Colour getColourForNormalizedValueInScheme(float val, ColourSchemeId colourScheme);
+    TESTABLE Colour getColourForNormalizedValueInScheme(float val, ColourSchemeId colourScheme);
 
 
     /**
@@ -45,7 +45,7 @@ namespace ColourScheme
      *  ColourScheme::getColourForNormalizedValue. The default value, if never
      *  set by a user is ColourSchemeId::INFERNO.
      */
-    void setColourScheme(ColourSchemeId colourScheme);
+    TESTABLE void setColourScheme(ColourSchemeId colourScheme);
 };
 
 
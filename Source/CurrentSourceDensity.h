@@ -0,0 +1,128 @@
+//
+//  CurrentSourceDensity.h
+//  ug3-electrode-viewer
+//
+
+#ifndef CurrentSourceDensity_h
+#define CurrentSourceDensity_h
+
+#include "SpatialFilter.h"
+
+/**
+    Current source density estimate over the electrode grid: the negative five-point
+    Laplacian of the voltage, in microvolts per site squared.
+
+    A neighbour that is off the grid, unmapped or flagged is replaced by the centre
+    value (Vaknin's edge correction), so it adds nothing along that axis. Unusable
+    sites have no estimate and read 0.
+
+    When the usable set changes the stencil is compiled into runs of regular interior
+    sites, which get a branch-free loop the compiler can vectorize, and a sparse matrix
+    for the remaining irregular sites.
+*/
+class CurrentSourceDensity {
+public:
+    void setGrid(int cols_, int rows_, const std::vector<uint8_t>& mappedSites) {
+        cols = std::max(0, cols_);
+        rows = std::max(0, rows_);
+        usable.setGrid(cols * rows, mappedSites);
+        output.assign(cols * rows, 0.0f);
+        isDirty = true;
+    }
+
+    int getNumSites() const { return cols * rows; }
+
+    /** Number of sites that need the irregular stencil; for tests and benchmarks */
+    int getNumIrregularSites() const { return int(irregularSites.size()); }
+
+    /** Same conventions as SpatialFilter::apply(); returns one value per grid site */
+    const float* apply(const float* values, int numValues, const uint8_t* flags, int numFlags) {
+        if (getNumSites() == 0 || values == nullptr) {
+            return output.data();
+        }
+
+        if (usable.update(numValues, flags, numFlags) || isDirty) {
+            compile();
+        }
+
+        float* out = output.data();
+        for (const Run& run : regularRuns) {
+            const float* centre = values + run.start;
+            float* result = out + run.start;
+            const float* up = centre - cols;
+            const float* down = centre + cols;
+            for (int k = 0; k < run.length; k++) {
+                result[k] = 4.0f * centre[k] - centre[k - 1] - centre[k + 1] - up[k] - down[k];
+            }
+        }
+
+        irregularStencil.multiply(values, irregularOutput.data());
+        for (size_t i = 0; i < irregularSites.size(); i++) {
+            out[irregularSites[i]] = irregularOutput[i];
+        }
+        return out;
+    }
+
+private:
+    struct Run {
+        int start;
+        int length;
+    };
+
+    void compile() {
+        regularRuns.clear();
+        irregularSites.clear();
+        irregularStencil.clear();
+        std::fill(output.begin(), output.end(), 0.0f);
+
+        for (int y = 0; y < rows; y++) {
+            for (int x = 0; x < cols; x++) {
+                const int site = x + y * cols;
+                if (!usable[site]) {
+                    continue;
+                }
+
+                const bool left = x > 0 && usable[site - 1];
+                const bool right = x < cols - 1 && usable[site + 1];
+                const bool up = y > 0 && usable[site - cols];
+                const bool down = y < rows - 1 && usable[site + cols];
+
+                if (left && right && up && down) {
+                    if (!regularRuns.empty() && regularRuns.back().start + regularRuns.back().length == site) {
+                        regularRuns.back().length++;
+                    }
+                    else {
+                        regularRuns.push_back({ site, 1 });
+                    }
+                    continue;
+                }
+
+                //A missing neighbour takes the centre value, so it drops out and the centre weight shrinks
+                const int numNeighbours = int(left) + int(right) + int(up) + int(down);
+                irregularStencil.add(site, float(numNeighbours));
+                if (left) irregularStencil.add(site - 1, -1.0f);
+                if (right) irregularStencil.add(site + 1, -1.0f);
+                if (up) irregularStencil.add(site - cols, -1.0f);
+                if (down) irregularStencil.add(site + cols, -1.0f);
+                irregularStencil.endRow();
+                irregularSites.push_back(site);
+            }
+        }
+
+        irregularOutput.assign(irregularSites.size(), 0.0f);
+        isDirty = false;
+    }
+
+    int cols = 0;
+    int rows = 0;
+    bool isDirty = true;
+
+    UsableSites usable;
+    std::vector<Run> regularRuns;
+    std::vector<int> irregularSites;
+    SparseMatrix irregularStencil;
+    std::vector<float> irregularOutput;
+    std::vector<float> output;
+};
+
+#endif /* CurrentSourceDensity_h */
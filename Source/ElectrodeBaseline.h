@@ -0,0 +1,91 @@
+//
+//  ElectrodeBaseline.h
+//  ug3-electrode-viewer
+//
+
+#ifndef ElectrodeBaseline_h
+#define ElectrodeBaseline_h
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+/**
+    Exponentially weighted running mean and variance of every electrode, used to
+    show each site as a z-score against its own baseline.
+
+    State is kept as separate mean / variance / z-score arrays so that update()
+    is one straight loop over contiguous floats that the compiler can vectorize.
+*/
+class ElectrodeBaseline {
+public:
+    /** Resizes the state and forgets the baseline; not for the audio thread */
+    void resize(int numElectrodes) {
+        mean.assign(numElectrodes, 0.0f);
+        variance.assign(numElectrodes, 0.0f);
+        zScores.assign(numElectrodes, 0.0f);
+        hasBaseline = false;
+    }
+
+    /** Forgets the baseline; the next update() starts it again from that frame */
+    void reset() {
+        hasBaseline = false;
+    }
+
+    int size() const { return int(mean.size()); }
+
+    /**
+        Adds one frame of values (one per electrode) with weight alpha, using the
+        exponentially weighted form of Welford's update:
+            d = x - mean, mean += alpha * d, variance = (1 - alpha) * (variance + alpha * d * d)
+    */
+    void update(const float* values, float alpha) {
+        const int n = size();
+        float* m = mean.data();
+        float* v = variance.data();
+        float* z = zScores.data();
+
+        if (!hasBaseline) {
+            std::copy(values, values + n, m);
+            std::fill(v, v + n, 0.0f);
+            std::fill(z, z + n, 0.0f);
+            hasBaseline = true;
+            return;
+        }
+
+        const float keep = 1.0f - alpha;
+        for (int i = 0; i < n; i++) {
+            const float d = values[i] - m[i];
+            const float increment = alpha * d;
+            const float newVariance = keep * (v[i] + d * increment);
+            m[i] += increment;
+            v[i] = newVariance;
+            z[i] = d / std::sqrt(newVariance + varianceFloor);
+        }
+    }
+
+    /** Weight of one update of blockSeconds for a baseline with the given time constant */
+    static float getAlpha(float blockSeconds, float timeConstantSeconds) {
+        if (timeConstantSeconds <= 0.0f) {
+            return 1.0f;
+        }
+        return 1.0f - std::exp(-blockSeconds / timeConstantSeconds);
+    }
+
+    const float* getZScores() const { return zScores.data(); }
+
+    const float* getMeans() const { return mean.data(); }
+
+    const float* getVariances() const { return variance.data(); }
+
+private:
+    //Keeps flat sites from dividing by zero; in squared microvolts
+    static constexpr float varianceFloor = 1.0e-6f;
+
+    std::vector<float> mean;
+    std::vector<float> variance;
+    std::vector<float> zScores;
+    bool hasBaseline = false;
+};
+
+#endif /* ElectrodeBaseline_h */
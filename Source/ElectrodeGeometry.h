@@ -0,0 +1,129 @@
+//
+//  ElectrodeGeometry.h
+//  ug3-electrode-viewer
+//
+
+#ifndef ElectrodeGeometry_h
+#define ElectrodeGeometry_h
+
+#include "FrameRasterizer.h"
+
+#include <limits>
+
+/**
+    Where the display puts each electrode. Shared by UG3ElectrodeDisplay and the offline
+    renderer, so frames rendered without the GUI line up with what the canvas shows.
+    The returned layouts have their grid size set; mappedSites is left to the caller.
+*/
+namespace ElectrodeGeometry {
+    const int leftBound = 20;
+    const int topBound = 20;
+    const int spacing = 4;
+    const int siteWidth = 8;
+    const int siteHeight = 8;
+    //Widest or tallest a site layout is drawn, however small its smallest site
+    const int maxSiteLayoutSize = 4096;
+
+    /** A cols x rows raster; layout lists the sites present in ascending order, empty for all of them */
+    inline RenderLayout placeGrid(int cols, int rows, const std::vector<int>& layout) {
+        RenderLayout placement;
+        placement.gridCols = cols;
+        placement.gridRows = rows;
+        size_t layoutIndex = 0;
+        for (int i = 0; i < cols * rows; i++) {
+            if (layout.empty() || (layoutIndex < layout.size() && layout[layoutIndex] == i)) {
+                const int column = i % cols;
+                const int row = i / cols;
+                placement.sites.push_back(juce::Rectangle<int>(leftBound + column * (siteWidth + spacing), topBound + row * (siteHeight + spacing), siteWidth, siteHeight));
+                layoutIndex++;
+            }
+        }
+        placement.fieldBounds = juce::Rectangle<float>(float(leftBound - spacing / 2), float(topBound - spacing / 2),
+                                                       float(cols * (siteWidth + spacing)), float(rows * (siteHeight + spacing)));
+        placement.width = leftBound + cols * (siteWidth + spacing);
+        placement.height = topBound + rows * (siteHeight + spacing) + topBound - spacing;
+        return placement;
+    }
+
+    /** Columns split into probes of probeCols each, with a one site gap between probes; sites are numbered probe by probe */
+    inline RenderLayout placeProbes(int cols, int rows, int probeCols) {
+        if (probeCols <= 0) {
+            return placeGrid(cols, rows, {});
+        }
+        RenderLayout placement;
+        placement.gridCols = cols;
+        placement.gridRows = rows;
+        placement.isProbeLayout = true;
+        const int sitesPerProbe = rows * probeCols;
+        for (int i = 0; i < cols * rows; i++) {
+            const int probeIndex = i / sitesPerProbe;
+            const int column = probeIndex * probeCols + i % probeCols;
+            const int row = (i - probeIndex * sitesPerProbe) / probeCols;
+            placement.sites.push_back(juce::Rectangle<int>(leftBound + (column + probeIndex) * (siteWidth + spacing), topBound + row * (siteHeight + spacing), siteWidth, siteHeight));
+        }
+        const int numProbes = cols / probeCols;
+        placement.fieldBounds = juce::Rectangle<float>(float(leftBound - spacing / 2), float(topBound - spacing / 2),
+                                                       float(cols * (siteWidth + spacing)), float(rows * (siteHeight + spacing)));
+        placement.width = leftBound + (cols + std::max(0, numProbes - 1)) * (siteWidth + spacing);
+        placement.height = topBound + rows * (siteHeight + spacing) + topBound - spacing;
+        return placement;
+    }
+
+    /**
+        Sites at their own coordinates, scaled so the smallest site dimension is siteWidth pixels
+        unless that would make the layout larger than maxSiteLayoutSize; the grid is a single row
+        of them, in visual buffer order
+    */
+    inline RenderLayout placeSites(const std::vector<ElectrodeSite>& sites) {
+        RenderLayout placement;
+        placement.gridCols = int(sites.size());
+        placement.gridRows = sites.empty() ? 0 : 1;
+        placement.isSiteLayout = true;
+        if (sites.empty()) {
+            placement.width = leftBound;
+            placement.height = 2 * topBound - spacing;
+            return placement;
+        }
+
+        float minSize = std::numeric_limits<float>::max();
+        float minX = std::numeric_limits<float>::max();
+        float minY = std::numeric_limits<float>::max();
+        float maxX = std::numeric_limits<float>::lowest();
+        float maxY = std::numeric_limits<float>::lowest();
+        for (const ElectrodeSite& site : sites) {
+            minSize = std::min(minSize, std::min(site.width, site.height));
+            minX = std::min(minX, site.x - 0.5f * site.width);
+            minY = std::min(minY, site.y - 0.5f * site.height);
+            maxX = std::max(maxX, site.x + 0.5f * site.width);
+            maxY = std::max(maxY, site.y + 0.5f * site.height);
+        }
+        //A tiny site far from the others would otherwise ask for an image too big to allocate
+        const float extent = std::max(maxX - minX, maxY - minY);
+        float pixelsPerMicron = minSize > 0.0f ? float(siteWidth) / minSize : 1.0f;
+        if (extent * pixelsPerMicron > float(maxSiteLayoutSize)) {
+            pixelsPerMicron = float(maxSiteLayoutSize) / extent;
+        }
+
+        int right = leftBound;
+        int bottom = topBound;
+        bool hasShapes = false;
+        for (const ElectrodeSite& site : sites) {
+            const int x = leftBound + int(std::lround((site.x - 0.5f * site.width - minX) * pixelsPerMicron));
+            const int y = topBound + int(std::lround((site.y - 0.5f * site.height - minY) * pixelsPerMicron));
+            const juce::Rectangle<int> r(x, y, std::max(1, int(std::lround(site.width * pixelsPerMicron))), std::max(1, int(std::lround(site.height * pixelsPerMicron))));
+            placement.sites.push_back(r);
+            placement.siteShapes.push_back(site.shape);
+            right = std::max(right, r.getRight());
+            bottom = std::max(bottom, r.getBottom());
+            hasShapes |= site.shape != SiteShape::RECTANGLE;
+        }
+        if (!hasShapes) {
+            placement.siteShapes.clear();
+        }
+        placement.width = right + spacing;
+        placement.height = bottom + topBound;
+        return placement;
+    }
+}
+
+#endif /* ElectrodeGeometry_h */
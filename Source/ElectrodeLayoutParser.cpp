@@ -0,0 +1,183 @@
+//
+//  ElectrodeLayoutParser.cpp
+//  ug3-electrode-viewer
+//
+
+#include "ElectrodeLayoutParser.h"
+
+std::map<String, ElectrodeMap> ElectrodeLayoutParser::parse(const DynamicObject::Ptr layoutFileContents) {
+    std::map<String, ElectrodeMap> electrodeMaps;
+    //Loop through all JSON entries; there should be String:Object pairs where the string corresponds to
+    //an acquisition mode and the Objects contain the rows and columns
+    for(const auto & entry : layoutFileContents->getProperties()) {
+        std::optional<int> tempRows;
+        std::optional<int> tempCols;
+        if(!entry.value.isObject()) {
+            continue;
+        }
+
+        //Sites placed at their own coordinates; the visual buffer is then one row of them
+        if(entry.value.getDynamicObject()->hasProperty("sites")
+           && entry.value.getDynamicObject()->getProperty("sites").isArray()) {
+            std::vector<ElectrodeSite> sites;
+            std::unordered_map<ElectrodeMapKey, int> channelMap;
+            parseSites(entry.value.getDynamicObject()->getProperty("sites").getArray(), sites, channelMap);
+            if(sites.empty()) {
+                LOGE("ignoring ", entry.name.toString(), "; none of its sites has a position and a size");
+                continue;
+            }
+            ElectrodeMap newMap(int(sites.size()), 1);
+            newMap.withLayout(std::move(channelMap)).withSites(std::move(sites));
+            electrodeMaps.emplace(entry.name.toString(), newMap);
+            continue;
+        }
+
+        if(entry.value.getDynamicObject()->hasProperty("rows") && entry.value.getDynamicObject()->getProperty("rows").isInt()) {
+            tempRows = entry.value.getDynamicObject()->getProperty("rows");
+        }
+
+        if(entry.value.getDynamicObject()->hasProperty("cols") && entry.value.getDynamicObject()->getProperty("cols").isInt()) {
+            tempCols = entry.value.getDynamicObject()->getProperty("cols");
+        }
+
+        if(tempRows.has_value() && tempCols.has_value()) {
+            std::optional<std::unordered_map<ElectrodeMapKey, int>> channelMap;
+            if(entry.value.getDynamicObject()->hasProperty("map")
+               && entry.value.getDynamicObject()->getProperty("map").isArray()) {
+                channelMap = parseChannelMap(entry.value.getDynamicObject()->getProperty("map").getArray(),
+                                             tempRows.value(),
+                                             tempCols.value());
+            }
+            ElectrodeMap newMap(tempCols.value(), tempRows.value());
+            if(channelMap.has_value() ) {
+                newMap = newMap.withLayout(channelMap.value());
+            }
+
+            //Optional: lay the columns out as separate probes of probeCols columns each
+            if(entry.value.getDynamicObject()->hasProperty("probeCols")
+               && entry.value.getDynamicObject()->getProperty("probeCols").isInt()) {
+                int probeCols = entry.value.getDynamicObject()->getProperty("probeCols");
+                if(probeCols > 0 && tempCols.value() % probeCols == 0) {
+                    newMap = newMap.withProbeColumns(probeCols);
+                }
+                else {
+                    LOGE("ignoring probeCols ", probeCols, " for ", entry.name.toString(), "; it must divide cols");
+                }
+            }
+
+            electrodeMaps.emplace(entry.name.toString(),newMap);
+        }
+    }
+    return electrodeMaps;
+}
+
+String ElectrodeLayoutParser::parseFile(const File& layoutFile, std::map<String, ElectrodeMap>& electrodeMaps) {
+    if(!layoutFile.exists()) {
+        return "tried to load " + layoutFile.getFullPathName() + " but file does not exist!";
+    }
+
+    if(!layoutFile.existsAsFile()) {
+        return "tried to load " + layoutFile.getFullPathName() + " but path is a directory!";
+    }
+
+    var layoutFileResult = JSON::parse(layoutFile);
+    if(layoutFileResult.isVoid() || !layoutFileResult.isObject()) {
+        return "tried to load " + layoutFile.getFullPathName() + " but file format is not valid JSON!";
+    }
+
+    electrodeMaps = parse(layoutFileResult.getDynamicObject());
+    return "";
+}
+
+std::optional<std::unordered_map<ElectrodeMapKey,int>> ElectrodeLayoutParser::parseChannelMap(Array<var>* mappings, int rows, int cols) {
+    std::unordered_map<ElectrodeMapKey, int> ret;
+    for(const auto& coord : *mappings) {
+        std::optional<int> tempX;
+        std::optional<int> tempY;
+
+        if(!coord.isObject()) {
+            continue;
+        }
+
+        if(coord.getProperty("x",var::undefined()).isInt()) {
+            tempX = coord.getProperty("x",0);
+        }
+
+        if(coord.getProperty("y",var::undefined()).isInt()) {
+            tempY = coord.getProperty("y",0);
+        }
+
+        if(tempX.has_value() && tempY.has_value()) {
+            if(!(coord.getProperty("channel",var::undefined()).isString())) {
+                continue;
+            }
+
+            if(!(coord.getProperty("stream",var::undefined()).isString())) {
+                continue;
+            }
+
+            //Add entry to hash table where
+            // K: hash of channel and stream name,
+            // V: serial location within visual buffer using x/y coordinates
+            String channelName = coord.getProperty("channel", "");
+            String streamName = coord.getProperty("stream", "");
+            ElectrodeMapKey key(channelName.toStdString(), streamName.toStdString());
+            ret.emplace(key,tempX.value() + tempY.value() * cols);
+        }
+    }
+
+    if(ret.empty()) {
+        return std::nullopt;
+    }
+    else {
+        return ret;
+    }
+}
+
+namespace {
+    bool isNumber(const var& value) {
+        return value.isInt() || value.isInt64() || value.isDouble();
+    }
+}
+
+void ElectrodeLayoutParser::parseSites(Array<var>* entries, std::vector<ElectrodeSite>& sites, std::unordered_map<ElectrodeMapKey, int>& channelMap) {
+    sites.clear();
+    channelMap.clear();
+    for(const auto& entry : *entries) {
+        if(!entry.isObject() || !isNumber(entry.getProperty("x", var::undefined())) || !isNumber(entry.getProperty("y", var::undefined()))) {
+            continue;
+        }
+
+        ElectrodeSite site;
+        site.x = float(entry.getProperty("x", 0));
+        site.y = float(entry.getProperty("y", 0));
+        if(isNumber(entry.getProperty("size", var::undefined()))) {
+            site.width = site.height = float(entry.getProperty("size", 0));
+        }
+        if(isNumber(entry.getProperty("width", var::undefined())) && isNumber(entry.getProperty("height", var::undefined()))) {
+            site.width = float(entry.getProperty("width", 0));
+            site.height = float(entry.getProperty("height", 0));
+        }
+        if(!(site.width > 0.0f) || !(site.height > 0.0f)) {
+            continue;
+        }
+
+        const String shape = entry.getProperty("shape", "rect").toString();
+        if(shape == "circle") {
+            site.shape = SiteShape::CIRCLE;
+        }
+        else if(shape == "hex") {
+            site.shape = SiteShape::HEXAGON;
+        }
+        else if(shape != "rect") {
+            LOGE("unknown site shape ", shape, "; drawing it as a rectangle");
+        }
+
+        if(entry.getProperty("channel", var::undefined()).isString() && entry.getProperty("stream", var::undefined()).isString()) {
+            String channelName = entry.getProperty("channel", "");
+            String streamName = entry.getProperty("stream", "");
+            channelMap.emplace(ElectrodeMapKey(channelName.toStdString(), streamName.toStdString()), int(sites.size()));
+        }
+        sites.push_back(site);
+    }
+}
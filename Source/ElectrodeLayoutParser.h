@@ -0,0 +1,42 @@
+//
+//  ElectrodeLayoutParser.h
+//  ug3-electrode-viewer
+//
+
+#ifndef ElectrodeLayoutParser_h
+#define ElectrodeLayoutParser_h
+
+#include <ProcessorHeaders.h>
+
+#include "ElectrodeMap.h"
+
+#include <map>
+#include <optional>
+#include <unordered_map>
+
+/**
+    Reads electrode layout files: a JSON object with one entry per acquisition capability,
+    each holding "rows", "cols" and optionally "probeCols" and a channel "map" of
+    {x, y, channel, stream} objects. Used by the processor and by the offline renderer.
+
+    Arrays that aren't grids give a "sites" array instead of rows and cols: one
+    {x, y, shape, size, channel, stream} object per electrode, in visual buffer order.
+    x and y are the site's centre in micrometres, y pointing down; shape is "rect"
+    (the default), "circle" or "hex"; size is the diameter, or width and height can be
+    given instead. channel and stream are optional, an electrode without them is unmapped.
+*/
+namespace ElectrodeLayoutParser {
+    /** One map per capability entry that has rows and cols, or a "sites" array with at least one usable site; other entries are skipped */
+    std::map<String, ElectrodeMap> parse(const DynamicObject::Ptr layoutFileContents);
+
+    /** Reads and parses a layout file; returns an empty string on success or why it couldn't be read */
+    String parseFile(const File& layoutFile, std::map<String, ElectrodeMap>& electrodeMaps);
+
+    /** Visual buffer index of every mapped channel, or nothing if no entry is usable */
+    std::optional<std::unordered_map<ElectrodeMapKey, int>> parseChannelMap(Array<var>* mappings, int rows, int cols);
+
+    /** Geometry of every usable entry in order, and the visual buffer index of each one naming a channel */
+    void parseSites(Array<var>* entries, std::vector<ElectrodeSite>& sites, std::unordered_map<ElectrodeMapKey, int>& channelMap);
+}
+
+#endif /* ElectrodeLayoutParser_h */
@@ -8,6 +8,10 @@
 #include <map>
 #include <utility>
 #include <string>
+#include <vector>
+#include <cstdint>
+
+#include "ElectrodeSite.h"
 
 struct ElectrodeMapKey {
 
@@ -43,6 +47,27 @@ public:
         return *this;
     }
 
+    //Splits the columns into probes of probeColumns each; 0 means a plain grid
+    ElectrodeMap& withProbeColumns(int probeColumns) {
+        m_probeColumns = probeColumns;
+        return *this;
+    }
+
+    int getProbeColumns() const {
+        return m_probeColumns;
+    }
+
+    //Places each visual buffer index at its own coordinates instead of on the grid
+    ElectrodeMap& withSites(std::vector<ElectrodeSite> sites) {
+        m_sites = std::move(sites);
+        return *this;
+    }
+
+    //empty for grids and probes
+    const std::vector<ElectrodeSite>& getSites() const {
+        return m_sites;
+    }
+
     //returns dimension of map, columns (max x) and rows (max y)
     std::pair<int,int> getDimensions() const {
         return {m_cols, m_rows};
@@ -52,6 +77,18 @@ public:
         return m_layoutMapping.size() > 0;
     }
 
+    //one entry per grid site (row major), non-zero where a channel is mapped; every site without a map
+    std::vector<uint8_t> getMappedSites() const {
+        const int numSites = m_cols * m_rows;
+        std::vector<uint8_t> sites(numSites, m_layoutMapping.empty() ? 1 : 0);
+        for (const auto& mapping : m_layoutMapping) {
+            if (mapping.second >= 0 && mapping.second < numSites) {
+                sites[mapping.second] = 1;
+            }
+        }
+        return sites;
+    }
+
     std::optional<int>  getChannelMapping(std::string channelName, std::string streamName) {
         ElectrodeMapKey key(channelName,streamName);
         auto mapping = m_layoutMapping.find(key);
@@ -64,6 +101,8 @@ public:
 private:
     int m_cols;
     int m_rows;
+    int m_probeColumns = 0;
+    std::vector<ElectrodeSite> m_sites;
     std::unordered_map<ElectrodeMapKey, int> m_layoutMapping;
 };
 
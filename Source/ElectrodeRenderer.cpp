@@ -0,0 +1,168 @@
+//
+//  ElectrodeRenderer.cpp
+//  ug3-electrode-viewer
+//
+
+#include "ElectrodeRenderer.h"
+#include "UG3ElectrodeViewer.h"
+#include "UG3ElectrodeViewerCanvas.h"
+#include "Instrumentation.h"
+
+ElectrodeRenderer::ElectrodeRenderer(UG3ElectrodeViewer* node, UG3ElectrodeViewerCanvas* canvas) : Thread("UG3 Renderer"), node(node), canvas(canvas), hasPendingSettings(false), hasPendingLayout(false), hasReadyFrame(false), lastFrameSeconds(0.0) {
+    spatialFilter.setSigma(smoothingSigma);
+}
+
+ElectrodeRenderer::~ElectrodeRenderer() {
+    cancelPendingUpdate();
+    stopThread(1000);
+}
+
+void ElectrodeRenderer::setSettings(const RenderSettings& settings_) {
+    const ScopedLock sl(pendingLock);
+    pendingSettings = settings_;
+    hasPendingSettings = true;
+}
+
+void ElectrodeRenderer::setLayout(const RenderLayout& layout_) {
+    {
+        const ScopedLock sl(pendingLock);
+        pendingLayout = layout_;
+        hasPendingLayout = true;
+    }
+    {
+        const ScopedLock sl(frameLock);
+        hasReadyFrame = false;
+    }
+    frontFrame = Image();
+}
+
+void ElectrodeRenderer::requestFrame() {
+    notify();
+}
+
+void ElectrodeRenderer::renderNow() {
+    renderFrame();
+}
+
+void ElectrodeRenderer::drawLatestFrame(Graphics& g) {
+    {
+        const ScopedLock sl(frameLock);
+        if (hasReadyFrame) {
+            std::swap(frontFrame, readyFrame);
+            hasReadyFrame = false;
+        }
+    }
+    if (frontFrame.isValid()) {
+        g.drawImageAt(frontFrame, 0, 0);
+    }
+}
+
+RenderedRange ElectrodeRenderer::getRange() const {
+    const ScopedLock sl(frameLock);
+    return readyRange;
+}
+
+void ElectrodeRenderer::run() {
+    while (!threadShouldExit()) {
+        //Requests made while a frame is being rendered leave the event signalled, so they become one frame
+        if (!wait(100)) {
+            continue;
+        }
+        renderFrame();
+        triggerAsyncUpdate();
+    }
+}
+
+void ElectrodeRenderer::handleAsyncUpdate() {
+    canvas->renderedFrameReady();
+}
+
+void ElectrodeRenderer::applyPendingChanges() {
+    const ScopedLock sl(pendingLock);
+    bool isCsdGridStale = false;
+
+    if (hasPendingLayout) {
+        layout = pendingLayout;
+        hasPendingLayout = false;
+        spatialFilter.setGrid(layout.gridCols, layout.gridRows, layout.mappedSites);
+        isCsdGridStale = true;
+    }
+
+    if (hasPendingSettings) {
+        //A new kind of value doesn't share the old range
+        if (pendingSettings.isImpedanceOn != settings.isImpedanceOn || pendingSettings.isAutoRangeOn != settings.isAutoRangeOn ||
+            pendingSettings.isShowingZScores() != settings.isShowingZScores() || pendingSettings.isShowingCsd() != settings.isShowingCsd() ||
+            pendingSettings.isShowingImpedanceTrend() != settings.isShowingImpedanceTrend() || pendingSettings.impedanceView != settings.impedanceView) {
+            autoRange.reset();
+        }
+        isCsdGridStale |= pendingSettings.isSmoothingOn != settings.isSmoothingOn;
+        settings = pendingSettings;
+        hasPendingSettings = false;
+    }
+
+    //Smoothing fills every site, so the CSD then treats the whole grid as usable
+    if (isCsdGridStale) {
+        csd.setGrid(layout.gridCols, layout.gridRows, settings.isSmoothingOn ? std::vector<uint8_t>() : layout.mappedSites);
+    }
+}
+
+void ElectrodeRenderer::renderFrame() {
+    const ScopedLock sl(renderLock);
+    UG3_TIME_SCOPE(DISPLAY_REFRESH);
+    const auto start = std::chrono::steady_clock::now();
+
+    applyPendingChanges();
+
+    const float* values;
+    int numValues;
+    if (settings.isShowingImpedanceTrend()) {
+        //The rates are recomputed on the message thread, so work from a copy
+        node->copyImpedanceChangeRates(impedanceViewValues);
+        values = impedanceViewValues.data();
+        numValues = int(impedanceViewValues.size());
+    }
+    else if (settings.isImpedanceOn) {
+        //A copy of one plane, so switching views never goes back to the source
+        node->copyImpedanceView(settings.impedanceView, settings.impedanceFrequency, impedanceViewValues);
+        values = impedanceViewValues.data();
+        numValues = int(impedanceViewValues.size());
+    }
+    else if (settings.isShowingZScores()) {
+        values = node->getZScores();
+        numValues = node->getNumZScores();
+    }
+    else {
+        values = node->getLatestValues();
+        numValues = node->getNumLatestValues();
+    }
+
+    const uint8_t* flags = node->getChannelHealthFlags();
+    const int numFlags = node->getNumChannelHealthFlags();
+
+    //Smoothing and CSD need grid neighbours, which sites placed by coordinate don't have
+    if (settings.isSmoothingOn && !layout.isSiteLayout) {
+        values = spatialFilter.apply(values, numValues, flags, numFlags);
+        numValues = spatialFilter.getNumSites();
+    }
+
+    if (settings.isShowingCsd() && !layout.isSiteLayout) {
+        values = settings.isSmoothingOn ? csd.apply(values, numValues, nullptr, 0) : csd.apply(values, numValues, flags, numFlags);
+        numValues = csd.getNumSites();
+    }
+
+    const int numSites = std::min(numValues, int(layout.sites.size()));
+    if (settings.isAutoRangeOn && numSites > 0) {
+        //Flagged channels are left out of the auto range
+        autoRange.update(values, numSites, numFlags >= numSites ? flags : nullptr);
+    }
+
+    const RenderedRange range = FrameRasterizer::getDrawingRange(settings, autoRange);
+    rasterizer.setNumThreads(node->getRenderThreads());
+    rasterizer.rasterize(backBuffer, layout, settings, range, values, numValues, flags, numFlags);
+    lastFrameSeconds.store(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count(), std::memory_order_relaxed);
+
+    const ScopedLock fl(frameLock);
+    std::swap(readyFrame, backBuffer);
+    hasReadyFrame = true;
+    readyRange = range;
+}
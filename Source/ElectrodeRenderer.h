@@ -0,0 +1,117 @@
+//
+//  ElectrodeRenderer.h
+//  ug3-electrode-viewer
+//
+
+#ifndef ElectrodeRenderer_h
+#define ElectrodeRenderer_h
+
+#include <VisualizerWindowHeaders.h>
+
+#include "FrameRasterizer.h"
+#include "QuantileSketch.h"
+#include "SpatialFilter.h"
+#include "CurrentSourceDensity.h"
+
+class UG3ElectrodeViewer;
+
+class UG3ElectrodeViewerCanvas;
+
+/**
+    Turns the processor's latest values into a picture of the electrode grid off the
+    message thread. Each frame pulls the values, runs the selected transforms, maps
+    them to colours and rasterizes the sites into a back buffer, which is then swapped
+    into the ready slot. The display's paint only blits the newest ready frame.
+
+    While acquisition runs, frames are rendered on this thread. A request that arrives
+    while a frame is in progress is folded into the next frame, and a ready frame the
+    message thread hasn't painted yet is simply replaced, so a busy UI drops frames
+    rather than queueing them. When acquisition is stopped, renderNow() renders on the
+    calling thread instead.
+*/
+class ElectrodeRenderer : public Thread, private AsyncUpdater {
+public:
+    ElectrodeRenderer(UG3ElectrodeViewer* node, UG3ElectrodeViewerCanvas* canvas);
+
+    ~ElectrodeRenderer() override;
+
+    //z-scores are drawn from -zScoreRange to +zScoreRange unless auto range is on
+    static constexpr float zScoreRange = FrameRasterizer::zScoreRange;
+
+    static constexpr float trendRange = FrameRasterizer::trendRange;
+
+    static constexpr float phaseRange = FrameRasterizer::phaseRange;
+
+    static constexpr float capacitanceRange = FrameRasterizer::capacitanceRange;
+
+    /** Applies from the next frame */
+    void setSettings(const RenderSettings& settings);
+
+    /** Applies from the next frame; the current frame is discarded as it no longer lines up */
+    void setLayout(const RenderLayout& layout);
+
+    /** Asks the render thread for a new frame; requests made while it is busy are merged */
+    void requestFrame();
+
+    /** Renders a frame on the calling thread, waiting for the render thread if it is mid-frame */
+    void renderNow();
+
+    /** Draws the newest finished frame at the origin; message thread only */
+    void drawLatestFrame(Graphics& g);
+
+    /** Range the newest finished frame was drawn with */
+    RenderedRange getRange() const;
+
+    /** Time the newest finished frame took to render */
+    double getLastFrameSeconds() const {
+        return lastFrameSeconds.load(std::memory_order_relaxed);
+    }
+
+    void run() override;
+
+private:
+    void handleAsyncUpdate() override;
+
+    /** Picks up new settings or layout; called with renderLock held */
+    void applyPendingChanges();
+
+    void renderFrame();
+
+    UG3ElectrodeViewer* node;
+    UG3ElectrodeViewerCanvas* canvas;
+
+    //Handed over from the message thread
+    CriticalSection pendingLock;
+    RenderSettings pendingSettings;
+    bool hasPendingSettings;
+    RenderLayout pendingLayout;
+    bool hasPendingLayout;
+
+    //Held for a whole frame so the thread and renderNow() never render at once
+    CriticalSection renderLock;
+    RenderSettings settings;
+    RenderLayout layout;
+    AutoRange autoRange;
+    SpatialFilter spatialFilter;
+    CurrentSourceDensity csd;
+    std::vector<float> impedanceViewValues;
+    FrameRasterizer rasterizer;
+    Image backBuffer;
+
+    //Finished frames; the ready frame is swapped into the front frame when painted
+    mutable CriticalSection frameLock;
+    Image readyFrame;
+    bool hasReadyFrame;
+    RenderedRange readyRange;
+    std::atomic<double> lastFrameSeconds;
+
+    //Message thread only
+    Image frontFrame;
+
+    //Gaussian width of the smoothing, in electrode sites
+    static constexpr float smoothingSigma = 1.0f;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(ElectrodeRenderer);
+};
+
+#endif /* ElectrodeRenderer_h */
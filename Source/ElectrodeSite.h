@@ -0,0 +1,60 @@
+//
+//  ElectrodeSite.h
+//  ug3-electrode-viewer
+//
+
+#ifndef ElectrodeSite_h
+#define ElectrodeSite_h
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+enum class SiteShape : uint8_t {
+    RECTANGLE,
+    //An ellipse filling the site's box
+    CIRCLE,
+    //Pointy-topped, so the rows of a hexagonal array interlock
+    HEXAGON
+};
+
+/** One electrode of a layout that isn't a grid, placed where the layout file says; micrometres, y pointing down */
+struct ElectrodeSite {
+    float x = 0.0f;
+    float y = 0.0f;
+    float width = 0.0f;
+    float height = 0.0f;
+    SiteShape shape = SiteShape::RECTANGLE;
+};
+
+/**
+    Pixels [left, right) of row of a width x height box that are inside shape, relative to the
+    box; left == right when the row misses it. Drawing and hit testing both go through this,
+    so a site is exactly the pixels it is drawn on.
+*/
+inline void getSiteSpan(SiteShape shape, int width, int height, int row, int& left, int& right) {
+    left = 0;
+    right = width;
+    if (shape == SiteShape::RECTANGLE || row < 0 || row >= height) {
+        return;
+    }
+    const float halfHeight = 0.5f * float(height);
+    //Distance of the pixel centre from the middle row, as a fraction of the half height
+    const float dy = std::abs(float(row) + 0.5f - halfHeight) / halfHeight;
+    float halfSpan;
+    if (shape == SiteShape::CIRCLE) {
+        halfSpan = dy < 1.0f ? std::sqrt(1.0f - dy * dy) : 0.0f;
+    }
+    else {
+        //The flat sides cover the middle half, then the width narrows linearly to the points
+        halfSpan = dy <= 0.5f ? 1.0f : std::max(0.0f, 2.0f * (1.0f - dy));
+    }
+    halfSpan *= 0.5f * float(width);
+    //A pixel is inside when its centre is, which keeps the span symmetric
+    const float centre = 0.5f * float(width) - 0.5f;
+    left = std::max(0, int(std::ceil(centre - halfSpan)));
+    right = std::min(width, int(std::floor(centre + halfSpan)) + 1);
+    right = std::max(left, right);
+}
+
+#endif /* ElectrodeSite_h */
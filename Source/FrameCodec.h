@@ -0,0 +1,174 @@
+//
+//  FrameCodec.h
+//  ug3-electrode-viewer
+//
+
+#ifndef FrameCodec_h
+#define FrameCodec_h
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+/**
+    Wire format of the frame server. Each message is a fixed header followed by a
+    payload; all integers are little-endian.
+
+        offset  0  uint32  magic "U3F2"
+        offset  4  uint32  frame sequence number
+        offset  8  uint32  number of values
+        offset 12  uint32  flags; bit 0 set for a key frame
+        offset 16  uint32  payload bytes
+        offset 20  uint16  grid columns
+        offset 22  uint16  grid rows
+        offset 24  int64   first sample number of the block
+
+    The payload is the frame's float bit patterns XORed with the previous frame the
+    receiver decoded (with zeros for a key frame), coded Gorilla-style by the zero bytes
+    at either end of each XOR word. It starts with one 4-bit descriptor per value, two to
+    a byte with the first value in the low nibble: 15 is an unchanged word, anything else
+    is 4 * leading zero bytes + trailing zero bytes. The bytes in between of every
+    changed word follow, in value order, least significant first. A value that moves
+    within its exponent keeps its sign and exponent byte, and quantized samples add
+    trailing zero bytes, so noisy live frames shrink as well as static ones; the coding
+    is lossless.
+*/
+namespace FrameCodec {
+    //"U3F2"; the first version of the format ran-length coded whole words
+    const uint32_t magic = 0x32463355;
+    const int headerBytes = 32;
+    const uint32_t keyFrameFlag = 1;
+
+    struct MessageHeader {
+        uint32_t sequence = 0;
+        uint32_t numValues = 0;
+        int cols = 0;
+        int rows = 0;
+        bool isKeyFrame = false;
+        uint32_t payloadBytes = 0;
+        int64_t sampleNumber = 0;
+    };
+
+    namespace detail {
+        inline void writeU32(uint8_t* out, uint32_t value) {
+            for (int i = 0; i < 4; i++) {
+                out[i] = uint8_t(value >> (8 * i));
+            }
+        }
+
+        inline uint32_t readU32(const uint8_t* in) {
+            return uint32_t(in[0]) | uint32_t(in[1]) << 8 | uint32_t(in[2]) << 16 | uint32_t(in[3]) << 24;
+        }
+
+        inline uint32_t getBits(float value) {
+            uint32_t bits;
+            std::memcpy(&bits, &value, sizeof(bits));
+            return bits;
+        }
+
+        const uint8_t unchangedWord = 15;
+
+        /** Descriptor of a XOR word, see the format description */
+        inline uint8_t getDescriptor(uint32_t word) {
+            if (word == 0) {
+                return unchangedWord;
+            }
+            int leading = 0;
+            while (leading < 3 && (word >> (24 - 8 * leading)) == 0) {
+                leading++;
+            }
+            int trailing = 0;
+            while (leading + trailing < 3 && ((word >> (8 * trailing)) & 0xff) == 0) {
+                trailing++;
+            }
+            return uint8_t(4 * leading + trailing);
+        }
+
+        /** Bytes a descriptor is followed by, or -1 if it can't come from getDescriptor() */
+        inline int getNumBytes(uint8_t descriptor) {
+            if (descriptor == unchangedWord) {
+                return 0;
+            }
+            const int numBytes = 4 - descriptor / 4 - descriptor % 4;
+            return numBytes > 0 ? numBytes : -1;
+        }
+    }
+
+    /** Appends the message for frame to out; previous is the frame the receiver last decoded, or nullptr for a key frame */
+    inline void encode(const float* frame, const float* previous, int numValues, int cols, int rows, uint32_t sequence, int64_t sampleNumber, std::vector<uint8_t>& out) {
+        using namespace detail;
+        const size_t start = out.size();
+        numValues = std::max(0, numValues);
+        const size_t descriptors = start + headerBytes;
+        out.resize(descriptors + (size_t(numValues) + 1) / 2, 0);
+
+        for (int i = 0; i < numValues; i++) {
+            const uint32_t word = getBits(frame[i]) ^ (previous != nullptr ? getBits(previous[i]) : 0u);
+            const uint8_t descriptor = getDescriptor(word);
+            out[descriptors + i / 2] |= uint8_t(descriptor << (4 * (i % 2)));
+            const int trailing = descriptor % 4;
+            for (int byte = 0; byte < getNumBytes(descriptor); byte++) {
+                out.push_back(uint8_t(word >> (8 * (trailing + byte))));
+            }
+        }
+
+        uint8_t* header = &out[start];
+        writeU32(header, magic);
+        writeU32(header + 4, sequence);
+        writeU32(header + 8, uint32_t(numValues));
+        writeU32(header + 12, previous == nullptr ? keyFrameFlag : 0);
+        writeU32(header + 16, uint32_t(out.size() - start - headerBytes));
+        writeU32(header + 20, uint32_t(std::clamp(cols, 0, 0xffff)) | uint32_t(std::clamp(rows, 0, 0xffff)) << 16);
+        writeU32(header + 24, uint32_t(uint64_t(sampleNumber)));
+        writeU32(header + 28, uint32_t(uint64_t(sampleNumber) >> 32));
+    }
+
+    /** Reads a header; returns false if the magic doesn't match */
+    inline bool readHeader(const uint8_t* data, MessageHeader& header) {
+        using namespace detail;
+        if (readU32(data) != magic) {
+            return false;
+        }
+        header.sequence = readU32(data + 4);
+        header.numValues = readU32(data + 8);
+        header.cols = int(readU32(data + 20) & 0xffff);
+        header.rows = int(readU32(data + 20) >> 16);
+        header.isKeyFrame = (readU32(data + 12) & keyFrameFlag) != 0;
+        header.payloadBytes = readU32(data + 16);
+        header.sampleNumber = int64_t(uint64_t(readU32(data + 24)) | uint64_t(readU32(data + 28)) << 32);
+        return true;
+    }
+
+    /** Decodes a payload into frame, which must hold the previously decoded frame unless this is a key frame */
+    inline bool decodePayload(const uint8_t* payload, const MessageHeader& header, std::vector<float>& frame) {
+        using namespace detail;
+        if (header.isKeyFrame) {
+            frame.assign(header.numValues, 0.0f);
+        }
+        else if (frame.size() != header.numValues) {
+            return false;
+        }
+
+        size_t position = (size_t(header.numValues) + 1) / 2;
+        if (position > header.payloadBytes) {
+            return false;
+        }
+        for (uint32_t i = 0; i < header.numValues; i++) {
+            const uint8_t descriptor = uint8_t((payload[i / 2] >> (4 * (i % 2))) & 0xf);
+            const int numBytes = getNumBytes(descriptor);
+            if (numBytes < 0 || position + numBytes > header.payloadBytes) {
+                return false;
+            }
+            uint32_t word = 0;
+            for (int byte = 0; byte < numBytes; byte++) {
+                word |= uint32_t(payload[position++]) << (8 * (descriptor % 4 + byte));
+            }
+            const uint32_t bits = getBits(frame[i]) ^ word;
+            std::memcpy(&frame[i], &bits, sizeof(bits));
+        }
+        return position == header.payloadBytes;
+    }
+}
+
+#endif /* FrameCodec_h */
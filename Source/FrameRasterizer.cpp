@@ -0,0 +1,231 @@
+//
+//  FrameRasterizer.cpp
+//  ug3-electrode-viewer
+//
+
+#include "FrameRasterizer.h"
+#include "ColourScheme.h"
+#include "ChannelHealth.h"
+#include "Instrumentation.h"
+
+#include <cmath>
+
+const int FrameRasterizer::maxThreads = 64;
+const int FrameRasterizer::tilesPerThread = 4;
+
+FrameRasterizer::FrameRasterizer() : idleColour(ColourScheme::getColourForNormalizedValue(.9)), maskedColour(Colours::black) {}
+
+void FrameRasterizer::setNumThreads(int numThreads) {
+    numThreads = jlimit(1, maxThreads, numThreads);
+    if (numThreads == getNumThreads()) {
+        return;
+    }
+    pool.reset();
+    if (numThreads > 1) {
+        pool = std::make_unique<TilePool>(numThreads);
+    }
+}
+
+void FrameRasterizer::forEachTile(int numTiles, const std::function<void(int)>& tileFunction) {
+    if (pool != nullptr) {
+        pool->run(numTiles, tileFunction);
+        return;
+    }
+    for (int tile = 0; tile < numTiles; tile++) {
+        tileFunction(tile);
+    }
+}
+
+void FrameRasterizer::binSitesIntoBands(const RenderLayout& layout, int height, int bandHeight, int numBands) {
+    bandSites.resize(numBands);
+    for (std::vector<int>& sites : bandSites) {
+        sites.clear();
+    }
+    for (int i = 0; i < int(layout.sites.size()); i++) {
+        const juce::Rectangle<int>& r = layout.sites[i];
+        if (r.getBottom() <= 0 || r.getY() >= height || r.isEmpty()) {
+            continue;
+        }
+        const int lastBand = (std::min(height, r.getBottom()) - 1) / bandHeight;
+        for (int band = std::max(0, r.getY()) / bandHeight; band <= lastBand; band++) {
+            bandSites[band].push_back(i);
+        }
+    }
+}
+
+RenderedRange FrameRasterizer::getDrawingRange(const RenderSettings& settings, const AutoRange& autoRange) {
+    RenderedRange range;
+    range.isValid = true;
+    if (settings.isAutoRangeOn) {
+        range.isValid = autoRange.isValid();
+        range.lower = autoRange.getLower();
+        range.upper = autoRange.getUpper();
+        if (settings.isZeroCentered || settings.isShowingZScores() || settings.isShowingCsd() || settings.isShowingImpedanceTrend()) {
+            range.upper = std::max(std::abs(range.lower), std::abs(range.upper));
+            range.lower = -range.upper;
+        }
+    }
+    else if (settings.isShowingZScores()) {
+        range.lower = -zScoreRange;
+        range.upper = zScoreRange;
+    }
+    else if (settings.isShowingImpedanceTrend()) {
+        range.lower = -trendRange;
+        range.upper = trendRange;
+    }
+    else if (settings.isShowingImpedanceView(ImpedanceView::PHASE)) {
+        range.lower = -phaseRange;
+        range.upper = phaseRange;
+    }
+    else if (settings.isShowingImpedanceView(ImpedanceView::FIT_CAPACITANCE)) {
+        range.lower = 0.0f;
+        range.upper = capacitanceRange;
+    }
+    else {
+        //CSD is signed, so it is always drawn about zero
+        range.upper = float(settings.scaleFactor);
+        range.lower = settings.isZeroCentered || settings.isShowingCsd() ? -range.upper : 0.0f;
+    }
+    return range;
+}
+
+void FrameRasterizer::rasterize(Image& target, const RenderLayout& layout, const RenderSettings& settings, const RenderedRange& range,
+                                const float* values, int numValues, const uint8_t* flags, int numFlags) {
+    const int numSites = int(layout.sites.size());
+    siteColours.resize(numSites);
+    const int numTiles = getNumThreads() > 1 ? getNumThreads() * tilesPerThread : 1;
+    {
+        UG3_TIME_SCOPE(COLOUR_MAPPING);
+        //The fixed scales keep their own normalization so colours match the scale labels exactly
+        const bool isFixedScale = !settings.isAutoRangeOn && settings.isShowingScaledValues();
+        const bool isZeroCentered = settings.isZeroCentered || settings.isShowingCsd();
+        const float scaleFactor = float(settings.scaleFactor);
+        const float scale = range.upper > range.lower ? 1.0f / (range.upper - range.lower) : 0.0f;
+        forEachTile(numTiles, [&](int tile) {
+            const int end = int(int64(numSites) * (tile + 1) / numTiles);
+            for (int i = int(int64(numSites) * tile / numTiles); i < end; i++) {
+                //NaN marks an impedance that wasn't measured or couldn't be fitted
+                if (i >= numValues || std::isnan(values[i])) {
+                    siteColours[i] = idleColour;
+                    continue;
+                }
+                float normalizedValue;
+                if (!isFixedScale) {
+                    normalizedValue = (values[i] - range.lower) * scale;
+                }
+                else if (isZeroCentered) {
+                    normalizedValue = values[i] / (2.0f * scaleFactor) + 0.5f;
+                }
+                else {
+                    normalizedValue = values[i] / scaleFactor;
+                }
+                siteColours[i] = ColourScheme::getColourForNormalizedValue(normalizedValue);
+            }
+        });
+    }
+
+    const int width = std::max(1, layout.width);
+    const int height = std::max(1, layout.height);
+    if (target.getWidth() != width || target.getHeight() != height) {
+        target = Image(Image::RGB, width, height, false, SoftwareImageType());
+    }
+    target.clear(target.getBounds(), Colours::darkgrey);
+
+    const bool drawField = settings.isSmoothingOn && !layout.isProbeLayout && !layout.isSiteLayout && numSites > 0 && numSites == layout.gridCols * layout.gridRows;
+    if (drawField) {
+        Graphics g(target);
+        paintContinuousField(g, layout);
+        return;
+    }
+
+    {
+        Image::BitmapData pixels(target, Image::BitmapData::writeOnly);
+        const bool hasShapes = layout.siteShapes.size() == layout.sites.size();
+        auto fillSite = [&](int i, const juce::Rectangle<int>& clip) {
+            const juce::Rectangle<int>& site = layout.sites[i];
+            const juce::Rectangle<int> r = site.getIntersection(clip);
+            const Colour colour = siteColours[i];
+            const SiteShape shape = hasShapes ? layout.siteShapes[i] : SiteShape::RECTANGLE;
+            for (int y = r.getY(); y < r.getBottom(); y++) {
+                //Shaped sites are drawn one span per row, so they cost no more than rectangles
+                int left, right;
+                getSiteSpan(shape, site.getWidth(), site.getHeight(), y - site.getY(), left, right);
+                const int end = std::min(r.getRight(), site.getX() + right);
+                for (int x = std::max(r.getX(), site.getX() + left); x < end; x++) {
+                    pixels.setPixelColour(x, y, colour);
+                }
+            }
+        };
+
+        if (numTiles == 1) {
+            for (int i = 0; i < numSites; i++) {
+                fillSite(i, target.getBounds());
+            }
+        }
+        else {
+            //Each band only writes its own rows, so sites that straddle two bands are drawn half by each
+            const int bandHeight = (height + numTiles - 1) / numTiles;
+            binSitesIntoBands(layout, height, bandHeight, numTiles);
+            forEachTile(numTiles, [&](int band) {
+                const juce::Rectangle<int> clip(0, band * bandHeight, width, bandHeight);
+                for (int i : bandSites[band]) {
+                    fillSite(i, clip);
+                }
+            });
+        }
+    }
+
+    bool hasMaskedSites = false;
+    for (int i = 0; i < std::min(numSites, numFlags) && flags != nullptr && !hasMaskedSites; i++) {
+        hasMaskedSites = flags[i] != HEALTHY;
+    }
+
+    if (hasMaskedSites) {
+        //Flagged channels get a crossed-out mask so they can't be mistaken for a colour on the scale
+        Graphics g(target);
+        const bool hasShapes = layout.siteShapes.size() == layout.sites.size();
+        for (int i = 0; i < std::min(numSites, numFlags); i++) {
+            if (flags[i] == HEALTHY) {
+                continue;
+            }
+            const juce::Rectangle<int>& site = layout.sites[i];
+            const SiteShape shape = hasShapes ? layout.siteShapes[i] : SiteShape::RECTANGLE;
+            //The mask covers the same spans as the fill, so it doesn't spill into the gaps between shaped sites
+            RectangleList<int> spans;
+            for (int row = 0; row < site.getHeight() && shape != SiteShape::RECTANGLE; row++) {
+                int left, right;
+                getSiteSpan(shape, site.getWidth(), site.getHeight(), row, left, right);
+                spans.addWithoutMerging(juce::Rectangle<int>(site.getX() + left, site.getY() + row, right - left, 1));
+            }
+            Graphics::ScopedSaveState state(g);
+            if (shape != SiteShape::RECTANGLE) {
+                g.reduceClipRegion(spans);
+            }
+            const juce::Rectangle<float> r = site.toFloat();
+            g.setColour(maskedColour);
+            g.fillRect(r);
+            g.setColour(Colours::red);
+            g.drawLine(r.getX(), r.getY(), r.getRight(), r.getBottom(), 1.0f);
+            g.drawLine(r.getX(), r.getBottom(), r.getRight(), r.getY(), 1.0f);
+        }
+    }
+}
+
+void FrameRasterizer::paintContinuousField(Graphics& g, const RenderLayout& layout) {
+    const int cols = layout.gridCols;
+    const int rows = layout.gridRows;
+    if (fieldImage.getWidth() != cols || fieldImage.getHeight() != rows) {
+        fieldImage = Image(Image::RGB, cols, rows, false, SoftwareImageType());
+    }
+
+    {
+        Image::BitmapData pixels(fieldImage, Image::BitmapData::writeOnly);
+        for (int i = 0; i < cols * rows; i++) {
+            pixels.setPixelColour(i % cols, i / cols, siteColours[i]);
+        }
+    }
+
+    //One pixel per site, stretched so that each pixel centre lands on its electrode's centre
+    g.setImageResamplingQuality(Graphics::mediumResamplingQuality);
+    g.drawImage(fieldImage, layout.fieldBounds);
+}
@@ -0,0 +1,145 @@
+//
+//  FrameRasterizer.h
+//  ug3-electrode-viewer
+//
+
+#ifndef FrameRasterizer_h
+#define FrameRasterizer_h
+
+#include <VisualizerWindowHeaders.h>
+
+#include "QuantileSketch.h"
+#include "ImpedanceSpectra.h"
+#include "ElectrodeSite.h"
+#include "TilePool.h"
+
+#include <memory>
+
+/** The display modes that change how a frame is computed and coloured */
+struct RenderSettings {
+    bool isImpedanceOn = false;
+    bool isZeroCentered = false;
+    int scaleFactor = 0;
+    bool isAutoRangeOn = false;
+    bool isZScoreOn = false;
+    bool isSmoothingOn = false;
+    bool isCsdOn = false;
+    bool isImpedanceTrendOn = false;
+    ImpedanceView impedanceView = ImpedanceView::MAGNITUDE;
+    //index into the impedance spectra's frequencies, for the magnitude and phase views
+    int impedanceFrequency = 0;
+
+    bool isShowingCsd() const { return isCsdOn && !isImpedanceOn; }
+
+    bool isShowingImpedanceTrend() const { return isImpedanceTrendOn && isImpedanceOn; }
+
+    bool isShowingImpedanceView(ImpedanceView view) const { return isImpedanceOn && !isImpedanceTrendOn && impedanceView == view; }
+
+    /** Whether the fixed scale factor applies; the other kinds of value have fixed ranges of their own */
+    bool isShowingScaledValues() const {
+        return !isShowingZScores() && !isShowingImpedanceTrend() && !isShowingImpedanceView(ImpedanceView::PHASE) && !isShowingImpedanceView(ImpedanceView::FIT_CAPACITANCE);
+    }
+
+    bool isShowingZScores() const { return isZScoreOn && !isImpedanceOn && !isCsdOn; }
+};
+
+/** Where the display puts each electrode, and the grid the values are indexed by */
+struct RenderLayout {
+    //one rectangle per electrode, in display coordinates
+    std::vector<juce::Rectangle<int>> sites;
+    int gridCols = 0;
+    int gridRows = 0;
+    std::vector<uint8_t> mappedSites;
+    bool isProbeLayout = false;
+    //Sites placed at the layout file's own coordinates, so they have no grid neighbours
+    bool isSiteLayout = false;
+    //one per site when any site isn't a rectangle; each is drawn inside its rectangle
+    std::vector<SiteShape> siteShapes;
+    //the continuous field image is stretched over this area
+    juce::Rectangle<float> fieldBounds;
+    //size of the rendered frame; it is drawn at the display origin
+    int width = 0;
+    int height = 0;
+};
+
+/** Colour range a frame was drawn with, for the scale labels */
+struct RenderedRange {
+    bool isValid = false;
+    float lower = 0.0f;
+    float upper = 0.0f;
+
+    bool operator==(const RenderedRange& other) const {
+        return isValid == other.isValid && lower == other.lower && upper == other.upper;
+    }
+};
+
+/**
+    Maps one frame of values to colours and draws the electrode sites into an image.
+    It holds no frame state beyond scratch buffers, so the live renderer and the
+    offline renderer draw identical pictures; use one per thread.
+
+    With more than one thread the colour mapping is split into runs of sites and the
+    rasterization into bands of rows, each run on a TilePool. Every tile writes its own
+    sites' colours or its own rows of the image, so tiles only meet at the end of a pass.
+*/
+class FrameRasterizer {
+public:
+    FrameRasterizer();
+
+    //z-scores are drawn from -zScoreRange to +zScoreRange unless auto range is on
+    static constexpr float zScoreRange = 3.0f;
+
+    //impedance change rates are drawn from -trendRange to +trendRange percent per day unless auto range is on
+    static constexpr float trendRange = 10.0f;
+
+    //impedance phases are drawn from -phaseRange to +phaseRange degrees unless auto range is on
+    static constexpr float phaseRange = 90.0f;
+
+    //fitted capacitances are drawn from 0 to capacitanceRange nanofarads unless auto range is on
+    static constexpr float capacitanceRange = 100.0f;
+
+    /** Range to draw values with; auto range is made symmetric about zero for signed data */
+    static RenderedRange getDrawingRange(const RenderSettings& settings, const AutoRange& autoRange);
+
+    /** Threads each frame is split across, the calling thread included; 1 keeps everything on the caller */
+    void setNumThreads(int numThreads);
+
+    int getNumThreads() const { return pool != nullptr ? pool->getNumThreads() : 1; }
+
+    //Upper bound for setNumThreads()
+    static const int maxThreads;
+
+    /**
+        Draws the sites of layout into target, which is resized to the layout if needed. Sites
+        past numValues or with a NaN value get the idle colour, and sites with a non-zero flag
+        are crossed out.
+    */
+    void rasterize(Image& target, const RenderLayout& layout, const RenderSettings& settings, const RenderedRange& range,
+                   const float* values, int numValues, const uint8_t* flags, int numFlags);
+
+private:
+    /** Runs tileFunction for every tile, on the pool if there is one */
+    void forEachTile(int numTiles, const std::function<void(int)>& tileFunction);
+
+    /** Lists the sites overlapping each band of bandHeight rows */
+    void binSitesIntoBands(const RenderLayout& layout, int height, int bandHeight, int numBands);
+
+    void paintContinuousField(Graphics& g, const RenderLayout& layout);
+
+    std::vector<Colour> siteColours;
+    Image fieldImage;
+
+    std::unique_ptr<TilePool> pool;
+    std::vector<std::vector<int>> bandSites;
+
+    //Tiles per thread; more tiles than threads leaves work to steal when tiles differ in cost
+    static const int tilesPerThread;
+
+    //Drawn where there is no value for an electrode yet
+    const Colour idleColour;
+    const Colour maskedColour;
+
+    JUCE_DECLARE_NON_COPYABLE(FrameRasterizer);
+};
+
+#endif /* FrameRasterizer_h */
@@ -0,0 +1,137 @@
+//
+//  FrameServer.cpp
+//  ug3-electrode-viewer
+//
+
+#include "FrameServer.h"
+
+#if !JUCE_WINDOWS
+#include <sys/socket.h>
+#include <sys/time.h>
+#endif
+
+const int FrameServer::defaultPort = 47810;
+const int FrameServer::sendTimeoutMs = 2000;
+
+FrameServer::FrameServer() : Thread("UG3 Frame Server"), pendingSampleNumber(0), pendingSequence(0), latestSampleNumber(0), latestSequence(0), gridCols(0), gridRows(0), numClients(0), numDroppedFrames(0) {}
+
+FrameServer::~FrameServer() {
+    stop();
+}
+
+String FrameServer::start(int port) {
+    stop();
+    listener = std::make_unique<StreamingSocket>();
+    //Loopback only; anything that should reach other machines can tunnel to it
+    if (!listener->createListener(port, "127.0.0.1")) {
+        listener.reset();
+        return "could not listen on 127.0.0.1:" + String(port);
+    }
+    latestSequence = pendingSequence.load(std::memory_order_acquire);
+    startThread();
+    return "";
+}
+
+void FrameServer::stop() {
+    //A write to a stalled client can block for up to sendTimeoutMs
+    stopThread(sendTimeoutMs + 1000);
+    clients.clear();
+    listener.reset();
+    numClients.store(0, std::memory_order_relaxed);
+}
+
+int FrameServer::getPort() const {
+    return listener != nullptr ? listener->getBoundPort() : -1;
+}
+
+void FrameServer::setGridSize(int cols, int rows) {
+    gridCols.store(cols, std::memory_order_relaxed);
+    gridRows.store(rows, std::memory_order_relaxed);
+}
+
+void FrameServer::submit(const float* values, int numValues, int64_t sampleNumber) {
+    if (numClients.load(std::memory_order_relaxed) == 0) {
+        return;
+    }
+    {
+        //If the server thread is taking the previous frame, this one is dropped rather than waited on
+        const ScopedTryLock lock(pendingLock);
+        if (!lock.isLocked()) {
+            numDroppedFrames.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        pending.assign(values, values + std::max(0, numValues));
+        pendingSampleNumber = sampleNumber;
+        pendingSequence.fetch_add(1, std::memory_order_release);
+    }
+    notify();
+}
+
+void FrameServer::acceptClients() {
+    while (listener->waitUntilReady(true, 0) == 1) {
+        StreamingSocket* socket = listener->waitForNextConnection();
+        if (socket == nullptr) {
+            return;
+        }
+#if !JUCE_WINDOWS
+        //Bounds how long a write to a client that stopped reading can hold up the others
+        timeval timeout = { sendTimeoutMs / 1000, (sendTimeoutMs % 1000) * 1000 };
+        setsockopt(socket->getRawSocketHandle(), SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+#endif
+        Client client;
+        client.socket.reset(socket);
+        clients.push_back(std::move(client));
+    }
+    numClients.store(int(clients.size()), std::memory_order_relaxed);
+}
+
+bool FrameServer::sendTo(Client& client) {
+    const bool isKeyFrame = client.reference.size() != latest.size();
+    message.clear();
+    FrameCodec::encode(latest.data(), isKeyFrame ? nullptr : client.reference.data(), int(latest.size()),
+                       gridCols.load(std::memory_order_relaxed), gridRows.load(std::memory_order_relaxed), latestSequence, latestSampleNumber, message);
+
+    if (client.socket->write(message.data(), int(message.size())) != int(message.size())) {
+        return false;
+    }
+    if (client.sentSequence != 0) {
+        numDroppedFrames.fetch_add(latestSequence - client.sentSequence - 1, std::memory_order_relaxed);
+    }
+    client.reference = latest;
+    client.sentSequence = latestSequence;
+    return true;
+}
+
+void FrameServer::run() {
+    while (!threadShouldExit()) {
+        //Also wakes up now and then to pick up new connections while no frames arrive
+        wait(50);
+        acceptClients();
+
+        if (pendingSequence.load(std::memory_order_acquire) != latestSequence) {
+            const ScopedLock lock(pendingLock);
+            //Swapping hands the old buffer back, so neither side allocates once warmed up
+            std::swap(latest, pending);
+            latestSampleNumber = pendingSampleNumber;
+            latestSequence = pendingSequence.load(std::memory_order_relaxed);
+        }
+        if (latest.empty()) {
+            continue;
+        }
+
+        for (auto client = clients.begin(); client != clients.end();) {
+            if (client->sentSequence == latestSequence) {
+                ++client;
+                continue;
+            }
+            //Not writable means the client hasn't read the last message yet; it gets whatever is newest once it has
+            const int ready = client->socket->waitUntilReady(false, 0);
+            if (ready < 0 || (ready > 0 && !sendTo(*client))) {
+                client = clients.erase(client);
+                continue;
+            }
+            ++client;
+        }
+        numClients.store(int(clients.size()), std::memory_order_relaxed);
+    }
+}
@@ -0,0 +1,99 @@
+//
+//  FrameServer.h
+//  ug3-electrode-viewer
+//
+
+#ifndef FrameServer_h
+#define FrameServer_h
+
+#include <ProcessorHeaders.h>
+
+#include "FrameCodec.h"
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+/**
+    Streams the reduced frames to remote heatmap viewers over loopback TCP, in the
+    FrameCodec format. Each client gets its frames delta coded against the last frame
+    it was actually sent, starting with a key frame.
+
+    The audio thread only copies its frame into a pending slot with submit(); a server
+    thread does the coding and the socket writes. A client that isn't ready to take
+    more data when a new frame arrives simply skips frames, so it always receives the
+    newest one, and a client that stalls for longer than sendTimeoutMs is dropped.
+*/
+class FrameServer : private Thread {
+public:
+    FrameServer();
+
+    ~FrameServer();
+
+    /** Listens on 127.0.0.1; port 0 picks a free one. Returns an empty string on success */
+    String start(int port);
+
+    /** Disconnects every client and stops listening */
+    void stop();
+
+    bool isRunning() const { return listener != nullptr; }
+
+    /** The port actually bound, or -1 when stopped */
+    int getPort() const;
+
+    /** Sent in every message header so viewers can lay the values out */
+    void setGridSize(int cols, int rows);
+
+    /** Offers the newest frame; called on the audio thread and never waits for the server thread */
+    void submit(const float* values, int numValues, int64_t sampleNumber);
+
+    int getNumClients() const { return numClients.load(std::memory_order_relaxed); }
+
+    /** Frames skipped across all clients because they weren't ready for them */
+    uint64_t getNumDroppedFrames() const { return numDroppedFrames.load(std::memory_order_relaxed); }
+
+    //Port used when SETFRAMESERVER doesn't give one
+    static const int defaultPort;
+
+    //A client that can't take a message for this long is disconnected
+    static const int sendTimeoutMs;
+
+private:
+    struct Client {
+        std::unique_ptr<StreamingSocket> socket;
+        //Frame the client last decoded; empty until its key frame is sent
+        std::vector<float> reference;
+        uint32_t sentSequence = 0;
+    };
+
+    void run() override;
+
+    void acceptClients();
+
+    /** Codes the newest frame for client; returns false if the client has gone */
+    bool sendTo(Client& client);
+
+    std::unique_ptr<StreamingSocket> listener;
+    std::vector<Client> clients;
+
+    //Written by submit() under pendingLock; the server thread copies it to latest
+    CriticalSection pendingLock;
+    std::vector<float> pending;
+    int64_t pendingSampleNumber;
+    std::atomic<uint32_t> pendingSequence;
+
+    //Owned by the server thread
+    std::vector<float> latest;
+    int64_t latestSampleNumber;
+    uint32_t latestSequence;
+    std::vector<uint8_t> message;
+
+    std::atomic<int> gridCols;
+    std::atomic<int> gridRows;
+    std::atomic<int> numClients;
+    std::atomic<uint64_t> numDroppedFrames;
+
+    JUCE_DECLARE_NON_COPYABLE(FrameServer);
+};
+
+#endif /* FrameServer_h */
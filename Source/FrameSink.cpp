@@ -0,0 +1,275 @@
+//
+//  FrameSink.cpp
+//  ug3-electrode-viewer
+//
+
+#include "FrameSink.h"
+
+#include <cerrno>
+#include <cstring>
+
+#if !JUCE_WINDOWS
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+    const char frameMagic[8] = { 'U', 'G', '3', 'F', 'R', 'A', 'M', 'E' };
+    const uint32_t frameVersion = 1;
+
+    //Slots start on a cache line so a reader and the writer of neighbouring slots don't share one
+    const size_t slotAlignment = 64;
+
+    size_t alignUp(size_t bytes) {
+        return (bytes + slotAlignment - 1) / slotAlignment * slotAlignment;
+    }
+
+    size_t getHeaderBytes() {
+        return alignUp(sizeof(SharedFrameHeader));
+    }
+
+    void copyString(char* destination, size_t capacity, const String& source) {
+        std::memset(destination, 0, capacity);
+        std::strncpy(destination, source.toRawUTF8(), capacity - 1);
+    }
+}
+
+SharedMemoryRegion::SharedMemoryRegion() : data(nullptr), size(0), fd(-1) {}
+
+SharedMemoryRegion::~SharedMemoryRegion() {
+    close();
+}
+
+#if JUCE_WINDOWS
+
+String SharedMemoryRegion::create(const String& name, size_t bytes) {
+    return "shared memory frame export is only available on Linux and macOS";
+}
+
+String SharedMemoryRegion::open(const String& name) {
+    return "shared memory frame export is only available on Linux and macOS";
+}
+
+void SharedMemoryRegion::close() {}
+
+#else
+
+String SharedMemoryRegion::create(const String& name, size_t bytes) {
+    close();
+    //macOS limits names to 31 characters, including the slash
+    if (!name.startsWithChar('/') || name.length() < 2 || name.length() > 31 || name.substring(1).containsChar('/')) {
+        return "shared memory name must be a slash followed by up to 30 characters, e.g. /ug3-frames";
+    }
+
+    //A stale object from a crashed session may have the wrong size
+    shm_unlink(name.toRawUTF8());
+    fd = shm_open(name.toRawUTF8(), O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd < 0) {
+        return "could not create shared memory " + name + ": " + String(std::strerror(errno));
+    }
+    ownedName = name;
+
+    if (ftruncate(fd, off_t(bytes)) != 0) {
+        const String error = "could not size shared memory " + name + ": " + String(std::strerror(errno));
+        close();
+        return error;
+    }
+
+    void* mapping = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (mapping == MAP_FAILED) {
+        const String error = "could not map shared memory " + name + ": " + String(std::strerror(errno));
+        close();
+        return error;
+    }
+    data = static_cast<uint8_t*>(mapping);
+    size = bytes;
+    return "";
+}
+
+String SharedMemoryRegion::open(const String& name) {
+    close();
+    fd = shm_open(name.toRawUTF8(), O_RDONLY, 0);
+    if (fd < 0) {
+        return "could not open shared memory " + name + ": " + String(std::strerror(errno));
+    }
+
+    struct stat status;
+    if (fstat(fd, &status) != 0 || status.st_size < off_t(sizeof(SharedFrameHeader))) {
+        close();
+        return "shared memory " + name + " is too small to hold frames";
+    }
+
+    void* mapping = mmap(nullptr, size_t(status.st_size), PROT_READ, MAP_SHARED, fd, 0);
+    if (mapping == MAP_FAILED) {
+        const String error = "could not map shared memory " + name + ": " + String(std::strerror(errno));
+        close();
+        return error;
+    }
+    data = static_cast<uint8_t*>(mapping);
+    size = size_t(status.st_size);
+    return "";
+}
+
+void SharedMemoryRegion::close() {
+    if (data != nullptr) {
+        munmap(data, size);
+        data = nullptr;
+        size = 0;
+    }
+    if (fd >= 0) {
+        ::close(fd);
+        fd = -1;
+    }
+    //Only the creator removes the name, so readers can't unlink the writer's ring
+    if (ownedName.isNotEmpty()) {
+        shm_unlink(ownedName.toRawUTF8());
+        ownedName = "";
+    }
+}
+
+#endif
+
+const char* const FrameSink::defaultName = "/ug3-frames";
+
+FrameSink::FrameSink() : header(nullptr), sequence(0) {}
+
+size_t FrameSink::getSlotBytes(int numValues) {
+    return alignUp(sizeof(SharedFrameSlot) + sizeof(float) * size_t(std::max(0, numValues)));
+}
+
+String FrameSink::open(const String& name, int cols, int rows, int numValues, const String& capability, const String& units, int numSlots) {
+    close();
+    if (numValues <= 0 || numSlots <= 0) {
+        return "frame export needs at least one value and one slot";
+    }
+
+    const size_t slotBytes = getSlotBytes(numValues);
+    const String error = region.create(name, getHeaderBytes() + slotBytes * size_t(numSlots));
+    if (error.isNotEmpty()) {
+        return error;
+    }
+
+    //The mapping starts zeroed, which is also a valid unwritten guard and sequence for every slot
+    header = new (region.getData()) SharedFrameHeader();
+    header->version = frameVersion;
+    header->headerBytes = uint32_t(getHeaderBytes());
+    header->slotBytes = uint32_t(slotBytes);
+    header->numSlots = uint32_t(numSlots);
+    header->cols = uint32_t(std::max(0, cols));
+    header->rows = uint32_t(std::max(0, rows));
+    header->numValues = uint32_t(numValues);
+    copyString(header->capability, sizeof(header->capability), capability);
+    copyString(header->units, sizeof(header->units), units);
+    header->latestSequence.store(0, std::memory_order_relaxed);
+    for (int slot = 0; slot < numSlots; slot++) {
+        new (region.getData() + header->headerBytes + slotBytes * size_t(slot)) SharedFrameSlot();
+    }
+    sequence = 0;
+
+    //Written last, so a reader that sees the magic sees a complete header
+    std::atomic_thread_fence(std::memory_order_release);
+    std::memcpy(header->magic, frameMagic, sizeof(frameMagic));
+    return "";
+}
+
+void FrameSink::close() {
+    header = nullptr;
+    region.close();
+}
+
+void FrameSink::publish(const float* values, int numValues, int64_t sampleNumber, double wallTimeSeconds) {
+    if (header == nullptr) {
+        return;
+    }
+
+    sequence++;
+    uint8_t* slotData = region.getData() + header->headerBytes + size_t(header->slotBytes) * size_t((sequence - 1) % header->numSlots);
+    SharedFrameSlot* slot = reinterpret_cast<SharedFrameSlot*>(slotData);
+
+    const uint64_t guard = slot->guard.load(std::memory_order_relaxed);
+    slot->guard.store(guard + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    const uint32_t count = uint32_t(std::min<int64_t>(std::max(0, numValues), header->numValues));
+    slot->sequence = sequence;
+    slot->sampleNumber = sampleNumber;
+    slot->wallTimeSeconds = wallTimeSeconds;
+    slot->numValues = count;
+    std::memcpy(slotData + sizeof(SharedFrameSlot), values, sizeof(float) * count);
+
+    slot->guard.store(guard + 2, std::memory_order_release);
+    header->latestSequence.store(sequence, std::memory_order_release);
+}
+
+SharedFrameReader::SharedFrameReader() : header(nullptr) {}
+
+String SharedFrameReader::open(const String& name) {
+    close();
+    const String error = region.open(name);
+    if (error.isNotEmpty()) {
+        return error;
+    }
+
+    const SharedFrameHeader* candidate = reinterpret_cast<const SharedFrameHeader*>(region.getData());
+    if (std::memcmp(candidate->magic, frameMagic, sizeof(frameMagic)) != 0 || candidate->version != frameVersion) {
+        close();
+        return name + " doesn't hold a version " + String(frameVersion) + " frame ring";
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (size_t(candidate->headerBytes) + size_t(candidate->slotBytes) * candidate->numSlots > region.getSize()) {
+        close();
+        return name + " is smaller than its header says";
+    }
+    header = candidate;
+    return "";
+}
+
+void SharedFrameReader::close() {
+    header = nullptr;
+    region.close();
+}
+
+bool SharedFrameReader::readLatest(std::vector<float>& values, SharedFrameInfo& info) {
+    if (header == nullptr) {
+        return false;
+    }
+
+    //A few tries in case the writer laps the slot while it is being copied
+    for (int attempt = 0; attempt < 4; attempt++) {
+        const uint64_t wanted = header->latestSequence.load(std::memory_order_acquire);
+        if (wanted == 0) {
+            return false;
+        }
+
+        const uint8_t* slotData = region.getData() + header->headerBytes + size_t(header->slotBytes) * size_t((wanted - 1) % header->numSlots);
+        const SharedFrameSlot* slot = reinterpret_cast<const SharedFrameSlot*>(slotData);
+
+        const uint64_t guardBefore = slot->guard.load(std::memory_order_acquire);
+        if (guardBefore % 2 != 0) {
+            continue;
+        }
+        const uint64_t sequence = slot->sequence;
+        const int64_t sampleNumber = slot->sampleNumber;
+        const double wallTimeSeconds = slot->wallTimeSeconds;
+        const uint32_t count = std::min(slot->numValues, header->numValues);
+        values.resize(count);
+        std::memcpy(values.data(), slotData + sizeof(SharedFrameSlot), sizeof(float) * count);
+        std::atomic_thread_fence(std::memory_order_acquire);
+
+        if (slot->guard.load(std::memory_order_relaxed) != guardBefore || sequence != wanted) {
+            continue;
+        }
+
+        info.sequence = sequence;
+        info.sampleNumber = sampleNumber;
+        info.wallTimeSeconds = wallTimeSeconds;
+        info.cols = int(header->cols);
+        info.rows = int(header->rows);
+        info.capability = String(header->capability);
+        info.units = String(header->units);
+        return true;
+    }
+    return false;
+}
@@ -0,0 +1,149 @@
+//
+//  FrameSink.h
+//  ug3-electrode-viewer
+//
+
+#ifndef FrameSink_h
+#define FrameSink_h
+
+#include <ProcessorHeaders.h>
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+/**
+    Layout of the shared memory ring the viewer exports its frames through. A
+    SharedFrameHeader sits at offset 0 and is followed by numSlots slots, each
+    slotBytes apart. A slot is a SharedFrameSlot followed by numValues floats,
+    indexed like the visual buffer (row-major over the cols x rows grid).
+
+    Frames are numbered from 1, and frame n lives in slot (n - 1) % numSlots. Each
+    slot's guard is odd while the writer is filling it, so a reader copies a slot,
+    then checks the guard didn't change and the slot still holds the frame it wanted.
+    Everything is in the writer's native byte order.
+*/
+struct SharedFrameHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t headerBytes;
+    uint32_t slotBytes;
+    uint32_t numSlots;
+    uint32_t cols;
+    uint32_t rows;
+    uint32_t numValues;
+    uint32_t reserved;
+    //NUL-terminated acquisition capability the layout belongs to, e.g. "1Hz/16Ch"
+    char capability[64];
+    //NUL-terminated unit of the values, e.g. "uV"
+    char units[16];
+    //Newest complete frame; 0 until the first frame is written
+    std::atomic<uint64_t> latestSequence;
+};
+
+struct SharedFrameSlot {
+    std::atomic<uint64_t> guard;
+    uint64_t sequence;
+    //First sample of the block the frame was taken from
+    int64_t sampleNumber;
+    //Seconds since the Unix epoch when the frame was written
+    double wallTimeSeconds;
+    uint32_t numValues;
+    uint32_t reserved;
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "the frame ring needs lock-free 64-bit atomics to be shared between processes");
+
+/** Frame metadata handed back by SharedFrameReader */
+struct SharedFrameInfo {
+    uint64_t sequence = 0;
+    int64_t sampleNumber = 0;
+    double wallTimeSeconds = 0.0;
+    int cols = 0;
+    int rows = 0;
+    String capability;
+    String units;
+};
+
+/** Shared memory mapping used by both ends; POSIX only */
+class SharedMemoryRegion {
+public:
+    SharedMemoryRegion();
+
+    ~SharedMemoryRegion();
+
+    /** Creates (replacing any old one) or opens the named object; returns an empty string on success */
+    String create(const String& name, size_t bytes);
+
+    String open(const String& name);
+
+    void close();
+
+    uint8_t* getData() const { return data; }
+
+    size_t getSize() const { return size; }
+
+private:
+    uint8_t* data;
+    size_t size;
+    String ownedName;
+    int fd;
+
+    JUCE_DECLARE_NON_COPYABLE(SharedMemoryRegion);
+};
+
+/**
+    Publishes every reduced frame into a POSIX shared memory ring (see SharedFrameHeader),
+    so other local processes can read frames in place. open() and close() do the system
+    calls and belong on the message thread while the audio thread is idle; publish() is
+    a copy into the mapping and is safe on the audio thread.
+*/
+class FrameSink {
+public:
+    FrameSink();
+
+    /** Creates the ring; returns an empty string on success or why it couldn't be created */
+    String open(const String& name, int cols, int rows, int numValues, const String& capability, const String& units, int numSlots);
+
+    /** Unmaps and unlinks the ring; readers that still have it mapped keep their copy */
+    void close();
+
+    bool isOpen() const { return header != nullptr; }
+
+    /** Copies one frame into the next slot; values past the ring's numValues are dropped */
+    void publish(const float* values, int numValues, int64_t sampleNumber, double wallTimeSeconds);
+
+    /** Bytes the ring takes for a frame of numValues floats */
+    static size_t getSlotBytes(int numValues);
+
+    //Name used when SETFRAMEEXPORT doesn't give one
+    static const char* const defaultName;
+
+private:
+    SharedMemoryRegion region;
+    SharedFrameHeader* header;
+    uint64_t sequence;
+
+    JUCE_DECLARE_NON_COPYABLE(FrameSink);
+};
+
+/** Reads the newest frame out of a ring written by FrameSink, from this or another process */
+class SharedFrameReader {
+public:
+    SharedFrameReader();
+
+    String open(const String& name);
+
+    void close();
+
+    /** Copies the newest frame; returns false if there is none yet or the writer kept overwriting it */
+    bool readLatest(std::vector<float>& values, SharedFrameInfo& info);
+
+private:
+    SharedMemoryRegion region;
+    const SharedFrameHeader* header;
+
+    JUCE_DECLARE_NON_COPYABLE(SharedFrameReader);
+};
+
+#endif /* FrameSink_h */
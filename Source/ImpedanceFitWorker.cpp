@@ -0,0 +1,71 @@
+//
+//  ImpedanceFitWorker.cpp
+//  ug3-electrode-viewer
+//
+
+#include "ImpedanceFitWorker.h"
+#include "Instrumentation.h"
+
+ImpedanceFitWorker::ImpedanceFitWorker(std::function<void()> onFitReady_) : Thread("UG3 Impedance Fit"), onFitReady(std::move(onFitReady_)), hasPendingSpectra(false), hasNewFit(false) {}
+
+ImpedanceFitWorker::~ImpedanceFitWorker() {
+    stopThread(1000);
+}
+
+void ImpedanceFitWorker::submit(const ImpedanceSpectra& spectra_) {
+    {
+        const ScopedLock sl(lock);
+        pendingSpectra = spectra_;
+        hasPendingSpectra = true;
+    }
+    if (!isThreadRunning()) {
+        startThread();
+    }
+    notify();
+}
+
+bool ImpedanceFitWorker::getFit(std::vector<float>& resistance_, std::vector<float>& capacitanceNanofarads) {
+    const ScopedLock sl(lock);
+    if (!hasNewFit) {
+        return false;
+    }
+    resistance_ = publishedResistance;
+    capacitanceNanofarads = publishedCapacitance;
+    hasNewFit = false;
+    return true;
+}
+
+void ImpedanceFitWorker::run() {
+    while (!threadShouldExit()) {
+        wait(100);
+
+        {
+            const ScopedLock sl(lock);
+            if (!hasPendingSpectra) {
+                continue;
+            }
+            std::swap(spectra, pendingSpectra);
+            hasPendingSpectra = false;
+        }
+
+        {
+            UG3_TIME_SCOPE(IMPEDANCE_FIT);
+            const int numElectrodes = spectra.getNumElectrodes();
+            resistance.resize(numElectrodes);
+            capacitance.resize(numElectrodes);
+            for (int i = 0; i < numElectrodes && !threadShouldExit(); i++) {
+                spectra.fitSeriesRC(i, resistance[i], capacitance[i]);
+            }
+        }
+
+        {
+            const ScopedLock sl(lock);
+            std::swap(publishedResistance, resistance);
+            std::swap(publishedCapacitance, capacitance);
+            hasNewFit = true;
+        }
+        if (onFitReady) {
+            onFitReady();
+        }
+    }
+}
@@ -0,0 +1,57 @@
+//
+//  ImpedanceFitWorker.h
+//  ug3-electrode-viewer
+//
+
+#ifndef ImpedanceFitWorker_h
+#define ImpedanceFitWorker_h
+
+#include <ProcessorHeaders.h>
+
+#include "ImpedanceSpectra.h"
+
+#include <functional>
+
+/**
+    Fits the equivalent circuit of every electrode on its own thread, so a new set of
+    impedances never holds up the message thread. The message thread hands over a copy
+    of the spectra and picks up the fitted values later; only the newest spectra are
+    kept, so a sweep that arrives mid-fit replaces any sweep still waiting.
+*/
+class ImpedanceFitWorker : public Thread {
+public:
+    /** onFitReady is called on the worker thread after each batch is published */
+    explicit ImpedanceFitWorker(std::function<void()> onFitReady);
+
+    ~ImpedanceFitWorker() override;
+
+    /** Queues the spectra for fitting, starting the thread on first use */
+    void submit(const ImpedanceSpectra& spectra);
+
+    /** Copies the newest fit, indexed like the spectra; returns false if it hasn't changed since the last call */
+    bool getFit(std::vector<float>& resistance, std::vector<float>& capacitanceNanofarads);
+
+    void run() override;
+
+private:
+    CriticalSection lock;
+    std::function<void()> onFitReady;
+
+    //Handed over from the message thread
+    ImpedanceSpectra pendingSpectra;
+    bool hasPendingSpectra;
+
+    //Owned by the worker thread
+    ImpedanceSpectra spectra;
+    std::vector<float> resistance;
+    std::vector<float> capacitance;
+
+    //Handed back
+    std::vector<float> publishedResistance;
+    std::vector<float> publishedCapacitance;
+    bool hasNewFit;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(ImpedanceFitWorker);
+};
+
+#endif /* ImpedanceFitWorker_h */
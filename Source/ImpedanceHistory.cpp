@@ -0,0 +1,212 @@
+//
+//  ImpedanceHistory.cpp
+//  ug3-electrode-viewer
+//
+
+#include "ImpedanceHistory.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace {
+    const char storeMagic[4] = { 'U', '3', 'I', 'H' };
+    const int storeVersion = 1;
+    const int64 headerBytes = 8;
+    //time, layout hash, electrode count and capability length
+    const int64 recordHeaderBytes = 24;
+    const double msPerDay = 24.0 * 60.0 * 60.0 * 1000.0;
+
+    float readFloat(const char* data) {
+        const uint32 bits = ByteOrder::littleEndianInt(data);
+        float value;
+        std::memcpy(&value, &bits, sizeof(value));
+        return value;
+    }
+}
+
+const double ImpedanceHistory::trendTimeConstantDays = 7.0;
+const double ImpedanceHistory::minTrendSpanDays = 1.0;
+const float ImpedanceHistory::maxChangeRatePercent = 100.0f;
+
+ImpedanceHistory::ImpedanceHistory() : validBytes(0) {}
+
+String ImpedanceHistory::open(const File& file) {
+    close();
+
+    if (!file.exists()) {
+        FileOutputStream out(file);
+        if (out.failedToOpen()) {
+            return "could not create impedance history " + file.getFullPathName();
+        }
+        out.write(storeMagic, sizeof(storeMagic));
+        out.writeInt(storeVersion);
+        out.flush();
+    }
+
+    MemoryBlock contents;
+    if (!file.loadFileAsData(contents)) {
+        return "could not read impedance history " + file.getFullPathName();
+    }
+    const char* data = static_cast<const char*>(contents.getData());
+    const int64 size = int64(contents.getSize());
+    if (size < headerBytes || std::memcmp(data, storeMagic, sizeof(storeMagic)) != 0 || int(ByteOrder::littleEndianInt(data + 4)) != storeVersion) {
+        return file.getFullPathName() + " is not an impedance history";
+    }
+
+    int64 position = headerBytes;
+    while (position + recordHeaderBytes <= size) {
+        const char* record = data + position;
+        const int64 timeMs = int64(ByteOrder::littleEndianInt64(record));
+        const uint64_t layoutHash = ByteOrder::littleEndianInt64(record + 8);
+        const int numElectrodes = int(ByteOrder::littleEndianInt(record + 16));
+        const int capabilityBytes = int(ByteOrder::littleEndianInt(record + 20));
+        if (numElectrodes <= 0 || capabilityBytes < 0) {
+            break;
+        }
+        const int64 recordBytes = recordHeaderBytes + capabilityBytes + 4 * int64(numElectrodes);
+        if (position + recordBytes > size) {
+            break;
+        }
+
+        const char* values = record + recordHeaderBytes + capabilityBytes;
+        std::vector<float> magnitudes(numElectrodes);
+        for (int i = 0; i < numElectrodes; i++) {
+            magnitudes[i] = readFloat(values + 4 * i);
+        }
+        sweeps.push_back({ timeMs, layoutHash, String::fromUTF8(record + recordHeaderBytes, capabilityBytes), numElectrodes });
+        addToColumns(timeMs, layoutHash, magnitudes.data(), numElectrodes);
+        position += recordBytes;
+    }
+
+    storeFile = file;
+    validBytes = position;
+    return "";
+}
+
+void ImpedanceHistory::close() {
+    storeFile = File();
+    validBytes = 0;
+    sweeps.clear();
+    series.clear();
+}
+
+String ImpedanceHistory::append(int64 timeMs, const String& capability, uint64_t layoutHash, const float* magnitudes, int numElectrodes) {
+    if (!isOpen()) {
+        return "no impedance history is open";
+    }
+    if (numElectrodes <= 0) {
+        return "an impedance sweep needs at least one electrode";
+    }
+
+    FileOutputStream out(storeFile);
+    if (out.failedToOpen()) {
+        return "could not open impedance history " + storeFile.getFullPathName();
+    }
+    //Drop whatever a torn write left behind
+    if (out.getPosition() != validBytes) {
+        out.setPosition(validBytes);
+        out.truncate();
+    }
+
+    out.writeInt64(timeMs);
+    out.writeInt64(int64(layoutHash));
+    out.writeInt(numElectrodes);
+    out.writeInt(int(capability.getNumBytesAsUTF8()));
+    out.write(capability.toRawUTF8(), capability.getNumBytesAsUTF8());
+    for (int i = 0; i < numElectrodes; i++) {
+        out.writeFloat(magnitudes[i]);
+    }
+    out.flush();
+    if (out.getStatus().failed()) {
+        return "could not write impedance history " + storeFile.getFullPathName() + ": " + out.getStatus().getErrorMessage();
+    }
+    validBytes = out.getPosition();
+
+    sweeps.push_back({ timeMs, layoutHash, capability, numElectrodes });
+    addToColumns(timeMs, layoutHash, magnitudes, numElectrodes);
+    return "";
+}
+
+void ImpedanceHistory::addToColumns(int64 timeMs, uint64_t layoutHash, const float* magnitudes, int numElectrodes) {
+    LayoutSeries& layout = series[layoutHash];
+    if (layout.timesMs.empty()) {
+        layout.numElectrodes = numElectrodes;
+        layout.firstTimeMs = timeMs;
+        layout.columns.assign(numElectrodes, {});
+        layout.trends.assign(numElectrodes, {});
+        layout.rates.assign(numElectrodes, 0.0f);
+    }
+    else if (numElectrodes != layout.numElectrodes) {
+        //A layout hash always has the same number of electrodes; the sweep stays in the file regardless
+        return;
+    }
+
+    //A clock stepping backwards must not unsort the columns
+    timeMs = std::max(timeMs, layout.timesMs.empty() ? timeMs : layout.timesMs.back());
+    layout.timesMs.push_back(timeMs);
+    const double day = double(timeMs - layout.firstTimeMs) / msPerDay;
+
+    for (int i = 0; i < numElectrodes; i++) {
+        const float magnitude = magnitudes[i];
+        layout.columns[i].push_back(magnitude);
+        //Also skips NaN
+        if (!(magnitude > 0.0f)) {
+            continue;
+        }
+
+        Trend& trend = layout.trends[i];
+        if (trend.weight == 0.0) {
+            trend.firstDay = day;
+        }
+        else {
+            const double decay = std::exp(-(day - trend.lastDay) / trendTimeConstantDays);
+            trend.weight *= decay;
+            trend.sumT *= decay;
+            trend.sumY *= decay;
+            trend.sumTT *= decay;
+            trend.sumTY *= decay;
+        }
+        const double y = std::log(double(magnitude));
+        trend.weight += 1.0;
+        trend.sumT += day;
+        trend.sumY += y;
+        trend.sumTT += day * day;
+        trend.sumTY += day * y;
+        trend.lastDay = day;
+
+        const double denominator = trend.weight * trend.sumTT - trend.sumT * trend.sumT;
+        if (day - trend.firstDay >= minTrendSpanDays && denominator > 1e-12) {
+            const double slope = (trend.weight * trend.sumTY - trend.sumT * trend.sumY) / denominator;
+            //Clamped before exp() so a wild slope can't overflow
+            const double maxSlope = std::log(1.0 + maxChangeRatePercent / 100.0);
+            const double rate = (std::exp(jlimit(-maxSlope, maxSlope, slope)) - 1.0) * 100.0;
+            layout.rates[i] = jlimit(-maxChangeRatePercent, maxChangeRatePercent, float(rate));
+        }
+    }
+}
+
+void ImpedanceHistory::getSeries(uint64_t layoutHash, int electrode, int64 fromMs, int64 toMs, std::vector<ImpedanceSample>& samples) const {
+    samples.clear();
+    const auto layoutIt = series.find(layoutHash);
+    if (layoutIt == series.end() || electrode < 0 || electrode >= layoutIt->second.numElectrodes) {
+        return;
+    }
+    const LayoutSeries& layout = layoutIt->second;
+    const auto first = std::lower_bound(layout.timesMs.begin(), layout.timesMs.end(), fromMs);
+    const auto last = std::upper_bound(first, layout.timesMs.end(), toMs);
+    const std::vector<float>& column = layout.columns[electrode];
+    for (auto it = first; it != last; ++it) {
+        samples.push_back({ *it, column[it - layout.timesMs.begin()] });
+    }
+}
+
+bool ImpedanceHistory::getChangeRates(uint64_t layoutHash, std::vector<float>& rates) const {
+    const auto layoutIt = series.find(layoutHash);
+    if (layoutIt == series.end()) {
+        rates.clear();
+        return false;
+    }
+    rates = layoutIt->second.rates;
+    return true;
+}
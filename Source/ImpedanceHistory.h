@@ -0,0 +1,119 @@
+//
+//  ImpedanceHistory.h
+//  ug3-electrode-viewer
+//
+
+#ifndef ImpedanceHistory_h
+#define ImpedanceHistory_h
+
+#include <ProcessorHeaders.h>
+
+#include <cstdint>
+#include <map>
+#include <vector>
+
+/** One electrode's impedance in one sweep */
+struct ImpedanceSample {
+    int64 timeMs;
+    //Ohms; NaN when the electrode wasn't measured in that sweep
+    float magnitude;
+};
+
+/** One appended sweep, without its values */
+struct ImpedanceSweepInfo {
+    int64 timeMs;
+    uint64_t layoutHash;
+    String capability;
+    int numElectrodes;
+};
+
+/**
+    Append-only store of impedance sweeps, for following chronic implants over weeks.
+
+    On disk the store is a file header (magic, version) followed by one record per
+    sweep: time (int64 ms since the epoch), layout hash (uint64), electrode count
+    (int32), capability length (int32), the capability in UTF-8, then one float32
+    magnitude per electrode, indexed like the visual buffer. Everything is little-endian.
+    A record cut short by a crash is ignored when the store is opened and overwritten
+    by the next sweep.
+
+    The file is deliberately a row-per-sweep log rather than a column-major store: a
+    sweep is appended with one write, and a crash can only tear the last record. It is
+    not indexed; open() reads it once and transposes it into columns in memory, one per
+    electrode and per layout hash, so an electrode's time series is a contiguous range
+    found by binary search on time. At one sweep a day for years of a few thousand
+    electrodes this is a few tens of megabytes, read once per session.
+    The change rate of every electrode is updated as each sweep arrives, from an
+    exponentially weighted least-squares fit of log impedance against time; it is
+    reported in percent per day, and is 0 until an electrode's measurements span at least
+    minTrendSpanDays, since sweeps minutes apart would turn a tiny change into a huge rate.
+    Rates are clamped to maxChangeRatePercent.
+*/
+class ImpedanceHistory {
+public:
+    ImpedanceHistory();
+
+    /** Opens the store at storeFile, creating it if needed, and loads its sweeps; returns an error or "" */
+    String open(const File& storeFile);
+
+    void close();
+
+    bool isOpen() const { return storeFile != File(); }
+
+    File getFile() const { return storeFile; }
+
+    /** Appends a sweep to the file and the columns; magnitudes of unmeasured electrodes should be NaN */
+    String append(int64 timeMs, const String& capability, uint64_t layoutHash, const float* magnitudes, int numElectrodes);
+
+    int getNumSweeps() const { return int(sweeps.size()); }
+
+    const ImpedanceSweepInfo& getSweep(int index) const { return sweeps[index]; }
+
+    /** Electrode's magnitudes between fromMs and toMs inclusive under layoutHash, oldest first */
+    void getSeries(uint64_t layoutHash, int electrode, int64 fromMs, int64 toMs, std::vector<ImpedanceSample>& samples) const;
+
+    /** Change rate of every electrode under layoutHash in percent per day; false if it has no sweeps */
+    bool getChangeRates(uint64_t layoutHash, std::vector<float>& rates) const;
+
+    //Each week back counts e times less in the change rate
+    static const double trendTimeConstantDays;
+
+    //Shortest time between an electrode's first and latest measurement that gives it a rate
+    static const double minTrendSpanDays;
+
+    //Rates are clamped to +/- this many percent per day
+    static const float maxChangeRatePercent;
+
+private:
+    /** Exponentially weighted sums for fitting log impedance against days */
+    struct Trend {
+        double weight = 0.0;
+        double sumT = 0.0;
+        double sumY = 0.0;
+        double sumTT = 0.0;
+        double sumTY = 0.0;
+        double firstDay = 0.0;
+        double lastDay = 0.0;
+    };
+
+    /** Columns of every sweep recorded with one layout */
+    struct LayoutSeries {
+        int numElectrodes = 0;
+        int64 firstTimeMs = 0;
+        std::vector<int64> timesMs;
+        std::vector<std::vector<float>> columns;
+        std::vector<Trend> trends;
+        std::vector<float> rates;
+    };
+
+    void addToColumns(int64 timeMs, uint64_t layoutHash, const float* magnitudes, int numElectrodes);
+
+    std::vector<ImpedanceSweepInfo> sweeps;
+    std::map<uint64_t, LayoutSeries> series;
+
+    File storeFile;
+    //Bytes of whole records; anything past this is a torn write
+    int64 validBytes;
+};
+
+#endif /* ImpedanceHistory_h */
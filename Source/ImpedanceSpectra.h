@@ -0,0 +1,111 @@
+//
+//  ImpedanceSpectra.h
+//  ug3-electrode-viewer
+//
+
+#ifndef ImpedanceSpectra_h
+#define ImpedanceSpectra_h
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+/** Which impedance quantity the canvas draws in impedance mode */
+enum class ImpedanceView {
+    MAGNITUDE,
+    PHASE,
+    //Series resistance and capacitance of a series RC fitted across all frequencies
+    FIT_RESISTANCE,
+    FIT_CAPACITANCE
+};
+
+/**
+    Impedance magnitude (Ohms) and phase (degrees) of every electrode at every measured
+    frequency. Each quantity is stored as one contiguous plane per frequency, indexed like
+    the visual buffer, so switching the displayed frequency or quantity is just picking a
+    different plane. Entries that weren't measured are NaN.
+*/
+class ImpedanceSpectra {
+public:
+    /** Clears every entry to unmeasured; frequencies are reset to 0, which means unknown */
+    void resize(int numFrequencies_, int numElectrodes_) {
+        numFrequencies = std::max(0, numFrequencies_);
+        numElectrodes = std::max(0, numElectrodes_);
+        frequencies.assign(numFrequencies, 0.0f);
+        magnitudes.assign(size_t(numFrequencies) * numElectrodes, std::numeric_limits<float>::quiet_NaN());
+        phases.assign(size_t(numFrequencies) * numElectrodes, std::numeric_limits<float>::quiet_NaN());
+    }
+
+    int getNumFrequencies() const { return numFrequencies; }
+
+    int getNumElectrodes() const { return numElectrodes; }
+
+    void setFrequency(int frequency, float hz) { frequencies[frequency] = hz; }
+
+    /** Hz, or 0 if the source didn't say */
+    float getFrequency(int frequency) const { return frequencies[frequency]; }
+
+    const std::vector<float>& getFrequencies() const { return frequencies; }
+
+    /** A fit needs at least one frequency the source reported */
+    bool hasKnownFrequency() const {
+        return std::any_of(frequencies.begin(), frequencies.end(), [](float hz) { return hz > 0.0f; });
+    }
+
+    void set(int frequency, int electrode, float magnitude, float phaseDegrees) {
+        magnitudes[size_t(frequency) * numElectrodes + electrode] = magnitude;
+        phases[size_t(frequency) * numElectrodes + electrode] = phaseDegrees;
+    }
+
+    const float* getMagnitudes(int frequency) const { return magnitudes.data() + size_t(frequency) * numElectrodes; }
+
+    const float* getPhases(int frequency) const { return phases.data() + size_t(frequency) * numElectrodes; }
+
+    /**
+        Least-squares fit of Z = R - j / (2 pi f C) to one electrode over every frequency that is
+        known and measured; NaN when there is nothing to fit or the reactance isn't capacitive
+    */
+    void fitSeriesRC(int electrode, float& resistance, float& capacitanceNanofarads) const {
+        double sumReal = 0.0;
+        double sumImagOverOmega = 0.0;
+        double sumInverseOmegaSquared = 0.0;
+        int numPoints = 0;
+        for (int f = 0; f < numFrequencies; f++) {
+            const float magnitude = getMagnitudes(f)[electrode];
+            const float phase = getPhases(f)[electrode];
+            if (!(frequencies[f] > 0.0f) || !std::isfinite(magnitude) || !std::isfinite(phase)) {
+                continue;
+            }
+            const double omega = 2.0 * pi * frequencies[f];
+            const double radians = phase * pi / 180.0;
+            sumReal += magnitude * std::cos(radians);
+            sumImagOverOmega += magnitude * std::sin(radians) / omega;
+            sumInverseOmegaSquared += 1.0 / (omega * omega);
+            numPoints++;
+        }
+
+        resistance = capacitanceNanofarads = std::numeric_limits<float>::quiet_NaN();
+        if (numPoints == 0) {
+            return;
+        }
+        resistance = float(sumReal / numPoints);
+        //The imaginary part is -k / omega with k = 1 / C
+        const double inverseCapacitance = -sumImagOverOmega / sumInverseOmegaSquared;
+        if (inverseCapacitance > 0.0) {
+            capacitanceNanofarads = float(1e9 / inverseCapacitance);
+        }
+    }
+
+private:
+    static constexpr double pi = 3.14159265358979323846;
+
+    int numFrequencies = 0;
+    int numElectrodes = 0;
+    std::vector<float> frequencies;
+    //numFrequencies planes of numElectrodes each
+    std::vector<float> magnitudes;
+    std::vector<float> phases;
+};
+
+#endif /* ImpedanceSpectra_h */
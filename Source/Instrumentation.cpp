@@ -0,0 +1,253 @@
+//
+//  Instrumentation.cpp
+//  ug3-electrode-viewer
+//
+
+#include "Instrumentation.h"
+
+#include <algorithm>
+#include <memory>
+#include <mutex>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace { // hidden from the outside world (true static and hidden)
+
+    using Instrumentation::StageHistogram;
+
+    /** Histograms owned by one thread; only that thread ever writes them */
+    struct ThreadTimings
+    {
+        StageHistogram stages[Instrumentation::numStages];
+        std::atomic<bool> resetRequested { false };
+        int index = 0;
+    };
+
+    struct Registry
+    {
+        std::mutex mutex;
+        std::vector<std::unique_ptr<ThreadTimings>> threads;
+        //Slots of threads that have exited, ready for the next new thread
+        std::vector<ThreadTimings*> freeSlots;
+    };
+
+    //Intentionally leaked so that late recordings during static destruction stay valid
+    Registry& getRegistry()
+    {
+        static Registry* registry = new Registry();
+        return *registry;
+    }
+
+    /**
+     *  Returns its slot to the registry when the thread exits. The histograms are kept, so
+     *  merged summaries still include the thread's timings and the next thread carries on
+     *  counting in the same slot; worker threads that come and go don't grow the registry.
+     */
+    struct ThreadSlot
+    {
+        ThreadTimings* timings = nullptr;
+
+        ~ThreadSlot()
+        {
+            if (timings == nullptr)
+                return;
+            Registry& registry = getRegistry();
+            std::lock_guard<std::mutex> lock(registry.mutex);
+            registry.freeSlots.push_back(timings);
+        }
+    };
+
+    //The registry lock is only taken the first time a thread records
+    ThreadTimings& getThreadTimings()
+    {
+        thread_local ThreadSlot slot;
+        if (slot.timings == nullptr)
+        {
+            Registry& registry = getRegistry();
+            std::lock_guard<std::mutex> lock(registry.mutex);
+            if (!registry.freeSlots.empty())
+            {
+                slot.timings = registry.freeSlots.back();
+                registry.freeSlots.pop_back();
+            }
+            else
+            {
+                registry.threads.push_back(std::make_unique<ThreadTimings>());
+                slot.timings = registry.threads.back().get();
+                slot.timings->index = int(registry.threads.size()) - 1;
+            }
+        }
+        return *slot.timings;
+    }
+
+    int getBucketForNanos(uint64_t nanos)
+    {
+        if (nanos == 0)
+            return 0;
+#if defined(_MSC_VER) && defined(_M_X64)
+        unsigned long highestBit;
+        _BitScanReverse64(&highestBit, nanos);
+        int bitLength = int(highestBit) + 1;
+#elif defined(__GNUC__) || defined(__clang__)
+        int bitLength = 64 - __builtin_clzll(nanos);
+#else
+        int bitLength = 0;
+        while (nanos > 0) { nanos >>= 1; bitLength++; }
+#endif
+        return bitLength < StageHistogram::numBuckets ? bitLength : StageHistogram::numBuckets - 1;
+    }
+
+    uint64_t getBucketUpperEdge(int bucket)
+    {
+        return bucket == 0 ? 0 : (uint64_t(1) << bucket);
+    }
+
+    uint64_t getPercentile(const uint64_t* buckets, uint64_t count, double quantile)
+    {
+        if (count == 0)
+            return 0;
+        uint64_t target = uint64_t(quantile * double(count - 1)) + 1;
+        uint64_t cumulative = 0;
+        for (int b = 0; b < StageHistogram::numBuckets; b++)
+        {
+            cumulative += buckets[b];
+            if (cumulative >= target)
+                return getBucketUpperEdge(b);
+        }
+        return getBucketUpperEdge(StageHistogram::numBuckets - 1);
+    }
+
+    void addHistogram(const StageHistogram& histogram, uint64_t* buckets, Instrumentation::StageSummary& summary)
+    {
+        for (int b = 0; b < StageHistogram::numBuckets; b++)
+            buckets[b] += histogram.buckets[b].load(std::memory_order_relaxed);
+        summary.count += histogram.count.load(std::memory_order_relaxed);
+        summary.totalNanos += histogram.totalNanos.load(std::memory_order_relaxed);
+        summary.maxNanos = std::max(summary.maxNanos, histogram.maxNanos.load(std::memory_order_relaxed));
+    }
+
+    void finishSummary(const uint64_t* buckets, Instrumentation::StageSummary& summary)
+    {
+        summary.meanNanos = summary.count > 0 ? double(summary.totalNanos) / double(summary.count) : 0.0;
+        summary.p50Nanos = getPercentile(buckets, summary.count, 0.5);
+        summary.p90Nanos = getPercentile(buckets, summary.count, 0.9);
+        summary.p99Nanos = getPercentile(buckets, summary.count, 0.99);
+    }
+}
+
+const char* Instrumentation::getStageName(Stage stage)
+{
+    switch (stage)
+    {
+        case Stage::PROCESS:
+            return "process";
+        case Stage::DISPLAY_REFRESH:
+            return "display_refresh";
+        case Stage::DISPLAY_PAINT:
+            return "display_paint";
+        case Stage::COLOUR_MAPPING:
+            return "colour_mapping";
+        case Stage::LAYOUT_PARSE:
+            return "layout_parse";
+        case Stage::PROPAGATION:
+            return "propagation";
+        case Stage::IMPEDANCE_FIT:
+            return "impedance_fit";
+        default:
+            return "unknown";
+    }
+}
+
+void Instrumentation::StageHistogram::record(uint64_t nanos)
+{
+    //Single writer: load/store pairs avoid the cost of locked read-modify-write instructions
+    std::atomic<uint64_t>& bucket = buckets[getBucketForNanos(nanos)];
+    bucket.store(bucket.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    count.store(count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    totalNanos.store(totalNanos.load(std::memory_order_relaxed) + nanos, std::memory_order_relaxed);
+    if (nanos > maxNanos.load(std::memory_order_relaxed))
+        maxNanos.store(nanos, std::memory_order_relaxed);
+}
+
+void Instrumentation::StageHistogram::clear()
+{
+    for (auto& bucket : buckets)
+        bucket.store(0, std::memory_order_relaxed);
+    count.store(0, std::memory_order_relaxed);
+    totalNanos.store(0, std::memory_order_relaxed);
+    maxNanos.store(0, std::memory_order_relaxed);
+}
+
+void Instrumentation::record(Stage stage, uint64_t nanos)
+{
+    ThreadTimings& timings = getThreadTimings();
+    if (timings.resetRequested.load(std::memory_order_relaxed))
+    {
+        for (auto& histogram : timings.stages)
+            histogram.clear();
+        timings.resetRequested.store(false, std::memory_order_relaxed);
+    }
+    timings.stages[static_cast<int>(stage)].record(nanos);
+}
+
+std::vector<Instrumentation::StageSummary> Instrumentation::getSummaries(bool perThread)
+{
+    std::vector<StageSummary> summaries;
+    Registry& registry = getRegistry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+
+    if (perThread)
+    {
+        for (const auto& timings : registry.threads)
+        {
+            //A pending reset means the thread hasn't cleared yet, so its data is stale
+            if (timings->resetRequested.load(std::memory_order_relaxed))
+                continue;
+            for (int s = 0; s < numStages; s++)
+            {
+                StageSummary summary;
+                summary.stage = static_cast<Stage>(s);
+                summary.threadIndex = timings->index;
+                uint64_t buckets[StageHistogram::numBuckets] = {};
+                addHistogram(timings->stages[s], buckets, summary);
+                if (summary.count == 0)
+                    continue;
+                finishSummary(buckets, summary);
+                summaries.push_back(summary);
+            }
+        }
+        return summaries;
+    }
+
+    for (int s = 0; s < numStages; s++)
+    {
+        StageSummary summary;
+        summary.stage = static_cast<Stage>(s);
+        uint64_t buckets[StageHistogram::numBuckets] = {};
+        for (const auto& timings : registry.threads)
+        {
+            if (!timings->resetRequested.load(std::memory_order_relaxed))
+                addHistogram(timings->stages[s], buckets, summary);
+        }
+        finishSummary(buckets, summary);
+        summaries.push_back(summary);
+    }
+    return summaries;
+}
+
+void Instrumentation::reset()
+{
+    Registry& registry = getRegistry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    for (const auto& timings : registry.threads)
+        timings->resetRequested.store(true, std::memory_order_relaxed);
+}
+
+int Instrumentation::getNumThreads()
+{
+    Registry& registry = getRegistry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    return int(registry.threads.size());
+}
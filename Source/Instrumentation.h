@@ -0,0 +1,125 @@
+//
+//  Instrumentation.h
+//  ug3-electrode-viewer
+//
+
+#ifndef Instrumentation_h
+#define Instrumentation_h
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+//Set to 0 (cmake -DUG3_INSTRUMENTATION=OFF) to compile every timing scope out of the plugin
+#ifndef UG3_INSTRUMENTATION
+#define UG3_INSTRUMENTATION 1
+#endif
+
+namespace Instrumentation
+{
+    /** Hot-path stages that carry a timing scope */
+    enum class Stage : int
+    {
+        PROCESS,
+        DISPLAY_REFRESH,
+        DISPLAY_PAINT,
+        COLOUR_MAPPING,
+        LAYOUT_PARSE,
+        PROPAGATION,
+        IMPEDANCE_FIT,
+        NUM_STAGES
+    };
+
+    constexpr int numStages = static_cast<int>(Stage::NUM_STAGES);
+
+    /** Lower-case name used in the JSON and CSV output */
+    const char* getStageName(Stage stage);
+
+    /**
+     *  Power-of-two histogram of durations in nanoseconds. Bucket b holds
+     *  durations in [2^(b-1), 2^b), bucket 0 holds zero-length scopes.
+     *  Only the owning thread writes, so updates are plain relaxed stores.
+     */
+    struct StageHistogram
+    {
+        static constexpr int numBuckets = 40;
+
+        std::atomic<uint64_t> buckets[numBuckets] = {};
+        std::atomic<uint64_t> count { 0 };
+        std::atomic<uint64_t> totalNanos { 0 };
+        std::atomic<uint64_t> maxNanos { 0 };
+
+        void record(uint64_t nanos);
+        void clear();
+    };
+
+    /** Aggregated view of one stage, either for one thread or merged across threads */
+    struct StageSummary
+    {
+        Stage stage = Stage::PROCESS;
+        //-1 when merged across all threads
+        int threadIndex = -1;
+        uint64_t count = 0;
+        uint64_t totalNanos = 0;
+        uint64_t maxNanos = 0;
+        double meanNanos = 0.0;
+        //percentiles are the upper edge of the bucket they fall in
+        uint64_t p50Nanos = 0;
+        uint64_t p90Nanos = 0;
+        uint64_t p99Nanos = 0;
+    };
+
+    /** Records a duration against the calling thread's histograms */
+    void record(Stage stage, uint64_t nanos);
+
+    /**
+     *  Returns one summary per stage merged across threads, or one per thread and stage.
+     *  A thread that exits hands its slot, timings included, to the next thread to start
+     *  recording, so per-thread summaries are per slot.
+     */
+    std::vector<StageSummary> getSummaries(bool perThread);
+
+    /** Asks every thread to clear its histograms the next time it records */
+    void reset();
+
+    /** Number of timing slots: the most threads that have been recording at the same time */
+    int getNumThreads();
+
+    /** Whether timing scopes were compiled in */
+    constexpr bool isEnabled() { return UG3_INSTRUMENTATION != 0; }
+
+    /** Times the enclosing scope with the steady clock */
+    class ScopedStageTimer
+    {
+    public:
+        explicit ScopedStageTimer(Stage stage_) : stage(stage_), start(std::chrono::steady_clock::now()) {}
+
+        ~ScopedStageTimer()
+        {
+            auto elapsed = std::chrono::steady_clock::now() - start;
+            record(stage, uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()));
+        }
+
+        ScopedStageTimer(const ScopedStageTimer&) = delete;
+        ScopedStageTimer& operator=(const ScopedStageTimer&) = delete;
+
+    private:
+        Stage stage;
+        std::chrono::steady_clock::time_point start;
+    };
+}
+
+#define UG3_INSTRUMENTATION_JOIN_(a, b) a##b
+#define UG3_INSTRUMENTATION_JOIN(a, b) UG3_INSTRUMENTATION_JOIN_(a, b)
+
+#if UG3_INSTRUMENTATION
+/** Times the rest of the enclosing scope, e.g. UG3_TIME_SCOPE(PROCESS); */
+#define UG3_TIME_SCOPE(stageName) \
+    Instrumentation::ScopedStageTimer UG3_INSTRUMENTATION_JOIN(ug3StageTimer_, __LINE__)(Instrumentation::Stage::stageName)
+#else
+#define UG3_TIME_SCOPE(stageName)
+#endif
+
+#endif /* Instrumentation_h */
@@ -0,0 +1,267 @@
+//
+//  PropagationEstimator.h
+//  ug3-electrode-viewer
+//
+
+#ifndef PropagationEstimator_h
+#define PropagationEstimator_h
+
+#include <cmath>
+#include <limits>
+
+#include "ElectrodeBaseline.h"
+#include "SpatialFilter.h"
+
+/** One arrow of the decimated propagation field */
+struct PropagationArrow {
+    //centre of the block of sites the arrow summarizes, in grid sites
+    float x;
+    float y;
+    //unit vector pointing the way the activity travels
+    float directionX;
+    float directionY;
+    //in sites per second
+    float speed;
+};
+
+struct PropagationLimits {
+    //z-score a site must exceed for an excursion to count as an event
+    float threshold = 3.0f;
+    //neighbouring peaks further apart than this belong to different events, in seconds
+    float maximumLag = 0.2f;
+    //peaks older than this no longer contribute to the field, in seconds
+    float eventWindow = 1.0f;
+    //how quickly the per-site baseline forgets, in seconds
+    float baselineTimeConstant = 5.0f;
+    //one arrow is kept per decimation x decimation block of sites
+    int decimation = 4;
+};
+
+/**
+    Estimates the direction and speed of activity travelling across the electrode grid
+    from peak latencies. Each site's value is scored against its own running baseline;
+    every excursion above the threshold records the time of its peak. The gradient of
+    those peak times over the grid neighbours points the way the activity travels, and
+    its inverse length is the speed.
+
+    Only neighbours whose peaks are within maximumLag of each other are differenced, so
+    unrelated events don't produce a gradient. The per-site gradients are averaged over
+    blocks of sites to give a sparse arrow field for drawing.
+
+    A peak can only be placed at the time of a frame, so latencies are resolved to the
+    frame spacing. The canvas feeds one frame per refresh (every 16 to 250 ms), which
+    limits it to waves that take at least a few refreshes to cross the grid.
+*/
+class PropagationEstimator {
+public:
+    /** mappedSites has one entry per grid site (row major); empty means every site is mapped */
+    void setGrid(int cols_, int rows_, const std::vector<uint8_t>& mappedSites) {
+        cols = std::max(0, cols_);
+        rows = std::max(0, rows_);
+        usable.setGrid(cols * rows, mappedSites);
+        const int numSites = cols * rows;
+        frame.assign(numSites, 0.0f);
+        baseline.resize(numSites);
+        excursionPeak.assign(numSites, 0.0f);
+        excursionTime.assign(numSites, 0.0);
+        isInExcursion.assign(numSites, 0);
+        peakTime.assign(numSites, noPeak);
+        gradientX.assign(numSites, 0.0f);
+        gradientY.assign(numSites, 0.0f);
+        hasGradient.assign(numSites, 0);
+        reset();
+    }
+
+    void setLimits(const PropagationLimits& limits_) {
+        limits = limits_;
+        limits.decimation = std::max(1, limits.decimation);
+    }
+
+    const PropagationLimits& getLimits() const { return limits; }
+
+    /** Forgets the baseline and every recorded peak */
+    void reset() {
+        baseline.reset();
+        hasFrame = false;
+        std::fill(isInExcursion.begin(), isInExcursion.end(), uint8_t(0));
+        std::fill(peakTime.begin(), peakTime.end(), noPeak);
+        arrows.clear();
+    }
+
+    int getNumSites() const { return cols * rows; }
+
+    /**
+        Adds one frame taken at timeSeconds. values holds numValues entries indexed like
+        the grid; flags (may be null) marks sites to leave out. Frames must arrive in time
+        order; the spacing between them sets the latency resolution.
+    */
+    void addFrame(const float* values, int numValues, const uint8_t* flags, int numFlags, double timeSeconds) {
+        const int numSites = getNumSites();
+        if (numSites == 0 || values == nullptr) {
+            return;
+        }
+
+        const int numCopied = std::min(numValues, numSites);
+        std::copy(values, values + numCopied, frame.begin());
+        std::fill(frame.begin() + numCopied, frame.end(), 0.0f);
+        usable.update(numValues, flags, numFlags);
+
+        //Stream time starts from 0 again when acquisition restarts
+        if (hasFrame && timeSeconds < lastTime) {
+            reset();
+        }
+        const double elapsed = hasFrame ? timeSeconds - lastTime : 0.0;
+        if (elapsed <= 0.0) {
+            //The first frame only seeds the baseline; a repeated timestamp adds nothing
+            if (!hasFrame) {
+                baseline.update(frame.data(), 1.0f);
+                hasFrame = true;
+                lastTime = timeSeconds;
+            }
+            return;
+        }
+        lastTime = timeSeconds;
+
+        baseline.update(frame.data(), ElectrodeBaseline::getAlpha(float(elapsed), limits.baselineTimeConstant));
+        detectPeaks(timeSeconds);
+        computeGradients(timeSeconds);
+        decimate();
+    }
+
+    const std::vector<PropagationArrow>& getArrows() const { return arrows; }
+
+    /** Time of each site's latest peak in seconds, or a large negative value if it has none */
+    const double* getPeakTimes() const { return peakTime.data(); }
+
+private:
+    static constexpr double noPeak = -std::numeric_limits<double>::max();
+
+    void detectPeaks(double now) {
+        const float* z = baseline.getZScores();
+        for (int i = 0; i < getNumSites(); i++) {
+            if (!usable[i]) {
+                isInExcursion[i] = 0;
+                continue;
+            }
+            if (z[i] > limits.threshold) {
+                if (!isInExcursion[i] || z[i] > excursionPeak[i]) {
+                    excursionPeak[i] = z[i];
+                    excursionTime[i] = now;
+                }
+                isInExcursion[i] = 1;
+            }
+            else if (isInExcursion[i]) {
+                //The peak is only known once the excursion has ended
+                isInExcursion[i] = 0;
+                peakTime[i] = excursionTime[i];
+            }
+        }
+    }
+
+    void computeGradients(double now) {
+        for (int y = 0; y < rows; y++) {
+            for (int x = 0; x < cols; x++) {
+                const int site = x + y * cols;
+                hasGradient[site] = 0;
+                if (!isRecentPeak(site, now)) {
+                    continue;
+                }
+                float dx, dy;
+                if (differentiate(site, x > 0 ? site - 1 : -1, x < cols - 1 ? site + 1 : -1, now, dx) &&
+                    differentiate(site, y > 0 ? site - cols : -1, y < rows - 1 ? site + cols : -1, now, dy)) {
+                    gradientX[site] = dx;
+                    gradientY[site] = dy;
+                    hasGradient[site] = 1;
+                }
+            }
+        }
+    }
+
+    /** Peak latency slope along one axis in seconds per site; central where both neighbours share the event */
+    bool differentiate(int site, int before, int after, double now, float& slope) const {
+        const bool hasBefore = isSameEvent(site, before, now);
+        const bool hasAfter = isSameEvent(site, after, now);
+        if (hasBefore && hasAfter) {
+            slope = float(0.5 * (peakTime[after] - peakTime[before]));
+        }
+        else if (hasAfter) {
+            slope = float(peakTime[after] - peakTime[site]);
+        }
+        else if (hasBefore) {
+            slope = float(peakTime[site] - peakTime[before]);
+        }
+        else {
+            return false;
+        }
+        return true;
+    }
+
+    bool isRecentPeak(int site, double now) const {
+        return usable[site] && now - peakTime[site] <= limits.eventWindow;
+    }
+
+    bool isSameEvent(int site, int neighbour, double now) const {
+        return neighbour >= 0 && isRecentPeak(neighbour, now) && std::abs(peakTime[neighbour] - peakTime[site]) <= limits.maximumLag;
+    }
+
+    void decimate() {
+        arrows.clear();
+        const int step = limits.decimation;
+        for (int blockY = 0; blockY < rows; blockY += step) {
+            for (int blockX = 0; blockX < cols; blockX += step) {
+                const int blockCols = std::min(step, cols - blockX);
+                const int blockRows = std::min(step, rows - blockY);
+                float sumX = 0.0f;
+                float sumY = 0.0f;
+                int count = 0;
+                for (int y = blockY; y < blockY + blockRows; y++) {
+                    for (int x = blockX; x < blockX + blockCols; x++) {
+                        const int site = x + y * cols;
+                        if (hasGradient[site]) {
+                            sumX += gradientX[site];
+                            sumY += gradientY[site];
+                            count++;
+                        }
+                    }
+                }
+
+                //A block needs a quarter of its sites to agree on an event before it gets an arrow
+                if (count == 0 || 4 * count < blockCols * blockRows) {
+                    continue;
+                }
+                const float meanX = sumX / float(count);
+                const float meanY = sumY / float(count);
+                const float slowness = std::sqrt(meanX * meanX + meanY * meanY);
+                //Peaks that land in the same frame everywhere have no measurable direction
+                if (slowness <= 0.0f) {
+                    continue;
+                }
+                arrows.push_back({ float(blockX) + 0.5f * float(blockCols - 1), float(blockY) + 0.5f * float(blockRows - 1),
+                                   meanX / slowness, meanY / slowness, 1.0f / slowness });
+            }
+        }
+    }
+
+    int cols = 0;
+    int rows = 0;
+    PropagationLimits limits;
+
+    UsableSites usable;
+    ElectrodeBaseline baseline;
+    std::vector<float> frame;
+    bool hasFrame = false;
+    double lastTime = 0.0;
+
+    std::vector<float> excursionPeak;
+    std::vector<double> excursionTime;
+    std::vector<uint8_t> isInExcursion;
+    std::vector<double> peakTime;
+
+    std::vector<float> gradientX;
+    std::vector<float> gradientY;
+    std::vector<uint8_t> hasGradient;
+
+    std::vector<PropagationArrow> arrows;
+};
+
+#endif /* PropagationEstimator_h */
@@ -0,0 +1,83 @@
+//
+//  PropagationWorker.cpp
+//  ug3-electrode-viewer
+//
+
+#include "PropagationWorker.h"
+#include "Instrumentation.h"
+
+PropagationWorker::PropagationWorker() : Thread("UG3 Propagation"), pendingTime(0.0), hasPendingFrame(false), pendingCols(0), pendingRows(0), hasPendingGrid(false), hasNewArrows(false) {}
+
+PropagationWorker::~PropagationWorker() {
+    stopThread(1000);
+}
+
+void PropagationWorker::setGrid(int cols, int rows, const std::vector<uint8_t>& mappedSites) {
+    const ScopedLock sl(lock);
+    pendingCols = cols;
+    pendingRows = rows;
+    pendingMappedSites = mappedSites;
+    hasPendingGrid = true;
+    //Frames taken against the old grid don't index the new one
+    hasPendingFrame = false;
+}
+
+void PropagationWorker::submitFrame(const float* values_, int numValues, const uint8_t* flags_, int numFlags, double timeSeconds) {
+    {
+        const ScopedLock sl(lock);
+        pendingValues.assign(values_, values_ + std::max(0, numValues));
+        if (flags_ != nullptr) {
+            pendingFlags.assign(flags_, flags_ + std::max(0, numFlags));
+        }
+        else {
+            pendingFlags.clear();
+        }
+        pendingTime = timeSeconds;
+        hasPendingFrame = true;
+    }
+    notify();
+}
+
+bool PropagationWorker::getArrows(std::vector<PropagationArrow>& arrows) {
+    const ScopedLock sl(lock);
+    if (!hasNewArrows) {
+        return false;
+    }
+    arrows = publishedArrows;
+    hasNewArrows = false;
+    return true;
+}
+
+void PropagationWorker::run() {
+    while (!threadShouldExit()) {
+        wait(100);
+
+        double time;
+        {
+            const ScopedLock sl(lock);
+            if (hasPendingGrid) {
+                estimator.setGrid(pendingCols, pendingRows, pendingMappedSites);
+                hasPendingGrid = false;
+                publishedArrows.clear();
+                hasNewArrows = true;
+            }
+            if (!hasPendingFrame) {
+                continue;
+            }
+            //Swapping hands the worker's old buffers back, so neither side allocates once warmed up
+            std::swap(values, pendingValues);
+            std::swap(flags, pendingFlags);
+            time = pendingTime;
+            hasPendingFrame = false;
+        }
+
+        {
+            UG3_TIME_SCOPE(PROPAGATION);
+            estimator.addFrame(values.data(), int(values.size()), flags.empty() ? nullptr : flags.data(), int(flags.size()), time);
+        }
+
+        const ScopedLock sl(lock);
+        publishedArrows = estimator.getArrows();
+        hasNewArrows = true;
+    }
+}
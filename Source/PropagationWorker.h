@@ -0,0 +1,64 @@
+//
+//  PropagationWorker.h
+//  ug3-electrode-viewer
+//
+
+#ifndef PropagationWorker_h
+#define PropagationWorker_h
+
+#include <VisualizerWindowHeaders.h>
+
+#include "PropagationEstimator.h"
+
+/**
+    Runs a PropagationEstimator on its own thread. The message thread hands over the
+    latest frame and picks up the latest arrow field, both under a short lock that only
+    covers copying; all of the peak detection and gradient work happens here.
+
+    Only the newest frame is kept, so if the estimator falls behind, frames are dropped
+    rather than queued, and the latency resolution drops with them.
+*/
+class PropagationWorker : public Thread {
+public:
+    PropagationWorker();
+
+    ~PropagationWorker() override;
+
+    /** Takes effect before the next frame is processed; forgets all recorded peaks */
+    void setGrid(int cols, int rows, const std::vector<uint8_t>& mappedSites);
+
+    /** Queues a frame, replacing any frame the worker hasn't picked up yet */
+    void submitFrame(const float* values, int numValues, const uint8_t* flags, int numFlags, double timeSeconds);
+
+    /** Copies the newest arrow field; returns false if it hasn't changed since the last call */
+    bool getArrows(std::vector<PropagationArrow>& arrows);
+
+    void run() override;
+
+private:
+    CriticalSection lock;
+
+    //Handed over from the message thread
+    std::vector<float> pendingValues;
+    std::vector<uint8_t> pendingFlags;
+    double pendingTime;
+    bool hasPendingFrame;
+
+    int pendingCols;
+    int pendingRows;
+    std::vector<uint8_t> pendingMappedSites;
+    bool hasPendingGrid;
+
+    //Owned by the worker thread
+    PropagationEstimator estimator;
+    std::vector<float> values;
+    std::vector<uint8_t> flags;
+
+    //Handed back to the message thread
+    std::vector<PropagationArrow> publishedArrows;
+    bool hasNewArrows;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(PropagationWorker);
+};
+
+#endif /* PropagationWorker_h */
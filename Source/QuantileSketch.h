@@ -0,0 +1,274 @@
+//
+//  QuantileSketch.h
+//  ug3-electrode-viewer
+//
+
+#ifndef QuantileSketch_h
+#define QuantileSketch_h
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+/**
+    Streaming estimate of a single quantile using the P-square algorithm
+    (Jain & Chlamtac, 1985). Keeps five markers, so each value costs O(1)
+    and nothing is ever sorted beyond the first five values.
+*/
+class P2Quantile {
+public:
+    explicit P2Quantile(double quantile_ = 0.5) : quantile(quantile_) {
+        reset();
+    }
+
+    void reset() {
+        count = 0;
+    }
+
+    void add(double x) {
+        if (count < 5) {
+            heights[count++] = x;
+            if (count == 5) {
+                std::sort(heights, heights + 5);
+                for (int i = 0; i < 5; i++) {
+                    positions[i] = i;
+                }
+                desired[0] = 0.0;
+                desired[1] = 2.0 * quantile;
+                desired[2] = 4.0 * quantile;
+                desired[3] = 2.0 + 2.0 * quantile;
+                desired[4] = 4.0;
+            }
+            return;
+        }
+
+        //Find the cell holding x, stretching the outer markers if needed
+        int cell;
+        if (x < heights[0]) {
+            heights[0] = x;
+            cell = 0;
+        }
+        else if (x >= heights[4]) {
+            heights[4] = x;
+            cell = 3;
+        }
+        else {
+            cell = 0;
+            while (x >= heights[cell + 1]) {
+                cell++;
+            }
+        }
+
+        for (int i = cell + 1; i < 5; i++) {
+            positions[i]++;
+        }
+        desired[1] += quantile / 2.0;
+        desired[2] += quantile;
+        desired[3] += (1.0 + quantile) / 2.0;
+        desired[4] += 1.0;
+        count++;
+
+        //Nudge the three inner markers towards their desired positions
+        for (int i = 1; i <= 3; i++) {
+            const double offset = desired[i] - positions[i];
+            if ((offset >= 1.0 && positions[i + 1] - positions[i] > 1) || (offset <= -1.0 && positions[i - 1] - positions[i] < -1)) {
+                const int step = offset > 0.0 ? 1 : -1;
+                const double candidate = parabolic(i, step);
+                if (heights[i - 1] < candidate && candidate < heights[i + 1]) {
+                    heights[i] = candidate;
+                }
+                else {
+                    heights[i] = linear(i, step);
+                }
+                positions[i] += step;
+            }
+        }
+    }
+
+    bool hasValue() const { return count > 0; }
+
+    double getValue() const {
+        if (count >= 5) {
+            return heights[2];
+        }
+        if (count == 0) {
+            return 0.0;
+        }
+        //Too few values for the markers; fall back to the exact answer
+        double sorted[5];
+        for (int i = 0; i < count; i++) {
+            int j = i;
+            for (; j > 0 && sorted[j - 1] > heights[i]; j--) {
+                sorted[j] = sorted[j - 1];
+            }
+            sorted[j] = heights[i];
+        }
+        return sorted[int(std::lround(quantile * (count - 1)))];
+    }
+
+private:
+    double parabolic(int i, int step) const {
+        const double left = positions[i] - positions[i - 1];
+        const double right = positions[i + 1] - positions[i];
+        return heights[i] + double(step) / double(positions[i + 1] - positions[i - 1])
+            * ((left + step) * (heights[i + 1] - heights[i]) / right
+               + (right - step) * (heights[i] - heights[i - 1]) / left);
+    }
+
+    double linear(int i, int step) const {
+        return heights[i] + step * (heights[i + step] - heights[i]) / double(positions[i + step] - positions[i]);
+    }
+
+    double quantile;
+    int count;
+    double heights[5];
+    int positions[5];
+    double desired[5];
+};
+
+
+/**
+    Colour range that follows the lower and upper quantiles of each frame.
+    The per-frame quantiles are smoothed, and the published range only moves
+    when the smoothed range leaves it or shrinks well inside it, so the colour
+    bar doesn't flicker from frame to frame.
+*/
+class AutoRange {
+public:
+    AutoRange(double lowerQuantile = 0.01, double upperQuantile = 0.99, float hysteresis_ = 0.1f, float smoothing_ = 0.2f)
+        : lowerSketch(lowerQuantile), upperSketch(upperQuantile), hysteresis(hysteresis_), smoothing(smoothing_) {
+        reset();
+    }
+
+    void reset() {
+        hasRange = false;
+        lower = 0.0f;
+        upper = 0.0f;
+        smoothedLower = 0.0f;
+        smoothedUpper = 0.0f;
+    }
+
+    /**
+        Feeds one frame of values; returns true if the published range changed.
+        Values whose entry in exclude is non-zero (e.g. flagged channels) are skipped.
+    */
+    bool update(const float* values, int numValues, const uint8_t* exclude = nullptr) {
+        if (numValues <= 0) {
+            return false;
+        }
+
+        lowerSketch.reset();
+        upperSketch.reset();
+
+        //Electrodes are stored in grid order, and neighbouring sites are strongly correlated.
+        //P-square assumes no particular order, so walk the frame with a stride coprime to its length.
+        const int stride = getStride(numValues);
+        int index = 0;
+        for (int i = 0; i < numValues; i++) {
+            const float value = values[index];
+            if (std::isfinite(value) && (exclude == nullptr || exclude[index] == 0)) {
+                lowerSketch.add(value);
+                upperSketch.add(value);
+            }
+            index += stride;
+            if (index >= numValues) {
+                index -= numValues;
+            }
+        }
+
+        if (!lowerSketch.hasValue()) {
+            return false;
+        }
+
+        const float frameLower = float(lowerSketch.getValue());
+        const float frameUpper = float(upperSketch.getValue());
+
+        if (!hasRange) {
+            smoothedLower = frameLower;
+            smoothedUpper = frameUpper;
+            const float headroom = hysteresis * (frameUpper - frameLower) / 2.0f;
+            publish(frameLower - headroom, frameUpper + headroom);
+            hasRange = true;
+            return true;
+        }
+
+        smoothedLower += smoothing * (frameLower - smoothedLower);
+        smoothedUpper += smoothing * (frameUpper - smoothedUpper);
+
+        const float band = hysteresis * (upper - lower);
+        float newLower = lower;
+        float newUpper = upper;
+
+        //Grow straight away with some headroom, shrink only once well inside the range
+        if (smoothedLower < lower) {
+            newLower = smoothedLower - band / 2.0f;
+        }
+        else if (smoothedLower > lower + band) {
+            newLower = smoothedLower;
+        }
+
+        if (smoothedUpper > upper) {
+            newUpper = smoothedUpper + band / 2.0f;
+        }
+        else if (smoothedUpper < upper - band) {
+            newUpper = smoothedUpper;
+        }
+
+        if (newLower == lower && newUpper == upper) {
+            return false;
+        }
+        publish(newLower, newUpper);
+        return true;
+    }
+
+    bool isValid() const { return hasRange; }
+
+    float getLower() const { return lower; }
+
+    float getUpper() const { return upper; }
+
+private:
+    //Keeps flat frames (e.g. all zero) from collapsing the range to nothing
+    static constexpr float minimumSpan = 1.0f;
+
+    void publish(float newLower, float newUpper) {
+        if (newUpper - newLower < minimumSpan) {
+            const float centre = (newLower + newUpper) / 2.0f;
+            newLower = centre - minimumSpan / 2.0f;
+            newUpper = centre + minimumSpan / 2.0f;
+        }
+        lower = newLower;
+        upper = newUpper;
+    }
+
+    static int getStride(int numValues) {
+        //Roughly the golden ratio of the length, bumped until it shares no factor with it
+        int stride = std::max(1, int(numValues * 0.618));
+        while (gcd(stride, numValues) != 1) {
+            stride++;
+        }
+        return stride;
+    }
+
+    static int gcd(int a, int b) {
+        while (b != 0) {
+            const int t = a % b;
+            a = b;
+            b = t;
+        }
+        return a;
+    }
+
+    P2Quantile lowerSketch;
+    P2Quantile upperSketch;
+    float hysteresis;
+    float smoothing;
+
+    bool hasRange;
+    float lower;
+    float upper;
+    float smoothedLower;
+    float smoothedUpper;
+};
+
+#endif /* QuantileSketch_h */
@@ -0,0 +1,137 @@
+//
+//  RefreshScheduler.h
+//  ug3-electrode-viewer
+//
+
+#ifndef RefreshScheduler_h
+#define RefreshScheduler_h
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+/**
+    Decides when the canvas draws and how often its timer fires.
+
+    A tick only produces a frame when the processor's frame sequence number has moved
+    on, or something on screen was changed. The timer rate follows the rate new data
+    arrives at, up to the display's refresh rate. It is capped so that rendering and
+    painting take at most half of each frame interval, and it drops to the minimum rate
+    when data stops arriving or the canvas isn't visible.
+*/
+class RefreshScheduler {
+public:
+    RefreshScheduler() {
+        reset(0.0);
+    }
+
+    void setRateLimits(float minimumRate_, float maximumRate_) {
+        minimumRate = std::max(1.0f, minimumRate_);
+        maximumRate = std::max(minimumRate, maximumRate_);
+        rate = std::min(std::max(rate, minimumRate), maximumRate);
+    }
+
+    /** Starts over at the maximum rate, as if data were arriving at least that fast */
+    void reset(double nowSeconds) {
+        rate = maximumRate;
+        dataRate = maximumRate;
+        renderCostSeconds = 0.0;
+        paintCostSeconds = 0.0;
+        hasWindow = false;
+        windowStartSeconds = nowSeconds;
+        windowStartSequence = 0;
+        hasRenderedSequence = false;
+        renderedSequence = 0;
+        isDirty = true;
+    }
+
+    /** Called on every timer tick with the processor's frame sequence number; returns true if a frame should be drawn */
+    bool tick(double nowSeconds, uint64_t frameSequence) {
+        if (!hasWindow || frameSequence < windowStartSequence) {
+            hasWindow = true;
+            windowStartSeconds = nowSeconds;
+            windowStartSequence = frameSequence;
+        }
+        else if (nowSeconds - windowStartSeconds >= rateWindowSeconds) {
+            dataRate = float(double(frameSequence - windowStartSequence) / (nowSeconds - windowStartSeconds));
+            windowStartSeconds = nowSeconds;
+            windowStartSequence = frameSequence;
+        }
+
+        updateRate();
+
+        if (!isDirty && hasRenderedSequence && frameSequence == renderedSequence) {
+            return false;
+        }
+        hasRenderedSequence = true;
+        renderedSequence = frameSequence;
+        isDirty = false;
+        return true;
+    }
+
+    /** Makes the next tick draw even if there is no new data, e.g. after a display setting changed */
+    void invalidate() {
+        isDirty = true;
+    }
+
+    void setVisible(bool isVisible_) {
+        isVisible = isVisible_;
+    }
+
+    /** Time the renderer spent on the last frame */
+    void recordRenderCost(double seconds) {
+        renderCostSeconds += costSmoothing * (seconds - renderCostSeconds);
+    }
+
+    /** Time the last paint took on the message thread */
+    void recordPaintCost(double seconds) {
+        paintCostSeconds += costSmoothing * (seconds - paintCostSeconds);
+    }
+
+    /** Rate the timer should run at, in Hz */
+    float getRate() const { return rate; }
+
+    /** Rate new frames have been arriving from the processor, in Hz */
+    float getDataRate() const { return dataRate; }
+
+private:
+    //Rendering and painting may use this fraction of each frame interval
+    static constexpr double frameBudget = 0.5;
+    static constexpr double costSmoothing = 0.2;
+    static constexpr double rateWindowSeconds = 0.5;
+    //The timer is only restarted when the rate moves by more than this fraction
+    static constexpr float rateHysteresis = 0.15f;
+
+    void updateRate() {
+        float target = minimumRate;
+        if (isVisible) {
+            //Render and paint run on different threads, so the slower of the two sets the pace
+            const double cost = std::max(renderCostSeconds, paintCostSeconds);
+            const float affordableRate = cost > 0.0 ? float(frameBudget / cost) : maximumRate;
+            target = std::min({ maximumRate, affordableRate, std::ceil(dataRate) });
+            target = std::max(minimumRate, target);
+        }
+        if (std::abs(target - rate) > rateHysteresis * rate) {
+            rate = target;
+        }
+    }
+
+    float minimumRate = 4.0f;
+    float maximumRate = 60.0f;
+    float rate = 60.0f;
+    float dataRate = 60.0f;
+    bool isVisible = true;
+
+    double renderCostSeconds = 0.0;
+    double paintCostSeconds = 0.0;
+
+    bool hasWindow = false;
+    double windowStartSeconds = 0.0;
+    uint64_t windowStartSequence = 0;
+
+    bool hasRenderedSequence = false;
+    uint64_t renderedSequence = 0;
+    bool isDirty = true;
+};
+
+#endif /* RefreshScheduler_h */
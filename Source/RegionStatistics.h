@@ -0,0 +1,102 @@
+//
+//  RegionStatistics.h
+//  ug3-electrode-viewer
+//
+
+#ifndef RegionStatistics_h
+#define RegionStatistics_h
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "ChannelHealth.h"
+
+/** One frame of a region's statistics; flagged sites are left out of all of them */
+struct RegionStats {
+    float mean = 0.0f;
+    float rms = 0.0f;
+    float max = 0.0f;
+    //sites whose magnitude is at or above the active level
+    int activeSites = 0;
+    //sites that went into the statistics
+    int usedSites = 0;
+};
+
+/**
+    Per-frame statistics for any number of regions of interest. Each region is
+    compiled once into a sorted list of indices into the visual buffer, so a frame
+    only visits the sites inside the regions and costs nothing for the rest of the
+    array. Regions may overlap.
+*/
+class RegionStatistics {
+public:
+    /** Replaces the regions; indices outside the visual buffer are skipped when a frame is added */
+    void setRegions(const std::vector<std::vector<int>>& regions) {
+        siteOffsets.assign(1, 0);
+        sites.clear();
+        for (const std::vector<int>& region : regions) {
+            std::vector<int> sorted = region;
+            std::sort(sorted.begin(), sorted.end());
+            sorted.erase(std::unique(sorted.begin(), sorted.end()), sorted.end());
+            sorted.erase(sorted.begin(), std::lower_bound(sorted.begin(), sorted.end(), 0));
+            sites.insert(sites.end(), sorted.begin(), sorted.end());
+            siteOffsets.push_back(int(sites.size()));
+        }
+        stats.assign(regions.size(), RegionStats());
+    }
+
+    int getNumRegions() const { return int(stats.size()); }
+
+    /** Number of sites in a region after compiling */
+    int getRegionSize(int region) const { return siteOffsets[region + 1] - siteOffsets[region]; }
+
+    /** Magnitude at or above which a site counts as active */
+    void setActiveLevel(float activeLevel_) { activeLevel = activeLevel_; }
+
+    void update(const float* values, int numValues, const uint8_t* flags, int numFlags) {
+        for (int region = 0; region < getNumRegions(); region++) {
+            double sum = 0.0;
+            double sumOfSquares = 0.0;
+            float max = 0.0f;
+            int active = 0;
+            int used = 0;
+            for (int i = siteOffsets[region]; i < siteOffsets[region + 1]; i++) {
+                const int site = sites[i];
+                //Sites are sorted, so the rest of the region is outside the buffer too
+                if (site >= numValues) {
+                    break;
+                }
+                if (flags != nullptr && site < numFlags && flags[site] != HEALTHY) {
+                    continue;
+                }
+                const float value = values[site];
+                max = used == 0 ? value : std::max(max, value);
+                sum += value;
+                sumOfSquares += double(value) * value;
+                active += std::abs(value) >= activeLevel ? 1 : 0;
+                used++;
+            }
+
+            RegionStats& regionStats = stats[region];
+            regionStats.usedSites = used;
+            regionStats.activeSites = active;
+            regionStats.max = max;
+            regionStats.mean = used > 0 ? float(sum / used) : 0.0f;
+            regionStats.rms = used > 0 ? float(std::sqrt(sumOfSquares / used)) : 0.0f;
+        }
+    }
+
+    /** Statistics of the last frame, one per region in the order they were given */
+    const std::vector<RegionStats>& getStats() const { return stats; }
+
+private:
+    //All regions' sites back to back; region r is sites[siteOffsets[r]] up to sites[siteOffsets[r + 1]]
+    std::vector<int> sites;
+    std::vector<int> siteOffsets = { 0 };
+    std::vector<RegionStats> stats;
+    float activeLevel = 100.0f;
+};
+
+#endif /* RegionStatistics_h */
@@ -0,0 +1,95 @@
+//
+//  RegionTracePanel.cpp
+//  ug3-electrode-viewer
+//
+
+#include "RegionTracePanel.h"
+
+const int RegionTracePanel::historyLength = 300;
+const int RegionTracePanel::legendWidth = 320;
+
+RegionTracePanel::RegionTracePanel() : writeIndex(0), numFrames(0) {}
+
+void RegionTracePanel::setRegions(const std::vector<RegionOfInterest>& regions) {
+    traces.clear();
+    for (const RegionOfInterest& region : regions) {
+        Trace trace;
+        trace.name = region.name;
+        trace.colour = region.colour;
+        trace.means.assign(historyLength, 0.0f);
+        traces.push_back(trace);
+    }
+    writeIndex = 0;
+    numFrames = 0;
+    repaint();
+}
+
+void RegionTracePanel::addFrame(const std::vector<RegionStats>& stats) {
+    //Statistics for a different set of regions, e.g. just after one was added
+    if (stats.size() != traces.size() || traces.empty()) {
+        return;
+    }
+    for (size_t i = 0; i < traces.size(); i++) {
+        traces[i].means[writeIndex] = stats[i].mean;
+        traces[i].latest = stats[i];
+    }
+    writeIndex = (writeIndex + 1) % historyLength;
+    numFrames = std::min(numFrames + 1, historyLength);
+}
+
+void RegionTracePanel::paint(Graphics& g) {
+    g.fillAll(Colours::black);
+    if (traces.empty()) {
+        return;
+    }
+
+    const juce::Rectangle<float> plot = getLocalBounds().withTrimmedRight(legendWidth).reduced(4).toFloat();
+
+    if (numFrames > 1 && plot.getWidth() > 0.0f) {
+        //All traces share one vertical scale so their levels can be compared
+        const int oldest = (writeIndex - numFrames + historyLength) % historyLength;
+        float lower = traces[0].means[oldest];
+        float upper = lower;
+        for (const Trace& trace : traces) {
+            for (int frame = 0; frame < numFrames; frame++) {
+                const float value = trace.means[(oldest + frame) % historyLength];
+                lower = std::min(lower, value);
+                upper = std::max(upper, value);
+            }
+        }
+        const float span = upper > lower ? upper - lower : 1.0f;
+        const float step = plot.getWidth() / float(historyLength - 1);
+
+        for (const Trace& trace : traces) {
+            Path path;
+            for (int frame = 0; frame < numFrames; frame++) {
+                //The newest frame is always at the right edge
+                const float x = plot.getRight() - float(numFrames - 1 - frame) * step;
+                const float y = plot.getBottom() - (trace.means[(oldest + frame) % historyLength] - lower) / span * plot.getHeight();
+                if (frame == 0) {
+                    path.startNewSubPath(x, y);
+                }
+                else {
+                    path.lineTo(x, y);
+                }
+            }
+            g.setColour(trace.colour);
+            g.strokePath(path, PathStrokeType(1.5f));
+        }
+
+        g.setColour(Colour(100, 100, 100));
+        g.setFont(12);
+        g.drawText(String(upper, 1) + " uV", plot.toNearestInt().removeFromTop(14), Justification::left);
+        g.drawText(String(lower, 1) + " uV", plot.toNearestInt().removeFromBottom(14), Justification::left);
+    }
+
+    g.setFont(14);
+    int height = 4;
+    for (const Trace& trace : traces) {
+        g.setColour(trace.colour);
+        g.drawText(trace.name + ": mean " + String(trace.latest.mean, 1) + " rms " + String(trace.latest.rms, 1) + " max " + String(trace.latest.max, 1)
+                   + " active " + String(trace.latest.activeSites) + "/" + String(trace.latest.usedSites),
+                   getWidth() - legendWidth, height, legendWidth - 4, 16, Justification::left);
+        height += 16;
+    }
+}
@@ -0,0 +1,58 @@
+//
+//  RegionTracePanel.h
+//  ug3-electrode-viewer
+//
+
+#ifndef RegionTracePanel_h
+#define RegionTracePanel_h
+
+#include <VisualizerWindowHeaders.h>
+
+#include "RegionStatistics.h"
+
+/** A region drawn on the display; sites are indices into the visual buffer */
+struct RegionOfInterest {
+    String name;
+    //in display coordinates
+    Path outline;
+    std::vector<int> sites;
+    Colour colour;
+};
+
+/**
+    Strip under the electrode display that plots each region's mean over the last
+    frames, with the newest mean, RMS, max and active site count beside it. Each
+    region keeps a fixed ring of values, so a frame costs one write per region.
+*/
+class RegionTracePanel : public Component {
+public:
+    RegionTracePanel();
+
+    /** Starts a new trace per region; the old history is dropped as it belongs to other regions */
+    void setRegions(const std::vector<RegionOfInterest>& regions);
+
+    /** Adds one frame of statistics, in the order the regions were given */
+    void addFrame(const std::vector<RegionStats>& stats);
+
+    void paint(Graphics& g) override;
+
+private:
+    struct Trace {
+        String name;
+        Colour colour;
+        std::vector<float> means;
+        RegionStats latest;
+    };
+
+    std::vector<Trace> traces;
+    //Ring position the next frame is written to, shared by all traces
+    int writeIndex;
+    int numFrames;
+
+    static const int historyLength;
+    static const int legendWidth;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(RegionTracePanel);
+};
+
+#endif /* RegionTracePanel_h */
@@ -0,0 +1,91 @@
+//
+//  SiteIndex.h
+//  ug3-electrode-viewer
+//
+
+#ifndef SiteIndex_h
+#define SiteIndex_h
+
+#include "FrameRasterizer.h"
+
+/**
+    Finds the site under a point of a layout in constant time, whatever the geometry. The
+    layout's area is cut into square cells as large as its largest site, and each cell lists
+    the sites overlapping it, so a lookup tests the few sites of one cell.
+*/
+class SiteIndex {
+public:
+    void build(const RenderLayout& layout) {
+        sites = layout.sites;
+        shapes = layout.siteShapes.size() == sites.size() ? layout.siteShapes : std::vector<SiteShape>();
+        cellSize = 1;
+        for (const juce::Rectangle<int>& r : sites) {
+            cellSize = std::max(cellSize, std::max(r.getWidth(), r.getHeight()));
+        }
+        bounds = juce::Rectangle<int>();
+        for (const juce::Rectangle<int>& r : sites) {
+            bounds = bounds.isEmpty() ? r : bounds.getUnion(r);
+        }
+        cols = (bounds.getWidth() + cellSize - 1) / cellSize;
+        rows = (bounds.getHeight() + cellSize - 1) / cellSize;
+
+        //Counted first, so every cell's sites are one contiguous run
+        cellStart.assign(size_t(cols) * rows + 1, 0);
+        forEachCell([this](int cell, int) { cellStart[cell + 1]++; });
+        for (size_t cell = 1; cell < cellStart.size(); cell++) {
+            cellStart[cell] += cellStart[cell - 1];
+        }
+        cellSites.resize(cellStart.back());
+        std::vector<int> next(cellStart.begin(), cellStart.end() - 1);
+        forEachCell([this, &next](int cell, int site) { cellSites[next[cell]++] = site; });
+    }
+
+    /** The site drawn at (x, y), or -1 if there is none */
+    int findSite(int x, int y) const {
+        if (!bounds.contains(x, y)) {
+            return -1;
+        }
+        const int cell = (y - bounds.getY()) / cellSize * cols + (x - bounds.getX()) / cellSize;
+        for (int k = cellStart[cell]; k < cellStart[cell + 1]; k++) {
+            const int site = cellSites[k];
+            const juce::Rectangle<int>& r = sites[site];
+            if (!r.contains(x, y)) {
+                continue;
+            }
+            int left, right;
+            getSiteSpan(shapes.empty() ? SiteShape::RECTANGLE : shapes[site], r.getWidth(), r.getHeight(), y - r.getY(), left, right);
+            if (x - r.getX() >= left && x - r.getX() < right) {
+                return site;
+            }
+        }
+        return -1;
+    }
+
+private:
+    template <typename Function>
+    void forEachCell(Function function) const {
+        for (int site = 0; site < int(sites.size()); site++) {
+            const juce::Rectangle<int> r = sites[site].translated(-bounds.getX(), -bounds.getY());
+            if (r.isEmpty()) {
+                continue;
+            }
+            for (int row = r.getY() / cellSize; row <= (r.getBottom() - 1) / cellSize; row++) {
+                for (int col = r.getX() / cellSize; col <= (r.getRight() - 1) / cellSize; col++) {
+                    function(row * cols + col, site);
+                }
+            }
+        }
+    }
+
+    std::vector<juce::Rectangle<int>> sites;
+    std::vector<SiteShape> shapes;
+    juce::Rectangle<int> bounds;
+    int cellSize = 1;
+    int cols = 0;
+    int rows = 0;
+    //cellSites[cellStart[c] .. cellStart[c + 1]) are the sites overlapping cell c
+    std::vector<int> cellStart;
+    std::vector<int> cellSites;
+};
+
+#endif /* SiteIndex_h */
@@ -0,0 +1,214 @@
+//
+//  SpatialFilter.h
+//  ug3-electrode-viewer
+//
+
+#ifndef SpatialFilter_h
+#define SpatialFilter_h
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+/** Row-compressed sparse matrix; each frame costs one pass over the non-zero weights */
+class SparseMatrix {
+public:
+    void clear() {
+        rowStart.assign(1, 0);
+        columns.clear();
+        weights.clear();
+    }
+
+    /** Appends a weight to the row currently being built */
+    void add(int column, float weight) {
+        columns.push_back(column);
+        weights.push_back(weight);
+    }
+
+    /** Closes the row currently being built */
+    void endRow() {
+        rowStart.push_back(int(columns.size()));
+    }
+
+    int getNumRows() const { return int(rowStart.size()) - 1; }
+
+    size_t getNumNonZeros() const { return weights.size(); }
+
+    /** y = A * x; x must cover every column referenced by the matrix */
+    void multiply(const float* x, float* y) const {
+        const int numRows = getNumRows();
+        const int* cols = columns.data();
+        const float* w = weights.data();
+        for (int row = 0; row < numRows; row++) {
+            float sum = 0.0f;
+            for (int k = rowStart[row]; k < rowStart[row + 1]; k++) {
+                sum += w[k] * x[cols[k]];
+            }
+            y[row] = sum;
+        }
+    }
+
+private:
+    std::vector<int> rowStart = { 0 };
+    std::vector<int> columns;
+    std::vector<float> weights;
+};
+
+/**
+    Tracks which grid sites hold a usable value: a channel is mapped to the site, the
+    frame covers it and it isn't flagged bad. Operators over the grid are rebuilt
+    whenever this set changes.
+*/
+class UsableSites {
+public:
+    /** mappedSites has one entry per grid site (row major); empty means every site is mapped */
+    void setGrid(int numSites, const std::vector<uint8_t>& mappedSites_) {
+        mappedSites = mappedSites_;
+        if (int(mappedSites.size()) != numSites) {
+            mappedSites.assign(numSites, 1);
+        }
+        usable.clear();
+    }
+
+    /** Returns true if the usable set differs from the last call */
+    bool update(int numValues, const uint8_t* flags, int numFlags) {
+        const int numSites = int(mappedSites.size());
+        bool changed = int(usable.size()) != numSites;
+        usable.resize(numSites);
+        for (int i = 0; i < numSites; i++) {
+            const uint8_t isUsable = mappedSites[i] && i < numValues && !(flags != nullptr && i < numFlags && flags[i] != 0);
+            changed |= usable[i] != isUsable;
+            usable[i] = isUsable;
+        }
+        return changed;
+    }
+
+    bool operator[](int site) const { return usable[site] != 0; }
+
+private:
+    std::vector<uint8_t> mappedSites;
+    std::vector<uint8_t> usable;
+};
+
+/**
+    Turns per-site values into a continuous field over the whole electrode grid.
+    Sites with no channel mapped to them, or flagged as bad, are filled from their
+    neighbours, and every site is smoothed with a Gaussian of the given width
+    (in sites) using normalized convolution over the valid sites only.
+
+    The weights depend only on the grid, the mapping and the set of bad sites, so
+    they are precomputed into a sparse matrix and each frame is one mat-vec.
+*/
+class SpatialFilter {
+public:
+    /** mappedSites has one entry per grid site (row major); empty means every site is mapped */
+    void setGrid(int cols_, int rows_, const std::vector<uint8_t>& mappedSites_) {
+        cols = std::max(0, cols_);
+        rows = std::max(0, rows_);
+        usable.setGrid(cols * rows, mappedSites_);
+        output.assign(cols * rows, 0.0f);
+        isDirty = true;
+    }
+
+    /** Gaussian width in sites; 0 only fills missing sites and leaves the others untouched */
+    void setSigma(float sigma_) {
+        if (sigma_ != sigma) {
+            sigma = std::max(0.0f, sigma_);
+            isDirty = true;
+        }
+    }
+
+    int getNumSites() const { return cols * rows; }
+
+    const SparseMatrix& getOperator() const { return weights; }
+
+    /**
+        Returns one value per grid site. values holds numValues entries indexed like the
+        grid; flags (may be null) marks sites to treat as missing. The operator is only
+        rebuilt when the set of usable sites changes.
+    */
+    const float* apply(const float* values, int numValues, const uint8_t* flags, int numFlags) {
+        const int numSites = getNumSites();
+        if (numSites == 0 || values == nullptr) {
+            return output.data();
+        }
+
+        const bool usableChanged = usable.update(numValues, flags, numFlags);
+        if (usableChanged || isDirty) {
+            rebuild();
+        }
+
+        weights.multiply(values, output.data());
+        return output.data();
+    }
+
+private:
+    //How far to look for a usable site when a missing one has none close by
+    static constexpr int maximumFillRadius = 8;
+
+    void rebuild() {
+        weights.clear();
+        const float width = sigma > 0.0f ? sigma : 1.0f;
+        const int smoothingRadius = std::max(1, int(std::ceil(2.0f * width)));
+
+        for (int y = 0; y < rows; y++) {
+            for (int x = 0; x < cols; x++) {
+                const int site = x + y * cols;
+                if (sigma == 0.0f && usable[site]) {
+                    weights.add(site, 1.0f);
+                    weights.endRow();
+                    continue;
+                }
+
+                //Widen the window until it holds a usable site, so isolated gaps still get filled
+                for (int radius = smoothingRadius; radius <= std::max(smoothingRadius, maximumFillRadius); radius *= 2) {
+                    if (addGaussianRow(x, y, radius, width)) {
+                        break;
+                    }
+                }
+                weights.endRow();
+            }
+        }
+        isDirty = false;
+    }
+
+    /** Adds the normalized Gaussian weights of the usable sites around (x, y); false if there are none */
+    bool addGaussianRow(int x, int y, int radius, float width) {
+        float total = 0.0f;
+        const float scale = -1.0f / (2.0f * width * width);
+        for (int pass = 0; pass < 2; pass++) {
+            for (int ny = std::max(0, y - radius); ny <= std::min(rows - 1, y + radius); ny++) {
+                for (int nx = std::max(0, x - radius); nx <= std::min(cols - 1, x + radius); nx++) {
+                    const int neighbour = nx + ny * cols;
+                    if (!usable[neighbour]) {
+                        continue;
+                    }
+                    const float distanceSquared = float((nx - x) * (nx - x) + (ny - y) * (ny - y));
+                    const float weight = std::exp(distanceSquared * scale);
+                    if (pass == 0) {
+                        total += weight;
+                    }
+                    else {
+                        weights.add(neighbour, weight / total);
+                    }
+                }
+            }
+            if (total <= 0.0f) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    int cols = 0;
+    int rows = 0;
+    float sigma = 1.0f;
+    bool isDirty = true;
+
+    UsableSites usable;
+    SparseMatrix weights;
+    std::vector<float> output;
+};
+
+#endif /* SpatialFilter_h */
@@ -0,0 +1,103 @@
+//
+//  SubselectionPublisher.h
+//  ug3-electrode-viewer
+//
+
+#ifndef SubselectionPublisher_h
+#define SubselectionPublisher_h
+
+#include <ProcessorHeaders.h>
+#include <functional>
+
+/** Block of electrodes picked for the LFP Viewer, as sent in its "filter" message */
+struct Subselection {
+    int start = 0;
+    int rows = 0;
+    int cols = 0;
+    int colsPerRow = 0;
+
+    bool operator==(const Subselection& other) const {
+        return start == other.start && rows == other.rows && cols == other.cols && colsPerRow == other.colsPerRow;
+    }
+
+    bool operator!=(const Subselection& other) const {
+        return !(*this == other);
+    }
+};
+
+/**
+    Coalesces subselection changes into at most one broadcast per interval.
+
+    A change arriving after a quiet interval is sent straight away. Changes within an
+    interval of the last send are held, and only the newest is sent when the interval
+    is up. A selection equal to the last one sent is never sent again. Message thread only.
+*/
+class SubselectionPublisher : private Timer {
+public:
+    using Sender = std::function<void(const Subselection&)>;
+
+    SubselectionPublisher(Sender send_, double intervalMs_) : send(std::move(send_)), intervalMs(intervalMs_), hasPending(false), hasSent(false), lastSendMs(0.0) {}
+
+    ~SubselectionPublisher() override {
+        stopTimer();
+    }
+
+    void publish(const Subselection& selection) {
+        publish(selection, Time::getMillisecondCounterHiRes());
+    }
+
+    /** publish() with the time given, for tests */
+    void publish(const Subselection& selection, double nowMs) {
+        pending = selection;
+        hasPending = true;
+        if (!sendIfDue(nowMs) && hasPending && !isTimerRunning()) {
+            startTimer(std::max(1, int(std::ceil(intervalMs - (nowMs - lastSendMs)))));
+        }
+    }
+
+    /** Sends the held selection if the interval since the last send is up; returns true if it was sent */
+    bool sendIfDue(double nowMs) {
+        if (!hasPending) {
+            return false;
+        }
+        if (hasSent && pending == lastSent) {
+            hasPending = false;
+            return false;
+        }
+        if (hasSent && nowMs - lastSendMs < intervalMs) {
+            return false;
+        }
+        hasPending = false;
+        hasSent = true;
+        lastSent = pending;
+        lastSendMs = nowMs;
+        send(lastSent);
+        return true;
+    }
+
+    bool hasPendingSelection() const {
+        return hasPending;
+    }
+
+private:
+    void timerCallback() override {
+        sendIfDue(Time::getMillisecondCounterHiRes());
+        if (!hasPending) {
+            stopTimer();
+        }
+    }
+
+    Sender send;
+    const double intervalMs;
+
+    Subselection pending;
+    bool hasPending;
+
+    Subselection lastSent;
+    bool hasSent;
+    double lastSendMs;
+
+    JUCE_DECLARE_NON_COPYABLE(SubselectionPublisher);
+};
+
+#endif /* SubselectionPublisher_h */
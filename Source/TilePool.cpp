@@ -0,0 +1,103 @@
+//
+//  TilePool.cpp
+//  ug3-electrode-viewer
+//
+
+#include "TilePool.h"
+
+TilePool::Worker::Worker(TilePool& pool, int queueIndex) : Thread("UG3 Tile Worker " + String(queueIndex)), pool(pool), queueIndex(queueIndex) {}
+
+void TilePool::Worker::run() {
+    while (!threadShouldExit()) {
+        if (wait(100)) {
+            pool.runTiles(queueIndex);
+        }
+    }
+}
+
+TilePool::TilePool(int numThreads) : tileFunction(nullptr), tilesLeft(0) {
+    numThreads = std::max(1, numThreads);
+    for (int i = 0; i < numThreads; i++) {
+        queues.push_back(std::make_unique<TileQueue>());
+    }
+    //Queue 0 belongs to the thread calling run()
+    for (int i = 1; i < numThreads; i++) {
+        workers.add(new Worker(*this, i));
+        workers.getLast()->startThread();
+    }
+}
+
+TilePool::~TilePool() {
+    for (Worker* worker : workers) {
+        worker->signalThreadShouldExit();
+        worker->notify();
+    }
+    for (Worker* worker : workers) {
+        worker->stopThread(1000);
+    }
+}
+
+void TilePool::run(int numTiles, const std::function<void(int)>& tileFunction_) {
+    if (numTiles <= 0) {
+        return;
+    }
+    if (queues.size() == 1) {
+        for (int tile = 0; tile < numTiles; tile++) {
+            tileFunction_(tile);
+        }
+        return;
+    }
+
+    tileFunction = &tileFunction_;
+    frameDone.reset();
+    tilesLeft.store(numTiles, std::memory_order_release);
+
+    //Neighbouring tiles go to the same thread, so a thread mostly walks one stretch of the image
+    const int numQueues = int(queues.size());
+    for (int q = 0; q < numQueues; q++) {
+        const ScopedLock sl(queues[q]->lock);
+        for (int tile = numTiles * q / numQueues; tile < numTiles * (q + 1) / numQueues; tile++) {
+            queues[q]->tiles.push_back(tile);
+        }
+    }
+    for (Worker* worker : workers) {
+        worker->notify();
+    }
+
+    runTiles(0);
+    frameDone.wait();
+    tileFunction = nullptr;
+}
+
+void TilePool::runTiles(int queueIndex) {
+    int tile;
+    while (takeTile(queueIndex, tile)) {
+        (*tileFunction)(tile);
+        if (tilesLeft.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            frameDone.signal();
+        }
+    }
+}
+
+bool TilePool::takeTile(int queueIndex, int& tile) {
+    {
+        TileQueue& own = *queues[queueIndex];
+        const ScopedLock sl(own.lock);
+        if (!own.tiles.empty()) {
+            tile = own.tiles.front();
+            own.tiles.pop_front();
+            return true;
+        }
+    }
+    const int numQueues = int(queues.size());
+    for (int offset = 1; offset < numQueues; offset++) {
+        TileQueue& victim = *queues[(queueIndex + offset) % numQueues];
+        const ScopedLock sl(victim.lock);
+        if (!victim.tiles.empty()) {
+            tile = victim.tiles.back();
+            victim.tiles.pop_back();
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,68 @@
+//
+//  TilePool.h
+//  ug3-electrode-viewer
+//
+
+#ifndef TilePool_h
+#define TilePool_h
+
+#include <VisualizerWindowHeaders.h>
+
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <vector>
+
+/**
+    A small work-stealing pool for splitting one frame into tiles. run() deals the tiles
+    out to one queue per thread, the calling thread included; each thread takes tiles
+    from the front of its own queue and, once that is empty, steals from the back of the
+    others', so a thread that drew cheap tiles helps with the expensive ones. run()
+    returns once every tile has run, which is the only synchronization the tiles get.
+*/
+class TilePool {
+public:
+    /** numThreads counts the calling thread, so 1 runs everything on the caller */
+    explicit TilePool(int numThreads);
+
+    ~TilePool();
+
+    int getNumThreads() const { return int(queues.size()); }
+
+    /** Calls tileFunction(tile) once for every tile in [0, numTiles); not reentrant */
+    void run(int numTiles, const std::function<void(int)>& tileFunction);
+
+private:
+    class Worker : public Thread {
+    public:
+        Worker(TilePool& pool, int queueIndex);
+
+        void run() override;
+
+    private:
+        TilePool& pool;
+        const int queueIndex;
+    };
+
+    struct TileQueue {
+        CriticalSection lock;
+        std::deque<int> tiles;
+    };
+
+    /** Runs tiles until none is left in any queue */
+    void runTiles(int queueIndex);
+
+    bool takeTile(int queueIndex, int& tile);
+
+    std::vector<std::unique_ptr<TileQueue>> queues;
+    OwnedArray<Worker> workers;
+
+    const std::function<void(int)>* tileFunction;
+    std::atomic<int> tilesLeft;
+    WaitableEvent frameDone;
+
+    JUCE_DECLARE_NON_COPYABLE(TilePool);
+};
+
+#endif /* TilePool_h */
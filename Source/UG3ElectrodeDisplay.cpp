@@ -7,6 +7,8 @@
 
 #include "UG3ElectrodeDisplay.h"
 #include "UG3ElectrodeViewerCanvas.h"
+#include "Instrumentation.h"
+#include "ChannelHealth.h"
 
 void Electrode::setColour(Colour c_)
 {
@@ -22,47 +24,25 @@ const Rectangle<int> Electrode::getRectangle() {
 }
 
 const int UG3ElectrodeDisplay::colorRangeSize = 32;
+const int UG3ElectrodeDisplay::numLayoutInfoLines = 5;
 
 
-UG3ElectrodeDisplay::UG3ElectrodeDisplay(UG3ElectrodeViewerCanvas* canvas, Viewport* viewport) : canvas(canvas), viewport(viewport), totalHeight(0), totalWidth(0), maxColorRangeText(""), minColorRangeText(""), isSubselectActive(false), numChannelsX(0), numChannelsY(0), subselectCorner(0), hoveredElectrode(0){
+UG3ElectrodeDisplay::UG3ElectrodeDisplay(UG3ElectrodeViewerCanvas* canvas, Viewport* viewport) : canvas(canvas), viewport(viewport), totalHeight(0), totalWidth(0), maxColorRangeText(""), minColorRangeText(""), isSubselectActive(false), numChannelsX(0), numChannelsY(0), subselectCorner(0), hoveredElectrode(0), isTelemetryOverlayVisible(false), numFlaggedChannels(0), isProbeLayout(false), isSiteLayout(false), isRegionDrawingActive(false){
     selectedColor = ColourScheme::getColourForNormalizedValue(.9);
 
     
 }
 
-void UG3ElectrodeDisplay::setGridLayout(int layoutMaxX, int layoutMaxY, std::vector<int> layout) {
-    int newTotalHeight = 0;
-    const int totalPixels = layoutMaxX * layoutMaxY;
-    int layoutIndex = 0;
-    newTotalHeight = TOP_BOUND;
+void UG3ElectrodeDisplay::createElectrodes() {
     electrodes.clear();
     colorRange.clear();
-        for (int i = 0; i < totalPixels; i++)
-    {
-        
-
-        int column = i % layoutMaxX;
-        int row = i / layoutMaxX;
-        int L = LEFT_BOUND + column * (WIDTH + SPACING);
-        int T = TOP_BOUND + row * (HEIGHT + SPACING);
-            
-        if(column == 0)
-            newTotalHeight += HEIGHT + SPACING;
-        
-        if(row == 0 && column == layoutMaxX - 1) {
-            totalWidth = L + WIDTH + SPACING;
-        }
-        
-        if(layout.size() == 0 || (layoutIndex < layout.size() && layout[layoutIndex] == i)) {
-            Electrode* e = new Electrode(Rectangle<int>(L, T, WIDTH, HEIGHT));
-            e -> setColour(selectedColor);
-            electrodes.add(e);
-            layoutIndex++;
-        }
+    for (const juce::Rectangle<int>& site : placement.sites) {
+        Electrode* e = new Electrode(site);
+        e -> setColour(selectedColor);
+        electrodes.add(e);
     }
-
-        
-    totalHeight = newTotalHeight + TOP_BOUND - SPACING;
+    totalWidth = placement.width;
+    totalHeight = placement.height;
     
     jassert(colorRangeSize > 1);
 
@@ -71,6 +51,13 @@ void UG3ElectrodeDisplay::setGridLayout(int layoutMaxX, int layoutMaxY, std::vec
         e->setColour(ColourScheme::getColourForNormalizedValue((float)(i) / float(colorRangeSize)));
         colorRange.add(e);
     }
+}
+
+void UG3ElectrodeDisplay::setGridLayout(int layoutMaxX, int layoutMaxY, std::vector<int> layout) {
+    isProbeLayout = false;
+    isSiteLayout = false;
+    placement = ElectrodeGeometry::placeGrid(layoutMaxX, layoutMaxY, layout);
+    createElectrodes();
     
     mouseListener = new DisplayMouseListener(this, layoutMaxY, layoutMaxX);
     mouseListener -> setBounds(0,0, getWidth(), getHeight());
@@ -79,54 +66,18 @@ void UG3ElectrodeDisplay::setGridLayout(int layoutMaxX, int layoutMaxY, std::vec
     
     numChannelsX = layoutMaxX;
     numChannelsY = layoutMaxY;
+    legendLayer.invalidate();
+    layoutInfoLayer.invalidate();
     
     repaint();
 
 }
 
 void UG3ElectrodeDisplay::setProbeLayout(int layoutX, int layoutY, int probeCols) {
-    int newTotalHeight = 0;
-    const int totalPixels = layoutX * layoutY;
-    
-    newTotalHeight = TOP_BOUND;
-    electrodes.clear();
-    colorRange.clear();
-    
-    int electrodesPerProbe = layoutY * probeCols;
-    for (int i = 0; i < totalPixels; i++)
-    {
-        
-        int probeIndex = i/electrodesPerProbe;
-        
-        int column = probeIndex * probeCols + i % probeCols;
-        int row = (i - probeIndex * electrodesPerProbe)/probeCols;
-        int L = LEFT_BOUND + column * (WIDTH + SPACING) + probeIndex * (WIDTH + SPACING);
-        int T = TOP_BOUND + row * (HEIGHT + SPACING);
-            
-        if(column == 0) {
-            newTotalHeight += HEIGHT + SPACING;
-        }
-        
-        if(row == 0 && column == layoutX - 1) {
-            totalWidth = L + WIDTH + SPACING;
-        }
-        
-        Electrode* e = new Electrode(Rectangle<int>(L, T, WIDTH, HEIGHT));
-        e -> setColour(selectedColor);
-        electrodes.add(e);
-        
-    }
-
-        
-    totalHeight = newTotalHeight + TOP_BOUND - SPACING;
-    
-    jassert(colorRangeSize > 1);
-
-    for (int i = 0; i < colorRangeSize; i++) {
-        Electrode* e = new Electrode(Rectangle<int>(totalWidth, totalHeight - TOP_BOUND - HEIGHT * (i + 1), WIDTH, HEIGHT));
-        e->setColour(ColourScheme::getColourForNormalizedValue((float)(i) / float(colorRangeSize)));
-        colorRange.add(e);
-    }
+    isProbeLayout = true;
+    isSiteLayout = false;
+    placement = ElectrodeGeometry::placeProbes(layoutX, layoutY, probeCols);
+    createElectrodes();
     
     mouseListener = new DisplayMouseListener(this, layoutX, layoutY);
     mouseListener -> setBounds(0,0, getWidth(), getHeight());
@@ -134,11 +85,38 @@ void UG3ElectrodeDisplay::setProbeLayout(int layoutX, int layoutY, int probeCols
     
     numChannelsX = layoutX;
     numChannelsY = layoutY;
+    legendLayer.invalidate();
+    layoutInfoLayer.invalidate();
     
     repaint();
 
 }
 
+void UG3ElectrodeDisplay::setSiteLayout(const std::vector<ElectrodeSite>& sites) {
+    isProbeLayout = false;
+    isSiteLayout = true;
+    //A subselection is a block of rows and columns, which these sites don't have
+    if(isSubselectActive) {
+        isSubselectActive = false;
+        updateSubselectedElectrodes(0, 0, 0, 0);
+    }
+    placement = ElectrodeGeometry::placeSites(sites);
+    siteIndex.build(placement);
+    createElectrodes();
+
+    mouseListener = new DisplayMouseListener(this, 1, int(sites.size()));
+    mouseListener -> setBounds(0,0, getWidth(), getHeight());
+    addAndMakeVisible(mouseListener);
+    mouseListener -> toFront(true);
+
+    numChannelsX = int(sites.size());
+    numChannelsY = 1;
+    legendLayer.invalidate();
+    layoutInfoLayer.invalidate();
+
+    repaint();
+}
+
 
 void UG3ElectrodeDisplay::resized() {
     
@@ -147,11 +125,57 @@ void UG3ElectrodeDisplay::resized() {
 }
 
 void UG3ElectrodeDisplay::paint(Graphics& g) {
+    UG3_TIME_SCOPE(DISPLAY_PAINT);
+    const auto paintStart = std::chrono::steady_clock::now();
+
     g.fillAll(Colours::darkgrey);
-    for(Electrode* e : electrodes) {
-        g.setColour(e -> getColour());
-        g.fillRect(e -> getRectangle());
+    //The electrodes were rasterized off the message thread; this is a single blit
+    canvas -> drawRenderedFrame(g);
+    if(!propagationArrows.empty() && !isProbeLayout && !isSiteLayout) {
+        paintPropagationArrows(g);
+    }
+    if(!regionsOfInterest.empty()) {
+        paintRegionsOfInterest(g);
+    }
+    if (colorRange.size() == colorRangeSize) {
+        legendLayer.draw(g, getLegendBounds(), [this](Graphics& lg) { paintLegend(lg); });
+    }
+
+    layoutInfoLayer.draw(g, juce::Rectangle<int>(totalWidth, TOP_BOUND, 600, numLayoutInfoLines * 16), [this](Graphics& lg) { paintLayoutInfo(lg); });
+
+    g.setColour(Colours::black);
+    int height = TOP_BOUND + numLayoutInfoLines * 16;
+    g.setFont(16);
+    g.drawText("Mouse is over electrode: "+String(hoveredElectrode), totalWidth, height, 400, 16, Justification::left);
+    height += 16;
+    if(hoveredElectrode >= 0 && hoveredElectrode < int(healthFlags.size())) {
+        g.drawText("Electrode Health: " + String(ChannelHealthMonitor::describe(healthFlags[hoveredElectrode])), totalWidth, height, 400, 16, Justification::left);
+        height += 16;
+    }
+    g.drawText("Flagged Channels: " + String(numFlaggedChannels), totalWidth, height, 400, 16, Justification::left);
+    height += 16;
+    if(!propagationArrows.empty()) {
+        float meanSpeed = 0.0f;
+        for(const PropagationArrow& arrow : propagationArrows) {
+            meanSpeed += arrow.speed;
+        }
+        meanSpeed /= float(propagationArrows.size());
+        g.drawText("Propagation Speed: " + String(meanSpeed, 1) + " sites/s", totalWidth, height, 400, 16, Justification::left);
+        height += 16;
+    }
+    if(isSubselectActive){
+        g.drawText("Subselection Top Left Channel: "+String(subselectCorner), totalWidth, height, 400, 16, Justification::left);
+        height += 16;
     }
+
+    if(isTelemetryOverlayVisible) {
+        paintTelemetryOverlay(g, height + 16);
+    }
+
+    canvas -> framePainted(std::chrono::duration<double>(std::chrono::steady_clock::now() - paintStart).count());
+}
+
+void UG3ElectrodeDisplay::paintLegend(Graphics& g) {
     for (Electrode* e : colorRange) {
         g.setColour(e->getColour());
         g.fillRect(e->getRectangle());
@@ -159,7 +183,24 @@ void UG3ElectrodeDisplay::paint(Graphics& g) {
 
     g.drawText(maxColorRangeText, colorRange[colorRangeSize - 1]->getRectangle().getRight(), colorRange[colorRangeSize - 1]->getRectangle().getY(), 400, 16, Justification::left);
     g.drawText(minColorRangeText, colorRange[1]->getRectangle().getRight(), colorRange[1]->getRectangle().getY(), 400, 16, Justification::left);
-    
+}
+
+juce::Rectangle<int> UG3ElectrodeDisplay::getLegendBounds() const {
+    juce::Rectangle<int> bounds;
+    for (Electrode* e : colorRange) {
+        bounds = bounds.isEmpty() ? e->getRectangle() : bounds.getUnion(e->getRectangle());
+    }
+    //The labels start at the right of their swatch, see paintLegend()
+    if (colorRange.size() == colorRangeSize) {
+        const juce::Rectangle<int> maxSwatch = colorRange[colorRangeSize - 1]->getRectangle();
+        const juce::Rectangle<int> minSwatch = colorRange[1]->getRectangle();
+        bounds = bounds.getUnion(juce::Rectangle<int>(maxSwatch.getRight(), maxSwatch.getY(), 400, 16));
+        bounds = bounds.getUnion(juce::Rectangle<int>(minSwatch.getRight(), minSwatch.getY(), 400, 16));
+    }
+    return bounds;
+}
+
+void UG3ElectrodeDisplay::paintLayoutInfo(Graphics& g) {
     g.setColour(Colours::black);
     int height = TOP_BOUND;
     g.setFont(16);
@@ -172,36 +213,103 @@ void UG3ElectrodeDisplay::paint(Graphics& g) {
     g.drawText("Layout File Path: " + String(canvas->getLayoutFilePath()), totalWidth, height, 600, 16, Justification::left);
     height += 16;
     g.drawText("Map Enabled: " + (canvas->isLayoutUsingMap() ? String("True") : String("False")), totalWidth, height, 400, 16, Justification::left);
-    height += 16;
-    g.drawText("Mouse is over electrode: "+String(hoveredElectrode), totalWidth, height, 400, 16, Justification::left);
-    height += 16;
-    if(isSubselectActive){
-        g.drawText("Subselection Top Left Channel: "+String(subselectCorner), totalWidth, height, 400, 16, Justification::left);
+}
+
+juce::Rectangle<int> UG3ElectrodeDisplay::getHoverTextBounds() const {
+    //The electrode line and, when health flags are known, its health line
+    return juce::Rectangle<int>(totalWidth, TOP_BOUND + numLayoutInfoLines * 16, 400, 32);
+}
+
+void UG3ElectrodeDisplay::paintPropagationArrows(Graphics& g) {
+    //Every arrow has the same length; only the direction is drawn, the speed is in the info text
+    const float pitch = float(WIDTH + SPACING);
+    const float halfLength = 1.5f * pitch;
+    g.setColour(Colours::white);
+    for(const PropagationArrow& arrow : propagationArrows) {
+        const float centreX = float(LEFT_BOUND) + arrow.x * pitch + 0.5f * float(WIDTH);
+        const float centreY = float(TOP_BOUND) + arrow.y * pitch + 0.5f * float(HEIGHT);
+        const Line<float> line(centreX - arrow.directionX * halfLength, centreY - arrow.directionY * halfLength,
+                               centreX + arrow.directionX * halfLength, centreY + arrow.directionY * halfLength);
+        g.drawArrow(line, 1.5f, 7.0f, 7.0f);
     }
 }
 
-void UG3ElectrodeDisplay::refresh(const float * values, bool isZeroCentered, int scaleFactor) {
-    
-    int count = 0;
-    for (auto e : electrodes)
-    {
-        float normalizedValue; 
-        if (isZeroCentered) {
-            normalizedValue = values[count] / (2.0f * float(scaleFactor)) + 0.5f;
-        }
-        else {
-            normalizedValue = values[count] / float(scaleFactor);
+void UG3ElectrodeDisplay::paintRegionsOfInterest(Graphics& g) {
+    g.setFont(12);
+    for(const RegionOfInterest& region : regionsOfInterest) {
+        g.setColour(region.colour);
+        g.strokePath(region.outline, PathStrokeType(1.5f));
+        const juce::Rectangle<float> bounds = region.outline.getBounds();
+        g.drawText(region.name, int(bounds.getX()), int(bounds.getY()) - 14, 100, 14, Justification::left);
+    }
+}
+
+void UG3ElectrodeDisplay::setRegionDrawingActive(bool isRegionDrawingActive_) {
+    isRegionDrawingActive = isRegionDrawingActive_;
+}
+
+void UG3ElectrodeDisplay::setRegionsOfInterest(const std::vector<RegionOfInterest>& regions) {
+    regionsOfInterest = regions;
+    repaint();
+}
+
+std::vector<int> UG3ElectrodeDisplay::getSitesInside(const Path& outline) const {
+    std::vector<int> sites;
+    for(int i = 0; i < electrodes.size(); i++) {
+        if(outline.contains(electrodes[i]->getRectangle().getCentre().toFloat())) {
+            sites.push_back(i);
         }
-        e->setColour(ColourScheme::getColourForNormalizedValue(normalizedValue));
-        count += 1;
     }
+    return sites;
+}
+
+void UG3ElectrodeDisplay::paintTelemetryOverlay(Graphics& g, int top) {
+    const ViewerTelemetry telemetry = canvas -> getTelemetry();
+    const int lines = 4;
+
+    g.setColour(Colours::black.withAlpha(0.6f));
+    g.fillRect(totalWidth, top, 400, lines * 16 + 8);
+
+    //Draw in red when either acquisition or drawing can't keep up
+    g.setColour(telemetry.isFallingBehind() ? Colours::red : Colours::lightgreen);
+    g.setFont(14);
+    int height = top + 4;
+    g.drawText("Sample Rate: " + String(telemetry.sampleRate, 1) + " Hz (nominal " + String(telemetry.nominalSampleRate, 1) + " Hz)", totalWidth + 4, height, 392, 16, Justification::left);
+    height += 16;
+    g.drawText("Block: " + String(telemetry.blockSize, 1) + " samples every " + String(telemetry.blockIntervalMs, 2) + " ms (jitter " + String(telemetry.blockJitterMs, 2) + " ms)", totalWidth + 4, height, 392, 16, Justification::left);
+    height += 16;
+    g.drawText("Frame Rate: " + String(telemetry.frameRate, 1) + " fps (target " + String(telemetry.targetFrameRate, 0) + " fps)", totalWidth + 4, height, 392, 16, Justification::left);
+    height += 16;
+    g.drawText("Refresh Latency: " + String(telemetry.refreshLatencyMs, 2) + " ms", totalWidth + 4, height, 392, 16, Justification::left);
+}
+
+void UG3ElectrodeDisplay::setTelemetryOverlayVisible(bool isVisible) {
+    isTelemetryOverlayVisible = isVisible;
+    repaint();
+}
+
+RenderLayout UG3ElectrodeDisplay::getRenderLayout() {
+    return placement;
+}
+
+void UG3ElectrodeDisplay::setHealthFlags(const uint8_t* flags, int numFlags, int numFlagged) {
+    numFlags = flags != nullptr ? std::min(numFlags, electrodes.size()) : 0;
+    healthFlags.assign(flags, flags + numFlags);
+    numFlaggedChannels = numFlagged;
+}
 
+void UG3ElectrodeDisplay::setPropagationArrows(const std::vector<PropagationArrow>& arrows) {
+    propagationArrows = arrows;
 }
 
 void UG3ElectrodeDisplay::setColorRangeText(const String& max, const String& min) {
+    if (max == maxColorRangeText && min == minColorRangeText) {
+        return;
+    }
     maxColorRangeText = max;
     minColorRangeText = min;
-    repaint();
+    legendLayer.invalidate();
+    repaint(getLegendBounds());
 }
 
 
@@ -211,7 +319,7 @@ void UG3ElectrodeDisplay::updateSubselectedElectrodes (int start, int rows, int
 
 
 void UG3ElectrodeDisplay::switchSubselectState(bool isSubselectActive_) {
-    isSubselectActive = isSubselectActive_;
+    isSubselectActive = isSubselectActive_ && !isSiteLayout;
     mouseListener -> toggleSubselect();
 }
 
@@ -247,18 +355,35 @@ void UG3ElectrodeDisplay::DisplayMouseListener::paint(Graphics& g){
             g.fillRect(*selection);
         }
     }
+    if(!region.isEmpty()) {
+        g.setColour(Colours::white);
+        g.strokePath(region, PathStrokeType(1.0f));
+    }
 }
 
 void UG3ElectrodeDisplay::DisplayMouseListener::mouseMove(const MouseEvent & event) {
-    display->hoveredElectrode = calculateElectrodeAtCoordinate(event.x, event.y);
+    //Moving doesn't change the selection, so only the hover text needs repainting
+    const int electrode = calculateElectrodeAtCoordinate(event.x, event.y);
+    if(electrode != display->hoveredElectrode) {
+        display->hoveredElectrode = electrode;
+        display->repaint(display->getHoverTextBounds());
+    }
     if(display->isSubselectActive) {
         if(selection)
             display -> subselectCorner = calculateElectrodeAtCoordinate(selection -> getX(), selection -> getY());
     }
-    repaint();
 }
 
 void UG3ElectrodeDisplay::DisplayMouseListener::mouseDown(const MouseEvent & event) {
+    if(display -> isRegionDrawingActive) {
+        region.clear();
+        regionStart = event.position;
+        isFreehandRegion = event.mods.isShiftDown();
+        if(isFreehandRegion) {
+            region.startNewSubPath(regionStart);
+        }
+        return;
+    }
     if(display -> isSubselectActive){
         if(selection -> contains(Point<int>(event.x, event.y))) {
             selectionStartX = event.x - selection -> getX();
@@ -272,6 +397,17 @@ void UG3ElectrodeDisplay::DisplayMouseListener::mouseDown(const MouseEvent & eve
 }
 
 void UG3ElectrodeDisplay::DisplayMouseListener::mouseDrag(const MouseEvent & event) {
+    if(display -> isRegionDrawingActive) {
+        if(isFreehandRegion) {
+            region.lineTo(event.position);
+        }
+        else {
+            region.clear();
+            region.addRectangle(juce::Rectangle<float>(regionStart, event.position));
+        }
+        repaint();
+        return;
+    }
     if(display -> isSubselectActive) {
         if(selectionStartX > 0) {
             selection -> setX(event.x - selectionStartX);
@@ -284,6 +420,19 @@ void UG3ElectrodeDisplay::DisplayMouseListener::mouseDrag(const MouseEvent & eve
 }
 
 void UG3ElectrodeDisplay::DisplayMouseListener::mouseUp(const MouseEvent & event) {
+    if(display -> isRegionDrawingActive) {
+        if(isFreehandRegion) {
+            region.closeSubPath();
+        }
+        //A click without a drag, or an outline around no electrode centres, makes no region
+        const std::vector<int> sites = display -> getSitesInside(region);
+        if(!sites.empty()) {
+            display -> canvas -> addRegionOfInterest(region, sites);
+        }
+        region.clear();
+        repaint();
+        return;
+    }
     if(display -> isSubselectActive) {
         if(selectionStartX > 0) {
             selection -> setX(event.x - selectionStartX);
@@ -316,6 +465,9 @@ void UG3ElectrodeDisplay::DisplayMouseListener::calculateElectrodesSelected() {
 }
 
 int UG3ElectrodeDisplay::DisplayMouseListener::calculateElectrodeAtCoordinate(int x, int y) {
+    if(display -> isSiteLayout) {
+        return display -> siteIndex.findSite(x, y);
+    }
     int nearestLeftEdge = std::min(x - LEFT_BOUND >= 0 ? (x - LEFT_BOUND)/(WIDTH+SPACING) : 0, display -> numChannelsX - 1);
     int nearestTopEdge = std::min(y - TOP_BOUND >= 0 ? (y - TOP_BOUND)/(HEIGHT+SPACING) : 0, display -> numChannelsY - 1);
     
@@ -15,6 +15,9 @@
 #include <set>
 
 #include "ColourScheme.h"
+#include "CachedLayer.h"
+#include "ElectrodeGeometry.h"
+#include "SiteIndex.h"
 #include "UG3ElectrodeViewerCanvas.h"
 
 class Electrode : public Component
@@ -33,19 +36,31 @@ private:
     juce::Rectangle<int> const rect;
 };
 
-class UG3ElectrodeDisplay : public Component{
+class TESTABLE UG3ElectrodeDisplay : public Component{
 public:
     UG3ElectrodeDisplay(UG3ElectrodeViewerCanvas* canvas, Viewport* viewport);
     
     void resized();
 
-    void refresh(const float * value, bool isZeroCentered, int scaleFactor);
+    int getNumElectrodes() const {return electrodes.size();}
+
+    /** Where each electrode goes in the frames the renderer draws; mappedSites is left to the caller */
+    RenderLayout getRenderLayout();
+
+    /** Keeps the ChannelHealthFlag bits for the hovered electrode's info line */
+    void setHealthFlags(const uint8_t* flags, int numFlags, int numFlagged);
+
+    /** Arrows drawn over a plain grid; an empty field hides the overlay */
+    void setPropagationArrows(const std::vector<PropagationArrow>& arrows);
         
     void paint(Graphics& g);
         
     void setGridLayout(int layoutXMax, int layoutYMax, std::vector<int> layout);
     
     void setProbeLayout(int layoutX, int layoutY, int probeCols);
+
+    /** Each electrode at its own coordinates, see ElectrodeGeometry::placeSites() */
+    void setSiteLayout(const std::vector<ElectrodeSite>& sites);
     
     int getTotalHeight() {return totalHeight;}
     
@@ -58,6 +73,17 @@ public:
     void switchSubselectState(bool isSubselectActive_);
     
     void updateSubselectWindow(subselectWindowOptions option);
+
+    void setTelemetryOverlayVisible(bool isVisible);
+
+    /** While on, dragging draws a new region of interest: a rectangle, or freehand with shift held */
+    void setRegionDrawingActive(bool isRegionDrawingActive_);
+
+    /** Outlines drawn over the electrodes */
+    void setRegionsOfInterest(const std::vector<RegionOfInterest>& regions);
+
+    /** Electrodes whose centre is inside the outline, as indices into the visual buffer */
+    std::vector<int> getSitesInside(const Path& outline) const;
     
     class DisplayMouseListener : public Component {
     public:
@@ -75,6 +101,10 @@ public:
         
     private:
         UG3ElectrodeDisplay* display;
+        //Region being drawn; rectangles are rebuilt from regionStart on every drag
+        Path region;
+        Point<float> regionStart;
+        bool isFreehandRegion = false;
         ScopedPointer<juce::Rectangle<int>> selection;
         int selectionStartX;
         int selectionStartY;
@@ -84,11 +114,11 @@ public:
     
     
 protected:
-    const static int LEFT_BOUND = 20;
-    const static int TOP_BOUND = 20;
-    const static int SPACING = 4;
-    const static int HEIGHT = 8;
-    const static int WIDTH = 8;
+    const static int LEFT_BOUND = ElectrodeGeometry::leftBound;
+    const static int TOP_BOUND = ElectrodeGeometry::topBound;
+    const static int SPACING = ElectrodeGeometry::spacing;
+    const static int HEIGHT = ElectrodeGeometry::siteHeight;
+    const static int WIDTH = ElectrodeGeometry::siteWidth;
     int subselectHorizonatal=8;
     int subselectVertical=8;
     bool isSubselectActive;
@@ -97,6 +127,30 @@ protected:
     int subselectCorner;
     
 private:
+    void paintTelemetryOverlay(Graphics& g, int top);
+
+    /** Electrode and legend swatches for the current placement */
+    void createElectrodes();
+
+    /** Colour bar and its range labels */
+    void paintLegend(Graphics& g);
+
+    juce::Rectangle<int> getLegendBounds() const;
+
+    /** Info lines that only change with the layout */
+    void paintLayoutInfo(Graphics& g);
+
+    /** Area of the hovered electrode's info lines, repainted on its own as the mouse moves */
+    juce::Rectangle<int> getHoverTextBounds() const;
+
+    //Redrawn only when the range text or the layout changes
+    CachedLayer legendLayer;
+    //Redrawn only when the layout changes; the file path and map come with every layout update
+    CachedLayer layoutInfoLayer;
+    static const int numLayoutInfoLines;
+
+    bool isTelemetryOverlayVisible;
+
     UG3ElectrodeViewerCanvas* canvas;
     Viewport* viewport;
     OwnedArray<Electrode> electrodes;
@@ -111,6 +165,25 @@ private:
     
     Colour selectedColor;
     Colour highlightedColor;
+
+    std::vector<uint8_t> healthFlags;
+    int numFlaggedChannels;
+
+    bool isProbeLayout;
+    bool isSiteLayout;
+    //Hit tests the hovered electrode of a site layout, which has no grid to compute it from
+    SiteIndex siteIndex;
+    //Site rectangles and frame size of the current layout, see ElectrodeGeometry
+    RenderLayout placement;
+
+    std::vector<PropagationArrow> propagationArrows;
+
+    void paintPropagationArrows(Graphics& g);
+
+    bool isRegionDrawingActive;
+    std::vector<RegionOfInterest> regionsOfInterest;
+
+    void paintRegionsOfInterest(Graphics& g);
     
     String maxColorRangeText;
     String minColorRangeText;
@@ -24,10 +24,15 @@
 #include "UG3ElectrodeViewer.h"
 
 #include "UG3ElectrodeViewerEditor.h"
+#include "FrameRasterizer.h"
 
+#include <cmath>
+#include <limits>
+
+const double UG3ElectrodeViewer::subselectionIntervalMs = 1000.0 / 30.0;
 
 UG3ElectrodeViewer::UG3ElectrodeViewer() 
-    : GenericProcessor("UG3 Electrode Viewer"), layoutMaxX(0), layoutMaxY(0), currentStreamName(""), effectiveSampleRate(0), probeCols(0)
+    : GenericProcessor("UG3 Electrode Viewer"), routesPending(false), layoutHash(0), hasSourceSpectra(false), impedanceRevision(0), frameSequence(0), impedanceFitWorker([this] { frameSequence.fetch_add(1, std::memory_order_release); }), displayReductionSuspended(false), suspendWhenHidden(true), renderThreads(1), latestValuesTime(0.0), zScoreEnabled(false), baselineResetPending(false), baselineTimeConstant(10.0f), regionsPending(false), regionActiveLevel(100.0f), frameExportSlots(8), frameServerPort(-1), effectiveSampleRate(0), currentStreamName(""), layoutMaxX(0), layoutMaxY(0), probeCols(0), subselectionPublisher([this](const Subselection& selection) { broadcastSubselection(selection); }, subselectionIntervalMs)
 {
     isEnabled = false;
 }
@@ -35,7 +40,8 @@ UG3ElectrodeViewer::UG3ElectrodeViewer()
 
 UG3ElectrodeViewer::~UG3ElectrodeViewer()
 {
-
+    //Its callback touches members that are destroyed before it
+    impedanceFitWorker.stopThread(1000);
 }
 
 
@@ -56,45 +62,70 @@ void UG3ElectrodeViewer::updateSettings()
     for(const auto &stream : dataStreams) {
         availableStreams.insert((stream->group.name != "default") ? stream->group.name : stream->getName());
     }
+
+    compileChannelRoutes();
 }
 
 
 void UG3ElectrodeViewer::process(AudioBuffer<float>& buffer)
 {
-    int count = 0;
-    for (auto channel : continuousChannels)
+    UG3_TIME_SCOPE(PROCESS);
+
+    float blockSeconds = 0.0f;
+    int64 firstSampleNumber = 0;
+    double streamSampleRate = 0.0;
+    for (auto stream : dataStreams)
     {
-        DataStream* stream = getDataStream(channel->getStreamId());
         String streamName = stream -> group.name != "default" ? stream -> group.name: stream -> getName();
-
         if (streamName == currentStreamName)
         {
+            int numSamples = getNumSamplesInBlock(stream->getStreamId());
+            blockSeconds = stream->getSampleRate() > 0 ? float(numSamples) / stream->getSampleRate() : 0.0f;
+            firstSampleNumber = getFirstSampleNumberForBlock(stream->getStreamId());
+            streamSampleRate = stream->getSampleRate();
+            blockTiming.recordBlock(numSamples, stream->getSampleRate());
+            effectiveSampleRate = blockTiming.getSampleRate();
+            break;
+        }
+    }
 
-            int globalIndex = channel->getGlobalIndex();
-            int bufferIndex;
-
-            auto electrodeMapIt= electrodeMaps.find(selectedCapability.value());
-
-            //If there is a mapping from acquisition to visual buffer then use mapping
-            //Else, just use linear mapping
-            if(electrodeMapIt != electrodeMaps.end() &&
-                    (*electrodeMapIt).second.hasMap()) {
-                String channelStreamName = stream->getName().upToFirstOccurrenceOf("-",false,false);
-                std::optional mapping = (*electrodeMapIt).second.getChannelMapping(channel->getName().toStdString(), channelStreamName.toStdString());
-                //It is possible for a channel not to have a mapping (If visual buffer < acquisition buffer)
-                //In this case, skip adding this channel to the visual buffer
-                if(mapping.has_value()) {
-                    bufferIndex = mapping.value();
-                }
-                else {
-                    continue;
-                }
-            }
-            else {
-                bufferIndex = count++;
-            }
-            currentValues.set(bufferIndex,*(buffer.getReadPointer(globalIndex, 0)));
+    //Nothing below is seen while the canvas is hidden; block timing above still feeds the telemetry
+    if (displayReductionSuspended.load(std::memory_order_relaxed)) {
+        return;
+    }
+
+    updateChannelRoutes();
+    for (const ChannelRoute& route : processRoutes) {
+        currentValues.set(route.bufferIndex, *(buffer.getReadPointer(route.globalIndex, 0)));
+    }
+    if (streamSampleRate > 0.0) {
+        latestValuesTime.store(double(firstSampleNumber) / streamSampleRate, std::memory_order_release);
+    }
+
+    if (channelHealth.size() == currentValues.size()) {
+        channelHealth.update(currentValues.getRawDataPointer(), blockSeconds);
+    }
+
+    updateRegionStatistics();
+
+    if (frameSink.isOpen() && blockSeconds > 0.0f) {
+        frameSink.publish(currentValues.getRawDataPointer(), currentValues.size(), firstSampleNumber, Time::currentTimeMillis() * 0.001);
+    }
+
+    if (frameServer.isRunning() && blockSeconds > 0.0f) {
+        frameServer.submit(currentValues.getRawDataPointer(), currentValues.size(), firstSampleNumber);
+    }
+
+    if (zScoreEnabled.load(std::memory_order_relaxed) && baseline.size() == currentValues.size()) {
+        if (baselineResetPending.exchange(false)) {
+            baseline.reset();
         }
+        baseline.update(currentValues.getRawDataPointer(), ElectrodeBaseline::getAlpha(blockSeconds, baselineTimeConstant.load(std::memory_order_relaxed)));
+    }
+
+    //Published last so a reader that sees the new number also sees this block's values
+    if (blockSeconds > 0.0f) {
+        frameSequence.fetch_add(1, std::memory_order_release);
     }
 }
 
@@ -102,10 +133,189 @@ void UG3ElectrodeViewer::process(AudioBuffer<float>& buffer)
 bool UG3ElectrodeViewer::startAcquisition() {
 
     effectiveSampleRate = 0;
+    blockTiming.reset();
+    baseline.resize(currentValues.size());
+    channelHealth.setLimits(healthLimits);
+    channelHealth.resize(currentValues.size());
+    channelHealth.setImpedances(impedanceValues.getRawDataPointer(), impedanceValues.size());
+
+    //Reopened every time so the ring matches the layout being acquired
+    const String exportError = applyFrameExport();
+    if (exportError.isNotEmpty()) {
+        LOGE("frame export disabled: ", exportError);
+    }
+
+    const String serverError = applyFrameServer();
+    if (serverError.isNotEmpty()) {
+        LOGE("frame server disabled: ", serverError);
+    }
 
     return true;
 }
 
+String UG3ElectrodeViewer::applyFrameExport() {
+    if (frameExportName.isEmpty()) {
+        frameSink.close();
+        return "";
+    }
+    return frameSink.open(frameExportName, layoutMaxX, layoutMaxY, currentValues.size(), selectedCapability.value_or(""), "uV", frameExportSlots);
+}
+
+String UG3ElectrodeViewer::applyFrameServer() {
+    if (frameServerPort < 0) {
+        frameServer.stop();
+        return "";
+    }
+    frameServer.setGridSize(layoutMaxX, layoutMaxY);
+    //Connected viewers stay connected across acquisitions; a new frame size just costs each a key frame
+    if (frameServer.isRunning() && (frameServerPort == 0 || frameServer.getPort() == frameServerPort)) {
+        return "";
+    }
+    return frameServer.start(frameServerPort);
+}
+
+void UG3ElectrodeViewer::updateRegionStatistics() {
+    //The audio thread never waits for the message thread; a busy lock just defers the swap or the copy to the next block
+    if (regionsPending.load(std::memory_order_acquire)) {
+        const ScopedTryLock lock(regionLock);
+        if (lock.isLocked()) {
+            std::swap(regionStatistics, pendingRegions);
+            regionsPending.store(false, std::memory_order_release);
+        }
+    }
+    if (regionStatistics.getNumRegions() == 0 && publishedRegionStats.empty()) {
+        return;
+    }
+
+    regionStatistics.setActiveLevel(regionActiveLevel.load(std::memory_order_relaxed));
+    regionStatistics.update(currentValues.getRawDataPointer(), currentValues.size(), channelHealth.getFlags(), channelHealth.size());
+
+    //setRegionsOfInterest() reserved room for every region, so this copy never allocates
+    const std::vector<RegionStats>& stats = regionStatistics.getStats();
+    const ScopedTryLock lock(regionStatsLock);
+    if (lock.isLocked() && stats.size() <= publishedRegionStats.capacity()) {
+        publishedRegionStats.resize(stats.size());
+        std::copy(stats.begin(), stats.end(), publishedRegionStats.begin());
+    }
+}
+
+void UG3ElectrodeViewer::compileChannelRoutes() {
+    std::vector<ChannelRoute> routes;
+
+    //No capability has been reported yet (e.g. no UG3 Interface upstream); fall back to linear mapping
+    auto electrodeMapIt = selectedCapability.has_value() ? electrodeMaps.find(selectedCapability.value()) : electrodeMaps.end();
+    const bool hasMap = electrodeMapIt != electrodeMaps.end() && (*electrodeMapIt).second.hasMap();
+
+    int count = 0;
+    for (int channelIndex = 0; channelIndex < continuousChannels.size(); channelIndex++) {
+        const ContinuousChannel* channel = continuousChannels[channelIndex];
+        DataStream* stream = getDataStream(channel->getStreamId());
+        String streamName = stream -> group.name != "default" ? stream -> group.name: stream -> getName();
+        if (streamName != currentStreamName) {
+            continue;
+        }
+
+        int bufferIndex;
+        if (hasMap) {
+            String channelStreamName = stream->getName().upToFirstOccurrenceOf("-",false,false);
+            std::optional mapping = (*electrodeMapIt).second.getChannelMapping(channel->getName().toStdString(), channelStreamName.toStdString());
+            //It is possible for a channel not to have a mapping (If visual buffer < acquisition buffer)
+            //In this case, the channel is left out of the visual buffer
+            if (!mapping.has_value()) {
+                continue;
+            }
+            bufferIndex = mapping.value();
+        }
+        else {
+            bufferIndex = count++;
+        }
+        routes.push_back({ channelIndex, channel->getGlobalIndex(), bufferIndex });
+    }
+
+    //FNV-1a over the grid and where each named channel goes, so the hash survives restarts
+    uint64_t hash = 14695981039346656037ull;
+    auto addToHash = [&hash](const void* bytes, size_t numBytes) {
+        for (size_t i = 0; i < numBytes; i++) {
+            hash = (hash ^ static_cast<const uint8_t*>(bytes)[i]) * 1099511628211ull;
+        }
+    };
+    const std::pair<int, int> dimensions = electrodeMapIt != electrodeMaps.end() ? (*electrodeMapIt).second.getDimensions() : std::make_pair(0, 0);
+    addToHash(&dimensions.first, sizeof(int));
+    addToHash(&dimensions.second, sizeof(int));
+    for (const ChannelRoute& route : routes) {
+        const String& name = continuousChannels[route.channelIndex]->getName();
+        addToHash(name.toRawUTF8(), name.getNumBytesAsUTF8());
+        addToHash(&route.bufferIndex, sizeof(int));
+    }
+    layoutHash = hash;
+    refreshImpedanceChangeRates();
+
+    //Health only compares sites that hold a channel; the grid sizes the visual buffer whenever there is one
+    const int numSites = dimensions.first * dimensions.second > 0 ? dimensions.first * dimensions.second : currentValues.size();
+    std::vector<uint8_t> mappedSites(numSites, 0);
+    for (const ChannelRoute& route : routes) {
+        if (route.bufferIndex >= 0 && route.bufferIndex < numSites) {
+            mappedSites[route.bufferIndex] = 1;
+        }
+    }
+    //A site layout's map is a single row in file order, so its neighbours come from the coordinates
+    const bool hasSites = electrodeMapIt != electrodeMaps.end() && !(*electrodeMapIt).second.getSites().empty();
+    ChannelNeighbours neighbours = hasSites ? ChannelNeighbours::fromSites(mappedSites, (*electrodeMapIt).second.getSites()) : ChannelNeighbours::fromGrid(mappedSites, dimensions.first);
+
+    channelRoutes = routes;
+    const ScopedLock lock(routeLock);
+    pendingRoutes = std::move(routes);
+    pendingNeighbours = std::move(neighbours);
+    routesPending.store(true, std::memory_order_release);
+}
+
+void UG3ElectrodeViewer::updateChannelRoutes() {
+    //As with the regions, a busy lock just keeps the old routes for another block
+    if (routesPending.load(std::memory_order_acquire)) {
+        const ScopedTryLock lock(routeLock);
+        if (lock.isLocked()) {
+            std::swap(processRoutes, pendingRoutes);
+            channelHealth.swapNeighbours(pendingNeighbours);
+            routesPending.store(false, std::memory_order_release);
+        }
+    }
+}
+
+void UG3ElectrodeViewer::refreshImpedanceChangeRates() {
+    //The render thread copies the rates under the same lock
+    const ScopedLock sl(impedanceLock);
+    impedanceHistory.getChangeRates(layoutHash, impedanceChangeRates);
+}
+
+void UG3ElectrodeViewer::setRegionsOfInterest(const std::vector<std::vector<int>>& regions) {
+    {
+        const ScopedLock lock(regionStatsLock);
+        publishedRegionStats.reserve(regions.size());
+    }
+    const ScopedLock lock(regionLock);
+    pendingRegions.setRegions(regions);
+    regionsPending.store(true, std::memory_order_release);
+}
+
+void UG3ElectrodeViewer::getRegionStatistics(std::vector<RegionStats>& stats) const {
+    const ScopedLock lock(regionStatsLock);
+    stats = publishedRegionStats;
+}
+
+void UG3ElectrodeViewer::setZScoreEnabled(bool isEnabled_) {
+    //The audio thread owns the baseline state, so it does the reset itself on its next block
+    if (isEnabled_ && !zScoreEnabled.load(std::memory_order_relaxed)) {
+        baselineResetPending.store(true);
+    }
+    zScoreEnabled.store(isEnabled_, std::memory_order_relaxed);
+}
+
+ViewerTelemetry UG3ElectrodeViewer::getTelemetry() const {
+    ViewerTelemetry telemetry;
+    blockTiming.fillTelemetry(telemetry);
+    return telemetry;
+}
+
 void UG3ElectrodeViewer::handleTTLEvent(TTLEventPtr event)
 {
 
@@ -126,7 +336,10 @@ void UG3ElectrodeViewer::handleBroadcastMessage(String message)
 String UG3ElectrodeViewer::handleConfigMessage(String message) {
     BroadcastPayload payload;
     if (BroadcastParser::getPayloadForCommand("", "IMPEDANCESREADY", message, payload)) {
+        const String error = loadImpedanceSpectra(payload.getPayload());
         loadImpedances();
+        recordImpedanceSweep();
+        return error;
     }
     else if (BroadcastParser::getPayloadForCommand("UG3ElectrodeViewer", "LOADINPUTINFO", message, payload)) {
 
@@ -151,6 +364,205 @@ String UG3ElectrodeViewer::handleConfigMessage(String message) {
             }
         }
 
+        compileChannelRoutes();
+    }
+    else if (BroadcastParser::getPayloadForCommand("UG3ElectrodeViewer", "SETHEALTHLIMITS", message, payload)) {
+        //Only the fields present are changed; they take effect when acquisition next starts
+        const DynamicObject::Ptr payloadMap = payload.getPayload();
+        if (payloadMap == nullptr) {
+            return "SETHEALTHLIMITS requires a payload";
+        }
+        auto readLimit = [&payloadMap](const char* name, float& limit) {
+            if (payloadMap->hasProperty(name) && (payloadMap->getProperty(name).isDouble() || payloadMap->getProperty(name).isInt())) {
+                limit = float(payloadMap->getProperty(name));
+            }
+        };
+        readLimit("flatStdDev", healthLimits.flatStdDev);
+        readLimit("railLevel", healthLimits.railLevel);
+        readLimit("railFraction", healthLimits.railFraction);
+        readLimit("noiseRatio", healthLimits.noiseRatio);
+        readLimit("impedanceDeviations", healthLimits.impedanceDeviations);
+        readLimit("timeConstant", healthLimits.timeConstant);
+    }
+    else if (BroadcastParser::getPayloadForCommand("UG3ElectrodeViewer", "SUSPENDWHENHIDDEN", message, payload)) {
+        //Rendering always stops while the canvas is hidden; this decides whether process() stops reducing blocks too
+        const DynamicObject::Ptr payloadMap = payload.getPayload();
+        if (payloadMap == nullptr || !payloadMap->hasProperty("enabled")) {
+            return "SUSPENDWHENHIDDEN requires an \"enabled\" field";
+        }
+        suspendWhenHidden.store(bool(payloadMap->getProperty("enabled")), std::memory_order_relaxed);
+        if (!suspendWhenHidden.load(std::memory_order_relaxed)) {
+            displayReductionSuspended.store(false, std::memory_order_relaxed);
+        }
+    }
+    else if (BroadcastParser::getPayloadForCommand("UG3ElectrodeViewer", "SETRENDERTHREADS", message, payload)) {
+        //Only the render thread reads this, and it picks the change up on its next frame
+        const DynamicObject::Ptr payloadMap = payload.getPayload();
+        if (payloadMap == nullptr || !payloadMap->hasProperty("threads") || !payloadMap->getProperty("threads").isInt()) {
+            return "SETRENDERTHREADS requires an integer \"threads\" field";
+        }
+        int threads = int(payloadMap->getProperty("threads"));
+        if (threads < 0) {
+            return "SETRENDERTHREADS threads must not be negative";
+        }
+        //0 means one per core
+        if (threads == 0) {
+            threads = SystemStats::getNumCpus();
+        }
+        renderThreads.store(jlimit(1, FrameRasterizer::maxThreads, threads), std::memory_order_relaxed);
+    }
+    else if (BroadcastParser::getPayloadForCommand("UG3ElectrodeViewer", "SETFRAMEEXPORT", message, payload)) {
+        //Publishes every reduced frame into a POSIX shared memory ring, see FrameSink.h for the layout
+        const DynamicObject::Ptr payloadMap = payload.getPayload();
+        if (payloadMap == nullptr || !payloadMap->hasProperty("enabled")) {
+            return "SETFRAMEEXPORT requires an \"enabled\" field";
+        }
+        String name = FrameSink::defaultName;
+        if (payloadMap->hasProperty("name") && payloadMap->getProperty("name").isString()) {
+            name = payloadMap->getProperty("name").toString();
+        }
+        if (payloadMap->hasProperty("slots") && payloadMap->getProperty("slots").isInt()) {
+            frameExportSlots = jlimit(2, 1024, int(payloadMap->getProperty("slots")));
+        }
+        frameExportName = bool(payloadMap->getProperty("enabled")) ? name : String();
+        //The audio thread writes to the ring, so during acquisition the change waits for the next start
+        if (!CoreServices::getAcquisitionStatus()) {
+            return applyFrameExport();
+        }
+    }
+    else if (BroadcastParser::getPayloadForCommand("UG3ElectrodeViewer", "SETFRAMESERVER", message, payload)) {
+        //Streams every reduced frame to viewers on 127.0.0.1, see FrameCodec.h for the wire format
+        const DynamicObject::Ptr payloadMap = payload.getPayload();
+        if (payloadMap == nullptr || !payloadMap->hasProperty("enabled")) {
+            return "SETFRAMESERVER requires an \"enabled\" field";
+        }
+        int port = FrameServer::defaultPort;
+        if (payloadMap->hasProperty("port") && payloadMap->getProperty("port").isInt()) {
+            port = int(payloadMap->getProperty("port"));
+            if (port < 0 || port > 65535) {
+                return "SETFRAMESERVER port must be between 0 and 65535";
+            }
+        }
+        frameServerPort = bool(payloadMap->getProperty("enabled")) ? port : -1;
+        //process() hands frames to the server, so during acquisition the change waits for the next start
+        if (!CoreServices::getAcquisitionStatus()) {
+            return applyFrameServer();
+        }
+    }
+    else if (BroadcastParser::getPayloadForCommand("UG3ElectrodeViewer", "SETIMPEDANCEHISTORY", message, payload)) {
+        //Every following IMPEDANCESREADY appends a sweep to the store, see ImpedanceHistory.h for the format
+        const DynamicObject::Ptr payloadMap = payload.getPayload();
+        if (payloadMap == nullptr || !payloadMap->hasProperty("enabled")) {
+            return "SETIMPEDANCEHISTORY requires an \"enabled\" field";
+        }
+        String error;
+        if (bool(payloadMap->getProperty("enabled"))) {
+            if (!payloadMap->hasProperty("path") || !payloadMap->getProperty("path").isString()) {
+                return "SETIMPEDANCEHISTORY requires a \"path\" field when enabled";
+            }
+            error = impedanceHistory.open(File(payloadMap->getProperty("path").toString()));
+        }
+        else {
+            impedanceHistory.close();
+        }
+        refreshImpedanceChangeRates();
+        return error;
+    }
+    else if (BroadcastParser::getPayloadForCommand("UG3ElectrodeViewer", "GETIMPEDANCEHISTORY", message, payload)) {
+        const DynamicObject::Ptr payloadMap = payload.getPayload();
+        if (payloadMap == nullptr || !payloadMap->hasProperty("electrode") || !payloadMap->getProperty("electrode").isInt()) {
+            return "GETIMPEDANCEHISTORY requires an integer \"electrode\" field";
+        }
+        //Times are milliseconds since the epoch; both ends are optional
+        const int64 fromMs = payloadMap->hasProperty("from") ? int64(payloadMap->getProperty("from")) : std::numeric_limits<int64>::min();
+        const int64 toMs = payloadMap->hasProperty("to") ? int64(payloadMap->getProperty("to")) : std::numeric_limits<int64>::max();
+        return getImpedanceHistoryJSON(int(payloadMap->getProperty("electrode")), fromMs, toMs);
+    }
+    else if (BroadcastParser::getPayloadForCommand("UG3ElectrodeViewer", "GETTIMINGS", message, payload)) {
+        const DynamicObject::Ptr payloadMap = payload.getPayload();
+        bool perThread = payloadMap != nullptr && payloadMap->hasProperty("perThread") && bool(payloadMap->getProperty("perThread"));
+        return getTimingsJSON(perThread);
+    }
+    else if (BroadcastParser::getPayloadForCommand("UG3ElectrodeViewer", "RESETTIMINGS", message, payload)) {
+        Instrumentation::reset();
+    }
+    else if (BroadcastParser::getPayloadForCommand("UG3ElectrodeViewer", "DUMPTIMINGS", message, payload)) {
+        const DynamicObject::Ptr payloadMap = payload.getPayload();
+        if (payloadMap == nullptr || !payloadMap->hasProperty("path") || !payloadMap->getProperty("path").isString()) {
+            return "DUMPTIMINGS requires a \"path\" field";
+        }
+        return writeTimingsCSV(File(payloadMap->getProperty("path").toString()));
+    }
+    return "";
+}
+
+String UG3ElectrodeViewer::getImpedanceHistoryJSON(int electrode, int64 fromMs, int64 toMs) const {
+    std::vector<ImpedanceSample> samples;
+    impedanceHistory.getSeries(layoutHash, electrode, fromMs, toMs, samples);
+
+    DynamicObject::Ptr result = new DynamicObject();
+    result->setProperty("electrode", electrode);
+    result->setProperty("layoutHash", String::toHexString((int64) layoutHash));
+    result->setProperty("sweeps", impedanceHistory.getNumSweeps());
+
+    Array<var> series;
+    for (const ImpedanceSample& sample : samples) {
+        DynamicObject::Ptr point = new DynamicObject();
+        point->setProperty("time", sample.timeMs);
+        //Unmeasured sweeps come out as null
+        point->setProperty("magnitude", std::isnan(sample.magnitude) ? var() : var(sample.magnitude));
+        series.add(var(point));
+    }
+    result->setProperty("samples", series);
+    if (electrode >= 0 && electrode < int(impedanceChangeRates.size())) {
+        result->setProperty("changePerDay", impedanceChangeRates[electrode]);
+    }
+
+    return JSON::toString(var(result), true);
+}
+
+String UG3ElectrodeViewer::getTimingsJSON(bool perThread) const {
+    DynamicObject::Ptr result = new DynamicObject();
+    result->setProperty("enabled", Instrumentation::isEnabled());
+    result->setProperty("threads", Instrumentation::getNumThreads());
+
+    Array<var> stages;
+    for (const auto& summary : Instrumentation::getSummaries(perThread)) {
+        DynamicObject::Ptr stage = new DynamicObject();
+        stage->setProperty("stage", Instrumentation::getStageName(summary.stage));
+        if (perThread) {
+            stage->setProperty("thread", summary.threadIndex);
+        }
+        stage->setProperty("count", (int64) summary.count);
+        stage->setProperty("mean_ns", summary.meanNanos);
+        stage->setProperty("p50_ns", (int64) summary.p50Nanos);
+        stage->setProperty("p90_ns", (int64) summary.p90Nanos);
+        stage->setProperty("p99_ns", (int64) summary.p99Nanos);
+        stage->setProperty("max_ns", (int64) summary.maxNanos);
+        stages.add(var(stage));
+    }
+    result->setProperty("stages", stages);
+
+    return JSON::toString(var(result), true);
+}
+
+String UG3ElectrodeViewer::writeTimingsCSV(const File& csvFile) const {
+    String csv = "thread,stage,count,total_ns,mean_ns,p50_ns,p90_ns,p99_ns,max_ns\n";
+    for (const auto& summary : Instrumentation::getSummaries(true)) {
+        csv << summary.threadIndex << ","
+            << Instrumentation::getStageName(summary.stage) << ","
+            << (int64) summary.count << ","
+            << (int64) summary.totalNanos << ","
+            << String(summary.meanNanos, 1) << ","
+            << (int64) summary.p50Nanos << ","
+            << (int64) summary.p90Nanos << ","
+            << (int64) summary.p99Nanos << ","
+            << (int64) summary.maxNanos << "\n";
+    }
+
+    if (!csvFile.replaceWithText(csv)) {
+        LOGE("could not write timing CSV to ", csvFile.getFullPathName());
+        return "could not write " + csvFile.getFullPathName();
     }
     return "";
 }
@@ -207,6 +619,10 @@ void UG3ElectrodeViewer::setLayoutParameters(int layoutMaxX_, int layoutMaxY_, c
     currentValues.insertMultiple(0, 0, layoutMaxX * layoutMaxY);
     impedanceValues.clear();
     impedanceValues.insertMultiple(0, 0, layoutMaxX * layoutMaxY);
+    //During acquisition the audio thread owns the baseline; startAcquisition() resizes it
+    if (!CoreServices::getAcquisitionStatus()) {
+        baseline.resize(currentValues.size());
+    }
     probeCols = probeCols_;
 }
 
@@ -220,38 +636,195 @@ void UG3ElectrodeViewer::getLayoutParameters(const String& acquisitionModeName,
         ElectrodeMap modeMap = electrodeMaps.at(acquisitionModeName);
         layoutMaxX_ = modeMap.getDimensions().first;
         layoutMaxY_ = modeMap.getDimensions().second;
+        probeCols_ = modeMap.getProbeColumns();
     }
 }
 
+std::vector<uint8_t> UG3ElectrodeViewer::getMappedSites(const String& acquisitionModeName) const {
+    const auto mapIt = electrodeMaps.find(acquisitionModeName);
+    if(mapIt == electrodeMaps.end()) {
+        return {};
+    }
+    return (*mapIt).second.getMappedSites();
+}
+
+std::vector<ElectrodeSite> UG3ElectrodeViewer::getElectrodeSites(const String& acquisitionModeName) const {
+    const auto mapIt = electrodeMaps.find(acquisitionModeName);
+    if(mapIt == electrodeMaps.end()) {
+        return {};
+    }
+    return (*mapIt).second.getSites();
+}
+
 void UG3ElectrodeViewer::loadImpedances() {
-    int count = 0;
-    for (auto channel : continuousChannels)
-    {
-        DataStream* stream = getDataStream(channel->getStreamId());
-        String streamName = stream -> group.name != "default" ? stream -> group.name: stream -> getName();
+    //Same routes as process(), so each impedance lands on the electrode its channel is drawn at
+    for (const ChannelRoute& route : channelRoutes) {
+        const ContinuousChannel* channel = continuousChannels[route.channelIndex];
+        if (channel->impedance.measured) {
+            impedanceValues.set(route.bufferIndex, channel->impedance.magnitude);
+        }
+    }
 
-        if ( streamName == currentStreamName)
-        {
-            if (channel->impedance.measured) {
-                impedanceValues.set(count, channel->impedance.magnitude);
+    if (!hasSourceSpectra) {
+        const ScopedLock sl(impedanceLock);
+        impedanceSpectra.resize(1, impedanceValues.size());
+        for (const ChannelRoute& route : channelRoutes) {
+            const ContinuousChannel* channel = continuousChannels[route.channelIndex];
+            if (channel->impedance.measured && route.bufferIndex >= 0 && route.bufferIndex < impedanceSpectra.getNumElectrodes()) {
+                impedanceSpectra.set(0, route.bufferIndex, channel->impedance.magnitude, channel->impedance.phase);
+            }
+        }
+        //The channels don't say at what frequency they were measured, so there is nothing to fit
+        if (impedanceSpectra.hasKnownFrequency()) {
+            impedanceFitWorker.submit(impedanceSpectra);
+        }
+        impedanceRevision++;
+    }
+
+    //During acquisition the audio thread owns the health state; startAcquisition() picks the impedances up
+    if (!CoreServices::getAcquisitionStatus()) {
+        channelHealth.setImpedances(impedanceValues.getRawDataPointer(), impedanceValues.size());
+    }
+    frameSequence.fetch_add(1, std::memory_order_release);
+}
+
+String UG3ElectrodeViewer::loadImpedanceSpectra(const DynamicObject::Ptr payloadMap) {
+    hasSourceSpectra = false;
+    if (payloadMap == nullptr || !payloadMap->hasProperty("frequencies")) {
+        return "";
+    }
+
+    //Planes are frequency-major; entry i of every plane belongs to channels[i]
+    const Array<var>* frequencies = payloadMap->getProperty("frequencies").getArray();
+    const Array<var>* magnitudes = payloadMap->getProperty("magnitudes").getArray();
+    const Array<var>* phases = payloadMap->getProperty("phases").getArray();
+    const Array<var>* channels = payloadMap->getProperty("channels").getArray();
+    if (frequencies == nullptr || magnitudes == nullptr || magnitudes->size() != frequencies->size()
+        || (phases != nullptr && phases->size() != frequencies->size())) {
+        return "IMPEDANCESREADY needs one \"magnitudes\" (and optional \"phases\") array per frequency";
+    }
+
+    //Where each entry lands, through the same routes as process(); -1 for entries that aren't displayed
+    std::vector<int> entryBufferIndex;
+    if (channels != nullptr) {
+        //Named like the electrode maps name them, so channels from every stream of a group resolve
+        std::map<std::pair<String, String>, int> routeIndex;
+        for (const ChannelRoute& route : channelRoutes) {
+            const ContinuousChannel* channel = continuousChannels[route.channelIndex];
+            const String channelStreamName = getDataStream(channel->getStreamId())->getName().upToFirstOccurrenceOf("-", false, false);
+            routeIndex[{ channel->getName(), channelStreamName }] = route.bufferIndex;
+        }
+        for (const var& entry : *channels) {
+            auto routeIt = routeIndex.find({ entry["channel"].toString(), entry["stream"].toString() });
+            entryBufferIndex.push_back(routeIt != routeIndex.end() ? (*routeIt).second : -1);
+        }
+    }
+    else {
+        //Without names, entries are indexed by the channel's index within its stream, which only
+        //identifies a channel when the displayed channels all come from one stream
+        for (const ChannelRoute& route : channelRoutes) {
+            const ContinuousChannel* channel = continuousChannels[route.channelIndex];
+            if (channel->getStreamId() != continuousChannels[channelRoutes.front().channelIndex]->getStreamId()) {
+                return "IMPEDANCESREADY needs a \"channels\" array to tell the streams of " + currentStreamName + " apart";
+            }
+            const int localIndex = channel->getLocalIndex();
+            if (localIndex >= int(entryBufferIndex.size())) {
+                entryBufferIndex.resize(localIndex + 1, -1);
             }
-            count++;
+            entryBufferIndex[localIndex] = route.bufferIndex;
         }
     }
+
+    const ScopedLock sl(impedanceLock);
+    impedanceSpectra.resize(frequencies->size(), impedanceValues.size());
+    for (int f = 0; f < frequencies->size(); f++) {
+        impedanceSpectra.setFrequency(f, float((*frequencies)[f]));
+        const Array<var>* magnitudePlane = (*magnitudes)[f].getArray();
+        const Array<var>* phasePlane = phases != nullptr ? (*phases)[f].getArray() : nullptr;
+        if (magnitudePlane == nullptr) {
+            continue;
+        }
+        const int numEntries = std::min(magnitudePlane->size(), int(entryBufferIndex.size()));
+        for (int entry = 0; entry < numEntries; entry++) {
+            const int bufferIndex = entryBufferIndex[entry];
+            if (bufferIndex < 0 || bufferIndex >= impedanceSpectra.getNumElectrodes()) {
+                continue;
+            }
+            const float phase = phasePlane != nullptr && entry < phasePlane->size() ? float((*phasePlane)[entry]) : std::numeric_limits<float>::quiet_NaN();
+            impedanceSpectra.set(f, bufferIndex, float((*magnitudePlane)[entry]), phase);
+        }
+    }
+    impedanceFitWorker.submit(impedanceSpectra);
+    impedanceRevision++;
+    hasSourceSpectra = true;
+    return "";
+}
+
+void UG3ElectrodeViewer::copyImpedanceView(ImpedanceView view, int frequency, std::vector<float>& values) {
+    const ScopedLock sl(impedanceLock);
+    if (view == ImpedanceView::FIT_RESISTANCE || view == ImpedanceView::FIT_CAPACITANCE) {
+        impedanceFitWorker.getFit(fitResistance, fitCapacitance);
+        values = view == ImpedanceView::FIT_RESISTANCE ? fitResistance : fitCapacitance;
+        return;
+    }
+    if (frequency < 0 || frequency >= impedanceSpectra.getNumFrequencies()) {
+        values.clear();
+        return;
+    }
+    const float* plane = view == ImpedanceView::PHASE ? impedanceSpectra.getPhases(frequency) : impedanceSpectra.getMagnitudes(frequency);
+    values.assign(plane, plane + impedanceSpectra.getNumElectrodes());
+}
+
+std::vector<float> UG3ElectrodeViewer::getImpedanceFrequencies() const {
+    const ScopedLock sl(impedanceLock);
+    return impedanceSpectra.getFrequencies();
+}
+
+void UG3ElectrodeViewer::recordImpedanceSweep() {
+    if (!impedanceHistory.isOpen() || impedanceValues.isEmpty()) {
+        return;
+    }
+
+    //Electrodes no channel was measured for are stored as NaN rather than their previous value
+    std::vector<float> sweep(impedanceValues.size(), std::numeric_limits<float>::quiet_NaN());
+    for (const ChannelRoute& route : channelRoutes) {
+        const ContinuousChannel* channel = continuousChannels[route.channelIndex];
+        if (channel->impedance.measured && route.bufferIndex >= 0 && route.bufferIndex < int(sweep.size())) {
+            sweep[route.bufferIndex] = channel->impedance.magnitude;
+        }
+    }
+
+    const String error = impedanceHistory.append(Time::currentTimeMillis(), selectedCapability.value_or(""), layoutHash, sweep.data(), int(sweep.size()));
+    if (error.isNotEmpty()) {
+        LOGE(error);
+        return;
+    }
+    refreshImpedanceChangeRates();
+    frameSequence.fetch_add(1, std::memory_order_release);
 }
 
 void UG3ElectrodeViewer::setSubselectedChannels(int start, int rows, int cols, int colsPerRow) {
+    Subselection selection;
+    selection.start = start;
+    selection.rows = rows;
+    selection.cols = cols;
+    selection.colsPerRow = colsPerRow;
+    subselectionPublisher.publish(selection);
+}
+
+void UG3ElectrodeViewer::broadcastSubselection(const Subselection& selection) {
     std::map<String, var> valueMap;
     valueMap["split"] = 0;
-    valueMap["start"] = start;
-    valueMap["rows"] = rows;
-    valueMap["cols"] = cols;
-    valueMap["colsPerRow"] = colsPerRow;
+    valueMap["start"] = selection.start;
+    valueMap["rows"] = selection.rows;
+    valueMap["cols"] = selection.cols;
+    valueMap["colsPerRow"] = selection.colsPerRow;
     String message = BroadcastParser::build("LFPViewer", "filter", valueMap);
     broadcastMessage(message);
 }
 
 bool UG3ElectrodeViewer::loadElectrodeLayoutJSON(const String& jsonString) {
+    UG3_TIME_SCOPE(LAYOUT_PARSE);
     var contents = JSON::parse(jsonString);
     if (!contents.isObject()) {
         return false;
@@ -266,64 +839,18 @@ void UG3ElectrodeViewer::loadElectrodeLayoutFile() {
         LOGE("called loadElectrodeLayoutFile(), but now path to layout file was set!");
         return;
     }
-    File layoutFilePath(electrodeLayoutPath.value());
-
-    if(!layoutFilePath.exists()) {
-        LOGE("tried to load ", layoutFilePath.getFullPathName(), " but file does not exist!");
-        return;
-    }
 
-    if(!layoutFilePath.existsAsFile()) {
-        LOGE("tried to load ", layoutFilePath.getFullPathName(), " but path is a directory!");
-        return;
+    UG3_TIME_SCOPE(LAYOUT_PARSE);
+    const String error = ElectrodeLayoutParser::parseFile(File(electrodeLayoutPath.value()), electrodeMaps);
+    if(error.isNotEmpty()) {
+        LOGE(error);
     }
-
-    var layoutFileResult = JSON::parse(layoutFilePath);
-    if(layoutFileResult.isVoid() || !layoutFileResult.isObject()) {
-        LOGE("tried to load ", layoutFilePath.getFullPathName(), " but file format is not valid JSON!");
-        return;
-    }
-
-    DynamicObject::Ptr layoutFileContents = layoutFileResult.getDynamicObject();
-    parseElectrodeLayoutFile(layoutFileContents);
-
+    compileChannelRoutes();
 }
 
 void UG3ElectrodeViewer::parseElectrodeLayoutFile(const DynamicObject::Ptr layoutFileContents) {
-    electrodeMaps.clear();
-    //Loop through all JSON entries; there should be String:Object pairs where the string corresponds to
-    //an acquisition mode and the Objects contain the rows and columns
-    for(const auto & entry : layoutFileContents->getProperties()) {
-        std::optional<int> tempRows;
-        std::optional<int> tempCols;
-        if(!entry.value.isObject()) {
-            continue;
-        }
-
-        if(entry.value.getDynamicObject()->hasProperty("rows") && entry.value.getDynamicObject()->getProperty("rows").isInt()) {
-            tempRows = entry.value.getDynamicObject()->getProperty("rows");
-        }
-
-        if(entry.value.getDynamicObject()->hasProperty("cols") && entry.value.getDynamicObject()->getProperty("cols").isInt()) {
-            tempCols = entry.value.getDynamicObject()->getProperty("cols");
-        }
-
-        if(tempRows.has_value() && tempCols.has_value()) {
-            std::optional<std::unordered_map<ElectrodeMapKey, int>> channelMap;
-            if(entry.value.getDynamicObject()->hasProperty("map")
-               && entry.value.getDynamicObject()->getProperty("map").isArray()) {
-                channelMap = parseChannelMap(entry.value.getDynamicObject()->getProperty("map").getArray(),
-                                             tempRows.value(),
-                                             tempCols.value());
-            }
-            ElectrodeMap newMap(tempCols.value(), tempRows.value());
-            if(channelMap.has_value() ) {
-                newMap = newMap.withLayout(channelMap.value());
-            }
-
-            electrodeMaps.emplace(entry.name.toString(),newMap);
-        }
-    }
+    electrodeMaps = ElectrodeLayoutParser::parse(layoutFileContents);
+    compileChannelRoutes();
 }
 
 
@@ -342,48 +869,4 @@ void UG3ElectrodeViewer::updateSourceElectrodeLayoutPath(const String& layoutFil
     sendConfigMessage(sn, message);
 }
 
-std::optional<std::unordered_map<ElectrodeMapKey,int>> UG3ElectrodeViewer::parseChannelMap(Array<var>* mappings, int rows, int cols) {
-    std::unordered_map<ElectrodeMapKey, int> ret;
-    for(const auto& coord : *mappings) {
-        std::optional<int> tempX;
-        std::optional<int> tempY;
-
-        if(!coord.isObject()) {
-            continue;
-        }
-
-        if(coord.getProperty("x",var::undefined()).isInt()) {
-            tempX = coord.getProperty("x",0);
-        }
-
-        if(coord.getProperty("y",var::undefined()).isInt()) {
-            tempY = coord.getProperty("y",0);
-        }
-
-        if(tempX.has_value() && tempY.has_value()) {
-            if(!(coord.getProperty("channel",var::undefined()).isString())) {
-                continue;
-            }
-
-            if(!(coord.getProperty("stream",var::undefined()).isString())) {
-                continue;
-            }
-
-            //Add entry to hash table where
-            // K: hash of channel and stream name,
-            // V: serial location within visual buffer using x/y coordinates
-            String channelName = coord.getProperty("channel", "");
-            String streamName = coord.getProperty("stream", "");
-            ElectrodeMapKey key(channelName.toStdString(), streamName.toStdString());
-            ret.emplace(key,tempX.value() + tempY.value() * cols);
-        }
-    }
-
-    if(ret.empty()) {
-        return std::nullopt;
-    }
-    else {
-        return ret;
-    }
-}
 
@@ -29,6 +29,26 @@
 #include <set>
 
 #include "ElectrodeMap.h"
+#include "ElectrodeLayoutParser.h"
+#include "ElectrodeBaseline.h"
+#include "ChannelHealth.h"
+#include "ViewerTelemetry.h"
+#include "Instrumentation.h"
+#include "SubselectionPublisher.h"
+#include "RegionStatistics.h"
+#include "FrameSink.h"
+#include "FrameServer.h"
+#include "ImpedanceHistory.h"
+#include "ImpedanceSpectra.h"
+#include "ImpedanceFitWorker.h"
+
+/** Where one channel of the displayed stream goes in the visual buffer */
+struct ChannelRoute {
+    //index into the processor's continuous channels
+    int channelIndex;
+    int globalIndex;
+    int bufferIndex;
+};
 
 /** 
 	A plugin that includes a canvas for displaying incoming data
@@ -94,6 +114,125 @@ public:
         return impedanceValues.getRawDataPointer();
     }
 
+    int getNumLatestValues() const {
+        return currentValues.size();
+    }
+
+    /** Stream time of the sample getLatestValues() was taken from, in seconds since acquisition started */
+    double getLatestValuesTime() const {
+        return latestValuesTime.load(std::memory_order_acquire);
+    }
+
+    int getNumImpedanceMagnitudes() const {
+        return impedanceValues.size();
+    }
+
+    /**
+        Copies one impedance view, indexed like getImpedanceMagnitudes(), with NaN where nothing was
+        measured or fitted; frequency picks the plane for the magnitude and phase views
+    */
+    void copyImpedanceView(ImpedanceView view, int frequency, std::vector<float>& values);
+
+    /** Frequencies of the latest impedances in Hz, 0 where the source didn't give one */
+    std::vector<float> getImpedanceFrequencies() const;
+
+    /** Changes whenever new impedances are loaded, so the toolbar knows to rebuild its views */
+    int getImpedanceRevision() const {
+        return impedanceRevision;
+    }
+
+    /** Copies each electrode's impedance change in percent per day over the recorded sweeps, see SETIMPEDANCEHISTORY */
+    void copyImpedanceChangeRates(std::vector<float>& rates) const {
+        const ScopedLock sl(impedanceLock);
+        rates = impedanceChangeRates;
+    }
+
+    int getNumImpedanceChangeRates() const {
+        const ScopedLock sl(impedanceLock);
+        return int(impedanceChangeRates.size());
+    }
+
+    /** Identifies the current layout and channel routing, so sweeps are only compared with sweeps of the same layout */
+    uint64_t getLayoutHash() const {
+        return layoutHash;
+    }
+
+    /** Goes up every time the displayed values change, so the canvas can skip frames with nothing new */
+    uint64_t getFrameSequence() const {
+        return frameSequence.load(std::memory_order_acquire);
+    }
+
+    /** While suspended, process() only measures block timing; the displayed values, channel health and
+        baseline stay as they were until it is resumed, which the canvas does when its tab is shown again */
+    void setDisplayReductionSuspended(bool isSuspended) {
+        displayReductionSuspended.store(isSuspended, std::memory_order_relaxed);
+    }
+
+    bool isDisplayReductionSuspended() const {
+        return displayReductionSuspended.load(std::memory_order_relaxed);
+    }
+
+    /** Whether the canvas should suspend the display reduction while its tab is hidden, see SUSPENDWHENHIDDEN */
+    bool shouldSuspendWhenHidden() const {
+        return suspendWhenHidden.load(std::memory_order_relaxed);
+    }
+
+    /** Threads the renderer splits each frame across, see SETRENDERTHREADS */
+    int getRenderThreads() const {
+        return renderThreads.load(std::memory_order_relaxed);
+    }
+
+    /** Port the frame server is listening on, or -1 when it is off */
+    int getFrameServerPort() const {
+        return frameServer.getPort();
+    }
+
+    /** Latest value of each electrode in standard deviations from its own running baseline */
+    const float* getZScores() const {
+        return baseline.getZScores();
+    }
+
+    /** Entries in getZScores(), which lags getNumLatestValues() after a layout change during acquisition */
+    int getNumZScores() const {
+        return baseline.size();
+    }
+
+    /** Turns the per-electrode baseline on or off; it restarts from the next block when turned on */
+    void setZScoreEnabled(bool isEnabled_);
+
+    bool isZScoreEnabled() const {
+        return zScoreEnabled.load(std::memory_order_relaxed);
+    }
+
+    /** Per-electrode ChannelHealthFlag bits, indexed like getLatestValues() */
+    const uint8_t* getChannelHealthFlags() const {
+        return channelHealth.getFlags();
+    }
+
+    int getNumChannelHealthFlags() const {
+        return channelHealth.size();
+    }
+
+    int getNumFlaggedChannels() const {
+        return channelHealth.getNumFlagged();
+    }
+
+    /** Replaces the regions of interest, each a list of indices into getLatestValues(); the audio thread picks them up on its next block */
+    void setRegionsOfInterest(const std::vector<std::vector<int>>& regions);
+
+    /** Copies the newest statistics, one per region in the order given to setRegionsOfInterest() */
+    void getRegionStatistics(std::vector<RegionStats>& stats) const;
+
+    /** Magnitude at or above which a site counts as active in the region statistics, in microvolts */
+    void setRegionActiveLevel(float activeLevel) {
+        regionActiveLevel.store(activeLevel, std::memory_order_relaxed);
+    }
+
+    /** Sets how quickly the per-electrode baseline forgets, in seconds */
+    void setBaselineTimeConstant(float seconds) {
+        baselineTimeConstant.store(seconds, std::memory_order_relaxed);
+    }
+
     const SortedSet<String>& getCapabilities() {
         return acquisitionCapabilitiesStrings;
     }
@@ -105,13 +244,23 @@ public:
     void sendUpdateActiveCapabilityRequest(const String& capability);
     
     float getSampleRate() {return effectiveSampleRate;}
+
+    /** Returns the measured sample rate, block size and block arrival jitter of the displayed stream */
+    ViewerTelemetry getTelemetry() const;
     
     void setLayoutParameters(int layoutMaxX_, int layoutMaxY_, const std::vector<int>& layout_, int probeCol_ = 0);
     
     void getLayoutParameters(const String& acquisitionModeName, int& layoutMaxX_, int& layoutMaxY_,std::vector<int>& layout_, int& probeCol_);
 
+    /** Grid sites of the mode's layout that a channel is mapped to, see ElectrodeMap::getMappedSites() */
+    std::vector<uint8_t> getMappedSites(const String& acquisitionModeName) const;
+
+    /** Where the mode's electrodes are when its layout gives them coordinates, empty for grids and probes */
+    std::vector<ElectrodeSite> getElectrodeSites(const String& acquisitionModeName) const;
+
 	void loadImpedances();
     
+    /** Sends the selection to the LFP Viewer; changes are coalesced so at most one message goes out per LFP Viewer frame */
     void setSubselectedChannels(int start, int rows, int cols, int colsPerRow);
 
     void updateSourceElectrodeLayoutPath(const String& layoutFilePath);
@@ -131,8 +280,11 @@ public:
 
         currentValues.clear();
         currentValues.insertMultiple(0, 0, channelCount);
+        baseline.resize(channelCount);
+        channelHealth.resize(channelCount);
 
         currentStreamName = name;
+        compileChannelRoutes();
     }
 
     String getLayoutFilePathString() {
@@ -157,8 +309,49 @@ private:
 
     void parseElectrodeLayoutFile(const DynamicObject::Ptr layoutFileContents);
 
+    /** Serializes the per-stage timing histograms for the GETTIMINGS config message */
+    String getTimingsJSON(bool perThread) const;
+
+    /** Writes the per-thread timing histograms as CSV; returns an empty string on success */
+    String writeTimingsCSV(const File& csvFile) const;
+
+    void broadcastSubselection(const Subselection& selection);
+
+    /** Called by process() once the block's values and health flags are in */
+    void updateRegionStatistics();
+
+    /**
+        Resolves the displayed stream's channels through the selected capability's map, or in stream
+        order when it has none, and hands the result to process(); call whenever any of those change
+    */
+    void compileChannelRoutes();
+
+    /** Called by process() to pick up routes compiled since the last block */
+    void updateChannelRoutes();
+
+    /** Refits impedanceChangeRates from the history for the current layout, under impedanceLock */
+    void refreshImpedanceChangeRates();
+
+    /** Opens or closes the shared memory export to match frameExportName; audio thread idle only */
+    String applyFrameExport();
+
+    /** Starts or stops the loopback frame server to match frameServerPort; audio thread idle only */
+    String applyFrameServer();
+
+    /**
+        Loads magnitudes and phases at several frequencies from an IMPEDANCESREADY payload, if it
+        carries any; otherwise loadImpedances() takes the single frequency the channels report.
+        Entries are matched to electrodes by the payload's "channels" list of channel and stream
+        names, or by index within the stream when it has none and the channels share one stream
+    */
+    String loadImpedanceSpectra(const DynamicObject::Ptr payloadMap);
+
+    /** Appends the impedances just loaded to the history, if one is open, and refreshes the change rates */
+    void recordImpedanceSweep();
+
+    /** Serializes one electrode's impedance history for the GETIMPEDANCEHISTORY config message */
+    String getImpedanceHistoryJSON(int electrode, int64 fromMs, int64 toMs) const;
 
-    std::optional<std::unordered_map<ElectrodeMapKey,int>> parseChannelMap(Array<var>* mappings, int rows, int cols);
 
     std::map<String, ElectrodeMap> electrodeMaps;
 
@@ -166,10 +359,68 @@ private:
     std::optional<String> selectedCapability = std::nullopt;
     std::optional<String> electrodeLayoutPath = std::nullopt;
 
+    //Compiled by the message thread, which keeps channelRoutes; process() swaps pendingRoutes into processRoutes
+    //and pendingNeighbours into channelHealth
+    std::vector<ChannelRoute> channelRoutes;
+    std::vector<ChannelRoute> pendingRoutes;
+    std::vector<ChannelRoute> processRoutes;
+    ChannelNeighbours pendingNeighbours;
+    CriticalSection routeLock;
+    std::atomic<bool> routesPending;
+
     Array<float> currentValues;
     Array<float> impedanceValues;
+    uint64_t layoutHash;
+
+    //Impedance sweeps over the life of the implant, see SETIMPEDANCEHISTORY
+    ImpedanceHistory impedanceHistory;
+    std::vector<float> impedanceChangeRates;
+
+    //Guards the spectra, the fits and the change rates, which the render thread copies its views from
+    mutable CriticalSection impedanceLock;
+    ImpedanceSpectra impedanceSpectra;
+    bool hasSourceSpectra;
+    int impedanceRevision;
+    std::vector<float> fitResistance;
+    std::vector<float> fitCapacitance;
+    std::atomic<uint64_t> frameSequence;
+    //Bumps frameSequence when a fit is ready, so it is declared after it
+    ImpedanceFitWorker impedanceFitWorker;
+    std::atomic<bool> displayReductionSuspended;
+    std::atomic<bool> suspendWhenHidden;
+    std::atomic<int> renderThreads;
+    std::atomic<double> latestValuesTime;
+
+    ElectrodeBaseline baseline;
+    std::atomic<bool> zScoreEnabled;
+    std::atomic<bool> baselineResetPending;
+    std::atomic<float> baselineTimeConstant;
+
+    //Owned by the audio thread; new regions are compiled into pendingRegions and swapped in by process()
+    RegionStatistics regionStatistics;
+    RegionStatistics pendingRegions;
+    CriticalSection regionLock;
+    std::atomic<bool> regionsPending;
+    std::atomic<float> regionActiveLevel;
+    //Copied out by process() when the message thread isn't reading it; the message thread reserves its room
+    std::vector<RegionStats> publishedRegionStats;
+    mutable CriticalSection regionStatsLock;
+
+    //Shared memory export of the reduced frames, see SETFRAMEEXPORT; empty name means off
+    FrameSink frameSink;
+    String frameExportName;
+    int frameExportSlots;
+
+    //Loopback TCP stream of the reduced frames, see SETFRAMESERVER; -1 means off
+    FrameServer frameServer;
+    int frameServerPort;
+
+    ChannelHealthMonitor channelHealth;
+    //applied to channelHealth when acquisition starts, while the audio thread is idle
+    ChannelHealthLimits healthLimits;
 
     float effectiveSampleRate;
+    BlockRateEstimator blockTiming;
     
     String currentStreamName;
     std::set<String> availableStreams;
@@ -178,6 +429,10 @@ private:
     int layoutMaxY;
     std::vector<int> layout;
     int probeCols;
+
+    SubselectionPublisher subselectionPublisher;
+    //The LFP Viewer redraws at about 30 Hz, so selections sent faster than this are never seen
+    static const double subselectionIntervalMs;
     
 
 	/** Generates an assertion if this class leaks */
@@ -29,11 +29,14 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "UG3ElectrodeViewerToolbar.h"
 
+const float UG3ElectrodeViewerCanvas::minimumRefreshRate = 4.0f;
+const float UG3ElectrodeViewerCanvas::maximumRefreshRate = 60.0f;
 
 UG3ElectrodeViewerCanvas::UG3ElectrodeViewerCanvas(UG3ElectrodeViewer* processor_)
-	: node(processor_), isImpedanceOn(false), areElectrodeColorsZeroCentered(false), colorScaleFactor(0), colorScaleText(""), animationIsActive(false)
+	: node(processor_), isImpedanceOn(false), areElectrodeColorsZeroCentered(false), colorScaleFactor(0), colorScaleText(""), isAutoRangeOn(false), isZScoreOn(false), isSmoothingOn(false), isCsdOn(false), isImpedanceTrendOn(false), impedanceView(ImpedanceView::MAGNITUDE), impedanceFrequency(0), shownImpedanceRevision(-1), gridCols(0), gridRows(0), isSiteLayout(false), numRegionsDrawn(0), regionLayoutSites(0), animationIsActive(false), isSuspended(false)
 {
     refreshRate = 30;
+    scheduler.setRateLimits(minimumRefreshRate, maximumRefreshRate);
     
     viewport = std::make_unique<UG3ElectrodeViewerViewport>(this);
 
@@ -45,7 +48,13 @@ UG3ElectrodeViewerCanvas::UG3ElectrodeViewerCanvas(UG3ElectrodeViewer* processor
     scrollBarThickness = viewport->getScrollBarThickness();
     
     addAndMakeVisible (viewport.get());
+
+    regionTracePanel = std::make_unique<RegionTracePanel>();
+    addChildComponent(regionTracePanel.get());
     
+    //The toolbar pushes its initial settings to the renderer, so it has to exist first
+    renderer = std::make_unique<ElectrodeRenderer>(node, this);
+
     toolbar = std::make_unique<UG3ElectrodeViewerToolbar>(this);
     addAndMakeVisible(toolbar.get());
     
@@ -61,8 +70,10 @@ UG3ElectrodeViewerCanvas::~UG3ElectrodeViewerCanvas()
 void UG3ElectrodeViewerCanvas::resized()
 {
     int toolbarHeight = 55;
-    viewport->setBounds(0, 0, getWidth(), getHeight()-toolbarHeight); // leave space at bottom for buttons
-    display->setBounds(0,0, std::max(display->getTotalWidth(), getWidth() - scrollBarThickness), std::max(display->getTotalHeight(), getHeight() - toolbarHeight));
+    int traceHeight = regionTracePanel->isVisible() ? 120 : 0;
+    viewport->setBounds(0, 0, getWidth(), getHeight() - toolbarHeight - traceHeight); // leave space at bottom for buttons
+    regionTracePanel->setBounds(0, getHeight() - toolbarHeight - traceHeight, getWidth(), traceHeight);
+    display->setBounds(0,0, std::max(display->getTotalWidth(), getWidth() - scrollBarThickness), std::max(display->getTotalHeight(), getHeight() - toolbarHeight - traceHeight));
     
     toolbar->setBounds(0,getHeight() - toolbarHeight, std::max(display->getTotalWidth(), getWidth() - scrollBarThickness), toolbarHeight);
 }
@@ -72,6 +83,11 @@ void UG3ElectrodeViewerCanvas::refreshState()
 
     resized();
 
+    //Whatever arrived while hidden is summed up by the latest values, so one frame is enough
+    if(resumeFromHidden() && animationIsActive) {
+        refresh();
+    }
+
 }
 
 
@@ -81,6 +97,8 @@ void UG3ElectrodeViewerCanvas::update()
     int layoutMaxY = 0;
     std::vector<int> layout;
     int probeCols = 0;
+    std::vector<ElectrodeSite> sites;
+    mappedSites.clear();
 
     toolbar->buildAcquisitionButtons();
 
@@ -88,14 +106,43 @@ void UG3ElectrodeViewerCanvas::update()
     std::optional<String> acquisitionModeName = toolbar->getCurrentAcquisitionName();
     if(acquisitionModeName.has_value()) {
         node -> getLayoutParameters(acquisitionModeName.value(), layoutMaxX, layoutMaxY, layout, probeCols);
+        mappedSites = node -> getMappedSites(acquisitionModeName.value());
+        sites = node -> getElectrodeSites(acquisitionModeName.value());
+    }
+    gridCols = layoutMaxX;
+    gridRows = layoutMaxY;
+    isSiteLayout = !sites.empty();
+    toolbar->setGridFeaturesEnabled(!isSiteLayout);
+    if(propagationWorker != nullptr) {
+        propagationWorker->setGrid(gridCols, gridRows, mappedSites);
     }
-    if(probeCols > 0) {
+    if(!sites.empty()) {
+        display -> setSiteLayout(sites);
+    }
+    else if(probeCols > 0) {
         display -> setProbeLayout(layoutMaxX, layoutMaxY, probeCols);
     }
     else {
         display->setGridLayout(layoutMaxX, layoutMaxY, layout);
     }
 
+    //Region sites are electrode indices, which mean something else in a new layout
+    if(display->getNumElectrodes() != regionLayoutSites) {
+        regionLayoutSites = display->getNumElectrodes();
+        if(!regionsOfInterest.empty()) {
+            clearRegionsOfInterest();
+        }
+    }
+
+    RenderLayout renderLayout = display->getRenderLayout();
+    renderLayout.gridCols = gridCols;
+    renderLayout.gridRows = gridRows;
+    renderLayout.mappedSites = mappedSites;
+    renderer->setLayout(renderLayout);
+    if(!animationIsActive) {
+        refresh();
+    }
+
     toolbar->resized();
     toolbar->repaint();
 }
@@ -103,19 +150,77 @@ void UG3ElectrodeViewerCanvas::update()
 
 void UG3ElectrodeViewerCanvas::refresh()
 {
-    const float* values;
-    if(isImpedanceOn){
-        values = node->getImpedanceMagnitudes();
-    } else {
-        values= node->getLatestValues();
+    if(animationIsActive) {
+        const bool isVisible = isShowing();
+        scheduler.setVisible(isVisible);
+        const bool hasNewFrame = scheduler.tick(Time::getMillisecondCounterHiRes() * 0.001, node->getFrameSequence());
+        applyScheduledRate();
+        if(!isVisible) {
+            suspendWhileHidden();
+            return;
+        }
+        //Shown again without refreshState(), e.g. the window was restored
+        if(resumeFromHidden()) {
+            scheduler.invalidate();
+        }
+        else if(!hasNewFrame) {
+            return;
+        }
     }
 
-    display->refresh(values, areElectrodeColorsZeroCentered, colorScaleFactor);
+    frameTiming.frameRequested();
 
-    repaint();
+    const uint8_t* healthFlags = node->getChannelHealthFlags();
+    const int numHealthFlags = node->getNumChannelHealthFlags();
+    display->setHealthFlags(healthFlags, numHealthFlags, node->getNumFlaggedChannels());
+
+    //A new sweep may have measured a different set of frequencies
+    if(isImpedanceOn && node->getImpedanceRevision() != shownImpedanceRevision) {
+        shownImpedanceRevision = node->getImpedanceRevision();
+        toolbar->updateImpedanceViews(node->getImpedanceFrequencies());
+    }
+
+    if(!regionsOfInterest.empty()) {
+        node->getRegionStatistics(regionStats);
+        regionTracePanel->addFrame(regionStats);
+        regionTracePanel->repaint();
+    }
+
+    //Frames are timed by the sample they were taken from, so a slow refresh doesn't skew latencies,
+    //but only one frame per refresh reaches the estimator: peak times are only resolved to the refresh interval
+    if(propagationWorker != nullptr && !isImpedanceOn && !isSiteLayout) {
+        propagationWorker->submitFrame(node->getLatestValues(), node->getNumLatestValues(), healthFlags, numHealthFlags,
+                                       node->getLatestValuesTime());
+        if(propagationWorker->getArrows(propagationArrows)) {
+            display->setPropagationArrows(propagationArrows);
+        }
+    }
+
+    //During acquisition the renderer's thread does the work and calls back when the frame is ready
+    if(animationIsActive) {
+        renderer->requestFrame();
+        return;
+    }
+
+    renderer->renderNow();
+    renderedFrameReady();
     
 }
 
+void UG3ElectrodeViewerCanvas::renderedFrameReady()
+{
+    scheduler.recordRenderCost(renderer->getLastFrameSeconds());
+    if(isAutoRangeOn && !(renderer->getRange() == shownRange)) {
+        setDisplayColorRangeText();
+    }
+    repaint();
+}
+
+void UG3ElectrodeViewerCanvas::drawRenderedFrame(Graphics& g)
+{
+    renderer->drawLatestFrame(g);
+}
+
 
 void UG3ElectrodeViewerCanvas::paint(Graphics& g)
 {
@@ -126,17 +231,44 @@ void UG3ElectrodeViewerCanvas::paint(Graphics& g)
 
 void UG3ElectrodeViewerCanvas::beginAnimation() {
     animationIsActive = true;
+    frameTiming.reset();
+    scheduler.reset(Time::getMillisecondCounterHiRes() * 0.001);
+    refreshRate = roundToInt(scheduler.getRate());
+    renderer->startThread();
     startCallbacks();
 }
 
 void UG3ElectrodeViewerCanvas::endAnimation() {
     animationIsActive = false;
     stopCallbacks();
+    renderer->stopThread(1000);
+    resumeFromHidden();
+}
+
+void UG3ElectrodeViewerCanvas::suspendWhileHidden() {
+    if(isSuspended) {
+        return;
+    }
+    isSuspended = true;
+    if(node->shouldSuspendWhenHidden()) {
+        node->setDisplayReductionSuspended(true);
+    }
+}
+
+bool UG3ElectrodeViewerCanvas::resumeFromHidden() {
+    if(!isSuspended) {
+        return false;
+    }
+    isSuspended = false;
+    node->setDisplayReductionSuspended(false);
+    scheduler.invalidate();
+    return true;
 }
 
 void UG3ElectrodeViewerCanvas::setColorScaleFactor(int scaleFactor, String unitText) {
     colorScaleFactor = scaleFactor;
     colorScaleText = unitText;
+    updateRenderSettings();
     setDisplayColorRangeText();
     if (!animationIsActive)
         refresh();
@@ -145,6 +277,7 @@ void UG3ElectrodeViewerCanvas::setColorScaleFactor(int scaleFactor, String unitT
 void UG3ElectrodeViewerCanvas::toggleImpedanceMode(bool isImpedanceOn_) {
 
     isImpedanceOn = isImpedanceOn_;
+    updateRenderSettings();
     if (isImpedanceOn_) {
         node->loadImpedances();
         refresh();
@@ -152,11 +285,145 @@ void UG3ElectrodeViewerCanvas::toggleImpedanceMode(bool isImpedanceOn_) {
     
 }
 
+void UG3ElectrodeViewerCanvas::setImpedanceView(ImpedanceView view, int frequency) {
+    impedanceView = view;
+    impedanceFrequency = frequency;
+    updateRenderSettings();
+    setDisplayColorRangeText();
+    if (!animationIsActive)
+        refresh();
+}
+
+std::vector<float> UG3ElectrodeViewerCanvas::getImpedanceFrequencies() const {
+    return node->getImpedanceFrequencies();
+}
+
+void UG3ElectrodeViewerCanvas::toggleImpedanceTrend(bool isImpedanceTrendOn_) {
+    isImpedanceTrendOn = isImpedanceTrendOn_;
+    updateRenderSettings();
+    setDisplayColorRangeText();
+    if (!animationIsActive)
+        refresh();
+}
+
 void UG3ElectrodeViewerCanvas::toggleZeroCenter(bool areElectrodeColorsZeroCentered_) {
     areElectrodeColorsZeroCentered = areElectrodeColorsZeroCentered_;
+    updateRenderSettings();
     setDisplayColorRangeText();
 }
 
+void UG3ElectrodeViewerCanvas::toggleAutoRange(bool isAutoRangeOn_) {
+    isAutoRangeOn = isAutoRangeOn_;
+    updateRenderSettings();
+    setDisplayColorRangeText();
+    if (!animationIsActive)
+        refresh();
+}
+
+void UG3ElectrodeViewerCanvas::toggleZScoreMode(bool isZScoreOn_) {
+    isZScoreOn = isZScoreOn_;
+    node->setZScoreEnabled(isZScoreOn_);
+    updateRenderSettings();
+    setDisplayColorRangeText();
+    if (!animationIsActive)
+        refresh();
+}
+
+void UG3ElectrodeViewerCanvas::toggleSmoothing(bool isSmoothingOn_) {
+    isSmoothingOn = isSmoothingOn_;
+    updateRenderSettings();
+    if (!animationIsActive)
+        refresh();
+}
+
+void UG3ElectrodeViewerCanvas::toggleCsdMode(bool isCsdOn_) {
+    isCsdOn = isCsdOn_;
+    updateRenderSettings();
+    setDisplayColorRangeText();
+    if (!animationIsActive)
+        refresh();
+}
+
+void UG3ElectrodeViewerCanvas::togglePropagationOverlay(bool isPropagationOverlayOn_) {
+    propagationArrows.clear();
+    display->setPropagationArrows(propagationArrows);
+    if (isPropagationOverlayOn_) {
+        propagationWorker = std::make_unique<PropagationWorker>();
+        propagationWorker->setGrid(gridCols, gridRows, mappedSites);
+        propagationWorker->startThread();
+    }
+    else {
+        propagationWorker.reset();
+    }
+}
+
+RenderSettings UG3ElectrodeViewerCanvas::getRenderSettings() const {
+    RenderSettings settings;
+    settings.isImpedanceOn = isImpedanceOn;
+    settings.isZeroCentered = areElectrodeColorsZeroCentered;
+    settings.scaleFactor = colorScaleFactor;
+    settings.isAutoRangeOn = isAutoRangeOn;
+    settings.isZScoreOn = isZScoreOn;
+    settings.isSmoothingOn = isSmoothingOn;
+    settings.isCsdOn = isCsdOn;
+    settings.isImpedanceTrendOn = isImpedanceTrendOn;
+    settings.impedanceView = impedanceView;
+    settings.impedanceFrequency = impedanceFrequency;
+    return settings;
+}
+
+void UG3ElectrodeViewerCanvas::updateRenderSettings() {
+    const RenderSettings settings = getRenderSettings();
+    renderer->setSettings(settings);
+    //The frame on screen no longer matches the settings even if the data hasn't moved on
+    scheduler.invalidate();
+}
+
+void UG3ElectrodeViewerCanvas::applyScheduledRate() {
+    const int scheduledRate = roundToInt(scheduler.getRate());
+    if(scheduledRate != refreshRate) {
+        refreshRate = scheduledRate;
+        startCallbacks();
+    }
+}
+
+void UG3ElectrodeViewerCanvas::toggleRegionDrawing(bool isRegionDrawingOn) {
+    display->setRegionDrawingActive(isRegionDrawingOn);
+}
+
+void UG3ElectrodeViewerCanvas::addRegionOfInterest(const Path& outline, const std::vector<int>& sites) {
+    RegionOfInterest region;
+    numRegionsDrawn++;
+    region.name = "ROI " + String(numRegionsDrawn);
+    region.outline = outline;
+    region.sites = sites;
+    //Golden ratio steps keep neighbouring regions' hues well apart
+    region.colour = Colour::fromHSV(std::fmod(0.12f + 0.618034f * float(numRegionsDrawn - 1), 1.0f), 0.7f, 1.0f, 1.0f);
+    regionsOfInterest.push_back(region);
+    updateRegionsOfInterest();
+}
+
+void UG3ElectrodeViewerCanvas::clearRegionsOfInterest() {
+    regionsOfInterest.clear();
+    numRegionsDrawn = 0;
+    updateRegionsOfInterest();
+}
+
+void UG3ElectrodeViewerCanvas::updateRegionsOfInterest() {
+    std::vector<std::vector<int>> regionSites;
+    for(const RegionOfInterest& region : regionsOfInterest) {
+        regionSites.push_back(region.sites);
+    }
+    node->setRegionsOfInterest(regionSites);
+    display->setRegionsOfInterest(regionsOfInterest);
+    regionTracePanel->setRegions(regionsOfInterest);
+
+    if(regionTracePanel->isVisible() != !regionsOfInterest.empty()) {
+        regionTracePanel->setVisible(!regionsOfInterest.empty());
+        resized();
+    }
+}
+
 void UG3ElectrodeViewerCanvas::toggleSubselect(bool isSubselectActive) {
     display -> switchSubselectState(isSubselectActive);
 }
@@ -178,8 +445,50 @@ void UG3ElectrodeViewerCanvas::updateSourceAcquisitionCapability(String capabili
 
 
 void UG3ElectrodeViewerCanvas::setDisplayColorRangeText() {
-    String max = colorScaleText;
-    String min = areElectrodeColorsZeroCentered ? String("-") + colorScaleText : String("0");
+    const RenderSettings settings = getRenderSettings();
+    //CSD is the voltage's second difference across sites
+    const String csdSuffix = isShowingCsd() ? "/site^2" : "";
+    //Values with a range of their own rather than the scale selector's, and their units
+    String plainUnit;
+    if (settings.isShowingZScores()) {
+        plainUnit = " SD";
+    }
+    else if (settings.isShowingImpedanceTrend()) {
+        plainUnit = " %/day";
+    }
+    else if (settings.isShowingImpedanceView(ImpedanceView::PHASE)) {
+        plainUnit = " deg";
+    }
+    else if (settings.isShowingImpedanceView(ImpedanceView::FIT_CAPACITANCE)) {
+        plainUnit = " nF";
+    }
+
+    if (isAutoRangeOn) {
+        shownRange = renderer->getRange();
+        const float lower = shownRange.lower;
+        const float upper = shownRange.upper;
+        if (!shownRange.isValid) {
+            display->setColorRangeText("auto", "");
+        }
+        else if (plainUnit.isNotEmpty()) {
+            display->setColorRangeText(String(upper, 2) + plainUnit + " (auto)", String(lower, 2) + plainUnit);
+        }
+        else {
+            //Impedances are in Ohms, voltages in microvolts
+            String unit = isImpedanceOn ? "Ohm" : "V";
+            int prefixShiftsOffset = isImpedanceOn ? 2 : 0;
+            display->setColorRangeText(UG3ElectrodeViewerToolbar::formatMetricValue(upper, unit, prefixShiftsOffset) + csdSuffix + " (auto)",
+                                       UG3ElectrodeViewerToolbar::formatMetricValue(lower, unit, prefixShiftsOffset) + csdSuffix);
+        }
+        return;
+    }
+    if (plainUnit.isNotEmpty()) {
+        const RenderedRange range = FrameRasterizer::getDrawingRange(settings, AutoRange());
+        display->setColorRangeText((range.lower < 0.0f ? "+" : "") + String(range.upper, 1) + plainUnit, String(range.lower, 1) + plainUnit);
+        return;
+    }
+    String max = colorScaleText + csdSuffix;
+    String min = (areElectrodeColorsZeroCentered || isShowingCsd()) ? String("-") + colorScaleText + csdSuffix : String("0");
     display->setColorRangeText(max, min);
 }
 
@@ -199,6 +508,21 @@ bool UG3ElectrodeViewerCanvas::isLayoutUsingMap() {
     return node->doesCapabilityHaveMap(currentAcqusitionName.value());
 }
 
+void UG3ElectrodeViewerCanvas::toggleTelemetryOverlay(bool isTelemetryOverlayOn) {
+    display -> setTelemetryOverlayVisible(isTelemetryOverlayOn);
+}
+
+void UG3ElectrodeViewerCanvas::framePainted(double paintSeconds) {
+    scheduler.recordPaintCost(paintSeconds);
+    frameTiming.framePresented();
+}
+
+ViewerTelemetry UG3ElectrodeViewerCanvas::getTelemetry() const {
+    ViewerTelemetry telemetry = node -> getTelemetry();
+    frameTiming.fillTelemetry(telemetry, animationIsActive ? float(refreshRate) : 0.0f);
+    return telemetry;
+}
+
 void UG3ElectrodeViewerCanvas::setElectrodeLayoutPath(String layoutFilePath) {
     node -> updateSourceElectrodeLayoutPath(layoutFilePath);
 }
@@ -27,6 +27,12 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include <VisualizerWindowHeaders.h>
 #include <optional>
 
+#include "ViewerTelemetry.h"
+#include "RefreshScheduler.h"
+#include "ElectrodeRenderer.h"
+#include "PropagationWorker.h"
+#include "RegionTracePanel.h"
+
 class UG3ElectrodeViewer;
 
 class UG3ElectrodeDisplay;
@@ -53,7 +59,7 @@ public:
 	/** Updates boundaries of sub-components whenever the canvas size changes */
 	void resized() override;
 
-	/** Called when the visualizer's tab becomes visible again */
+	/** Called when the visualizer's tab becomes visible again; catches up with a single frame of the latest data */
 	void refreshState() override;
 
 	/** Updates settings */
@@ -69,8 +75,39 @@ public:
     
     void toggleImpedanceMode(bool isImpedanceOn);
 
+    /** Picks what impedance mode draws; frequency indexes getImpedanceFrequencies() for the magnitude and phase views */
+    void setImpedanceView(ImpedanceView view, int frequency);
+
+    std::vector<float> getImpedanceFrequencies() const;
+
+    /** In impedance mode, shows how fast each electrode's impedance is changing across the recorded sweeps */
+    void toggleImpedanceTrend(bool isImpedanceTrendOn_);
+
 	void toggleZeroCenter(bool areElectrodeColorsZeroCentered_);
+
+    /** Follows the 1st to 99th percentile of each frame instead of the fixed scale factor */
+    void toggleAutoRange(bool isAutoRangeOn_);
+
+    /** Shows each electrode's voltage in standard deviations from its own running baseline */
+    void toggleZScoreMode(bool isZScoreOn_);
+
+    /** Fills unmapped and flagged sites from their neighbours and smooths the grid into a continuous field */
+    void toggleSmoothing(bool isSmoothingOn_);
+
+    /** Shows the current source density (negative spatial Laplacian) of the voltages instead of the voltages */
+    void toggleCsdMode(bool isCsdOn_);
+
+    /** Draws arrows showing which way activity travels across the grid, estimated on a worker thread */
+    void togglePropagationOverlay(bool isPropagationOverlayOn_);
     
+    /** While on, dragging over the display draws regions of interest instead of moving the subselection */
+    void toggleRegionDrawing(bool isRegionDrawingOn);
+
+    /** Adds a region whose statistics the processor computes every block and the trace panel plots */
+    void addRegionOfInterest(const Path& outline, const std::vector<int>& sites);
+
+    void clearRegionsOfInterest();
+
     void toggleSubselect(bool isSubselectActive);
     
     void setSubselectedChannels(int start, int rows, int cols, int colsPerRow);
@@ -95,6 +132,20 @@ public:
 
 	bool isLayoutUsingMap();
 
+    void toggleTelemetryOverlay(bool isTelemetryOverlayOn);
+
+    /** Called by the display at the end of each paint to close the pending frame measurement */
+    void framePainted(double paintSeconds);
+
+    /** Called by the display to draw the newest frame from the renderer */
+    void drawRenderedFrame(Graphics& g);
+
+    /** Called by the renderer on the message thread when it has finished a frame */
+    void renderedFrameReady();
+
+    /** Returns processor block timing combined with the canvas frame timing */
+    ViewerTelemetry getTelemetry() const;
+
 	void saveCustomParametersToXml(XmlElement* xml) override;
 
 	void loadCustomParametersFromXml(XmlElement* xml) override;
@@ -117,8 +168,82 @@ private:
 	int colorScaleFactor;
 	String colorScaleText;
 
+    bool isAutoRangeOn;
+    //Auto range the scale labels currently show
+    RenderedRange shownRange;
+
+    bool isZScoreOn;
+
+    bool isSmoothingOn;
+
+    bool isCsdOn;
+
+    bool isImpedanceTrendOn;
+
+    ImpedanceView impedanceView;
+    int impedanceFrequency;
+    //Impedances the toolbar's views were built for
+    int shownImpedanceRevision;
+
+    //Grid of the current layout
+    int gridCols;
+    int gridRows;
+    //Sites placed by coordinate are a single row, so nothing that works in grid rows and columns applies
+    bool isSiteLayout;
+    std::vector<uint8_t> mappedSites;
+
+    /** The current display modes */
+    RenderSettings getRenderSettings() const;
+
+    /** Passes the current display modes to the renderer */
+    void updateRenderSettings();
+
+    //Only exists while the propagation overlay is on, so the thread isn't running otherwise
+    std::unique_ptr<PropagationWorker> propagationWorker;
+    std::vector<PropagationArrow> propagationArrows;
+
+    std::vector<RegionOfInterest> regionsOfInterest;
+    std::vector<RegionStats> regionStats;
+    //Shown under the display while there is at least one region
+    std::unique_ptr<RegionTracePanel> regionTracePanel;
+    //Used to name and colour the next region
+    int numRegionsDrawn;
+    //Layout the regions' sites index into; the regions are dropped when it changes
+    int regionLayoutSites;
+
+    /** Passes the regions to the processor, the display and the trace panel */
+    void updateRegionsOfInterest();
+
+    bool isShowingCsd() const { return isCsdOn && !isImpedanceOn; }
+
+    bool isShowingZScores() const { return isZScoreOn && !isImpedanceOn && !isCsdOn; }
+
 	bool animationIsActive;
 
+    FrameRateEstimator frameTiming;
+
+    //Decides which timer ticks draw and how fast the timer runs during acquisition
+    RefreshScheduler scheduler;
+    //Refresh rate never goes below this, so acquisition resuming is picked up quickly
+    static const float minimumRefreshRate;
+    //Typical display refresh rate; drawing faster than this is never seen
+    static const float maximumRefreshRate;
+
+    /** Restarts the timer if the scheduler has picked a new rate */
+    void applyScheduledRate();
+
+    //Set while acquisition runs with the tab hidden, so nothing is rendered
+    bool isSuspended;
+
+    /** Stops rendering, and the processor's display reduction if it is allowed to */
+    void suspendWhileHidden();
+
+    /** Undoes suspendWhileHidden(); returns false if the canvas wasn't suspended */
+    bool resumeFromHidden();
+
+    //Declared last so its thread stops before anything it draws from is destroyed
+    std::unique_ptr<ElectrodeRenderer> renderer;
+
 	/** Generates an assertion if this class leaks */
 	JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(UG3ElectrodeViewerCanvas);
 };
@@ -24,9 +24,22 @@ String UG3ElectrodeViewerToolbar::calculateMetricString(int value, String unit,
 
 }
 
+String UG3ElectrodeViewerToolbar::formatMetricValue(float value, String unit, int prefixShiftsOffset) {
+    std::vector<String> metricPrefixes = { "u", "m", "", "K", "M" };
+    int prefixShifts = prefixShiftsOffset;
+    while (std::abs(value) >= 1000.0f && prefixShifts < int(metricPrefixes.size()) - 1) {
+        value = value / 1000.0f;
+        prefixShifts++;
+    }
+
+    int decimalPlaces = std::abs(value) < 10.0f ? 2 : (std::abs(value) < 100.0f ? 1 : 0);
+    return String(value, decimalPlaces) + (prefixShifts < metricPrefixes.size() ? metricPrefixes[prefixShifts] : "?") + unit;
+}
+
 
 const std::vector<int> UG3ElectrodeViewerToolbar::voltageOptions = { 1, 5, 10, 50, 100, 500, 1000, 5000, 10000, 50000, 100000, 500000, 1000000, 5000000 };
 const std::vector<int> UG3ElectrodeViewerToolbar::impedanceOptions = {100, 500, 1000, 5000, 10000, 50000, 100000, 500000, 1000000, 5000000, 10000000, 50000000 };
+const int UG3ElectrodeViewerToolbar::viewIdStride = 1000;
 
 UG3ElectrodeViewerToolbar::UG3ElectrodeViewerToolbar(UG3ElectrodeViewerCanvas* canvas) : canvas(canvas){
     
@@ -39,6 +52,21 @@ UG3ElectrodeViewerToolbar::UG3ElectrodeViewerToolbar(UG3ElectrodeViewerCanvas* c
     impedanceButton->setToggleState(false, sendNotification);
     addAndMakeVisible(impedanceButton);
 
+    impedanceTrendButton = new UtilityButton("OFF", Font("Default", "Plain", 15));
+    impedanceTrendButton->setRadius(5.0f);
+    impedanceTrendButton->setEnabledState(false);
+    impedanceTrendButton->setCorners(true, true, true, true);
+    impedanceTrendButton->addListener(this);
+    impedanceTrendButton->setClickingTogglesState(true);
+    impedanceTrendButton->setToggleState(false, dontSendNotification);
+    addAndMakeVisible(impedanceTrendButton);
+
+    impedanceViewSelector = new ComboBox("Impedance View Selector");
+    impedanceViewSelector->setEnabled(false);
+    impedanceViewSelector->addListener(this);
+    addAndMakeVisible(impedanceViewSelector);
+    updateImpedanceViews({});
+
     zeroCenterButton = new UtilityButton("OFF", Font("Default", "Plain", 15));
     zeroCenterButton->setRadius(5.0f);
     zeroCenterButton->setEnabledState(true);
@@ -115,6 +143,76 @@ UG3ElectrodeViewerToolbar::UG3ElectrodeViewerToolbar(UG3ElectrodeViewerCanvas* c
     loadLayoutButton->addListener(this);
     addAndMakeVisible(loadLayoutButton);
 
+    telemetryButton = new UtilityButton("OFF", Font("Default", "Plain", 15));
+    telemetryButton->setRadius(5.0f);
+    telemetryButton->setEnabledState(true);
+    telemetryButton->setCorners(true, true, true, true);
+    telemetryButton->addListener(this);
+    telemetryButton->setClickingTogglesState(true);
+    telemetryButton->setToggleState(false, dontSendNotification);
+    addAndMakeVisible(telemetryButton);
+
+    autoRangeButton = new UtilityButton("OFF", Font("Default", "Plain", 15));
+    autoRangeButton->setRadius(5.0f);
+    autoRangeButton->setEnabledState(true);
+    autoRangeButton->setCorners(true, true, true, true);
+    autoRangeButton->addListener(this);
+    autoRangeButton->setClickingTogglesState(true);
+    autoRangeButton->setToggleState(false, dontSendNotification);
+    addAndMakeVisible(autoRangeButton);
+
+    zScoreButton = new UtilityButton("OFF", Font("Default", "Plain", 15));
+    zScoreButton->setRadius(5.0f);
+    zScoreButton->setEnabledState(true);
+    zScoreButton->setCorners(true, true, true, true);
+    zScoreButton->addListener(this);
+    zScoreButton->setClickingTogglesState(true);
+    zScoreButton->setToggleState(false, dontSendNotification);
+    addAndMakeVisible(zScoreButton);
+
+    smoothingButton = new UtilityButton("OFF", Font("Default", "Plain", 15));
+    smoothingButton->setRadius(5.0f);
+    smoothingButton->setEnabledState(true);
+    smoothingButton->setCorners(true, true, true, true);
+    smoothingButton->addListener(this);
+    smoothingButton->setClickingTogglesState(true);
+    smoothingButton->setToggleState(false, dontSendNotification);
+    addAndMakeVisible(smoothingButton);
+
+    csdButton = new UtilityButton("OFF", Font("Default", "Plain", 15));
+    csdButton->setRadius(5.0f);
+    csdButton->setEnabledState(true);
+    csdButton->setCorners(true, true, true, true);
+    csdButton->addListener(this);
+    csdButton->setClickingTogglesState(true);
+    csdButton->setToggleState(false, dontSendNotification);
+    addAndMakeVisible(csdButton);
+
+    propagationButton = new UtilityButton("OFF", Font("Default", "Plain", 15));
+    propagationButton->setRadius(5.0f);
+    propagationButton->setEnabledState(true);
+    propagationButton->setCorners(true, true, true, true);
+    propagationButton->addListener(this);
+    propagationButton->setClickingTogglesState(true);
+    propagationButton->setToggleState(false, dontSendNotification);
+    addAndMakeVisible(propagationButton);
+
+    regionButton = new UtilityButton("OFF", Font("Default", "Plain", 15));
+    regionButton->setRadius(5.0f);
+    regionButton->setEnabledState(true);
+    regionButton->setCorners(true, true, true, true);
+    regionButton->addListener(this);
+    regionButton->setClickingTogglesState(true);
+    regionButton->setToggleState(false, dontSendNotification);
+    addAndMakeVisible(regionButton);
+
+    clearRegionsButton = new UtilityButton("Clear", Font("Default", "Plain", 15));
+    clearRegionsButton->setRadius(5.0f);
+    clearRegionsButton->setEnabledState(true);
+    clearRegionsButton->setCorners(true, true, true, true);
+    clearRegionsButton->addListener(this);
+    addAndMakeVisible(clearRegionsButton);
+
 }
 
 UG3ElectrodeViewerToolbar::~UG3ElectrodeViewerToolbar(){}
@@ -128,7 +226,9 @@ void UG3ElectrodeViewerToolbar::resized(){
     voltageSelector->setBounds(leftEdge + 10, getHeight() - 30, 160, 22);
     impedanceSelector->setBounds(leftEdge + 10, getHeight() - 30, 160, 22);
     impedanceButton->setBounds(voltageSelector -> getRight() + 10, getHeight() - 30, 60, 22);
-    zeroCenterButton->setBounds(impedanceButton->getRight() + 50, getHeight() - 30, 60, 22);
+    impedanceTrendButton->setBounds(impedanceButton->getRight() + 50, getHeight() - 30, 60, 22);
+    impedanceViewSelector->setBounds(impedanceTrendButton->getRight() + 50, getHeight() - 30, 140, 22);
+    zeroCenterButton->setBounds(impedanceViewSelector->getRight() + 30, getHeight() - 30, 60, 22);
     subSelectButton->setBounds(zeroCenterButton->getRight() + 50, getHeight() - 30, 60, 22);
     
     subselectHorDecButton->setBounds(subSelectButton->getRight() + 30, getHeight() - 30, 60, 22);
@@ -139,6 +239,21 @@ void UG3ElectrodeViewerToolbar::resized(){
 
     loadLayoutButton->setBounds(subselectVertIncButton -> getRight() + 10, getHeight() - 30, 60, 22);
 
+    telemetryButton->setBounds(loadLayoutButton->getRight() + 50, getHeight() - 30, 60, 22);
+
+    autoRangeButton->setBounds(telemetryButton->getRight() + 50, getHeight() - 30, 60, 22);
+
+    zScoreButton->setBounds(autoRangeButton->getRight() + 50, getHeight() - 30, 60, 22);
+
+    smoothingButton->setBounds(zScoreButton->getRight() + 50, getHeight() - 30, 60, 22);
+
+    csdButton->setBounds(smoothingButton->getRight() + 50, getHeight() - 30, 60, 22);
+
+    propagationButton->setBounds(csdButton->getRight() + 50, getHeight() - 30, 60, 22);
+
+    regionButton->setBounds(propagationButton->getRight() + 50, getHeight() - 30, 60, 22);
+    clearRegionsButton->setBounds(regionButton->getRight(), getHeight() - 30, 60, 22);
+
 }
 
 void UG3ElectrodeViewerToolbar::paint(Graphics& g){
@@ -151,6 +266,8 @@ void UG3ElectrodeViewerToolbar::paint(Graphics& g){
     String selectorText = impedanceButton->getToggleState() ? "Impedance Selector (Ohms)" : "Voltage Selector (V)";
     g.drawText(selectorText, voltageSelector->getX(), voltageSelector->getY()-22, 300, 20, Justification::left, false);
     g.drawText("Impedance Mode", impedanceButton->getX(), impedanceButton->getY()-22, 300, 20, Justification::left, false);
+    g.drawText("Trend (%/day)", impedanceTrendButton->getX(), impedanceTrendButton->getY() - 22, 300, 20, Justification::left, false);
+    g.drawText("Impedance View", impedanceViewSelector->getX(), impedanceViewSelector->getY() - 22, 300, 20, Justification::left, false);
     g.drawText("Zero Center (+/-)", zeroCenterButton->getX(), zeroCenterButton->getY() - 22, 300, 20, Justification::left, false);
     g.drawText("Subselect", subSelectButton->getX(), subSelectButton->getY() - 22, 300, 20, Justification::left, false);
    
@@ -158,6 +275,13 @@ void UG3ElectrodeViewerToolbar::paint(Graphics& g){
     g.drawText("Subselect Vertical", subselectVertDecButton->getX(), subselectVertDecButton->getY() - 22, 300, 20, Justification::left, false);
 
     g.drawText("Layout File", loadLayoutButton->getX(), loadLayoutButton->getY() - 22, 300, 20, Justification::left, false);
+    g.drawText("Stats", telemetryButton->getX(), telemetryButton->getY() - 22, 300, 20, Justification::left, false);
+    g.drawText("Auto Range", autoRangeButton->getX(), autoRangeButton->getY() - 22, 300, 20, Justification::left, false);
+    g.drawText("Z-Score", zScoreButton->getX(), zScoreButton->getY() - 22, 300, 20, Justification::left, false);
+    g.drawText("Smooth", smoothingButton->getX(), smoothingButton->getY() - 22, 300, 20, Justification::left, false);
+    g.drawText("CSD", csdButton->getX(), csdButton->getY() - 22, 300, 20, Justification::left, false);
+    g.drawText("Waves", propagationButton->getX(), propagationButton->getY() - 22, 300, 20, Justification::left, false);
+    g.drawText("ROIs (shift: freehand)", regionButton->getX(), regionButton->getY() - 22, 300, 20, Justification::left, false);
 
 
 }
@@ -167,6 +291,11 @@ void UG3ElectrodeViewerToolbar::comboBoxChanged (ComboBox* combo){
         canvas -> setColorScaleFactor(voltageOptions[combo->getSelectedItemIndex()], combo->getText());
     } else if (combo == impedanceSelector) {
         canvas->setColorScaleFactor(impedanceOptions[combo->getSelectedItemIndex()], combo->getText());
+    } else if (combo == impedanceViewSelector) {
+        //Item ids are view * viewIdStride + frequency + 1
+        const int id = combo->getSelectedId() - 1;
+        canvas->setImpedanceView(ImpedanceView(id / viewIdStride), id % viewIdStride);
+        updateSelectorsEnabled();
     }
 
 }
@@ -181,6 +310,12 @@ void UG3ElectrodeViewerToolbar::buttonClicked (Button* button){
     if(button == impedanceButton) {
         canvas -> toggleImpedanceMode(button->getToggleState());
         static_cast<UtilityButton*>(button)->setLabel(button->getToggleState() ? "ON" : "OFF");
+        //The trend only exists for impedances
+        impedanceTrendButton->setEnabledState(button->getToggleState());
+        impedanceViewSelector->setEnabled(button->getToggleState());
+        if (button->getToggleState()) {
+            updateImpedanceViews(canvas->getImpedanceFrequencies());
+        }
         removeChildComponent((button->getToggleState() ? voltageSelector : impedanceSelector));
         addAndMakeVisible((button->getToggleState() ? impedanceSelector : voltageSelector));
 
@@ -193,6 +328,12 @@ void UG3ElectrodeViewerToolbar::buttonClicked (Button* button){
         resized();
         return;
     }
+    else if (button == impedanceTrendButton) {
+        canvas->toggleImpedanceTrend(button->getToggleState());
+        static_cast<UtilityButton*>(button)->setLabel(button->getToggleState() ? "ON" : "OFF");
+        updateSelectorsEnabled();
+        return;
+    }
     else if (button == zeroCenterButton) {
         canvas->toggleZeroCenter(button->getToggleState());
         static_cast<UtilityButton*>(button)->setLabel(button->getToggleState() ? "ON" : "OFF");
@@ -205,6 +346,47 @@ void UG3ElectrodeViewerToolbar::buttonClicked (Button* button){
         resized();
         return;
     }
+    else if (button == telemetryButton) {
+        canvas->toggleTelemetryOverlay(button->getToggleState());
+        static_cast<UtilityButton*>(button)->setLabel(button->getToggleState() ? "ON" : "OFF");
+        return;
+    }
+    else if (button == autoRangeButton) {
+        canvas->toggleAutoRange(button->getToggleState());
+        static_cast<UtilityButton*>(button)->setLabel(button->getToggleState() ? "ON" : "OFF");
+        updateSelectorsEnabled();
+        return;
+    }
+    else if (button == zScoreButton) {
+        canvas->toggleZScoreMode(button->getToggleState());
+        static_cast<UtilityButton*>(button)->setLabel(button->getToggleState() ? "ON" : "OFF");
+        updateSelectorsEnabled();
+        return;
+    }
+    else if (button == smoothingButton) {
+        canvas->toggleSmoothing(button->getToggleState());
+        static_cast<UtilityButton*>(button)->setLabel(button->getToggleState() ? "ON" : "OFF");
+        return;
+    }
+    else if (button == csdButton) {
+        canvas->toggleCsdMode(button->getToggleState());
+        static_cast<UtilityButton*>(button)->setLabel(button->getToggleState() ? "ON" : "OFF");
+        return;
+    }
+    else if (button == propagationButton) {
+        canvas->togglePropagationOverlay(button->getToggleState());
+        static_cast<UtilityButton*>(button)->setLabel(button->getToggleState() ? "ON" : "OFF");
+        return;
+    }
+    else if (button == regionButton) {
+        canvas->toggleRegionDrawing(button->getToggleState());
+        static_cast<UtilityButton*>(button)->setLabel(button->getToggleState() ? "ON" : "OFF");
+        return;
+    }
+    else if (button == clearRegionsButton) {
+        canvas->clearRegionsOfInterest();
+        return;
+    }
     else if (button == subselectHorIncButton){
         canvas -> updateSubselectWindow(subselectWindowOptions::HorInc);
     }
@@ -233,6 +415,60 @@ void UG3ElectrodeViewerToolbar::buttonClicked (Button* button){
 
 }
 
+void UG3ElectrodeViewerToolbar::updateSelectorsEnabled() {
+    voltageSelector->setEnabled(!autoRangeButton->getToggleState() && !zScoreButton->getToggleState());
+    //Phases and capacitances have fixed ranges of their own
+    const int view = (impedanceViewSelector->getSelectedId() - 1) / viewIdStride;
+    const bool isOhms = view == int(ImpedanceView::MAGNITUDE) || view == int(ImpedanceView::FIT_RESISTANCE);
+    impedanceSelector->setEnabled(!autoRangeButton->getToggleState() && !impedanceTrendButton->getToggleState() && isOhms);
+}
+
+void UG3ElectrodeViewerToolbar::updateImpedanceViews(const std::vector<float>& frequencies) {
+    const int selectedId = impedanceViewSelector->getSelectedId();
+    impedanceViewSelector->clear(dontSendNotification);
+
+    //Sources that don't report a frequency still have one magnitude and phase
+    const int numFrequencies = jlimit(1, viewIdStride - 1, int(frequencies.size()));
+    for (int f = 0; f < numFrequencies; f++) {
+        const float hz = f < int(frequencies.size()) ? frequencies[f] : 0.0f;
+        const String at = hz > 0.0f ? " @ " + String(hz, hz < 10.0f ? 1 : 0) + " Hz" : "";
+        impedanceViewSelector->addItem("|Z|" + at, int(ImpedanceView::MAGNITUDE) * viewIdStride + f + 1);
+        impedanceViewSelector->addItem("Phase" + at, int(ImpedanceView::PHASE) * viewIdStride + f + 1);
+    }
+    //A series RC can only be fitted where the source said at what frequencies it measured
+    if (std::any_of(frequencies.begin(), frequencies.end(), [](float hz) { return hz > 0.0f; })) {
+        impedanceViewSelector->addItem("Fit R (series RC)", int(ImpedanceView::FIT_RESISTANCE) * viewIdStride + 1);
+        impedanceViewSelector->addItem("Fit C (series RC)", int(ImpedanceView::FIT_CAPACITANCE) * viewIdStride + 1);
+    }
+
+    if (impedanceViewSelector->indexOfItemId(selectedId) >= 0) {
+        impedanceViewSelector->setSelectedId(selectedId, dontSendNotification);
+        return;
+    }
+    //Back to the magnitude at the first frequency, which is also what the canvas starts with
+    impedanceViewSelector->setSelectedId(1, dontSendNotification);
+    if (selectedId != 0) {
+        canvas->setImpedanceView(ImpedanceView::MAGNITUDE, 0);
+        updateSelectorsEnabled();
+    }
+}
+
+void UG3ElectrodeViewerToolbar::setGridFeaturesEnabled(bool enabled) {
+    //Turning them off through the buttons also stops them in the canvas
+    if (!enabled && subSelectButton->getToggleState()) {
+        subSelectButton->setToggleState(false, sendNotification);
+    }
+    if (!enabled && propagationButton->getToggleState()) {
+        propagationButton->setToggleState(false, sendNotification);
+    }
+    subSelectButton->setEnabledState(enabled);
+    subselectHorDecButton->setEnabledState(enabled);
+    subselectHorIncButton->setEnabledState(enabled);
+    subselectVertDecButton->setEnabledState(enabled);
+    subselectVertIncButton->setEnabledState(enabled);
+    propagationButton->setEnabledState(enabled);
+}
+
 std::optional<String> UG3ElectrodeViewerToolbar::getCurrentAcquisitionName() const {
     for(const auto & button : acquisitionButtons) {
         if(button -> getToggleState()) {
@@ -281,6 +517,34 @@ void UG3ElectrodeViewerToolbar::saveToolbarParameters(XmlElement* xml) {
         ug3Toolbar->setAttribute("ZERO_CENTER_ON",1);
     }
 
+    if (telemetryButton->getToggleState()) {
+        ug3Toolbar->setAttribute("STATS_OVERLAY_ON", 1);
+    }
+
+    if (autoRangeButton->getToggleState()) {
+        ug3Toolbar->setAttribute("AUTO_RANGE_ON", 1);
+    }
+
+    if (zScoreButton->getToggleState()) {
+        ug3Toolbar->setAttribute("Z_SCORE_ON", 1);
+    }
+
+    if (smoothingButton->getToggleState()) {
+        ug3Toolbar->setAttribute("SMOOTHING_ON", 1);
+    }
+
+    if (csdButton->getToggleState()) {
+        ug3Toolbar->setAttribute("CSD_ON", 1);
+    }
+
+    if (impedanceTrendButton->getToggleState()) {
+        ug3Toolbar->setAttribute("IMPEDANCE_TREND_ON", 1);
+    }
+
+    if (propagationButton->getToggleState()) {
+        ug3Toolbar->setAttribute("PROPAGATION_ON", 1);
+    }
+
 }
 
 void UG3ElectrodeViewerToolbar::loadToolbarParameters(XmlElement* xml) {
@@ -299,6 +563,34 @@ void UG3ElectrodeViewerToolbar::loadToolbarParameters(XmlElement* xml) {
                 zeroCenterButton->setToggleState(true, sendNotification);
             }
 
+            if (subNode->getIntAttribute("STATS_OVERLAY_ON") > 0) {
+                telemetryButton->setToggleState(true, sendNotification);
+            }
+
+            if (subNode->getIntAttribute("AUTO_RANGE_ON") > 0) {
+                autoRangeButton->setToggleState(true, sendNotification);
+            }
+
+            if (subNode->getIntAttribute("Z_SCORE_ON") > 0) {
+                zScoreButton->setToggleState(true, sendNotification);
+            }
+
+            if (subNode->getIntAttribute("SMOOTHING_ON") > 0) {
+                smoothingButton->setToggleState(true, sendNotification);
+            }
+
+            if (subNode->getIntAttribute("CSD_ON") > 0) {
+                csdButton->setToggleState(true, sendNotification);
+            }
+
+            if (subNode->getIntAttribute("IMPEDANCE_TREND_ON") > 0) {
+                impedanceTrendButton->setToggleState(true, sendNotification);
+            }
+
+            if (subNode->getIntAttribute("PROPAGATION_ON") > 0) {
+                propagationButton->setToggleState(true, sendNotification);
+            }
+
 
         }
     }
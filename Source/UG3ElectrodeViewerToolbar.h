@@ -34,6 +34,9 @@ public:
     void toggleEnabled(bool enabled);
 
     static String calculateMetricString(int value, String unit, int prefixShiftsOffset = 0);
+
+    /** Like calculateMetricString, but keeps the sign and a few significant digits */
+    static String formatMetricValue(float value, String unit, int prefixShiftsOffset = 0);
     
     void buildAcquisitionButtons();
 
@@ -43,15 +46,25 @@ public:
 
     void loadToolbarParameters(XmlElement* xml);
 
+    /** Lists the magnitude and phase at each measured frequency, plus the fitted values when any frequency is known, keeping the current choice if it is still there */
+    void updateImpedanceViews(const std::vector<float>& frequencies);
+
+    /** Subselection and propagation work in grid rows and columns, which layouts placed by coordinate don't have */
+    void setGridFeaturesEnabled(bool enabled);
+
 private:
     
     static const std::vector<int> voltageOptions;
     static const std::vector<int> impedanceOptions;
+    //Impedance view item ids step by this per view, leaving room for one id per frequency
+    static const int viewIdStride;
 
     UG3ElectrodeViewerCanvas* canvas;
     ScopedPointer<ComboBox> voltageSelector;
     ScopedPointer<ComboBox> impedanceSelector;
     ScopedPointer<UtilityButton> impedanceButton;
+    ScopedPointer<UtilityButton> impedanceTrendButton;
+    ScopedPointer<ComboBox> impedanceViewSelector;
     ScopedPointer<UtilityButton> zeroCenterButton;
     ScopedPointer<UtilityButton> subSelectButton;
     
@@ -62,6 +75,24 @@ private:
 
     ScopedPointer<UtilityButton> loadLayoutButton;
 
+    ScopedPointer<UtilityButton> telemetryButton;
+
+    ScopedPointer<UtilityButton> autoRangeButton;
+
+    ScopedPointer<UtilityButton> zScoreButton;
+
+    ScopedPointer<UtilityButton> smoothingButton;
+
+    ScopedPointer<UtilityButton> csdButton;
+
+    ScopedPointer<UtilityButton> propagationButton;
+
+    ScopedPointer<UtilityButton> regionButton;
+    ScopedPointer<UtilityButton> clearRegionsButton;
+
+    /** The fixed scale selectors do nothing while auto range, z-scores or the impedance trend are on */
+    void updateSelectorsEnabled();
+
 
     OwnedArray<UtilityButton> acquisitionButtons;
 };
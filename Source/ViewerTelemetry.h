@@ -0,0 +1,195 @@
+//
+//  ViewerTelemetry.h
+//  ug3-electrode-viewer
+//
+
+#ifndef ViewerTelemetry_h
+#define ViewerTelemetry_h
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+
+/**
+    Snapshot of the acquisition and display timing figures shown by the stats overlay.
+    Acquisition fields are filled in by the processor, frame fields by the canvas.
+*/
+struct ViewerTelemetry {
+    //measured samples per second on the displayed stream
+    float sampleRate = 0.0f;
+    //sample rate advertised by the displayed stream
+    float nominalSampleRate = 0.0f;
+    //mean number of samples per process() block
+    float blockSize = 0.0f;
+    //mean time between process() blocks
+    float blockIntervalMs = 0.0f;
+    //mean absolute deviation of the block arrival interval
+    float blockJitterMs = 0.0f;
+
+    //frames actually presented per second
+    float frameRate = 0.0f;
+    //frames per second the canvas is asking for
+    float targetFrameRate = 0.0f;
+    //time from a refresh() request until the frame was painted
+    float refreshLatencyMs = 0.0f;
+
+    //true when acquisition or drawing can not keep up with the nominal rates
+    bool isFallingBehind() const {
+        bool acquisitionBehind = nominalSampleRate > 0.0f && sampleRate > 0.0f && sampleRate < 0.95f * nominalSampleRate;
+        bool displayBehind = targetFrameRate > 0.0f && frameRate > 0.0f && frameRate < 0.8f * targetFrameRate;
+        return acquisitionBehind || displayBehind;
+    }
+};
+
+/**
+    Measures block arrival on the audio thread. Results are published through atomics so
+    the message thread can read them without locking.
+*/
+class BlockRateEstimator {
+public:
+    void reset() {
+        hasLastBlock = false;
+        windowSamples = 0;
+        meanIntervalSeconds = 0.0;
+        meanDeviationSeconds = 0.0;
+        meanBlockSize = 0.0;
+        sampleRate.store(0.0f, std::memory_order_relaxed);
+        nominalSampleRate.store(0.0f, std::memory_order_relaxed);
+        blockSize.store(0.0f, std::memory_order_relaxed);
+        blockIntervalMs.store(0.0f, std::memory_order_relaxed);
+        blockJitterMs.store(0.0f, std::memory_order_relaxed);
+    }
+
+    //Called once per process() call with the number of samples in the displayed stream's block
+    void recordBlock(int numSamples, float streamSampleRate) {
+        const Clock::time_point now = Clock::now();
+        nominalSampleRate.store(streamSampleRate, std::memory_order_relaxed);
+
+        if (!hasLastBlock) {
+            hasLastBlock = true;
+            lastBlockTime = now;
+            windowStart = now;
+            windowSamples = 0;
+            meanBlockSize = numSamples;
+            return;
+        }
+
+        const double interval = std::chrono::duration<double>(now - lastBlockTime).count();
+        lastBlockTime = now;
+
+        if (meanIntervalSeconds == 0.0) {
+            meanIntervalSeconds = interval;
+        }
+        meanDeviationSeconds += smoothing * (std::abs(interval - meanIntervalSeconds) - meanDeviationSeconds);
+        meanIntervalSeconds += smoothing * (interval - meanIntervalSeconds);
+        meanBlockSize += smoothing * (numSamples - meanBlockSize);
+
+        //The rate is measured over whole windows so that a single late block doesn't swing it
+        windowSamples += numSamples;
+        const double windowLength = std::chrono::duration<double>(now - windowStart).count();
+        if (windowLength >= rateWindowSeconds) {
+            sampleRate.store(float(windowSamples / windowLength), std::memory_order_relaxed);
+            windowStart = now;
+            windowSamples = 0;
+        }
+
+        blockSize.store(float(meanBlockSize), std::memory_order_relaxed);
+        blockIntervalMs.store(float(meanIntervalSeconds * 1000.0), std::memory_order_relaxed);
+        blockJitterMs.store(float(meanDeviationSeconds * 1000.0), std::memory_order_relaxed);
+    }
+
+    float getSampleRate() const { return sampleRate.load(std::memory_order_relaxed); }
+
+    //Fills in the acquisition fields of a telemetry snapshot
+    void fillTelemetry(ViewerTelemetry& telemetry) const {
+        telemetry.sampleRate = sampleRate.load(std::memory_order_relaxed);
+        telemetry.nominalSampleRate = nominalSampleRate.load(std::memory_order_relaxed);
+        telemetry.blockSize = blockSize.load(std::memory_order_relaxed);
+        telemetry.blockIntervalMs = blockIntervalMs.load(std::memory_order_relaxed);
+        telemetry.blockJitterMs = blockJitterMs.load(std::memory_order_relaxed);
+    }
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    static constexpr double smoothing = 0.05;
+    static constexpr double rateWindowSeconds = 0.5;
+
+    //Only touched on the audio thread
+    bool hasLastBlock = false;
+    Clock::time_point lastBlockTime;
+    Clock::time_point windowStart;
+    int64_t windowSamples = 0;
+    double meanIntervalSeconds = 0.0;
+    double meanDeviationSeconds = 0.0;
+    double meanBlockSize = 0.0;
+
+    std::atomic<float> sampleRate { 0.0f };
+    std::atomic<float> nominalSampleRate { 0.0f };
+    std::atomic<float> blockSize { 0.0f };
+    std::atomic<float> blockIntervalMs { 0.0f };
+    std::atomic<float> blockJitterMs { 0.0f };
+};
+
+/**
+    Measures achieved frame rate and the latency between a refresh request and the
+    paint that presents it. Both calls are expected on the same (message) thread.
+*/
+class FrameRateEstimator {
+public:
+    void reset() {
+        hasPendingRequest = false;
+        hasLastPresent = false;
+        meanFrameSeconds = 0.0;
+        meanLatencySeconds = 0.0;
+    }
+
+    //Called when a new frame has been requested (canvas refresh)
+    void frameRequested() {
+        if (!hasPendingRequest) {
+            requestTime = Clock::now();
+            hasPendingRequest = true;
+        }
+    }
+
+    //Called at the end of a paint; only counts paints that answer a refresh request
+    void framePresented() {
+        if (!hasPendingRequest) {
+            return;
+        }
+        hasPendingRequest = false;
+
+        const Clock::time_point now = Clock::now();
+        const double latency = std::chrono::duration<double>(now - requestTime).count();
+        meanLatencySeconds = meanLatencySeconds == 0.0 ? latency : meanLatencySeconds + smoothing * (latency - meanLatencySeconds);
+
+        if (hasLastPresent) {
+            const double frameSeconds = std::chrono::duration<double>(now - lastPresentTime).count();
+            meanFrameSeconds = meanFrameSeconds == 0.0 ? frameSeconds : meanFrameSeconds + smoothing * (frameSeconds - meanFrameSeconds);
+        }
+        hasLastPresent = true;
+        lastPresentTime = now;
+    }
+
+    //Fills in the display fields of a telemetry snapshot
+    void fillTelemetry(ViewerTelemetry& telemetry, float targetFrameRate) const {
+        telemetry.frameRate = meanFrameSeconds > 0.0 ? float(1.0 / meanFrameSeconds) : 0.0f;
+        telemetry.targetFrameRate = targetFrameRate;
+        telemetry.refreshLatencyMs = float(meanLatencySeconds * 1000.0);
+    }
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    static constexpr double smoothing = 0.1;
+
+    bool hasPendingRequest = false;
+    bool hasLastPresent = false;
+    Clock::time_point requestTime;
+    Clock::time_point lastPresentTime;
+    double meanFrameSeconds = 0.0;
+    double meanLatencySeconds = 0.0;
+};
+
+#endif /* ViewerTelemetry_h */
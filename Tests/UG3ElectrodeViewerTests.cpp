@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include <thread>
 
 #include "gtest/gtest.h"
 
@@ -7,6 +8,9 @@
 #include "../Source/UG3ElectrodeViewer.h"
 #include "../Source/UG3ElectrodeViewerCanvas.h"
 #include "../Source/ColourScheme.h"
+#include "../Source/CachedLayer.h"
+#include "../Source/ElectrodeGeometry.h"
+#include "../Source/SiteIndex.h"
 
 
 #include <ModelProcessors.h>
@@ -187,3 +191,1301 @@ TEST_F(UG3ElectrodeViewerTests, VisualIntegrityTest) {
     tester->stopAcquisition();
 }
 
+
+TEST_F(UG3ElectrodeViewerTests, TelemetryTest) {
+    const int numSamples = 100;
+
+    processor->setCurrentStreamName("FakeSourceNode0");
+    tester->startAcquisition(false);
+
+    EXPECT_EQ(processor->getTelemetry().blockSize, 0.0f);
+
+    for (int block = 0; block < 3; block++) {
+        auto input_buffer = CreateBuffer(0, 1, num_channels, numSamples);
+        WriteBlock(input_buffer);
+    }
+
+    ViewerTelemetry telemetry = processor->getTelemetry();
+    EXPECT_FLOAT_EQ(telemetry.blockSize, float(numSamples));
+    EXPECT_FLOAT_EQ(telemetry.nominalSampleRate, sample_rate_);
+    EXPECT_GE(telemetry.blockIntervalMs, 0.0f);
+
+    //Blocks paced in real time, each longer than the 0.5 s measuring window, give back the stream's rate
+    const int realTimeSamples = std::max(1, int(sample_rate_ * 0.6f));
+    const int blockMs = int(1000.0f * realTimeSamples / sample_rate_);
+    for (int block = 0; block < 3; block++) {
+        Thread::sleep(blockMs);
+        auto input_buffer = CreateBuffer(0, 1, num_channels, realTimeSamples);
+        WriteBlock(input_buffer);
+    }
+
+    telemetry = processor->getTelemetry();
+    EXPECT_GT(telemetry.sampleRate, 0.0f);
+    EXPECT_NEAR(telemetry.sampleRate, sample_rate_, 0.2f * sample_rate_);
+    EXPECT_GT(processor->getSampleRate(), 0.0f);
+    EXPECT_NEAR(processor->getSampleRate(), sample_rate_, 0.2f * sample_rate_);
+
+    tester->stopAcquisition();
+}
+
+TEST_F(UG3ElectrodeViewerTests, TimingsConfigMessageTest) {
+    processor->setCurrentStreamName("FakeSourceNode0");
+    tester->startAcquisition(false);
+    auto input_buffer = CreateBuffer(0, 1, num_channels, 10);
+    WriteBlock(input_buffer);
+    tester->stopAcquisition();
+
+    String response = processor->handleConfigMessage(BroadcastParser::build("UG3ElectrodeViewer", "GETTIMINGS", std::map<String, var>()));
+    var timings = JSON::parse(response);
+    ASSERT_TRUE(timings.isObject());
+    ASSERT_TRUE(timings.getProperty("stages", var()).isArray());
+
+    if (Instrumentation::isEnabled()) {
+        var processStage = (*timings.getProperty("stages", var()).getArray())[0];
+        EXPECT_EQ(processStage.getProperty("stage", "").toString(), "process");
+        EXPECT_GE(int64(processStage.getProperty("count", 0)), 1);
+    }
+
+    //Threads that come and go reuse the slots of the ones that exited, keeping their timings
+    Instrumentation::reset();
+    Instrumentation::record(Instrumentation::Stage::PROPAGATION, 100);
+    const int numThreads = Instrumentation::getNumThreads();
+    const uint64_t count = Instrumentation::getSummaries(false)[int(Instrumentation::Stage::PROPAGATION)].count;
+    for (int i = 0; i < 20; i++) {
+        std::thread worker([] { Instrumentation::record(Instrumentation::Stage::PROPAGATION, 100); });
+        worker.join();
+    }
+    EXPECT_LE(Instrumentation::getNumThreads(), numThreads + 1);
+    EXPECT_EQ(Instrumentation::getSummaries(false)[int(Instrumentation::Stage::PROPAGATION)].count, count + 20);
+}
+
+TEST_F(UG3ElectrodeViewerTests, AutoRangeTest) {
+    std::vector<float> values(1000);
+    for (int i = 0; i < values.size(); i++) {
+        values[i] = float(i);
+    }
+
+    AutoRange autoRange;
+    ASSERT_TRUE(autoRange.update(values.data(), int(values.size())));
+    //p1 and p99 of 0..999 plus the hysteresis headroom
+    EXPECT_NEAR(autoRange.getLower(), 10.0f - 49.0f, 15.0f);
+    EXPECT_NEAR(autoRange.getUpper(), 989.0f + 49.0f, 15.0f);
+
+    //Small drifts stay inside the hysteresis band and don't move the colour bar
+    for (float& value : values) {
+        value *= 1.02f;
+    }
+    for (int frame = 0; frame < 20; frame++) {
+        EXPECT_FALSE(autoRange.update(values.data(), int(values.size())));
+    }
+
+    //A large change in amplitude does
+    for (float& value : values) {
+        value *= 4.0f;
+    }
+    bool rangeChanged = false;
+    for (int frame = 0; frame < 20; frame++) {
+        rangeChanged |= autoRange.update(values.data(), int(values.size()));
+    }
+    EXPECT_TRUE(rangeChanged);
+    EXPECT_GT(autoRange.getUpper(), 3500.0f);
+}
+
+TEST_F(UG3ElectrodeViewerTests, ZScoreTest) {
+    const int numSamples = 10;
+
+    //Turned on before any acquisition, the zeroed baseline is drawn rather than read past
+    processor->setLayoutParameters(4, 4, {});
+    processor->setZScoreEnabled(true);
+    ASSERT_EQ(processor->getNumZScores(), 16);
+    RenderSettings settings;
+    settings.isZScoreOn = true;
+    ElectrodeRenderer renderer(processor, nullptr);
+    renderer.setLayout(ElectrodeGeometry::placeGrid(4, 4, {}));
+    renderer.setSettings(settings);
+    renderer.renderNow();
+    EXPECT_TRUE(renderer.getRange().isValid);
+
+    //A bigger layout while stopped grows the baseline with it
+    processor->setLayoutParameters(5, 5, {});
+    EXPECT_EQ(processor->getNumZScores(), 25);
+    renderer.setLayout(ElectrodeGeometry::placeGrid(5, 5, {}));
+    renderer.renderNow();
+
+    processor->setCurrentStreamName("FakeSourceNode0");
+    processor->setBaselineTimeConstant(1000.0f);
+    processor->setZScoreEnabled(true);
+    tester->startAcquisition(false);
+
+    //Every channel alternates 10 above and below its own level, which differs per channel
+    for (int block = 0; block < 2000; block++) {
+        AudioBuffer<float> input_buffer(num_channels, numSamples);
+        for (int chidx = 0; chidx < num_channels; chidx++) {
+            float offset = (block % 2 == 0) ? 10.0f : -10.0f;
+            for (int sample_idx = 0; sample_idx < numSamples; sample_idx++) {
+                input_buffer.setSample(chidx, sample_idx, 1000.0f * chidx + offset);
+            }
+        }
+        WriteBlock(input_buffer);
+    }
+
+    //The last block was 10 below the baseline, so about one standard deviation below it
+    const float* zScores = processor->getZScores();
+    for (int chidx = 0; chidx < num_channels; chidx++) {
+        EXPECT_NEAR(zScores[chidx], -1.0f, 0.1f);
+    }
+
+    tester->stopAcquisition();
+}
+
+TEST_F(UG3ElectrodeViewerTests, ChannelHealthTest) {
+    const int numSamples = 10;
+    const int flatChannel = 3;
+    const int railedChannel = 7;
+
+    processor->setCurrentStreamName("FakeSourceNode0");
+    tester->startAcquisition(false);
+
+    for (int block = 0; block < 100; block++) {
+        AudioBuffer<float> input_buffer(num_channels, numSamples);
+        for (int chidx = 0; chidx < num_channels; chidx++) {
+            float value = 10.0f * std::sin(1.7f * block + chidx);
+            if (chidx == flatChannel) {
+                value = 5.0f;
+            }
+            else if (chidx == railedChannel) {
+                value = 7000.0f;
+            }
+            for (int sample_idx = 0; sample_idx < numSamples; sample_idx++) {
+                input_buffer.setSample(chidx, sample_idx, value);
+            }
+        }
+        WriteBlock(input_buffer);
+    }
+
+    const uint8_t* flags = processor->getChannelHealthFlags();
+    EXPECT_TRUE(flags[flatChannel] & FLATLINE);
+    EXPECT_TRUE(flags[railedChannel] & RAILED);
+    for (int chidx = 0; chidx < num_channels; chidx++) {
+        if (chidx != flatChannel && chidx != railedChannel) {
+            EXPECT_EQ(flags[chidx], HEALTHY);
+        }
+    }
+    EXPECT_EQ(processor->getNumFlaggedChannels(), 2);
+
+    tester->stopAcquisition();
+
+    //The same channels on a 5x5 grid whose last row and column hold nothing
+    std::map<String, var> payload;
+    payload["capabilities"] = var(Array<String>{"1Hz/16Ch"});
+    payload["currentCapability"] = var("1Hz/16Ch");
+    processor->handleConfigMessage(BroadcastParser::build("", "LOADINPUTINFO", payload));
+
+    const DataStream* stream = processor->getDataStreams()[0];
+    const String streamName = stream->getName().upToFirstOccurrenceOf("-", false, false);
+    Array<var> map;
+    for (int i = 0; i < num_channels; i++) {
+        DynamicObject::Ptr coord = new DynamicObject();
+        coord->setProperty("x", i % 4);
+        coord->setProperty("y", i / 4);
+        coord->setProperty("channel", stream->getContinuousChannels()[i]->getName());
+        coord->setProperty("stream", streamName);
+        map.add(var(coord));
+    }
+    DynamicObject::Ptr entry = new DynamicObject();
+    entry->setProperty("rows", 5);
+    entry->setProperty("cols", 5);
+    entry->setProperty("map", map);
+    DynamicObject::Ptr layout = new DynamicObject();
+    layout->setProperty("1Hz/16Ch", var(entry));
+    ASSERT_TRUE(processor->loadElectrodeLayoutJSON(JSON::toString(var(layout))));
+    processor->setCurrentStreamName("FakeSourceNode0");
+    processor->setLayoutParameters(5, 5, {});
+    tester->startAcquisition(false);
+
+    for (int block = 0; block < 100; block++) {
+        AudioBuffer<float> input_buffer(num_channels, numSamples);
+        for (int chidx = 0; chidx < num_channels; chidx++) {
+            float value = 10.0f * std::sin(1.7f * block + chidx);
+            if (chidx == flatChannel) {
+                value = 5.0f;
+            }
+            else if (chidx == railedChannel) {
+                value = 7000.0f;
+            }
+            for (int sample_idx = 0; sample_idx < numSamples; sample_idx++) {
+                input_buffer.setSample(chidx, sample_idx, value);
+            }
+        }
+        WriteBlock(input_buffer);
+    }
+
+    //The empty sites read a constant 0, but nothing is there to be flat
+    ASSERT_EQ(processor->getNumChannelHealthFlags(), 25);
+    flags = processor->getChannelHealthFlags();
+    for (int site = 0; site < 25; site++) {
+        const int x = site % 5;
+        const int y = site / 5;
+        if (x == 4 || y == 4) {
+            EXPECT_EQ(flags[site], HEALTHY);
+        }
+    }
+    EXPECT_TRUE(flags[(flatChannel / 4) * 5 + flatChannel % 4] & FLATLINE);
+    EXPECT_TRUE(flags[(railedChannel / 4) * 5 + railedChannel % 4] & RAILED);
+    EXPECT_EQ(processor->getNumFlaggedChannels(), 2);
+
+    tester->stopAcquisition();
+
+    //Empty sites don't drag the neighbour median down either: on a 3x3 grid whose top row is
+    //empty, the centre is a quarter of the way between its mapped neighbours and the holes
+    std::vector<uint8_t> mappedSites = { 0, 0, 0, 1, 1, 1, 1, 1, 1 };
+    ChannelNeighbours neighbours = ChannelNeighbours::fromGrid(mappedSites, 3);
+    ChannelHealthMonitor monitor;
+    monitor.resize(9);
+    monitor.swapNeighbours(neighbours);
+    const float amplitudes[9] = { 0.0f, 0.0f, 0.0f, 1.0f, 30.0f, 10.0f, 10.0f, 10.0f, 10.0f };
+    float values[9];
+    for (int update = 0; update < 100; update++) {
+        for (int site = 0; site < 9; site++) {
+            values[site] = update % 2 == 0 ? amplitudes[site] : -amplitudes[site];
+        }
+        monitor.update(values, 0.25f);
+    }
+    for (int site = 0; site < 9; site++) {
+        EXPECT_EQ(monitor.getFlags()[site], HEALTHY);
+    }
+    EXPECT_EQ(monitor.getNumFlagged(), 0);
+}
+
+TEST_F(UG3ElectrodeViewerTests, SpatialFilterTest) {
+    //5x5 grid with nothing mapped to the centre site
+    std::vector<uint8_t> mappedSites(25, 1);
+    mappedSites[12] = 0;
+    SpatialFilter filter;
+    filter.setGrid(5, 5, mappedSites);
+
+    std::vector<float> values(25, 10.0f);
+    values[12] = 1000.0f;
+
+    //Smoothing a constant field leaves it constant, and the unmapped site is filled, not read
+    const float* field = filter.apply(values.data(), int(values.size()), nullptr, 0);
+    for (int site = 0; site < 25; site++) {
+        EXPECT_NEAR(field[site], 10.0f, 1.0e-4f);
+    }
+
+    //Without smoothing, usable sites pass through and flagged ones are filled from neighbours
+    filter.setSigma(0.0f);
+    std::vector<uint8_t> flags(25, HEALTHY);
+    flags[0] = FLATLINE;
+    values[0] = -50.0f;
+    values[6] = 7.0f;
+    field = filter.apply(values.data(), int(values.size()), flags.data(), int(flags.size()));
+    EXPECT_EQ(field[6], 7.0f);
+    EXPECT_EQ(field[24], 10.0f);
+    EXPECT_GT(field[0], 7.0f);
+    EXPECT_LT(field[0], 10.0f);
+}
+
+TEST_F(UG3ElectrodeViewerTests, CurrentSourceDensityTest) {
+    const int cols = 6;
+    const int rows = 6;
+    std::vector<uint8_t> mappedSites(cols * rows, 1);
+    mappedSites[14] = 0;
+    CurrentSourceDensity csd;
+    csd.setGrid(cols, rows, mappedSites);
+
+    //A flat field has no sources anywhere, including the edges and around the missing site
+    std::vector<float> values(cols * rows, 5.0f);
+    const float* density = csd.apply(values.data(), int(values.size()), nullptr, 0);
+    for (int site = 0; site < cols * rows; site++) {
+        EXPECT_EQ(density[site], 0.0f);
+    }
+
+    //x^2 + y^2 has a Laplacian of 4 everywhere; interior sites away from the gap see all of it
+    for (int site = 0; site < cols * rows; site++) {
+        const int x = site % cols;
+        const int y = site / cols;
+        values[site] = float(x * x + y * y);
+    }
+    density = csd.apply(values.data(), int(values.size()), nullptr, 0);
+    EXPECT_EQ(density[4 * cols + 4], -4.0f);
+    EXPECT_EQ(density[3 * cols + 3], -4.0f);
+    EXPECT_EQ(density[14], 0.0f);
+}
+
+TEST_F(UG3ElectrodeViewerTests, PropagationEstimatorTest) {
+    const int cols = 8;
+    const int rows = 8;
+    PropagationEstimator estimator;
+    estimator.setGrid(cols, rows, std::vector<uint8_t>());
+
+    std::vector<float> values(cols * rows);
+    const double frameSeconds = 0.002;
+    double time = 0.0;
+
+    //Low level noise so every site has a baseline to score against
+    for (int frame = 0; frame < 500; frame++) {
+        for (int site = 0; site < cols * rows; site++) {
+            values[site] = (frame + site) % 2 ? 1.0f : -1.0f;
+        }
+        estimator.addFrame(values.data(), int(values.size()), nullptr, 0, time);
+        time += frameSeconds;
+    }
+    EXPECT_TRUE(estimator.getArrows().empty());
+
+    //A pulse sweeping along +x at 100 sites per second
+    const double start = time + 0.02;
+    for (int frame = 0; frame < 200; frame++) {
+        for (int site = 0; site < cols * rows; site++) {
+            const double lag = (time - (start + 0.01 * (site % cols))) / 0.004;
+            values[site] = ((frame + site) % 2 ? 1.0f : -1.0f) + 50.0f * float(std::exp(-lag * lag));
+        }
+        estimator.addFrame(values.data(), int(values.size()), nullptr, 0, time);
+        time += frameSeconds;
+    }
+
+    const std::vector<PropagationArrow>& arrows = estimator.getArrows();
+    ASSERT_EQ(int(arrows.size()), 4);
+    for (const PropagationArrow& arrow : arrows) {
+        EXPECT_NEAR(arrow.directionX, 1.0f, 1.0e-3f);
+        EXPECT_NEAR(arrow.directionY, 0.0f, 1.0e-3f);
+        EXPECT_NEAR(arrow.speed, 100.0f, 1.0f);
+    }
+
+    //Frames are timed in stream time, which starts from 0 again when acquisition restarts
+    estimator.addFrame(values.data(), int(values.size()), nullptr, 0, 0.0);
+    EXPECT_TRUE(estimator.getArrows().empty());
+
+    //The canvas submits one frame per refresh, so peaks are only resolved to the refresh interval:
+    //at 30 Hz a pulse that crosses the row in 7 ms peaks in the same frame everywhere and has no direction
+    PropagationEstimator refreshed;
+    refreshed.setGrid(cols, rows, std::vector<uint8_t>());
+    const double refreshSeconds = 1.0 / 30.0;
+    time = 0.0;
+    for (int frame = 0; frame < 300; frame++) {
+        for (int site = 0; site < cols * rows; site++) {
+            values[site] = (frame + site) % 2 ? 1.0f : -1.0f;
+        }
+        refreshed.addFrame(values.data(), int(values.size()), nullptr, 0, time);
+        time += refreshSeconds;
+    }
+
+    const double fastStart = time + 0.21;
+    for (int frame = 0; frame < 30; frame++) {
+        for (int site = 0; site < cols * rows; site++) {
+            const double lag = (time - (fastStart + 0.001 * (site % cols))) / 0.04;
+            values[site] = ((frame + site) % 2 ? 1.0f : -1.0f) + 50.0f * float(std::exp(-lag * lag));
+        }
+        refreshed.addFrame(values.data(), int(values.size()), nullptr, 0, time);
+        time += refreshSeconds;
+        EXPECT_TRUE(refreshed.getArrows().empty());
+    }
+    for (int site = 1; site < cols * rows; site++) {
+        EXPECT_EQ(refreshed.getPeakTimes()[site], refreshed.getPeakTimes()[0]);
+    }
+    EXPECT_GT(refreshed.getPeakTimes()[0], 0.0);
+}
+
+TEST_F(UG3ElectrodeViewerTests, ElectrodeRendererTest) {
+    const int numSamples = 10;
+    processor->setCurrentStreamName("FakeSourceNode0");
+    tester->startAcquisition(false);
+    auto input_buffer = CreateBuffer(0, 100, num_channels, numSamples);
+    WriteBlock(input_buffer);
+
+    //Four 4x4 pixel sites in a row
+    RenderLayout layout;
+    for (int site = 0; site < 4; site++) {
+        layout.sites.push_back(Rectangle<int>(site * 4, 0, 4, 4));
+    }
+    layout.gridCols = 4;
+    layout.gridRows = 1;
+    layout.width = 16;
+    layout.height = 4;
+
+    RenderSettings settings;
+    settings.scaleFactor = 5000;
+
+    ElectrodeRenderer renderer(processor, nullptr);
+    renderer.setLayout(layout);
+    renderer.setSettings(settings);
+    renderer.renderNow();
+
+    RenderedRange range = renderer.getRange();
+    EXPECT_TRUE(range.isValid);
+    EXPECT_EQ(range.lower, 0.0f);
+    EXPECT_EQ(range.upper, 5000.0f);
+
+    //The frame is kept after it has been painted, so a repaint without a new frame draws it again
+    for (int paint = 0; paint < 2; paint++) {
+        Image target(Image::RGB, 16, 4, true);
+        {
+            Graphics g(target);
+            renderer.drawLatestFrame(g);
+        }
+        for (int site = 0; site < 4; site++) {
+            const Colour expected = ColourScheme::getColourForNormalizedValue(input_buffer.getSample(site, 0) / 5000.0f);
+            EXPECT_TRUE(target.getPixelAt(site * 4 + 1, 2) == expected);
+        }
+    }
+
+    settings.isZeroCentered = true;
+    renderer.setSettings(settings);
+    renderer.renderNow();
+    range = renderer.getRange();
+    EXPECT_EQ(range.lower, -5000.0f);
+
+    tester->stopAcquisition();
+}
+
+TEST_F(UG3ElectrodeViewerTests, RefreshSchedulerTest) {
+    const int numSamples = 10;
+    processor->setCurrentStreamName("FakeSourceNode0");
+    tester->startAcquisition(false);
+    const uint64_t startSequence = processor->getFrameSequence();
+    auto input_buffer = CreateBuffer(0, 100, num_channels, numSamples);
+    WriteBlock(input_buffer);
+    EXPECT_EQ(processor->getFrameSequence(), startSequence + 1);
+    tester->stopAcquisition();
+
+    RefreshScheduler scheduler;
+    scheduler.setRateLimits(4.0f, 60.0f);
+    scheduler.reset(0.0);
+
+    //A tick without new data only draws if something on screen changed
+    EXPECT_TRUE(scheduler.tick(0.0, 1));
+    EXPECT_FALSE(scheduler.tick(0.01, 1));
+    scheduler.invalidate();
+    EXPECT_TRUE(scheduler.tick(0.02, 1));
+
+    //Data arriving at 10 frames a second, ticked at 60 Hz
+    uint64_t sequence = 1;
+    double now = 0.02;
+    for (int tick = 0; tick < 120; tick++) {
+        now += 1.0 / 60.0;
+        if (tick % 6 == 0) {
+            sequence++;
+        }
+        scheduler.tick(now, sequence);
+    }
+    //The rate is measured over whole ticks, so it is only close to the data rate
+    EXPECT_NEAR(scheduler.getDataRate(), 10.0f, 2.0f);
+    EXPECT_NEAR(scheduler.getRate(), 10.0f, 2.0f);
+
+    //No data drops to the minimum rate
+    for (int tick = 0; tick < 20; tick++) {
+        now += 0.1;
+        scheduler.tick(now, sequence);
+    }
+    EXPECT_EQ(scheduler.getRate(), 4.0f);
+
+    //Fast data, but 50 ms frames only leave room for 10 frames a second
+    for (int tick = 0; tick < 20; tick++) {
+        now += 0.05;
+        sequence += 5;
+        scheduler.recordRenderCost(0.05);
+        scheduler.tick(now, sequence);
+    }
+    EXPECT_NEAR(scheduler.getRate(), 10.0f, 2.0f);
+
+    //A hidden canvas runs at the minimum rate
+    scheduler.setVisible(false);
+    for (int tick = 0; tick < 5; tick++) {
+        now += 0.25;
+        sequence += 25;
+        scheduler.tick(now, sequence);
+    }
+    EXPECT_EQ(scheduler.getRate(), 4.0f);
+}
+
+TEST_F(UG3ElectrodeViewerTests, DisplayReductionSuspendTest) {
+    const int numSamples = 10;
+    processor->setCurrentStreamName("FakeSourceNode0");
+    tester->startAcquisition(false);
+
+    auto input_buffer = CreateBuffer(0, 100, num_channels, numSamples);
+    WriteBlock(input_buffer);
+    const uint64_t sequence = processor->getFrameSequence();
+
+    //Suspended blocks leave the displayed values alone but are still timed
+    processor->setDisplayReductionSuspended(true);
+    auto hidden_buffer = CreateBuffer(5000, 100, num_channels, numSamples);
+    WriteBlock(hidden_buffer);
+    EXPECT_EQ(processor->getFrameSequence(), sequence);
+    EXPECT_EQ(processor->getLatestValues()[0], input_buffer.getSample(0, 0));
+    EXPECT_EQ(processor->getTelemetry().blockSize, float(numSamples));
+
+    //The first block after resuming brings the display up to date in one step
+    processor->setDisplayReductionSuspended(false);
+    WriteBlock(hidden_buffer);
+    EXPECT_EQ(processor->getFrameSequence(), sequence + 1);
+    EXPECT_EQ(processor->getLatestValues()[0], hidden_buffer.getSample(0, 0));
+
+    //Turning the option off also resumes a suspended reduction
+    std::map<String, var> payload;
+    payload["enabled"] = false;
+    processor->setDisplayReductionSuspended(true);
+    EXPECT_EQ(processor->handleConfigMessage(BroadcastParser::build("UG3ElectrodeViewer", "SUSPENDWHENHIDDEN", payload)), "");
+    EXPECT_FALSE(processor->shouldSuspendWhenHidden());
+    EXPECT_FALSE(processor->isDisplayReductionSuspended());
+
+    tester->stopAcquisition();
+}
+
+TEST_F(UG3ElectrodeViewerTests, CachedLayerTest) {
+    CachedLayer layer;
+    int numPaints = 0;
+    auto paintLayer = [&numPaints](Graphics& g) {
+        numPaints++;
+        g.setColour(Colours::red);
+        g.fillRect(10, 10, 4, 4);
+    };
+    const Rectangle<int> bounds(8, 8, 8, 8);
+
+    //The layer is drawn in the target's coordinates, and a repaint reuses it
+    for (int paint = 0; paint < 2; paint++) {
+        Image target(Image::RGB, 20, 20, true);
+        {
+            Graphics g(target);
+            layer.draw(g, bounds, paintLayer);
+        }
+        EXPECT_TRUE(target.getPixelAt(11, 11) == Colours::red);
+        EXPECT_TRUE(target.getPixelAt(9, 9) == Colours::black);
+    }
+    EXPECT_EQ(numPaints, 1);
+    EXPECT_EQ(layer.getNumRedraws(), 1);
+
+    Image target(Image::RGB, 20, 20, true);
+    Graphics g(target);
+    layer.invalidate();
+    layer.draw(g, bounds, paintLayer);
+    EXPECT_EQ(numPaints, 2);
+
+    //Moving the layer repaints it too
+    layer.draw(g, bounds.translated(1, 0), paintLayer);
+    EXPECT_EQ(numPaints, 3);
+    layer.draw(g, bounds.translated(1, 0), paintLayer);
+    EXPECT_EQ(numPaints, 3);
+}
+
+TEST_F(UG3ElectrodeViewerTests, SubselectionPublisherTest) {
+    std::vector<Subselection> sent;
+    SubselectionPublisher publisher([&sent](const Subselection& selection) { sent.push_back(selection); }, 33.0);
+
+    Subselection selection;
+    selection.rows = 2;
+    selection.cols = 2;
+    selection.colsPerRow = 8;
+
+    //The first change goes straight out
+    publisher.publish(selection, 1000.0);
+    ASSERT_EQ(int(sent.size()), 1);
+
+    //The same rectangle again is dropped
+    publisher.publish(selection, 1100.0);
+    EXPECT_EQ(int(sent.size()), 1);
+    EXPECT_FALSE(publisher.hasPendingSelection());
+
+    //A drag within one interval only sends where it ended up
+    for (int step = 1; step <= 10; step++) {
+        selection.start = step;
+        publisher.publish(selection, 1100.0 + step);
+    }
+    ASSERT_EQ(int(sent.size()), 2);
+    EXPECT_EQ(sent.back().start, 1);
+    EXPECT_TRUE(publisher.hasPendingSelection());
+    EXPECT_FALSE(publisher.sendIfDue(1120.0));
+    EXPECT_TRUE(publisher.sendIfDue(1134.0));
+    ASSERT_EQ(int(sent.size()), 3);
+    EXPECT_EQ(sent.back().start, 10);
+
+    //Moving away and back within an interval leaves nothing to send
+    selection.start = 11;
+    publisher.publish(selection, 1140.0);
+    selection.start = 10;
+    publisher.publish(selection, 1141.0);
+    EXPECT_FALSE(publisher.sendIfDue(1200.0));
+    EXPECT_EQ(int(sent.size()), 3);
+}
+
+TEST_F(UG3ElectrodeViewerTests, RegionStatisticsTest) {
+    RegionStatistics statistics;
+    //Unsorted, duplicated and out of range sites are cleaned up when compiling
+    statistics.setRegions({ { 3, 1, 1, -2 }, { 0, 1, 2, 3 }, { 40 } });
+    ASSERT_EQ(statistics.getNumRegions(), 3);
+    EXPECT_EQ(statistics.getRegionSize(0), 2);
+    statistics.setActiveLevel(25.0f);
+
+    const float values[] = { -30.0f, 10.0f, 20.0f, 40.0f };
+    uint8_t flags[] = { HEALTHY, HEALTHY, FLATLINE, HEALTHY };
+    statistics.update(values, 4, flags, 4);
+
+    const RegionStats& firstRegion = statistics.getStats()[0];
+    EXPECT_EQ(firstRegion.usedSites, 2);
+    EXPECT_FLOAT_EQ(firstRegion.mean, 25.0f);
+    EXPECT_FLOAT_EQ(firstRegion.rms, std::sqrt((100.0f + 1600.0f) / 2.0f));
+    EXPECT_FLOAT_EQ(firstRegion.max, 40.0f);
+    EXPECT_EQ(firstRegion.activeSites, 1);
+
+    //The flagged site is left out
+    const RegionStats& secondRegion = statistics.getStats()[1];
+    EXPECT_EQ(secondRegion.usedSites, 3);
+    EXPECT_FLOAT_EQ(secondRegion.mean, 20.0f / 3.0f);
+    EXPECT_EQ(secondRegion.activeSites, 2);
+
+    EXPECT_EQ(statistics.getStats()[2].usedSites, 0);
+
+    //Through the processor, the regions are picked up on the next block
+    const int numSamples = 10;
+    processor->setCurrentStreamName("FakeSourceNode0");
+    tester->startAcquisition(false);
+    processor->setRegionsOfInterest({ { 0, 1 }, { 15 } });
+    auto input_buffer = CreateBuffer(0, 100, num_channels, numSamples);
+    WriteBlock(input_buffer);
+
+    std::vector<RegionStats> stats;
+    processor->getRegionStatistics(stats);
+    ASSERT_EQ(int(stats.size()), 2);
+    EXPECT_FLOAT_EQ(stats[0].mean, (input_buffer.getSample(0, 0) + input_buffer.getSample(1, 0)) / 2.0f);
+    EXPECT_FLOAT_EQ(stats[1].max, input_buffer.getSample(15, 0));
+
+    tester->stopAcquisition();
+}
+
+#if !JUCE_WINDOWS
+TEST_F(UG3ElectrodeViewerTests, SharedMemoryFrameExportTest) {
+    const int numSamples = 10;
+    const String name = "/ug3-test-" + String::toHexString(Random::getSystemRandom().nextInt());
+    processor->setCurrentStreamName("FakeSourceNode0");
+
+    std::map<String, var> payload;
+    payload["enabled"] = true;
+    payload["name"] = name;
+    payload["slots"] = 4;
+    ASSERT_EQ(processor->handleConfigMessage(BroadcastParser::build("UG3ElectrodeViewer", "SETFRAMEEXPORT", payload)), "");
+
+    SharedFrameReader reader;
+    ASSERT_EQ(reader.open(name), "");
+    std::vector<float> values;
+    SharedFrameInfo info;
+    EXPECT_FALSE(reader.readLatest(values, info));
+
+    //More blocks than slots, so the ring wraps
+    tester->startAcquisition(false);
+    AudioBuffer<float> input_buffer;
+    for (int block = 0; block < 6; block++) {
+        input_buffer = CreateBuffer(float(block * 1000), 10, num_channels, numSamples);
+        WriteBlock(input_buffer);
+    }
+    tester->stopAcquisition();
+
+    //startAcquisition() recreated the ring, so the reader has to open the new one
+    ASSERT_EQ(reader.open(name), "");
+    ASSERT_TRUE(reader.readLatest(values, info));
+    EXPECT_EQ(info.sequence, 6u);
+    EXPECT_EQ(info.units, "uV");
+    ASSERT_EQ(int(values.size()), num_channels);
+    for (int channel = 0; channel < num_channels; channel++) {
+        EXPECT_EQ(values[channel], input_buffer.getSample(channel, 0));
+    }
+
+    payload["enabled"] = false;
+    EXPECT_EQ(processor->handleConfigMessage(BroadcastParser::build("UG3ElectrodeViewer", "SETFRAMEEXPORT", payload)), "");
+    reader.close();
+    EXPECT_NE(reader.open(name), "");
+}
+#endif
+
+TEST_F(UG3ElectrodeViewerTests, FrameCodecCompressionTest) {
+    //Live frames: every electrode sits at its own offset and moves by a few microvolts of noise each frame
+    const int numValues = 1024;
+    const int numFrames = 50;
+    Random random(42);
+    std::vector<float> offsets(numValues);
+    for (float& offset : offsets) {
+        offset = random.nextFloat() * 2000.0f - 1000.0f;
+    }
+
+    std::vector<float> frame(numValues);
+    std::vector<float> previous;
+    std::vector<float> decoded;
+    std::vector<uint8_t> message;
+    size_t deltaBytes = 0;
+    for (int f = 0; f < numFrames; f++) {
+        for (int i = 0; i < numValues; i++) {
+            frame[i] = offsets[i] + random.nextFloat() * 20.0f - 10.0f;
+        }
+        message.clear();
+        FrameCodec::encode(frame.data(), previous.empty() ? nullptr : previous.data(), numValues, 32, 32, uint32_t(f), f, message);
+        FrameCodec::MessageHeader header;
+        ASSERT_TRUE(FrameCodec::readHeader(message.data(), header));
+        ASSERT_EQ(message.size(), size_t(FrameCodec::headerBytes) + header.payloadBytes);
+        ASSERT_TRUE(FrameCodec::decodePayload(message.data() + FrameCodec::headerBytes, header, decoded));
+        //Still lossless
+        ASSERT_EQ(decoded, frame);
+        if (f > 0) {
+            deltaBytes += header.payloadBytes;
+        }
+        previous = frame;
+    }
+    //Whole XOR words would cost more than the raw floats; dropping the unchanged sign and exponent byte doesn't
+    EXPECT_LT(double(deltaBytes), 0.9 * 4.0 * numValues * (numFrames - 1));
+
+    //Unchanged frames cost half a byte per value
+    message.clear();
+    FrameCodec::encode(frame.data(), frame.data(), numValues, 32, 32, 0, 0, message);
+    EXPECT_EQ(message.size(), size_t(FrameCodec::headerBytes + numValues / 2));
+
+    //A corrupt descriptor is rejected rather than read past
+    message[FrameCodec::headerBytes] = 13;
+    FrameCodec::MessageHeader header;
+    ASSERT_TRUE(FrameCodec::readHeader(message.data(), header));
+    EXPECT_FALSE(FrameCodec::decodePayload(message.data() + FrameCodec::headerBytes, header, decoded));
+}
+
+TEST_F(UG3ElectrodeViewerTests, FrameServerLoopbackTest) {
+    FrameServer server;
+    ASSERT_EQ(server.start(0), "");
+    server.setGridSize(4, 4);
+    StreamingSocket client;
+    ASSERT_TRUE(client.connect("127.0.0.1", server.getPort(), 1000));
+    for (int attempt = 0; attempt < 100 && server.getNumClients() == 0; attempt++) {
+        Thread::sleep(10);
+    }
+    ASSERT_EQ(server.getNumClients(), 1);
+
+    std::vector<float> decoded;
+    auto readFrame = [&](FrameCodec::MessageHeader& header) {
+        uint8_t headerBytes[FrameCodec::headerBytes];
+        if (client.waitUntilReady(true, 2000) != 1 || client.read(headerBytes, FrameCodec::headerBytes, true) != FrameCodec::headerBytes
+            || !FrameCodec::readHeader(headerBytes, header)) {
+            return false;
+        }
+        std::vector<uint8_t> payload(header.payloadBytes);
+        if (client.read(payload.data(), int(payload.size()), true) != int(payload.size())) {
+            return false;
+        }
+        return FrameCodec::decodePayload(payload.data(), header, decoded);
+    };
+
+    std::vector<float> frame(16);
+    for (int i = 0; i < 16; i++) {
+        frame[i] = float(i * 10);
+    }
+    server.submit(frame.data(), 16, 1000);
+    FrameCodec::MessageHeader keyFrame;
+    ASSERT_TRUE(readFrame(keyFrame));
+    EXPECT_TRUE(keyFrame.isKeyFrame);
+    EXPECT_EQ(keyFrame.cols, 4);
+    EXPECT_EQ(keyFrame.sampleNumber, 1000);
+    EXPECT_EQ(decoded, frame);
+
+    //One electrode changes, so the delta is the descriptors and the bytes of one word
+    frame[5] = -3.5f;
+    server.submit(frame.data(), 16, 1010);
+    FrameCodec::MessageHeader delta;
+    ASSERT_TRUE(readFrame(delta));
+    EXPECT_FALSE(delta.isKeyFrame);
+    EXPECT_LT(delta.payloadBytes, keyFrame.payloadBytes);
+    EXPECT_EQ(decoded, frame);
+
+    //Frames offered faster than they are read may be skipped, but the client always catches up to the newest
+    for (int block = 0; block < 50; block++) {
+        frame[block % 16] += 1.0f;
+        server.submit(frame.data(), 16, 1020 + block);
+    }
+    //submit() drops a frame rather than wait for the server thread, so offer the newest once more
+    Thread::sleep(20);
+    server.submit(frame.data(), 16, 1069);
+    FrameCodec::MessageHeader header = delta;
+    uint32_t lastSequence = delta.sequence;
+    while (header.sampleNumber != 1069) {
+        ASSERT_TRUE(readFrame(header));
+        EXPECT_GT(header.sequence, lastSequence);
+        lastSequence = header.sequence;
+    }
+    EXPECT_EQ(decoded, frame);
+
+    server.stop();
+    EXPECT_EQ(server.getPort(), -1);
+}
+
+TEST_F(UG3ElectrodeViewerTests, FrameServerConfigTest) {
+    std::map<String, var> payload;
+    EXPECT_NE(processor->handleConfigMessage(BroadcastParser::build("UG3ElectrodeViewer", "SETFRAMESERVER", payload)), "");
+
+    payload["enabled"] = true;
+    payload["port"] = 70000;
+    EXPECT_NE(processor->handleConfigMessage(BroadcastParser::build("UG3ElectrodeViewer", "SETFRAMESERVER", payload)), "");
+
+    payload["port"] = 0;
+    ASSERT_EQ(processor->handleConfigMessage(BroadcastParser::build("UG3ElectrodeViewer", "SETFRAMESERVER", payload)), "");
+    EXPECT_GT(processor->getFrameServerPort(), 0);
+
+    payload["enabled"] = false;
+    EXPECT_EQ(processor->handleConfigMessage(BroadcastParser::build("UG3ElectrodeViewer", "SETFRAMESERVER", payload)), "");
+    EXPECT_EQ(processor->getFrameServerPort(), -1);
+}
+
+TEST_F(UG3ElectrodeViewerTests, OfflineRenderingTest) {
+    var contents = JSON::parse(R"({"Probe": {"rows": 2, "cols": 4, "probeCols": 2}, "Grid": {"rows": 2, "cols": 3}, "Broken": {"rows": 2}})");
+    ASSERT_TRUE(contents.isObject());
+    const std::map<String, ElectrodeMap> maps = ElectrodeLayoutParser::parse(contents.getDynamicObject());
+    ASSERT_EQ(maps.size(), 2u);
+    EXPECT_EQ(maps.at("Probe").getProbeColumns(), 2);
+    EXPECT_EQ(maps.at("Grid").getDimensions(), std::make_pair(3, 2));
+
+    //Sites are 8 pixels with 4 between them, 20 pixels in from the corner
+    const RenderLayout grid = ElectrodeGeometry::placeGrid(3, 2, {});
+    ASSERT_EQ(grid.sites.size(), 6u);
+    EXPECT_TRUE(grid.sites[4] == Rectangle<int>(32, 32, 8, 8));
+    EXPECT_EQ(grid.width, 56);
+    EXPECT_EQ(grid.height, 60);
+
+    //Probe sites are numbered probe by probe, and the second probe is one site further right
+    const RenderLayout probes = ElectrodeGeometry::placeProbes(4, 2, 2);
+    ASSERT_EQ(probes.sites.size(), 8u);
+    EXPECT_TRUE(probes.isProbeLayout);
+    EXPECT_EQ(probes.sites[3].getY(), 32);
+    EXPECT_EQ(probes.sites[4].getX(), 56);
+    EXPECT_EQ(probes.width, 80);
+
+    //One value short, so the last site is drawn idle
+    RenderSettings settings;
+    settings.scaleFactor = 100;
+    const std::vector<float> values = { 0.0f, 20.0f, 40.0f, 60.0f, 80.0f };
+    FrameRasterizer rasterizer;
+    Image image;
+    rasterizer.rasterize(image, grid, settings, FrameRasterizer::getDrawingRange(settings, AutoRange()), values.data(), int(values.size()), nullptr, 0);
+    ASSERT_EQ(image.getWidth(), grid.width);
+    ASSERT_EQ(image.getHeight(), grid.height);
+    for (int site = 0; site < 6; site++) {
+        const Point<int> centre = grid.sites[site].getCentre();
+        const Colour expected = ColourScheme::getColourForNormalizedValue(site < 5 ? values[site] / 100.0f : 0.9f);
+        EXPECT_TRUE(image.getPixelAt(centre.x, centre.y) == expected);
+    }
+}
+
+TEST_F(UG3ElectrodeViewerTests, TiledRenderingTest) {
+    //Every tile runs exactly once, however the threads end up stealing them
+    TilePool pool(4);
+    std::vector<std::atomic<int>> runs(1000);
+    for (int frame = 0; frame < 20; frame++) {
+        pool.run(int(runs.size()), [&runs](int tile) { runs[tile].fetch_add(1); });
+    }
+    for (const std::atomic<int>& count : runs) {
+        EXPECT_EQ(count.load(), 20);
+    }
+
+    //Sites straddle band edges and some are masked, and the tiled picture still matches the serial one
+    const RenderLayout grid = ElectrodeGeometry::placeGrid(64, 64, {});
+    std::vector<float> values(grid.sites.size());
+    std::vector<uint8_t> flags(grid.sites.size(), HEALTHY);
+    for (int i = 0; i < int(values.size()); i++) {
+        values[i] = float((i * 37) % 100);
+        if (i % 97 == 0) {
+            flags[i] = FLATLINE;
+        }
+    }
+    RenderSettings settings;
+    settings.scaleFactor = 100;
+    const RenderedRange range = FrameRasterizer::getDrawingRange(settings, AutoRange());
+
+    FrameRasterizer serial;
+    FrameRasterizer tiled;
+    tiled.setNumThreads(4);
+    EXPECT_EQ(tiled.getNumThreads(), 4);
+    Image expected;
+    Image image;
+    serial.rasterize(expected, grid, settings, range, values.data(), int(values.size()) - 10, flags.data(), int(flags.size()));
+    tiled.rasterize(image, grid, settings, range, values.data(), int(values.size()) - 10, flags.data(), int(flags.size()));
+    ASSERT_EQ(image.getWidth(), expected.getWidth());
+    ASSERT_EQ(image.getHeight(), expected.getHeight());
+    int mismatches = 0;
+    for (int y = 0; y < image.getHeight(); y++) {
+        for (int x = 0; x < image.getWidth(); x++) {
+            mismatches += image.getPixelAt(x, y) != expected.getPixelAt(x, y);
+        }
+    }
+    EXPECT_EQ(mismatches, 0);
+
+    std::map<String, var> payload;
+    EXPECT_NE(processor->handleConfigMessage(BroadcastParser::build("UG3ElectrodeViewer", "SETRENDERTHREADS", payload)), "");
+    payload["threads"] = 3;
+    EXPECT_EQ(processor->handleConfigMessage(BroadcastParser::build("UG3ElectrodeViewer", "SETRENDERTHREADS", payload)), "");
+    EXPECT_EQ(processor->getRenderThreads(), 3);
+    payload["threads"] = 0;
+    EXPECT_EQ(processor->handleConfigMessage(BroadcastParser::build("UG3ElectrodeViewer", "SETRENDERTHREADS", payload)), "");
+    EXPECT_EQ(processor->getRenderThreads(), jlimit(1, FrameRasterizer::maxThreads, SystemStats::getNumCpus()));
+}
+
+TEST_F(UG3ElectrodeViewerTests, ImpedanceMappingTest) {
+    std::map<String, var> payload;
+    payload["capabilities"] = var(Array<String>{"1Hz/16Ch"});
+    payload["currentCapability"] = var("1Hz/16Ch");
+    processor->handleConfigMessage(BroadcastParser::build("", "LOADINPUTINFO", payload));
+
+    //Channels are mapped back to front, and the last channel isn't mapped at all
+    const DataStream* stream = processor->getDataStreams()[0];
+    const String streamName = stream->getName().upToFirstOccurrenceOf("-", false, false);
+    Array<var> map;
+    for (int i = 0; i < num_channels - 1; i++) {
+        DynamicObject::Ptr coord = new DynamicObject();
+        coord->setProperty("x", (num_channels - 1 - i) % 4);
+        coord->setProperty("y", (num_channels - 1 - i) / 4);
+        coord->setProperty("channel", stream->getContinuousChannels()[i]->getName());
+        coord->setProperty("stream", streamName);
+        map.add(var(coord));
+    }
+    DynamicObject::Ptr entry = new DynamicObject();
+    entry->setProperty("rows", 4);
+    entry->setProperty("cols", 4);
+    entry->setProperty("map", map);
+    DynamicObject::Ptr layout = new DynamicObject();
+    layout->setProperty("1Hz/16Ch", var(entry));
+    ASSERT_TRUE(processor->loadElectrodeLayoutJSON(JSON::toString(var(layout))));
+    processor->setCurrentStreamName("FakeSourceNode0");
+    processor->setLayoutParameters(4, 4, {});
+
+    for (int i = 0; i < num_channels; i++) {
+        stream->getContinuousChannels()[i]->impedance.magnitude = 1000.0f + i;
+        stream->getContinuousChannels()[i]->impedance.measured = true;
+    }
+    processor->handleConfigMessage(BroadcastParser::build("", "IMPEDANCESREADY", {}));
+
+    ASSERT_EQ(processor->getNumImpedanceMagnitudes(), num_channels);
+    for (int i = 0; i < num_channels - 1; i++) {
+        EXPECT_EQ(processor->getImpedanceMagnitudes()[num_channels - 1 - i], 1000.0f + i);
+    }
+    EXPECT_EQ(processor->getImpedanceMagnitudes()[0], 0.0f);
+
+    //The samples go through the same routes
+    tester->startAcquisition(false);
+    auto input_buffer = CreateBuffer(0, 10, num_channels, 1);
+    WriteBlock(input_buffer);
+    tester->stopAcquisition();
+    for (int i = 0; i < num_channels - 1; i++) {
+        EXPECT_EQ(processor->getLatestValues()[num_channels - 1 - i], input_buffer.getSample(i, 0));
+    }
+}
+
+TEST_F(UG3ElectrodeViewerTests, ImpedanceHistoryTest) {
+    const File storeFile = File::getSpecialLocation(File::tempDirectory).getNonexistentChildFile("ug3_impedance_history", ".bin");
+    const int64 day = 24 * 60 * 60 * 1000;
+    const int64 start = int64(1700000000) * 1000;
+    const float nan = std::numeric_limits<float>::quiet_NaN();
+    {
+        ImpedanceHistory history;
+        ASSERT_EQ(history.open(storeFile), "");
+        //Electrode 0 doubles every ten days; electrode 1 is missing from the first sweep and then holds steady
+        const float sweeps[3][2] = { { 1000.0f, nan }, { 2000.0f, 5000.0f }, { 4000.0f, 5000.0f } };
+        for (int i = 0; i < 3; i++) {
+            ASSERT_EQ(history.append(start + i * 10 * day, "1Hz/16Ch", 42, sweeps[i], 2), "");
+        }
+        const float other[3] = { 1.0f, 2.0f, 3.0f };
+        ASSERT_EQ(history.append(start, "Other", 7, other, 3), "");
+    }
+
+    //Torn writes at the end are ignored and then overwritten
+    {
+        FileOutputStream out(storeFile);
+        out.write("garbage", 7);
+    }
+
+    ImpedanceHistory history;
+    ASSERT_EQ(history.open(storeFile), "");
+    ASSERT_EQ(history.getNumSweeps(), 4);
+    EXPECT_EQ(history.getSweep(3).capability, "Other");
+
+    std::vector<ImpedanceSample> samples;
+    history.getSeries(42, 0, start + 1, start + 30 * day, samples);
+    ASSERT_EQ(samples.size(), 2u);
+    EXPECT_EQ(samples[0].timeMs, start + 10 * day);
+    EXPECT_EQ(samples[1].magnitude, 4000.0f);
+    history.getSeries(42, 1, start, start, samples);
+    ASSERT_EQ(samples.size(), 1u);
+    EXPECT_TRUE(std::isnan(samples[0].magnitude));
+
+    std::vector<float> rates;
+    ASSERT_TRUE(history.getChangeRates(42, rates));
+    ASSERT_EQ(rates.size(), 2u);
+    EXPECT_NEAR(rates[0], (std::pow(2.0, 0.1) - 1.0) * 100.0, 1e-3);
+    EXPECT_NEAR(rates[1], 0.0f, 1e-4);
+    EXPECT_FALSE(history.getChangeRates(1, rates));
+
+    const float next[2] = { 8000.0f, 5000.0f };
+    ASSERT_EQ(history.append(start + 30 * day, "1Hz/16Ch", 42, next, 2), "");
+    ImpedanceHistory reopened;
+    ASSERT_EQ(reopened.open(storeFile), "");
+    EXPECT_EQ(reopened.getNumSweeps(), 5);
+
+    //Sweeps a minute apart give no rate rather than a huge one, and a real jump a day later is clamped
+    const int64 minute = 60 * 1000;
+    const float close[3][1] = { { 1000.0f }, { 1010.0f }, { 990.0f } };
+    for (int i = 0; i < 3; i++) {
+        ASSERT_EQ(reopened.append(start + i * minute, "1Hz/16Ch", 9, close[i], 1), "");
+    }
+    ASSERT_TRUE(reopened.getChangeRates(9, rates));
+    EXPECT_EQ(rates[0], 0.0f);
+    const float jump[1] = { 1.0e6f };
+    ASSERT_EQ(reopened.append(start + day + minute, "1Hz/16Ch", 9, jump, 1), "");
+    ASSERT_TRUE(reopened.getChangeRates(9, rates));
+    EXPECT_TRUE(std::isfinite(rates[0]));
+    EXPECT_LE(std::abs(rates[0]), ImpedanceHistory::maxChangeRatePercent);
+    EXPECT_GT(rates[0], 0.0f);
+
+    //The processor appends a sweep whenever impedances arrive
+    const File processorStore = storeFile.getSiblingFile("ug3_impedance_history_processor.bin");
+    processorStore.deleteFile();
+    processor->setCurrentStreamName("FakeSourceNode0");
+    processor->setLayoutParameters(4, 4, {});
+    const DataStream* stream = processor->getDataStreams()[0];
+    for (int i = 0; i < num_channels; i++) {
+        stream->getContinuousChannels()[i]->impedance.magnitude = 1000.0f;
+        stream->getContinuousChannels()[i]->impedance.measured = true;
+    }
+    std::map<String, var> payload;
+    payload["enabled"] = true;
+    payload["path"] = processorStore.getFullPathName();
+    ASSERT_EQ(processor->handleConfigMessage(BroadcastParser::build("UG3ElectrodeViewer", "SETIMPEDANCEHISTORY", payload)), "");
+    processor->handleConfigMessage(BroadcastParser::build("", "IMPEDANCESREADY", {}));
+    processor->handleConfigMessage(BroadcastParser::build("", "IMPEDANCESREADY", {}));
+    EXPECT_EQ(processor->getNumImpedanceChangeRates(), num_channels);
+
+    std::map<String, var> query;
+    query["electrode"] = 3;
+    const var result = JSON::parse(processor->handleConfigMessage(BroadcastParser::build("UG3ElectrodeViewer", "GETIMPEDANCEHISTORY", query)));
+    ASSERT_TRUE(result.isObject());
+    EXPECT_EQ(int(result["sweeps"]), 2);
+    ASSERT_TRUE(result["samples"].isArray());
+    EXPECT_EQ(result["samples"].size(), 2);
+    EXPECT_EQ(float(result["samples"][0]["magnitude"]), 1000.0f);
+
+    payload["enabled"] = false;
+    EXPECT_EQ(processor->handleConfigMessage(BroadcastParser::build("UG3ElectrodeViewer", "SETIMPEDANCEHISTORY", payload)), "");
+    EXPECT_EQ(processor->getNumImpedanceChangeRates(), 0);
+    storeFile.deleteFile();
+    processorStore.deleteFile();
+}
+
+TEST_F(UG3ElectrodeViewerTests, ImpedanceSpectraTest) {
+    //Series RC: Z = R - j / (2 pi f C)
+    auto seriesRC = [](float resistance, float capacitance, float hz, float& magnitude, float& phase) {
+        const double reactance = 1.0 / (2.0 * MathConstants<double>::pi * hz * capacitance);
+        magnitude = float(std::hypot(double(resistance), reactance));
+        phase = float(-std::atan2(reactance, double(resistance)) * 180.0 / MathConstants<double>::pi);
+    };
+    const std::vector<float> frequencies = { 100.0f, 1000.0f, 10000.0f };
+
+    ImpedanceSpectra spectra;
+    spectra.resize(int(frequencies.size()), 2);
+    //Until the source says at what frequencies it measured, there is nothing to fit against
+    EXPECT_FALSE(spectra.hasKnownFrequency());
+    for (int f = 0; f < int(frequencies.size()); f++) {
+        float magnitude, phase;
+        seriesRC(10000.0f, 10e-9f, frequencies[f], magnitude, phase);
+        spectra.setFrequency(f, frequencies[f]);
+        spectra.set(f, 0, magnitude, phase);
+    }
+    EXPECT_TRUE(spectra.hasKnownFrequency());
+    float resistance, capacitance;
+    spectra.fitSeriesRC(0, resistance, capacitance);
+    EXPECT_NEAR(resistance, 10000.0f, 1.0f);
+    EXPECT_NEAR(capacitance, 10.0f, 0.01f);
+    //Nothing measured, nothing fitted
+    spectra.fitSeriesRC(1, resistance, capacitance);
+    EXPECT_TRUE(std::isnan(resistance));
+    EXPECT_TRUE(std::isnan(capacitance));
+
+    std::map<String, var> payload;
+    payload["capabilities"] = var(Array<String>{"1Hz/16Ch"});
+    payload["currentCapability"] = var("1Hz/16Ch");
+    processor->handleConfigMessage(BroadcastParser::build("", "LOADINPUTINFO", payload));
+
+    const DataStream* stream = processor->getDataStreams()[0];
+    const String streamName = stream->getName().upToFirstOccurrenceOf("-", false, false);
+    Array<var> map;
+    for (int i = 0; i < num_channels; i++) {
+        DynamicObject::Ptr coord = new DynamicObject();
+        coord->setProperty("x", i % 4);
+        coord->setProperty("y", i / 4);
+        coord->setProperty("channel", stream->getContinuousChannels()[i]->getName());
+        coord->setProperty("stream", streamName);
+        map.add(var(coord));
+    }
+    DynamicObject::Ptr entry = new DynamicObject();
+    entry->setProperty("rows", 4);
+    entry->setProperty("cols", 4);
+    entry->setProperty("map", map);
+    DynamicObject::Ptr layout = new DynamicObject();
+    layout->setProperty("1Hz/16Ch", var(entry));
+    ASSERT_TRUE(processor->loadElectrodeLayoutJSON(JSON::toString(var(layout))));
+    processor->setCurrentStreamName("FakeSourceNode0");
+    processor->setLayoutParameters(4, 4, {});
+
+    //Every channel is a series RC with its own resistance, measured at three frequencies
+    Array<var> sweepFrequencies, magnitudes, phases;
+    for (float hz : frequencies) {
+        Array<var> magnitudePlane, phasePlane;
+        for (int i = 0; i < num_channels; i++) {
+            float magnitude, phase;
+            seriesRC(1000.0f * (i + 1), 10e-9f, hz, magnitude, phase);
+            magnitudePlane.add(magnitude);
+            phasePlane.add(phase);
+        }
+        sweepFrequencies.add(hz);
+        magnitudes.add(magnitudePlane);
+        phases.add(phasePlane);
+    }
+    std::map<String, var> sweep;
+    sweep["frequencies"] = sweepFrequencies;
+    sweep["magnitudes"] = magnitudes;
+    sweep["phases"] = phases;
+    processor->handleConfigMessage(BroadcastParser::build("", "IMPEDANCESREADY", sweep));
+
+    EXPECT_EQ(processor->getImpedanceFrequencies(), frequencies);
+    std::vector<float> values;
+    processor->copyImpedanceView(ImpedanceView::PHASE, 1, values);
+    ASSERT_EQ(int(values.size()), num_channels);
+    for (int i = 0; i < num_channels; i++) {
+        EXPECT_FLOAT_EQ(values[i], float(phases[1][i]));
+    }
+    processor->copyImpedanceView(ImpedanceView::MAGNITUDE, 2, values);
+    ASSERT_EQ(int(values.size()), num_channels);
+    for (int i = 0; i < num_channels; i++) {
+        EXPECT_FLOAT_EQ(values[i], float(magnitudes[2][i]));
+    }
+
+    //The fit arrives from the worker thread
+    values.clear();
+    for (int attempt = 0; attempt < 200 && values.empty(); attempt++) {
+        Thread::sleep(10);
+        processor->copyImpedanceView(ImpedanceView::FIT_RESISTANCE, 0, values);
+    }
+    ASSERT_EQ(int(values.size()), num_channels);
+    for (int i = 0; i < num_channels; i++) {
+        EXPECT_NEAR(values[i], 1000.0f * (i + 1), 1.0f);
+    }
+    processor->copyImpedanceView(ImpedanceView::FIT_CAPACITANCE, 0, values);
+    ASSERT_EQ(int(values.size()), num_channels);
+    EXPECT_NEAR(values[0], 10.0f, 0.01f);
+
+    //Named entries resolve by channel and stream, in any order, so streams of a group can't collide
+    Array<var> channels, namedMagnitudes;
+    for (int f = 0; f < int(frequencies.size()); f++) {
+        Array<var> plane;
+        for (int i = num_channels - 1; i >= 0; i--) {
+            plane.add(magnitudes[f][i]);
+        }
+        //An entry from another stream has nowhere to go
+        plane.add(1.0f);
+        namedMagnitudes.add(plane);
+    }
+    for (int i = num_channels - 1; i >= 0; i--) {
+        DynamicObject::Ptr channel = new DynamicObject();
+        channel->setProperty("channel", stream->getContinuousChannels()[i]->getName());
+        channel->setProperty("stream", streamName);
+        channels.add(var(channel));
+    }
+    DynamicObject::Ptr other = new DynamicObject();
+    other->setProperty("channel", stream->getContinuousChannels()[0]->getName());
+    other->setProperty("stream", "OtherStream");
+    channels.add(var(other));
+    std::map<String, var> namedSweep;
+    namedSweep["frequencies"] = sweepFrequencies;
+    namedSweep["magnitudes"] = namedMagnitudes;
+    namedSweep["channels"] = channels;
+    EXPECT_EQ(processor->handleConfigMessage(BroadcastParser::build("", "IMPEDANCESREADY", namedSweep)), "");
+    processor->copyImpedanceView(ImpedanceView::MAGNITUDE, 2, values);
+    ASSERT_EQ(int(values.size()), num_channels);
+    for (int i = 0; i < num_channels; i++) {
+        EXPECT_FLOAT_EQ(values[i], float(magnitudes[2][i]));
+    }
+}
+
+TEST_F(UG3ElectrodeViewerTests, SiteLayoutTest) {
+    //Two interlocking rows of circles, a square without a channel, and an entry without a size that is skipped
+    var contents = JSON::parse(R"({"Hex": {"sites": [
+        {"x": 0, "y": 0, "size": 10, "shape": "circle", "channel": "CH1", "stream": "S"},
+        {"x": 15, "y": 0, "size": 10, "shape": "circle", "channel": "CH2", "stream": "S"},
+        {"x": 7.5, "y": 13, "size": 10, "shape": "circle", "channel": "CH3", "stream": "S"},
+        {"x": 30, "y": 13, "width": 20, "height": 10},
+        {"x": 45, "y": 0}]}})");
+    ASSERT_TRUE(contents.isObject());
+    std::map<String, ElectrodeMap> maps = ElectrodeLayoutParser::parse(contents.getDynamicObject());
+    ASSERT_EQ(maps.count("Hex"), 1u);
+    ElectrodeMap& hex = maps.at("Hex");
+    ASSERT_EQ(hex.getSites().size(), 4u);
+    EXPECT_EQ(hex.getDimensions(), std::make_pair(4, 1));
+    EXPECT_EQ(hex.getChannelMapping("CH3", "S"), std::optional<int>(2));
+    EXPECT_EQ(hex.getMappedSites(), std::vector<uint8_t>({ 1, 1, 1, 0 }));
+    EXPECT_TRUE(hex.getSites()[3].shape == SiteShape::RECTANGLE);
+
+    //Health compares the circles with each other, being 15 micrometres apart, and not the empty square
+    const ChannelNeighbours neighbours = ChannelNeighbours::fromSites(hex.getMappedSites(), hex.getSites());
+    EXPECT_EQ(neighbours.start, std::vector<int>({ 0, 2, 4, 6, 6 }));
+    EXPECT_EQ(neighbours.indices, std::vector<int>({ 1, 2, 0, 2, 0, 1 }));
+
+    //The smallest site is 8 pixels across, so a micrometre is 0.8 pixels
+    const RenderLayout layout = ElectrodeGeometry::placeSites(hex.getSites());
+    ASSERT_EQ(layout.sites.size(), 4u);
+    EXPECT_TRUE(layout.isSiteLayout);
+    EXPECT_TRUE(layout.sites[0] == Rectangle<int>(20, 20, 8, 8));
+    EXPECT_TRUE(layout.sites[2] == Rectangle<int>(26, 30, 8, 8));
+    EXPECT_TRUE(layout.sites[3] == Rectangle<int>(40, 30, 16, 8));
+
+    //A tiny site a long way from the rest scales the layout down to fit instead of up
+    ElectrodeSite farSite;
+    farSite.x = 100000.0f;
+    farSite.width = 1.0f;
+    farSite.height = 1.0f;
+    const RenderLayout wide = ElectrodeGeometry::placeSites({ hex.getSites()[0], farSite });
+    EXPECT_LE(wide.width, ElectrodeGeometry::leftBound + ElectrodeGeometry::maxSiteLayoutSize + ElectrodeGeometry::spacing + 1);
+    EXPECT_GE(wide.sites[1].getWidth(), 1);
+
+    SiteIndex index;
+    index.build(layout);
+    for (int site = 0; site < 4; site++) {
+        const Point<int> centre = layout.sites[site].getCentre();
+        EXPECT_EQ(index.findSite(centre.x, centre.y), site);
+    }
+    //A circle's corner and the gap between sites hit nothing
+    EXPECT_EQ(index.findSite(20, 20), -1);
+    EXPECT_EQ(index.findSite(29, 24), -1);
+    EXPECT_EQ(index.findSite(0, 0), -1);
+
+    //Drawn through the same tiles as grids, inside each shape only
+    RenderSettings settings;
+    settings.scaleFactor = 100;
+    settings.isSmoothingOn = true;
+    const std::vector<float> values = { 10.0f, 30.0f, 50.0f, 70.0f };
+    FrameRasterizer serial;
+    FrameRasterizer tiled;
+    tiled.setNumThreads(3);
+    Image expected;
+    Image image;
+    const RenderedRange range = FrameRasterizer::getDrawingRange(settings, AutoRange());
+    serial.rasterize(expected, layout, settings, range, values.data(), int(values.size()), nullptr, 0);
+    tiled.rasterize(image, layout, settings, range, values.data(), int(values.size()), nullptr, 0);
+    for (int y = 0; y < image.getHeight(); y++) {
+        for (int x = 0; x < image.getWidth(); x++) {
+            const int site = index.findSite(x, y);
+            const Colour colour = site < 0 ? Colours::darkgrey : ColourScheme::getColourForNormalizedValue(values[site] / 100.0f);
+            EXPECT_TRUE(image.getPixelAt(x, y) == colour) << x << ", " << y;
+            EXPECT_TRUE(expected.getPixelAt(x, y) == colour) << x << ", " << y;
+        }
+    }
+
+    //A flagged circle is masked inside the circle only
+    const uint8_t flags[] = { FLATLINE, HEALTHY, HEALTHY, HEALTHY };
+    serial.rasterize(image, layout, settings, range, values.data(), int(values.size()), flags, 4);
+    for (int y = 0; y < image.getHeight(); y++) {
+        for (int x = 0; x < image.getWidth(); x++) {
+            if (index.findSite(x, y) != 0) {
+                EXPECT_TRUE(image.getPixelAt(x, y) == expected.getPixelAt(x, y)) << x << ", " << y;
+            }
+        }
+    }
+    EXPECT_TRUE(image.getPixelAt(20, 20) == Colours::darkgrey);
+    EXPECT_TRUE(image.getPixelAt(24, 21) == Colours::black);
+}
@@ -0,0 +1,452 @@
+//
+//  UG3HeatmapRender.cpp
+//  ug3-electrode-viewer
+//
+//  Offline heatmap renderer: draws every frame of a recorded session the way the
+//  canvas would, without the GUI. Frames are read in order, then coloured, rasterized
+//  and encoded on several threads at once.
+//
+//  Usage: UG3ElectrodeViewer_render --layout layout.json --data session.bin
+//             [--capability NAME] [--format raw|frames]
+//             [--png-dir DIR | --raw-video FILE|-]
+//             [--scale 500] [--zero-center] [--auto-range] [--smooth]
+//             [--scheme inferno|viridis|plasma|magma|jet] [--threads N]
+//             [--first 0] [--count 0] [--stride 1]
+//
+//  raw data is float32 in microvolts in the host's byte order, one frame after another, each
+//  cols x rows values in visual buffer order. frames data is a capture of the frame
+//  server's stream (see FrameCodec.h), e.g. from nc 127.0.0.1 47810 > session.u3fs;
+//  without --format it is recognized by its magic. The raw video is packed rgb24, so
+//  it can be piped into e.g. ffmpeg -f rawvideo -pix_fmt rgb24 -s WxH -i - out.mp4.
+//
+
+#include "../Source/ElectrodeGeometry.h"
+#include "../Source/ElectrodeLayoutParser.h"
+#include "../Source/FrameRasterizer.h"
+#include "../Source/FrameCodec.h"
+#include "../Source/SpatialFilter.h"
+#include "../Source/ColourScheme.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <thread>
+
+namespace {
+
+    struct RenderOptions {
+        String layoutPath;
+        String dataPath;
+        String capability;
+        String format;
+        String pngDirectory;
+        String rawVideoPath;
+        RenderSettings settings;
+        ColourSchemeId scheme = ColourSchemeId::INFERNO;
+        int threads = int(std::max(1u, std::thread::hardware_concurrency()));
+        int64 first = 0;
+        int64 count = 0;
+        int stride = 1;
+    };
+
+    bool parseScheme(const String& name, ColourSchemeId& scheme) {
+        const std::pair<const char*, ColourSchemeId> schemes[] = {
+            { "inferno", ColourSchemeId::INFERNO }, { "viridis", ColourSchemeId::VIRIDIS }, { "plasma", ColourSchemeId::PLASMA },
+            { "magma", ColourSchemeId::MAGMA }, { "jet", ColourSchemeId::JET }
+        };
+        for (const auto& entry : schemes) {
+            if (name.equalsIgnoreCase(entry.first)) {
+                scheme = entry.second;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /** Returns an empty string when the options are usable */
+    String parseOptions(int argc, char* argv[], RenderOptions& options) {
+        options.settings.scaleFactor = 500;
+        for (int i = 1; i < argc; i++) {
+            const String arg(argv[i]);
+            const String value = i + 1 < argc ? String(argv[i + 1]) : String();
+            if (arg == "--layout") { options.layoutPath = value; i++; }
+            else if (arg == "--data") { options.dataPath = value; i++; }
+            else if (arg == "--capability") { options.capability = value; i++; }
+            else if (arg == "--format") { options.format = value; i++; }
+            else if (arg == "--png-dir") { options.pngDirectory = value; i++; }
+            else if (arg == "--raw-video") { options.rawVideoPath = value; i++; }
+            else if (arg == "--scale") { options.settings.scaleFactor = value.getIntValue(); i++; }
+            else if (arg == "--zero-center") { options.settings.isZeroCentered = true; }
+            else if (arg == "--auto-range") { options.settings.isAutoRangeOn = true; }
+            else if (arg == "--smooth") { options.settings.isSmoothingOn = true; }
+            else if (arg == "--scheme") {
+                if (!parseScheme(value, options.scheme)) {
+                    return "unknown colour scheme " + value;
+                }
+                i++;
+            }
+            else if (arg == "--threads") { options.threads = value.getIntValue(); i++; }
+            else if (arg == "--first") { options.first = value.getLargeIntValue(); i++; }
+            else if (arg == "--count") { options.count = value.getLargeIntValue(); i++; }
+            else if (arg == "--stride") { options.stride = value.getIntValue(); i++; }
+            else { std::cerr << "ignoring unknown argument " << arg << std::endl; }
+        }
+
+        if (options.layoutPath.isEmpty() || options.dataPath.isEmpty()) {
+            return "--layout and --data are required";
+        }
+        if (options.pngDirectory.isEmpty() == options.rawVideoPath.isEmpty()) {
+            return "give exactly one of --png-dir and --raw-video";
+        }
+        if (options.format.isNotEmpty() && options.format != "raw" && options.format != "frames") {
+            return "--format must be raw or frames";
+        }
+        if (!options.settings.isAutoRangeOn && options.settings.scaleFactor <= 0) {
+            return "--scale must be positive";
+        }
+        options.threads = std::max(1, options.threads);
+        options.stride = std::max(1, options.stride);
+        options.first = std::max<int64>(0, options.first);
+        return "";
+    }
+
+    /** Reads frames of a recording in order */
+    class FrameReader {
+    public:
+        virtual ~FrameReader() {}
+
+        /** Fills values with the next frame; returns false at the end of the data or on an error */
+        virtual bool readFrame(std::vector<float>& values) = 0;
+
+        /** Why reading stopped early, or empty at a clean end of the data */
+        String getError() const { return error; }
+
+    protected:
+        String error;
+    };
+
+    class RawFrameReader : public FrameReader {
+    public:
+        RawFrameReader(const File& file, int numValues_) : stream(file), numValues(numValues_) {}
+
+        bool readFrame(std::vector<float>& values) override {
+            values.resize(numValues);
+            const int bytes = int(sizeof(float)) * numValues;
+            const int read = stream.read(values.data(), bytes);
+            if (read != bytes) {
+                if (read > 0) {
+                    error = "the data ends part way through a frame";
+                }
+                return false;
+            }
+            return true;
+        }
+
+        bool isOpen() const { return stream.openedOk(); }
+
+    private:
+        FileInputStream stream;
+        const int numValues;
+    };
+
+    class CodecFrameReader : public FrameReader {
+    public:
+        CodecFrameReader(const File& file, int numValues_) : stream(file), numValues(numValues_) {}
+
+        bool readFrame(std::vector<float>& values) override {
+            while (true) {
+                uint8_t header[FrameCodec::headerBytes];
+                const int read = stream.read(header, FrameCodec::headerBytes);
+                if (read != FrameCodec::headerBytes) {
+                    if (read > 0) {
+                        error = "the data ends part way through a message header";
+                    }
+                    return false;
+                }
+                FrameCodec::MessageHeader message;
+                if (!FrameCodec::readHeader(header, message)) {
+                    error = "found a message without the frame server's magic";
+                    return false;
+                }
+                if (int(message.numValues) != numValues) {
+                    error = "a frame has " + String(message.numValues) + " values, the layout has " + String(numValues);
+                    return false;
+                }
+                payload.resize(message.payloadBytes);
+                if (stream.read(payload.data(), int(payload.size())) != int(payload.size())) {
+                    error = "the data ends part way through a message";
+                    return false;
+                }
+                //A capture can start mid-stream; deltas before the first key frame can't be decoded
+                if (!message.isKeyFrame && reference.empty()) {
+                    continue;
+                }
+                if (!FrameCodec::decodePayload(payload.data(), message, reference)) {
+                    error = "a message's payload doesn't decode";
+                    return false;
+                }
+                values = reference;
+                return true;
+            }
+        }
+
+        bool isOpen() const { return stream.openedOk(); }
+
+    private:
+        FileInputStream stream;
+        const int numValues;
+        std::vector<uint8_t> payload;
+        std::vector<float> reference;
+    };
+
+    bool startsWithFrameMagic(const File& file) {
+        FileInputStream stream(file);
+        uint8_t magic[4];
+        if (!stream.openedOk() || stream.read(magic, 4) != 4) {
+            return false;
+        }
+        const uint8_t expected[4] = { uint8_t(FrameCodec::magic), uint8_t(FrameCodec::magic >> 8), uint8_t(FrameCodec::magic >> 16), uint8_t(FrameCodec::magic >> 24) };
+        return std::memcmp(magic, expected, 4) == 0;
+    }
+
+    /** Frames read in order and the range each is drawn with, rendered together across the worker threads */
+    struct FrameBatch {
+        std::vector<std::vector<float>> values;
+        std::vector<RenderedRange> ranges;
+        std::vector<int64> indices;
+        std::vector<std::vector<uint8_t>> rgb;
+        int size = 0;
+    };
+
+    /** One per thread; holds the scratch state of the GUI's render path */
+    struct FrameWorker {
+        FrameRasterizer rasterizer;
+        SpatialFilter spatialFilter;
+        Image image;
+    };
+
+    void packRgb(const Image& image, std::vector<uint8_t>& rgb) {
+        rgb.resize(size_t(image.getWidth()) * size_t(image.getHeight()) * 3);
+        const Image::BitmapData pixels(image, Image::BitmapData::readOnly);
+        size_t offset = 0;
+        for (int y = 0; y < image.getHeight(); y++) {
+            for (int x = 0; x < image.getWidth(); x++) {
+                const Colour colour = pixels.getPixelColour(x, y);
+                rgb[offset++] = colour.getRed();
+                rgb[offset++] = colour.getGreen();
+                rgb[offset++] = colour.getBlue();
+            }
+        }
+    }
+}
+
+int main(int argc, char* argv[]) {
+    using Clock = std::chrono::steady_clock;
+    RenderOptions options;
+    const String optionsError = parseOptions(argc, argv, options);
+    if (optionsError.isNotEmpty()) {
+        std::cerr << optionsError << std::endl;
+        return 2;
+    }
+
+    std::map<String, ElectrodeMap> electrodeMaps;
+    const String layoutError = ElectrodeLayoutParser::parseFile(File::getCurrentWorkingDirectory().getChildFile(options.layoutPath), electrodeMaps);
+    if (layoutError.isNotEmpty()) {
+        std::cerr << layoutError << std::endl;
+        return 1;
+    }
+    if (electrodeMaps.empty()) {
+        std::cerr << options.layoutPath << " has no capability with rows and cols" << std::endl;
+        return 1;
+    }
+    auto mapIt = options.capability.isEmpty() ? electrodeMaps.begin() : electrodeMaps.find(options.capability);
+    if (mapIt == electrodeMaps.end()) {
+        std::cerr << options.layoutPath << " has no capability " << options.capability << std::endl;
+        return 1;
+    }
+    const ElectrodeMap& electrodeMap = mapIt->second;
+    const int cols = electrodeMap.getDimensions().first;
+    const int rows = electrodeMap.getDimensions().second;
+
+    //Laid out exactly as the canvas lays out this capability
+    RenderLayout layout = !electrodeMap.getSites().empty() ? ElectrodeGeometry::placeSites(electrodeMap.getSites())
+                        : electrodeMap.getProbeColumns() > 0 ? ElectrodeGeometry::placeProbes(cols, rows, electrodeMap.getProbeColumns())
+                                                             : ElectrodeGeometry::placeGrid(cols, rows, {});
+    layout.mappedSites = electrodeMap.getMappedSites();
+    //Like the live view, sites placed by coordinate have no grid neighbours to smooth over
+    if (layout.isSiteLayout) {
+        options.settings.isSmoothingOn = false;
+    }
+
+    //The rasterizers take their idle colour from the scheme, so it is set before any is made
+    ColourScheme::setColourScheme(options.scheme);
+
+    const File dataFile = File::getCurrentWorkingDirectory().getChildFile(options.dataPath);
+    const bool isFrameStream = options.format.isNotEmpty() ? options.format == "frames" : startsWithFrameMagic(dataFile);
+    std::unique_ptr<FrameReader> reader;
+    if (isFrameStream) {
+        auto codecReader = std::make_unique<CodecFrameReader>(dataFile, cols * rows);
+        if (!codecReader->isOpen()) {
+            std::cerr << "could not open " << options.dataPath << std::endl;
+            return 1;
+        }
+        reader = std::move(codecReader);
+    }
+    else {
+        auto rawReader = std::make_unique<RawFrameReader>(dataFile, cols * rows);
+        if (!rawReader->isOpen()) {
+            std::cerr << "could not open " << options.dataPath << std::endl;
+            return 1;
+        }
+        reader = std::move(rawReader);
+    }
+
+    File pngDirectory;
+    std::FILE* rawVideo = nullptr;
+    if (options.pngDirectory.isNotEmpty()) {
+        pngDirectory = File::getCurrentWorkingDirectory().getChildFile(options.pngDirectory);
+        if (!pngDirectory.createDirectory()) {
+            std::cerr << "could not create " << options.pngDirectory << std::endl;
+            return 1;
+        }
+    }
+    else {
+        rawVideo = options.rawVideoPath == "-" ? stdout : std::fopen(options.rawVideoPath.toRawUTF8(), "wb");
+        if (rawVideo == nullptr) {
+            std::cerr << "could not open " << options.rawVideoPath << std::endl;
+            return 1;
+        }
+    }
+
+    std::vector<std::unique_ptr<FrameWorker>> workers;
+    for (int t = 0; t < options.threads; t++) {
+        workers.push_back(std::make_unique<FrameWorker>());
+        workers.back()->spatialFilter.setSigma(1.0f);
+        workers.back()->spatialFilter.setGrid(cols, rows, layout.mappedSites);
+    }
+
+    std::cerr << "rendering " << options.dataPath << " (" << (isFrameStream ? "frame stream" : "raw float32") << ") as "
+              << cols << " x " << rows << " sites into " << layout.width << " x " << layout.height << " frames on "
+              << options.threads << " thread(s)" << std::endl;
+
+    //Auto range follows the recording frame by frame, like the live view, so it is worked out in order before the parallel pass
+    AutoRange autoRange;
+    FrameBatch batch;
+    const int batchSize = options.threads * 4;
+    batch.values.resize(batchSize);
+    batch.ranges.resize(batchSize);
+    batch.indices.resize(batchSize);
+    batch.rgb.resize(batchSize);
+
+    std::vector<float> skipped;
+    int64 frameIndex = 0;
+    int64 framesWritten = 0;
+    std::atomic<bool> hasWriteError(false);
+    const Clock::time_point start = Clock::now();
+
+    while (options.count <= 0 || framesWritten < options.count) {
+        batch.size = 0;
+        while (batch.size < batchSize && (options.count <= 0 || framesWritten + batch.size < options.count)) {
+            //Frames outside --first and --stride are still read, as the frame stream is delta coded
+            while (frameIndex < options.first || (frameIndex - options.first) % options.stride != 0) {
+                if (!reader->readFrame(skipped)) {
+                    break;
+                }
+                frameIndex++;
+            }
+            if (frameIndex < options.first || (frameIndex - options.first) % options.stride != 0 || !reader->readFrame(batch.values[batch.size])) {
+                break;
+            }
+            std::vector<float>& values = batch.values[batch.size];
+            if (options.settings.isAutoRangeOn) {
+                //Matches the live view, where auto range sees the values after smoothing
+                const float* ranged = values.data();
+                int numRanged = int(values.size());
+                if (options.settings.isSmoothingOn) {
+                    ranged = workers[0]->spatialFilter.apply(values.data(), numRanged, nullptr, 0);
+                    numRanged = workers[0]->spatialFilter.getNumSites();
+                }
+                autoRange.update(ranged, std::min(numRanged, int(layout.sites.size())));
+            }
+            batch.ranges[batch.size] = FrameRasterizer::getDrawingRange(options.settings, autoRange);
+            batch.indices[batch.size] = frameIndex++;
+            batch.size++;
+        }
+        if (batch.size == 0) {
+            break;
+        }
+
+        std::atomic<int> nextFrame(0);
+        auto renderFrames = [&](FrameWorker& worker) {
+            for (int k = nextFrame++; k < batch.size; k = nextFrame++) {
+                const float* values = batch.values[k].data();
+                int numValues = int(batch.values[k].size());
+                if (options.settings.isSmoothingOn) {
+                    values = worker.spatialFilter.apply(values, numValues, nullptr, 0);
+                    numValues = worker.spatialFilter.getNumSites();
+                }
+                worker.rasterizer.rasterize(worker.image, layout, options.settings, batch.ranges[k], values, numValues, nullptr, 0);
+
+                if (rawVideo != nullptr) {
+                    packRgb(worker.image, batch.rgb[k]);
+                    continue;
+                }
+                //PNG files are independent, so they are written straight from the worker
+                const File pngFile = pngDirectory.getChildFile("frame_" + String(batch.indices[k]).paddedLeft('0', 6) + ".png");
+                pngFile.deleteFile();
+                FileOutputStream stream(pngFile);
+                PNGImageFormat png;
+                if (!stream.openedOk() || !png.writeImageToStream(worker.image, stream)) {
+                    hasWriteError = true;
+                }
+            }
+        };
+
+        std::vector<std::thread> threads;
+        for (int t = 1; t < std::min(options.threads, batch.size); t++) {
+            threads.emplace_back(renderFrames, std::ref(*workers[t]));
+        }
+        renderFrames(*workers[0]);
+        for (std::thread& thread : threads) {
+            thread.join();
+        }
+
+        if (rawVideo != nullptr) {
+            for (int k = 0; k < batch.size; k++) {
+                if (std::fwrite(batch.rgb[k].data(), 1, batch.rgb[k].size(), rawVideo) != batch.rgb[k].size()) {
+                    hasWriteError = true;
+                }
+            }
+        }
+        framesWritten += batch.size;
+        if (hasWriteError) {
+            break;
+        }
+    }
+
+    if (rawVideo != nullptr && rawVideo != stdout) {
+        hasWriteError = std::fclose(rawVideo) != 0 || hasWriteError;
+    }
+    else if (rawVideo != nullptr) {
+        std::fflush(rawVideo);
+    }
+
+    const double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    std::cerr << "frames rendered:    " << framesWritten << " in " << seconds << " s ("
+              << (seconds > 0.0 ? double(framesWritten) / seconds : 0.0) << " fps)" << std::endl;
+    if (rawVideo != nullptr) {
+        std::cerr << "raw video:          rgb24 " << layout.width << "x" << layout.height << std::endl;
+    }
+
+    if (hasWriteError) {
+        std::cerr << "could not write every frame" << std::endl;
+        return 1;
+    }
+    if (reader->getError().isNotEmpty()) {
+        std::cerr << "stopped reading " << options.dataPath << ": " << reader->getError() << std::endl;
+        return 1;
+    }
+    return 0;
+}